@@ -35,11 +35,9 @@ void AtAbort(aborthook_f *hook) {
 
 void Abort(void) {
   int i;
-#ifndef NDEBUG
   if (FLAG_statistics) {
     PrintStats();
   }
-#endif
   for (i = g_aborthooks.n; i--;) {
     g_aborthooks.p[i]();
   }
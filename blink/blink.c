@@ -39,7 +39,9 @@
 #include "blink/macros.h"
 #include "blink/map.h"
 #include "blink/overlays.h"
+#include "blink/perfmap.h"
 #include "blink/pml4t.h"
+#include "blink/profile.h"
 #include "blink/signal.h"
 #include "blink/sigwinch.h"
 #include "blink/stats.h"
@@ -108,22 +110,30 @@ _Alignas(1) static const char USAGE[] =
 #if !defined(DISABLE_STRACE) && !defined(TINY)
     "  -s                   enable system call logging\n"
 #endif
-#ifndef NDEBUG
     "  -Z                   print internal statistics on exit\n"
+#ifndef NDEBUG
     "  -L PATH              log filename (default is blink.log)\n"
 #endif
 #if !defined(DISABLE_OVERLAYS) || !defined(DISABLE_VFS)
     "  -C PATH              sets chroot dir or overlay spec [default \":o\"]\n"
 #endif
-#if !defined(DISABLE_OVERLAYS) || !defined(NDEBUG)
+#if !defined(DISABLE_OVERLAYS) || !defined(NDEBUG) || defined(HAVE_THREADS)
     "Environment:\n"
 #endif
 #ifndef DISABLE_OVERLAYS
     "  $BLINK_OVERLAYS      file system roots [default \":o\"]\n"
 #endif
 #ifndef DISABLE_VFS
-    "  $BLINK_PREFIX        file system root [default \"/\"]\n"
+    "  $BLINK_PREFIX        file system root or packfs image [default \"/\"]\n"
+    "  $BLINK_MOUNTS        extra mounts, e.g. \"tmpfs /tmp tmpfs size=64m\"\n"
+#endif
+#ifdef HAVE_THREADS
+    "  $BLINK_THREAD_POOL   idle threads kept for reuse [default 16]\n"
 #endif
+#ifndef DISABLE_JIT
+    "  $BLINK_PERF          describe jit code to perf: map and/or jitdump\n"
+#endif
+    "  $BLINK_PROFILE       sample guest stacks, writing them to this file\n"
 #ifndef NDEBUG
 
     "  $BLINK_LOG_FILENAME  log filename (same as -L flag)\n"
@@ -163,6 +173,7 @@ void TerminateSignal(struct Machine *m, int sig, int code) {
     PrintDiagnostics(m);
   }
   if ((syssig = XlatSignal(sig)) == -1) syssig = SIGKILL;
+  WriteProfile();
   FreeMachine(m);
 #ifdef HAVE_JIT
   ShutdownJit();
@@ -225,7 +236,7 @@ static int Exec(char *execfn, char *prog, char **argv, char **envp) {
     DisableJit(&old->system->jit);  // unmapping exec pages is slow
 #endif
     unassert(!m->sysdepth);
-    unassert(!m->pagelocks.i);
+    unassert(!m->pins.n);
     unassert(!FreeVirtual(old->system, -0x800000000000, 0x1000000000000));
     for (i = 1; i <= 64; ++i) {
       if (Read64(old->system->hands[i - 1].handler) == SIG_IGN_LINUX) {
@@ -233,9 +244,9 @@ static int Exec(char *execfn, char *prog, char **argv, char **envp) {
       }
     }
     memcpy(m->system->rlim, old->system->rlim, sizeof(old->system->rlim));
+    m->system->signals = old->system->signals;
     LoadProgram(m, execfn, prog, argv, envp, NULL);
-    m->system->fds.list = old->system->fds.list;
-    old->system->fds.list = 0;
+    MoveFds(&m->system->fds, &old->system->fds);
     // releasing the execve() lock must come after unlocking fds
     memcpy(&oldmask, &old->system->exec_sigmask, sizeof(oldmask));
     UNLOCK(&old->system->exec_lock);
@@ -244,6 +255,10 @@ static int Exec(char *execfn, char *prog, char **argv, char **envp) {
     // restore the signal mask we had before execve() was called
     unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
   }
+#ifdef HAVE_JIT
+  SetupPerfMap(m->system);
+#endif
+  SetupProfiler(m->system);
   Blink(m);
 }
 
@@ -272,7 +287,17 @@ static void GetOpts(int argc, char *argv[]) {
 #endif
 #ifndef DISABLE_VFS
   FLAG_prefix = getenv("BLINK_PREFIX");
+  FLAG_mounts = getenv("BLINK_MOUNTS");
 #endif
+#ifdef HAVE_THREADS
+  if (getenv("BLINK_THREAD_POOL")) {
+    FLAG_threadpool = atoi(getenv("BLINK_THREAD_POOL"));
+  }
+#endif
+#ifndef DISABLE_JIT
+  FLAG_perf = getenv("BLINK_PERF");
+#endif
+  FLAG_profile = getenv("BLINK_PROFILE");
 #if LOG_ENABLED
   FLAG_logpath = getenv("BLINK_LOG_FILENAME");
 #endif
@@ -389,6 +414,10 @@ int main(int argc, char *argv[]) {
     WriteErrorString("error: vfs initialization failed\n");
     exit(EXIT_FAILURE);
   }
+  if (FLAG_mounts && VfsMountAll(FLAG_mounts)) {
+    WriteErrorString("error: bad blink mounts spec; see log for details\n");
+    exit(EXIT_FAILURE);
+  }
 #endif
   HandleSigs();
   InitBus();
@@ -3320,7 +3320,7 @@ static void Tui(void) {
           ReactiveDraw();
         }
       } else {
-        m->xedd = (struct XedDecodedInst *)m->opcache->icache[0];
+        m->xedd = (struct XedDecodedInst *)m->opcache->icache;
         m->xedd->length = 1;
         m->xedd->bytes[0] = 0xCC;
         m->xedd->op.rde &= ~00000077760000000000000;
@@ -3418,7 +3418,7 @@ static void Tui(void) {
             writesize = m->writesize;
           }
           ScrollMemoryViews();
-          if (m->signals & ~m->sigmask) {
+          if ((m->signals | m->system->signals) & ~m->sigmask) {
             if ((sig = ConsumeSignal(m, 0, 0))) {
               exit(EXIT_FAILURE_WITH_SIGNAL(sig));
             }
@@ -3470,6 +3470,7 @@ _Noreturn static void PrintVersion(void) {
 
 static void GetOpts(int argc, char *argv[]) {
   int opt;
+  const char *pool;
   bool wantunsafe = false;
   FLAG_nologstderr = true;
 #ifndef DISABLE_OVERLAYS
@@ -3478,6 +3479,10 @@ static void GetOpts(int argc, char *argv[]) {
 #endif
 #ifndef DISABLE_VFS
   FLAG_prefix = getenv("BLINK_PREFIX");
+  FLAG_mounts = getenv("BLINK_MOUNTS");
+#endif
+#ifdef HAVE_THREADS
+  if ((pool = getenv("BLINK_THREAD_POOL"))) FLAG_threadpool = atoi(pool);
 #endif
   while ((opt = GetOpt(argc, argv, "0hjmvVtrzRNsZb:Hw:L:C:B:")) != -1) {
     switch (opt) {
@@ -3720,6 +3725,10 @@ int main(int argc, char *argv[]) {
     WriteErrorString("error: vfs initialization failed\n");
     exit(EXIT_FAILURE);
   }
+  if (FLAG_mounts && VfsMountAll(FLAG_mounts)) {
+    WriteErrorString("error: bad blink mounts spec; see log for details\n");
+    exit(EXIT_FAILURE);
+  }
 #endif
 #ifdef HAVE_JIT
   AddPath_StartOp_Hook = AddPath_StartOp_Tui;
@@ -43,33 +43,16 @@ struct Bus *g_bus;
 
 void InitBus(void) {
   unsigned i;
-  pthread_condattr_t_ cattr;
-  pthread_mutexattr_t_ mattr;
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
   if (g_bus) FreeBig(g_bus, sizeof(*g_bus));
 #endif
   unassert(g_bus =
                (struct Bus *)AllocateBig(sizeof(*g_bus), PROT_READ | PROT_WRITE,
                                          BUS_MEMORY | MAP_ANONYMOUS_, -1, 0));
-  unassert(!pthread_condattr_init(&cattr));
-  unassert(!pthread_mutexattr_init(&mattr));
-#ifdef HAVE_PTHREAD_PROCESS_SHARED
-  unassert(!pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED));
-  unassert(!pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED));
-#endif
 #ifdef HAVE_THREADS
   for (i = 0; i < kBusCount; ++i)
     unassert(!pthread_mutex_init(&g_bus->lock[i], 0));
 #endif
-  unassert(!pthread_mutex_init(&g_bus->futexes.lock, &mattr));
-  for (i = 0; i < kFutexMax; ++i) {
-    unassert(!pthread_cond_init(&g_bus->futexes.mem[i].cond, &cattr));
-    unassert(!pthread_mutex_init(&g_bus->futexes.mem[i].lock, &mattr));
-    dll_init(&g_bus->futexes.mem[i].elem);
-    dll_make_last(&g_bus->futexes.free, &g_bus->futexes.mem[i].elem);
-  }
-  unassert(!pthread_mutexattr_destroy(&mattr));
-  unassert(!pthread_condattr_destroy(&cattr));
 }
 
 void LockBus(const u8 *locality) {
@@ -13,26 +13,8 @@
 #include "blink/tunables.h"
 #include "blink/types.h"
 
-#define FUTEX_CONTAINER(e) DLL_CONTAINER(struct Futex, elem, e)
-
-struct Futex {
-  i64 addr;
-  int waiters;
-  struct Dll elem;
-  pthread_cond_t_ cond;
-  pthread_mutex_t_ lock;
-};
-
-struct Futexes {
-  struct Dll *active;
-  struct Dll *free;
-  pthread_mutex_t_ lock;
-  struct Futex mem[kFutexMax];
-};
-
 struct Bus {
   pthread_mutex_t_ lock[kBusCount];
-  struct Futexes futexes;
 };
 
 extern struct Bus *g_bus;
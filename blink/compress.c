@@ -55,3 +55,19 @@ void Inflate(void *out, unsigned outsize, const void *in, unsigned insize) {
   unassert(inflate(&zs, Z_FINISH) == Z_STREAM_END);
   unassert(inflateEnd(&zs) == Z_OK);
 }
+
+// same as Inflate() except it reports corrupt data rather than crash,
+// for when the compressed data comes from some file we didn't write
+bool TryInflate(void *out, unsigned outsize, const void *in,
+                unsigned insize) {
+  bool ok;
+  z_stream zs = {0};
+  zs.next_in = (z_const Bytef *)in;
+  zs.avail_in = insize;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = outsize;
+  if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) return false;
+  ok = inflate(&zs, Z_FINISH) == Z_STREAM_END && !zs.avail_out;
+  inflateEnd(&zs);
+  return ok;
+}
@@ -33,6 +33,7 @@
 #include "blink/machine.h"
 #include "blink/map.h"
 #include "blink/overlays.h"
+#include "blink/thread.h"
 #include "blink/util.h"
 #include "blink/vfs.h"
 
@@ -82,3 +83,20 @@ void LoadDebugSymbols(struct System *s) {
     LoadFileMapSymbols(s, FILEMAP_CONTAINER(e));
   }
 }
+
+/**
+ * Loads symbols for the program running in `s`, unless it has them.
+ *
+ * This is for the tools that name guest addresses on the host, which
+ * share a single table. It should be called once the program's loaded
+ * and the symbols of the previous program are dropped after execve().
+ */
+void LoadSharedSymbols(struct System *s) {
+  static struct Dis dis;
+  if (s->dis) return;
+  DisFree(&dis);
+  s->dis = &dis;
+  LOCK(&s->mmap_lock);
+  LoadDebugSymbols(s);
+  UNLOCK(&s->mmap_lock);
+}
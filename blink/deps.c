@@ -40,31 +40,32 @@ static int CrawlFlags(struct Machine *m,  //
                       int depth) {
   u64 place;
   int need, deps;
+  struct XedDecodedInst xedd[1];
   for (need = 0;;) {
     place = pc;
     SPX_LOGF("%" PRIx64 " %*s%s", pc, depth * 2, "", DescribeOp(m, pc));
-    if (LoadInstruction2(m, place)) {
+    if (SpeculateInstruction(m, place, xedd)) {
       WriteCod("/\tfailed to speculate instruction at %" PRIx64 "\n", place);
       return -1;
     }
-    pc += Oplength(m->xedd->op.rde);
-    deps = GetFlagDeps(m->xedd->op.rde);
+    pc += Oplength(xedd->op.rde);
+    deps = GetFlagDeps(xedd->op.rde);
     if (deps) {
       WriteCod("/\top at %" PRIx64 " needs %s\n", place,
                DescribeCpuFlags(deps));
     }
     need |= deps & myflags;
-    if (!(myflags &= ~GetFlagClobbers(m->xedd->op.rde))) {
+    if (!(myflags &= ~GetFlagClobbers(xedd->op.rde))) {
       return need;
     } else if (!--look) {
       WriteCod("/\tgiving up on speculation\n");
       return -1;
-    } else if (IsJump(m->xedd->op.rde)) {
-      pc += m->xedd->op.disp;
-    } else if (IsConditionalJump(m->xedd->op.rde)) {
-      need |= CrawlFlags(m, pc + m->xedd->op.disp, myflags, look, depth + 1);
+    } else if (IsJump(xedd->op.rde)) {
+      pc += xedd->op.disp;
+    } else if (IsConditionalJump(xedd->op.rde)) {
+      need |= CrawlFlags(m, pc + xedd->op.disp, myflags, look, depth + 1);
       if (need == -1) return -1;
-    } else if (ClassifyOp(m->xedd->op.rde) != kOpNormal) {
+    } else if (ClassifyOp(xedd->op.rde) != kOpNormal) {
       WriteCod("/\tspeculated abnormal op at %" PRIx64 "\n", place);
       return -1;
     }
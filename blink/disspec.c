@@ -534,6 +534,7 @@ const char *DisSpecMap1(struct XedDecodedInst *x, char *p) {
     RCASE(0x06, "clts");
     RCASE(0x09, "wbinvd");
     RCASE(0x0B, "ud2");
+    RCASE(0x0E, "femms");
     RCASE(0x20, "mov %Hd %Cd");
     RCASE(0x22, "mov %Cd %Hd");
     RCASE(0x28, "movapSD %Vps Wps");
@@ -104,6 +104,10 @@ long enodev(void) {
   return ReturnErrno(ENODEV);
 }
 
+long enotty(void) {
+  return ReturnErrno(ENOTTY);
+}
+
 long eacces(void) {
   return ReturnErrno(EACCES);
 }
@@ -127,3 +131,23 @@ long exdev(void) {
 long enametoolong(void) {
   return ReturnErrno(ENAMETOOLONG);
 }
+
+long enotempty(void) {
+  return ReturnErrno(ENOTEMPTY);
+}
+
+long enospc(void) {
+  return ReturnErrno(ENOSPC);
+}
+
+long efbig(void) {
+  return ReturnErrno(EFBIG);
+}
+
+long erofs(void) {
+  return ReturnErrno(EROFS);
+}
+
+long eio(void) {
+  return ReturnErrno(EIO);
+}
@@ -20,11 +20,17 @@ long erange(void);
 long eperm(void);
 long esrch(void);
 long enodev(void);
+long enotty(void);
 long eacces(void);
 long eisdir(void);
 long eexist(void);
 long eloop(void);
 long exdev(void);
 long enametoolong(void);
+long enotempty(void);
+long enospc(void);
+long efbig(void);
+long erofs(void);
+long eio(void);
 
 #endif /* BLINK_ERRNO_H_ */
@@ -34,23 +34,114 @@
 #include "blink/log.h"
 #include "blink/macros.h"
 #include "blink/thread.h"
+#include "blink/tunables.h"
 #include "blink/vfs.h"
 
+// Fd objects are never returned to malloc(). Once their last reference
+// goes away they're kept on this list so they can be reused by AddFd().
+// That way AcquireFd() may safely touch an Fd that was closed by some
+// other thread, since its memory is guaranteed to still be an Fd.
+static struct FdPool {
+  pthread_mutex_t_ lock;
+  struct Dll *free;
+} g_fdpool = {PTHREAD_MUTEX_INITIALIZER_};
+
 void InitFds(struct Fds *fds) {
   fds->list = 0;
+  fds->table = 0;
   unassert(!pthread_mutex_init(&fds->lock, 0));
 }
 
-struct Fd *AddFd(struct Fds *fds, int fildes, int oflags) {
+void LockFdPool(void) {
+  LOCK(&g_fdpool.lock);
+}
+
+void UnlockFdPool(void) {
+  UNLOCK(&g_fdpool.lock);
+}
+
+static struct Fd *AllocateFd(void) {
+  struct Dll *e;
   struct Fd *fd;
+  LOCK(&g_fdpool.lock);
+  if ((e = dll_first(g_fdpool.free))) {
+    dll_remove(&g_fdpool.free, e);
+  }
+  UNLOCK(&g_fdpool.lock);
+  if (e) {
+    fd = FD_CONTAINER(e);
+    fd->socktype = 0;
+    fd->norestart = false;
+    fd->seals = 0;
+    fd->dirstream = 0;
+    fd->path = 0;
+    memset(&fd->saddr, 0, sizeof(fd->saddr));
+  } else if ((fd = (struct Fd *)calloc(1, sizeof(*fd)))) {
+    unassert(!pthread_mutex_init(&fd->lock, 0));
+  }
+  return fd;
+}
+
+static void RecycleFd(struct Fd *fd) {
+  free(fd->path);
+  fd->path = 0;
+  LOCK(&g_fdpool.lock);
+  dll_make_first(&g_fdpool.free, &fd->elem);
+  UNLOCK(&g_fdpool.lock);
+}
+
+static bool GrowFds(struct Fds *fds, int fildes) {
+  int i, n;
+  struct FdTable *t, *t2;
+  t = atomic_load_explicit(&fds->table, memory_order_relaxed);
+  n = t ? t->size : kMinFdTable;
+  while (n <= fildes) {
+    if (n > INT_MAX / 2) return false;
+    n *= 2;
+  }
+  if (!(t2 = (struct FdTable *)calloc(
+            1, sizeof(struct FdTable) + n * sizeof(t2->p[0])))) {
+    return false;
+  }
+  t2->size = n;
+  if (t) {
+    for (i = 0; i < t->size; ++i) {
+      atomic_store_explicit(
+          t2->p + i, atomic_load_explicit(t->p + i, memory_order_relaxed),
+          memory_order_relaxed);
+    }
+    t2->retired = t;
+  }
+  atomic_store_explicit(&fds->table, t2, memory_order_release);
+  return true;
+}
+
+struct Fd *AddFd(struct Fds *fds, int fildes, int oflags) {
+  struct Fd *fd, *old;
+  struct FdTable *t;
   if (fildes >= 0) {
-    if ((fd = (struct Fd *)calloc(1, sizeof(*fd)))) {
+    t = atomic_load_explicit(&fds->table, memory_order_relaxed);
+    if (!t || fildes >= t->size) {
+      if (!GrowFds(fds, fildes)) {
+        enomem();
+        return 0;
+      }
+      t = atomic_load_explicit(&fds->table, memory_order_relaxed);
+    }
+    if ((fd = AllocateFd())) {
+      // a stale entry might exist if the host closed this fd behind
+      // our back, in which case it'll be forgotten about
+      if ((old = atomic_load_explicit(t->p + fildes, memory_order_relaxed))) {
+        RemoveFd(fds, old);
+        FreeFd(old);
+      }
       dll_init(&fd->elem);
       fd->cb = &kFdCbHost;
       fd->fildes = fildes;
       fd->oflags = oflags;
-      unassert(!pthread_mutex_init(&fd->lock, 0));
+      atomic_store_explicit(&fd->refs, 1, memory_order_relaxed);
       dll_make_first(&fds->list, &fd->elem);
+      atomic_store_explicit(t->p + fildes, fd, memory_order_release);
     }
     return fd;
   } else {
@@ -66,32 +157,95 @@ struct Fd *ForkFd(struct Fds *fds, struct Fd *fd, int fildes, int oflags) {
       fd2->path = fd->path ? strdup(fd->path) : 0;
       fd2->socktype = fd->socktype;
       fd2->norestart = fd->norestart;
+      fd2->seals = fd->seals;
       memcpy(&fd2->saddr, &fd->saddr, sizeof(fd->saddr));
     }
   }
   return fd2;
 }
 
+// returns fd object, which caller must hold Fds::lock to use
 struct Fd *GetFd(struct Fds *fds, int fildes) {
-  bool lru;
-  struct Dll *e;
-  if (fildes >= 0) {
-    lru = false;
-    for (e = dll_first(fds->list); e; e = dll_next(fds->list, e)) {
-      if (FD_CONTAINER(e)->fildes == fildes) {
-        if (lru) {
-          dll_remove(&fds->list, e);
-          dll_make_first(&fds->list, e);
-        }
-        return FD_CONTAINER(e);
-      }
-      lru = true;
-    }
+  struct Fd *fd;
+  struct FdTable *t;
+  if (fildes >= 0 &&  //
+      (t = atomic_load_explicit(&fds->table, memory_order_relaxed)) &&
+      fildes < t->size &&
+      (fd = atomic_load_explicit(t->p + fildes, memory_order_relaxed))) {
+    return fd;
   }
   ebadf();
   return 0;
 }
 
+// returns fd object without locking, which must be passed to ReleaseFd()
+struct Fd *AcquireFd(struct Fds *fds, int fildes) {
+  int refs;
+  struct Fd *fd;
+  struct FdTable *t;
+  if (fildes < 0) {
+    ebadf();
+    return 0;
+  }
+  for (;;) {
+    t = atomic_load_explicit(&fds->table, memory_order_acquire);
+    if (!t || fildes >= t->size ||
+        !(fd = atomic_load_explicit(t->p + fildes, memory_order_acquire))) {
+      ebadf();
+      return 0;
+    }
+    refs = atomic_load_explicit(&fd->refs, memory_order_relaxed);
+    do {
+      if (!refs) break;  // it's being recycled
+    } while (!atomic_compare_exchange_weak_explicit(&fd->refs, &refs, refs + 1,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed));
+    if (!refs) continue;
+    // now that it can't be recycled, make sure it's still the same fd
+    t = atomic_load_explicit(&fds->table, memory_order_acquire);
+    if (fd->fildes == fildes &&
+        atomic_load_explicit(t->p + fildes, memory_order_relaxed) == fd) {
+      return fd;
+    }
+    ReleaseFd(fd);
+  }
+}
+
+void ReleaseFd(struct Fd *fd) {
+  if (atomic_fetch_add_explicit(&fd->refs, -1, memory_order_acq_rel) == 1) {
+    RecycleFd(fd);
+  }
+}
+
+// removes fd from table, which caller must hold Fds::lock to do
+void RemoveFd(struct Fds *fds, struct Fd *fd) {
+  struct FdTable *t;
+  dll_remove(&fds->list, &fd->elem);
+  if ((t = atomic_load_explicit(&fds->table, memory_order_relaxed)) &&
+      fd->fildes < t->size &&
+      atomic_load_explicit(t->p + fd->fildes, memory_order_relaxed) == fd) {
+    atomic_store_explicit(t->p + fd->fildes, 0, memory_order_release);
+  }
+}
+
+// transfers descriptors to the new system created by execve()
+void MoveFds(struct Fds *dst, struct Fds *src) {
+  unassert(!dst->list);
+  unassert(!dst->table);
+  dst->list = src->list;
+  dst->table = src->table;
+  src->list = 0;
+  src->table = 0;
+}
+
+// forgets references held by threads that didn't survive fork()
+void ResetFds(struct Fds *fds) {
+  struct Dll *e;
+  for (e = dll_first(fds->list); e; e = dll_next(fds->list, e)) {
+    atomic_store_explicit(&FD_CONTAINER(e)->refs, 1, memory_order_relaxed);
+  }
+}
+
 void LockFd(struct Fd *fd) {
   LOCK(&fd->lock);
 }
@@ -109,22 +263,27 @@ int CountFds(struct Fds *fds) {
   return n;
 }
 
+// drops the reference held by the table, after RemoveFd() is called
 void FreeFd(struct Fd *fd) {
   if (fd) {
-    unassert(!pthread_mutex_destroy(&fd->lock));
-    free(fd->path);
-    free(fd);
+    ReleaseFd(fd);
   }
 }
 
 void DestroyFds(struct Fds *fds) {
   struct Dll *e, *e2;
+  struct FdTable *t, *t2;
   for (e = dll_first(fds->list); e; e = e2) {
     e2 = dll_next(fds->list, e);
     dll_remove(&fds->list, e);
     FreeFd(FD_CONTAINER(e));
   }
   unassert(!fds->list);
+  for (t = fds->table; t; t = t2) {
+    t2 = t->retired;
+    free(t);
+  }
+  fds->table = 0;
   unassert(!pthread_mutex_destroy(&fds->lock));
 }
 
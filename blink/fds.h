@@ -9,6 +9,7 @@
 #include <sys/uio.h>
 #include <termios.h>
 
+#include "blink/atomic.h"
 #include "blink/dll.h"
 #include "blink/thread.h"
 #include "blink/types.h"
@@ -33,9 +34,11 @@ struct Fd {
   int oflags;      // host O_XXX constants
   int socktype;    // host SOCK_XXX constants
   bool norestart;  // is SO_RCVTIMEO in play?
+  int seals;       // memfd seals, if not tracked by the host
   DIR *dirstream;  // for getdents() lazilly
   struct Dll elem;
   pthread_mutex_t_ lock;
+  _Atomic(int) refs;  // one for the table plus one per AcquireFd()
   const struct FdCb *cb;
   char *path;
   union {
@@ -45,17 +48,37 @@ struct Fd {
   } saddr;
 };
 
+// Fds are indexed by file descriptor number so lookups are O(1). The
+// table is only modified while holding Fds::lock, but AcquireFd() can
+// read it without the lock. When it grows, the old table is retired as
+// opposed to freed, since readers may still be looking at it.
+struct FdTable {
+  int size;
+  struct FdTable *retired;
+  _Atomic(struct Fd *) p[];
+};
+
 struct Fds {
   struct Dll *list;
+  _Atomic(struct FdTable *) table;
   pthread_mutex_t_ lock;
 };
 
 extern const struct FdCb kFdCbHost;
+extern const struct FdCb kFdCbSignalfd;
+extern const struct FdCb kFdCbIoUring;
 
 void InitFds(struct Fds *);
 struct Fd *AddFd(struct Fds *, int, int);
 struct Fd *ForkFd(struct Fds *, struct Fd *, int, int);
 struct Fd *GetFd(struct Fds *, int);
+struct Fd *AcquireFd(struct Fds *, int);
+void ReleaseFd(struct Fd *);
+void RemoveFd(struct Fds *, struct Fd *);
+void MoveFds(struct Fds *, struct Fds *);
+void ResetFds(struct Fds *);
+void LockFdPool(void);
+void UnlockFdPool(void);
 void LockFd(struct Fd *);
 void UnlockFd(struct Fd *);
 int CountFds(struct Fds *);
@@ -19,6 +19,7 @@
 #include "blink/flag.h"
 
 #include "blink/builtin.h"
+#include "blink/tunables.h"
 
 bool FLAG_zero;
 bool FLAG_wantjit;
@@ -29,6 +30,7 @@ bool FLAG_alsologtostderr;
 
 int FLAG_strace;
 int FLAG_vabits;
+int FLAG_threadpool = kThreadPool;
 
 long FLAG_pagesize;
 
@@ -48,5 +50,8 @@ const char *FLAG_overlays;
 #endif
 #ifndef DISABLE_VFS
 const char *FLAG_prefix;
+const char *FLAG_mounts;
 #endif
 const char *FLAG_bios;
+const char *FLAG_perf;
+const char *FLAG_profile;
@@ -86,6 +86,7 @@ bool FuseBranchTest(P) {
   FlushCod(m->path.jb);
   WriteCod("/\tfusing branch test+jcc\n");
   BeginCod(m, m->ip);
+  AddJitLines(m->path.jb, m->ip, jlen);
 #if LOG_JIX
   Jitter(A,
          "a1i"  // arg1 = ip
@@ -216,6 +217,7 @@ bool FuseBranchCmp(P, bool imm) {
   FlushCod(m->path.jb);
   WriteCod("/\tfusing branch cmp+jcc\n");
   BeginCod(m, m->ip);
+  AddJitLines(m->path.jb, m->ip, jlen);
 #if LOG_JIX
   Jitter(A,
          "a1i"  // arg1 = ip
@@ -0,0 +1,578 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/errno.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/map.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tsan.h"
+#include "blink/tunables.h"
+#include "blink/types.h"
+
+#ifdef __linux
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux) && defined(SYS_futex) && CAN_64BIT
+// when guest memory is linear, the guest futex word is host memory at a
+// fixed offset, so we can just ask the host kernel to sleep on it. this
+// also makes futexes on MAP_SHARED memory work between guest processes
+#define HasHostFutex() HasLinearMapping()
+#else
+#define HasHostFutex() false
+#endif
+
+#define FUTEX_WAITER_CONTAINER(e) DLL_CONTAINER(struct FutexWaiter, elem, e)
+
+// thread blocked in futex(FUTEX_WAIT), which lives on its stack. the
+// address and bucket change if the waiter gets requeued, which happens
+// while holding the locks of both the old and new bucket
+struct FutexWaiter {
+  i64 addr;
+  u32 bitset;
+  bool woken;
+  bool requeued;
+  struct Dll elem;
+  pthread_cond_t_ cond;
+  _Atomic(struct FutexBucket *) bucket;
+};
+
+struct FutexBucket {
+  pthread_mutex_t_ lock;
+  struct Dll *waiters GUARDED_BY(lock);
+};
+
+// futex waiters are hashed by guest address across buckets which are
+// locked independently, so unrelated futexes don't contend on a lock
+static struct Futexes {
+  pthread_once_t_ once;
+  struct FutexBucket bucket[kFutexBuckets];
+} g_futexes = {
+    PTHREAD_ONCE_INIT_,
+};
+
+static void InitFutexes(void) {
+  int i;
+  for (i = 0; i < kFutexBuckets; ++i) {
+    unassert(!pthread_mutex_init(&g_futexes.bucket[i].lock, 0));
+  }
+}
+
+static struct FutexBucket *GetFutexBucket(i64 addr) {
+  _Static_assert(IS2POW(kFutexBuckets), "futex buckets must be two-power");
+  unassert(!pthread_once_(&g_futexes.once, InitFutexes));
+  return g_futexes.bucket +
+         (((u64)addr >> 2) * 0x9e3779b97f4a7c15 >> 32) % kFutexBuckets;
+}
+
+void LockFutexes(void) {
+  int i;
+  unassert(!pthread_once_(&g_futexes.once, InitFutexes));
+  for (i = 0; i < kFutexBuckets; ++i) {
+    LOCK(&g_futexes.bucket[i].lock);
+  }
+}
+
+void UnlockFutexes(void) {
+  int i;
+  for (i = kFutexBuckets; i--;) {
+    UNLOCK(&g_futexes.bucket[i].lock);
+  }
+}
+
+// forgets waiters belonging to threads that didn't survive fork()
+void ResetFutexes(void) {
+  int i;
+  for (i = 0; i < kFutexBuckets; ++i) {
+    g_futexes.bucket[i].waiters = 0;
+  }
+}
+
+// locks the buckets of two futexes in a consistent order
+static void LockFutexPair(struct FutexBucket *b1, struct FutexBucket *b2) {
+  if (b1 == b2) {
+    LOCK(&b1->lock);
+  } else if (b1 < b2) {
+    LOCK(&b1->lock);
+    LOCK(&b2->lock);
+  } else {
+    LOCK(&b2->lock);
+    LOCK(&b1->lock);
+  }
+}
+
+static void UnlockFutexPair(struct FutexBucket *b1, struct FutexBucket *b2) {
+  UNLOCK(&b1->lock);
+  if (b2 != b1) UNLOCK(&b2->lock);
+}
+
+// locks the bucket a waiter is in, which may be changed by a requeue
+static struct FutexBucket *LockFutexWaiter(struct FutexWaiter *w) {
+  struct FutexBucket *b;
+  for (;;) {
+    b = atomic_load_explicit(&w->bucket, memory_order_acquire);
+    LOCK(&b->lock);
+    if (b == atomic_load_explicit(&w->bucket, memory_order_relaxed)) return b;
+    UNLOCK(&b->lock);
+  }
+}
+
+// returns -1 if a futex waiter should keep waiting
+static int CheckFutexWait(struct Machine *m, i64 uaddr, u32 expect,
+                          bool poll) {
+  u8 *mem;
+  if (m->killed) return EAGAIN;
+  if (CheckInterrupt(m, true)) return EINTR;
+  if (!poll) return -1;
+  if (!(mem = LookupAddress(m, uaddr))) return errno;
+  // the word is polled too, since futexes on MAP_SHARED memory might
+  // be woken by a guest process that has its own futex table
+  if (Load32(mem) != expect) return 0;
+  return -1;
+}
+
+#if defined(__linux) && defined(SYS_futex) && CAN_64BIT
+
+static long HostFutex(i64 uaddr, int op, u32 val, void *timeout, i64 uaddr2,
+                      u32 val3) {
+  return syscall(SYS_futex, ToHost(uaddr), op, val, timeout,
+                 uaddr2 ? ToHost(uaddr2) : 0, val3);
+}
+
+// the host kernel sleeps the waiter, but it's still listed in the table
+// so a requeue can tell it that it was moved, since it stops sleeping
+// every so often to check for interrupts and must know where it's at
+static int HostFutexWait(struct Machine *m, i64 uaddr, int op, u32 expect,
+                         u32 bitset, struct timespec deadline) {
+  int rc;
+  bool slept;
+  bool requeued;
+  struct FutexBucket *b;
+  struct FutexWaiter w;
+  struct timespec tick;
+  w.addr = uaddr;
+  w.bitset = bitset;
+  w.woken = false;
+  w.requeued = false;
+  dll_init(&w.elem);
+  b = GetFutexBucket(uaddr);
+  atomic_store_explicit(&w.bucket, b, memory_order_relaxed);
+  LOCK(&b->lock);
+  dll_make_last(&b->waiters, &w.elem);
+  UNLOCK(&b->lock);
+  for (slept = false;; slept = true) {
+    if (slept) {
+      b = LockFutexWaiter(&w);
+      requeued = w.requeued;
+      UNLOCK(&b->lock);
+      // once moved, there's no telling what value to expect at the new
+      // address, so sleeping again could miss a wakeup. it's returned
+      // as a wakeup instead, which futex waiters must be ready for
+      if (requeued) {
+        rc = 0;
+        break;
+      }
+      if ((rc = CheckFutexWait(m, uaddr, expect, true)) != -1) break;
+    }
+    tick = GetTime();
+    if (CompareTime(tick, deadline) >= 0) {
+      rc = ETIMEDOUT;
+      break;
+    }
+    tick = AddTime(tick, FromMilliseconds(kPollingMs));
+    if (CompareTime(tick, deadline) > 0) tick = deadline;
+    STATISTIC(++futex_host_waits);
+    if (!HostFutex(uaddr,
+                   FUTEX_WAIT_BITSET_LINUX | FUTEX_CLOCK_REALTIME_LINUX |
+                       (op & FUTEX_PRIVATE_FLAG_LINUX),
+                   expect, &tick, 0, bitset)) {
+      rc = 0;
+      break;
+    }
+    if ((rc = errno) == EAGAIN) {
+      // the word changing after we've already slept means we missed
+      // the wakeup while checking for interrupts; it's still a wake
+      if (slept) rc = 0;
+      break;
+    }
+    unassert(rc == ETIMEDOUT || rc == EINTR);
+  }
+  b = LockFutexWaiter(&w);
+  dll_remove(&b->waiters, &w.elem);
+  UNLOCK(&b->lock);
+  return rc;
+}
+
+#else
+
+static long HostFutex(i64 uaddr, int op, u32 val, void *timeout, i64 uaddr2,
+                      u32 val3) {
+  __builtin_unreachable();
+}
+
+static int HostFutexWait(struct Machine *m, i64 uaddr, int op, u32 expect,
+                         u32 bitset, struct timespec deadline) {
+  __builtin_unreachable();
+}
+
+#endif
+
+// wakes up to count waiters at uaddr whose bitset intersects ours
+static int WakeFutexLocked(struct FutexBucket *b, i64 uaddr, u32 count,
+                           u32 bitset) {
+  int n;
+  struct Dll *e, *e2;
+  struct FutexWaiter *w;
+  for (n = 0, e = dll_first(b->waiters); e && n < count; e = e2) {
+    e2 = dll_next(b->waiters, e);
+    w = FUTEX_WAITER_CONTAINER(e);
+    if (w->addr == uaddr && (w->bitset & bitset)) {
+      dll_remove(&b->waiters, e);
+      w->woken = true;
+      unassert(!pthread_cond_signal(&w->cond));
+      ++n;
+    }
+  }
+  return n;
+}
+
+// moves up to count waiters from uaddr to uaddr2 without waking them
+static int RequeueFutexLocked(struct FutexBucket *b, i64 uaddr,
+                              struct FutexBucket *b2, i64 uaddr2, u32 count) {
+  int n;
+  struct Dll *e, *e2;
+  struct FutexWaiter *w;
+  for (n = 0, e = dll_first(b->waiters); e && n < count; e = e2) {
+    e2 = dll_next(b->waiters, e);
+    w = FUTEX_WAITER_CONTAINER(e);
+    if (w->addr == uaddr) {
+      dll_remove(&b->waiters, e);
+      w->addr = uaddr2;
+      w->requeued = true;
+      atomic_store_explicit(&w->bucket, b2, memory_order_release);
+      dll_make_last(&b2->waiters, e);
+      ++n;
+    }
+  }
+  return n;
+}
+
+static int FutexWake(i64 uaddr, int op, u32 count, u32 bitset) {
+  int n;
+  struct FutexBucket *b;
+  if (!count) return 0;
+  if (HasHostFutex()) {
+    return HostFutex(uaddr,
+                     FUTEX_WAKE_BITSET_LINUX | (op & FUTEX_PRIVATE_FLAG_LINUX),
+                     MIN(count, INT_MAX), 0, 0, bitset);
+  }
+  b = GetFutexBucket(uaddr);
+  LOCK(&b->lock);
+  n = WakeFutexLocked(b, uaddr, count, bitset);
+  UNLOCK(&b->lock);
+  return n;
+}
+
+int SysFutexWake(struct Machine *m, i64 uaddr, u32 count) {
+  int rc;
+  rc = FutexWake(uaddr, 0, count, FUTEX_BITSET_MATCH_ANY_LINUX);
+  THR_LOGF("pid=%d tid=%d woke %d waiters at address %#" PRIx64,
+           m->system->pid, m->tid, rc, uaddr);
+  return rc;
+}
+
+static int FutexWait(struct Machine *m, i64 uaddr, int op, u32 expect,
+                     u32 bitset, struct timespec deadline) {
+  int rc;
+  u8 *mem;
+  bool poll;
+  struct FutexBucket *b;
+  struct FutexWaiter w;
+  struct timespec tick;
+  if (m->killed) return EAGAIN;
+  if (CheckInterrupt(m, true)) return EINTR;
+  if (!(mem = LookupAddress(m, uaddr))) return errno;
+  if (HasHostFutex()) {
+    return HostFutexWait(m, uaddr, op, expect, bitset, deadline);
+  }
+  w.addr = uaddr;
+  w.bitset = bitset;
+  w.woken = false;
+  w.requeued = false;
+  dll_init(&w.elem);
+  unassert(!pthread_cond_init(&w.cond, 0));
+  b = GetFutexBucket(uaddr);
+  atomic_store_explicit(&w.bucket, b, memory_order_relaxed);
+  LOCK(&b->lock);
+  if (Load32(mem) != expect) {
+    UNLOCK(&b->lock);
+    unassert(!pthread_cond_destroy(&w.cond));
+    return EAGAIN;
+  }
+  dll_make_last(&b->waiters, &w.elem);
+  tick = GetTime();
+  do {
+    if (CompareTime(tick, deadline) >= 0) {
+      rc = ETIMEDOUT;
+    } else {
+      tick = AddTime(tick, FromMilliseconds(kPollingMs));
+      if (CompareTime(tick, deadline) > 0) tick = deadline;
+      rc = pthread_cond_timedwait(&w.cond, &b->lock, &tick);
+      unassert(!rc || rc == ETIMEDOUT);
+      // interrupts are checked without holding the bucket lock, since
+      // it's acquired after the system locks when forking
+      poll = !w.requeued;
+      UNLOCK(&b->lock);
+      rc = CheckFutexWait(m, uaddr, expect, poll);
+      b = LockFutexWaiter(&w);
+    }
+    if (w.woken) rc = 0;
+  } while (rc == -1);
+  if (!w.woken) dll_remove(&b->waiters, &w.elem);
+  UNLOCK(&b->lock);
+  unassert(!pthread_cond_destroy(&w.cond));
+  return rc;
+}
+
+static int FutexRequeue(struct Machine *m, i64 uaddr, int op, u32 nwake,
+                        u32 nrequeue, i64 uaddr2, bool cmp, u32 expect) {
+  int n;
+  u8 *mem;
+  struct FutexBucket *b, *b2;
+  if ((i32)nwake < 0 || (i32)nrequeue < 0) return einval();
+  if (!(mem = LookupAddress(m, uaddr))) return -1;
+  if (!LookupAddress(m, uaddr2)) return -1;
+  b = GetFutexBucket(uaddr);
+  b2 = GetFutexBucket(uaddr2);
+  LockFutexPair(b, b2);
+  if (HasHostFutex()) {
+    n = HostFutex(uaddr, op, nwake, (void *)(uintptr_t)nrequeue, uaddr2,
+                  expect);
+    // the kernel doesn't say which waiters it moved, so they're all told
+    // they were, which at worst wakes the rest of them a bit early. only
+    // cmp_requeue tells us if any moved, since it counts the requeued
+    if (n != -1 && nrequeue && (!cmp || n > nwake)) {
+      RequeueFutexLocked(b, uaddr, b2, uaddr2, -1);
+    }
+    UnlockFutexPair(b, b2);
+    return n;
+  }
+  if (cmp && Load32(mem) != expect) {
+    UnlockFutexPair(b, b2);
+    return eagain();
+  }
+  n = WakeFutexLocked(b, uaddr, nwake, FUTEX_BITSET_MATCH_ANY_LINUX);
+  n += RequeueFutexLocked(b, uaddr, b2, uaddr2, nrequeue);
+  UnlockFutexPair(b, b2);
+  return n;
+}
+
+static bool DoFutexOp(_Atomic(u32) *word, u32 encoded) {
+  int op, cmp;
+  i32 oparg, cmparg;
+  u32 expect, oldval, newval;
+  op = (encoded >> 28) & 15;
+  cmp = (encoded >> 24) & 15;
+  oparg = (i32)(encoded << 8) >> 20;
+  cmparg = (i32)(encoded << 20) >> 20;
+  if (op & FUTEX_OP_OPARG_SHIFT_LINUX) {
+    oparg = 1u << (oparg & 31);
+    op &= ~FUTEX_OP_OPARG_SHIFT_LINUX;
+  }
+  for (expect = atomic_load_explicit(word, memory_order_relaxed);;) {
+    oldval = Little32(expect);
+    switch (op) {
+      case FUTEX_OP_SET_LINUX:
+        newval = oparg;
+        break;
+      case FUTEX_OP_ADD_LINUX:
+        newval = oldval + oparg;
+        break;
+      case FUTEX_OP_OR_LINUX:
+        newval = oldval | oparg;
+        break;
+      case FUTEX_OP_ANDN_LINUX:
+        newval = oldval & ~oparg;
+        break;
+      case FUTEX_OP_XOR_LINUX:
+        newval = oldval ^ oparg;
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    if (atomic_compare_exchange_weak_explicit(word, &expect, Little32(newval),
+                                              memory_order_acq_rel,
+                                              memory_order_relaxed)) {
+      break;
+    }
+  }
+  switch (cmp) {
+    case FUTEX_OP_CMP_EQ_LINUX:
+      return (i32)oldval == cmparg;
+    case FUTEX_OP_CMP_NE_LINUX:
+      return (i32)oldval != cmparg;
+    case FUTEX_OP_CMP_LT_LINUX:
+      return (i32)oldval < cmparg;
+    case FUTEX_OP_CMP_LE_LINUX:
+      return (i32)oldval <= cmparg;
+    case FUTEX_OP_CMP_GT_LINUX:
+      return (i32)oldval > cmparg;
+    case FUTEX_OP_CMP_GE_LINUX:
+      return (i32)oldval >= cmparg;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+static int FutexWakeOp(struct Machine *m, i64 uaddr, int op, u32 nwake,
+                       u32 nwake2, i64 uaddr2, u32 encoded) {
+  int n;
+  _Atomic(u32) *word;
+  struct FutexBucket *b, *b2;
+  if (((encoded >> 28) & 7) > FUTEX_OP_XOR_LINUX ||
+      ((encoded >> 24) & 15) > FUTEX_OP_CMP_GE_LINUX) {
+    return enosys();
+  }
+  if (!LookupAddress(m, uaddr)) return -1;
+  if (!(word = (_Atomic(u32) *)LookupWritableAddress(m, uaddr2))) return -1;
+  if (HasHostFutex()) {
+    return HostFutex(uaddr, op, nwake, (void *)(uintptr_t)nwake2, uaddr2,
+                     encoded);
+  }
+  b = GetFutexBucket(uaddr);
+  b2 = GetFutexBucket(uaddr2);
+  LockFutexPair(b, b2);
+  n = WakeFutexLocked(b, uaddr, nwake, FUTEX_BITSET_MATCH_ANY_LINUX);
+  if (DoFutexOp(word, encoded)) {
+    n += WakeFutexLocked(b2, uaddr2, nwake2, FUTEX_BITSET_MATCH_ANY_LINUX);
+  }
+  UnlockFutexPair(b, b2);
+  return n;
+}
+
+static int LoadFutexTimeout(struct Machine *m, i64 addr, bool absolute,
+                            bool realtime, struct timespec *deadline) {
+  struct timespec timeout, now;
+  const struct timespec_linux *gt;
+  if (!addr) {
+    *deadline = GetMaxTime();
+    return 0;
+  }
+  if (!(gt = (const struct timespec_linux *)SchlepR(m, addr, sizeof(*gt)))) {
+    return -1;
+  }
+  timeout.tv_sec = Read64(gt->sec);
+  timeout.tv_nsec = Read64(gt->nsec);
+  if (!(0 <= timeout.tv_sec && 0 <= timeout.tv_nsec &&
+        timeout.tv_nsec < 1000000000)) {
+    return einval();
+  }
+  if (!absolute) {
+    *deadline = AddTime(GetTime(), timeout);
+  } else if (realtime) {
+    *deadline = timeout;
+  } else {
+    // waits are timed using the realtime clock internally
+    now = GetMonotonic();
+    *deadline = GetTime();
+    if (CompareTime(timeout, now) > 0) {
+      *deadline = AddTime(*deadline, SubtractTime(timeout, now));
+    }
+  }
+  return 0;
+}
+
+static int SysFutexWait(struct Machine *m,  //
+                        i64 uaddr,          //
+                        i32 op,             //
+                        u32 expect,         //
+                        i64 timeout_addr,   //
+                        u32 bitset) {
+  int rc;
+  struct timespec deadline;
+  if (!bitset) return einval();
+  if (LoadFutexTimeout(m, timeout_addr,
+                       (op & ~(FUTEX_PRIVATE_FLAG_LINUX |
+                               FUTEX_CLOCK_REALTIME_LINUX)) ==
+                           FUTEX_WAIT_BITSET_LINUX,
+                       !!(op & FUTEX_CLOCK_REALTIME_LINUX), &deadline) == -1) {
+    return -1;
+  }
+  THR_LOGF("pid=%d tid=%d is waiting at address %#" PRIx64, m->system->pid,
+           m->tid, uaddr);
+  if ((rc = FutexWait(m, uaddr, op, expect, bitset, deadline))) {
+    THR_LOGF("futex wait returned %s", DescribeHostErrno(rc));
+    errno = rc;
+    rc = -1;
+  }
+  return rc;
+}
+
+int SysFutex(struct Machine *m,  //
+             i64 uaddr,          //
+             i32 op,             //
+             u32 val,            //
+             i64 timeout_addr,   //
+             i64 uaddr2,         //
+             u32 val3) {
+  int cmd;
+  if (uaddr & 3) return efault();
+  cmd = op & ~(FUTEX_PRIVATE_FLAG_LINUX | FUTEX_CLOCK_REALTIME_LINUX);
+  if ((op & FUTEX_CLOCK_REALTIME_LINUX) && cmd != FUTEX_WAIT_LINUX &&
+      cmd != FUTEX_WAIT_BITSET_LINUX) {
+    return enosys();
+  }
+  switch (cmd) {
+    case FUTEX_WAIT_LINUX:
+      return SysFutexWait(m, uaddr, op, val, timeout_addr,
+                          FUTEX_BITSET_MATCH_ANY_LINUX);
+    case FUTEX_WAIT_BITSET_LINUX:
+      return SysFutexWait(m, uaddr, op, val, timeout_addr, val3);
+    case FUTEX_WAKE_LINUX:
+      return FutexWake(uaddr, op, val, FUTEX_BITSET_MATCH_ANY_LINUX);
+    case FUTEX_WAKE_BITSET_LINUX:
+      if (!val3) return einval();
+      return FutexWake(uaddr, op, val, val3);
+    case FUTEX_REQUEUE_LINUX:
+    case FUTEX_CMP_REQUEUE_LINUX:
+      if (uaddr2 & 3) return efault();
+      return FutexRequeue(m, uaddr, op, val, timeout_addr, uaddr2,
+                          cmd == FUTEX_CMP_REQUEUE_LINUX, val3);
+    case FUTEX_WAKE_OP_LINUX:
+      if (uaddr2 & 3) return efault();
+      return FutexWakeOp(m, uaddr, op, val, timeout_addr, uaddr2, val3);
+    default:
+      LOGF("unsupported %s op %#x", "futex", op);
+      return einval();
+  }
+}
@@ -368,135 +368,6 @@ cleananddie:
   return -1;
 }
 
-int HostfsTraverse(struct VfsInfo **dir, const char **path,
-                   struct VfsInfo *root) {
-  char hostpath[VFS_PATH_MAX];
-  struct VfsInfo *next, *original;
-  struct HostfsInfo *nexthost;
-  const char *currentpath = *path, *nextpath;
-  struct stat st;
-  ssize_t hostpathlen, currentnamelen;
-  u32 currentdev;
-  int hostfd;
-  VFS_LOGF("HostfsTraverse(%s, \"%s\", %p)", (*dir)->name, *path, root);
-  if ((hostpathlen = HostfsGetOptimalDirFdName(*dir, "", &hostfd, hostpath)) ==
-      -1) {
-    return -1;
-  }
-  if (hostpathlen > 0 && hostpath[hostpathlen - 1] != '/') {
-    if (hostpathlen + 1 >= VFS_PATH_MAX) {
-      return enametoolong();
-    }
-    hostpath[hostpathlen] = '/';
-    ++hostpathlen;
-  }
-  VFS_LOGF("HostfsTraverse: hostpath=\"%s\", hostfd=%d", hostpath, hostfd);
-  original = *dir;
-  next = NULL;
-  nexthost = NULL;
-  currentdev = (*dir)->dev;
-  while (*currentpath) {
-    while (*currentpath == '/') {
-      ++currentpath;
-    }
-    nextpath = currentpath;
-    while (*nextpath && *nextpath != '/') {
-      ++nextpath;
-    }
-    if (nextpath == currentpath) {
-      break;
-    }
-    if (!strcmp(currentpath, ".")) {
-      currentpath = nextpath;
-      continue;
-    } else if (!strcmp(currentpath, "..")) {
-      currentpath = nextpath;
-      if (*dir == root || (*dir)->parent == NULL) {
-        continue;
-      }
-      unassert(!VfsAcquireInfo((*dir)->parent, &next));
-      unassert(!VfsFreeInfo(*dir));
-      *dir = next;
-      if (next->dev != currentdev) {
-        *path = currentpath;
-        return 0;
-      }
-      if (hostpathlen > 0) {
-        --hostpathlen;
-        while (hostpathlen > 0 && hostpath[hostpathlen - 1] != '/') {
-          --hostpathlen;
-        }
-        hostpath[hostpathlen] = '\0';
-      }
-      continue;
-    }
-    currentnamelen = nextpath - currentpath;
-    if (currentnamelen >= VFS_NAME_MAX) {
-      enametoolong();
-      goto cleananddie;
-    }
-    if (currentnamelen + hostpathlen + 1 >= VFS_PATH_MAX) {
-      enametoolong();
-      goto cleananddie;
-    }
-    memcpy(hostpath + hostpathlen, currentpath, currentnamelen);
-    hostpath[hostpathlen + currentnamelen] = '\0';
-    VFS_LOGF("HostfsTraverse: fstatat(%d, \"%s\", %p, AT_SYMLINK_NOFOLLOW)",
-             hostfd, hostpath, &st);
-    if (fstatat(hostfd, hostpath, &st, AT_SYMLINK_NOFOLLOW) == -1) {
-      if (original != *dir) {
-        *path = currentpath;
-        return 0;
-      } else {
-        return enoent();
-      }
-    }
-    hostpath[hostpathlen + currentnamelen] = '/';
-    hostpath[hostpathlen + currentnamelen + 1] = '\0';
-    hostpathlen += currentnamelen + 1;
-    if (HostfsCreateInfo(&nexthost) == -1) {
-      goto cleananddie;
-    }
-    nexthost->mode = st.st_mode;
-    nexthost->filefd = -1;
-    if (VfsCreateInfo(&next) == -1) {
-      unassert(!HostfsFreeInfo(nexthost));
-      goto cleananddie;
-    }
-    next->name = strndup(currentpath, currentnamelen);
-    if (next->name == NULL) {
-      unassert(!VfsFreeInfo(next));
-      unassert(!HostfsFreeInfo(nexthost));
-      enomem();
-      goto cleananddie;
-    }
-    next->namelen = currentnamelen;
-    next->data = nexthost;
-    unassert(!VfsAcquireDevice((*dir)->device, &next->device));
-    next->dev = currentdev;
-    next->ino =
-        HostfsHash(st.st_dev, (const char *)&st.st_ino, sizeof(st.st_ino));
-    next->mode = st.st_mode;
-    next->refcount = 1;
-    next->parent = *dir;
-    *dir = next;
-    currentpath = nextpath;
-    VFS_LOGF("HostfsTraverse: Changed current path to \"%s\"", currentpath);
-    if (!S_ISDIR(st.st_mode)) {
-      break;
-    }
-  }
-  *path = currentpath;
-  return 0;
-cleananddie:
-  while (original != *dir) {
-    unassert(!VfsAcquireInfo((*dir)->parent, &next));
-    unassert(!VfsFreeInfo(*dir));
-    *dir = next;
-  }
-  return -1;
-}
-
 ssize_t HostfsReadlink(struct VfsInfo *info, char **output) {
   struct HostfsInfo *hostinfo;
   char *buf;
@@ -1938,13 +1809,13 @@ cleananddie:
 
 struct VfsSystem g_hostfs = {.name = "hostfs",
                              .nodev = true,
+                             .dcache = true,
                              .ops = {
                                  .Init = HostfsInit,
                                  .Freeinfo = HostfsFreeInfo,
                                  .Freedevice = HostfsFreeDevice,
                                  .Readmountentry = HostfsReadmountentry,
                                  .Finddir = HostfsFinddir,
-                                 .Traverse = HostfsTraverse,
                                  .Readlink = HostfsReadlink,
                                  .Mkdir = HostfsMkdir,
                                  .Mkfifo = HostfsMkfifo,
@@ -16,17 +16,29 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <stdlib.h>
 #include <string.h>
 
 #include "blink/assert.h"
 #include "blink/bitscan.h"
 #include "blink/endian.h"
+#include "blink/jit.h"
 #include "blink/linux.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/stats.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
 #include "blink/x86.h"
 
+// the system icache maps each guest page of code to a slot holding
+// the decoded instructions found so far on that page. threads only
+// need a lock to insert. lookups are lockless, using the slot seqlock
+// to detect entries being evicted out from under them. the seqlock is
+// also the generation of the page, since modified code evicts it, so
+// hits don't need to be checked against the code bytes, except when
+// there's no jit, because then nothing watches for self-modifying code
+
 static bool IsOpcodeEqual(struct XedDecodedInst *xedd, u8 *a) {
   int n;
   u64 w;
@@ -43,18 +55,226 @@ static bool IsOpcodeEqual(struct XedDecodedInst *xedd, u8 *a) {
   }
 }
 
-static int ReadInstruction(struct Machine *m, u8 *p, unsigned n) {
+// returns true if writes to guest code are sure to evict its pages
+static bool IsICacheWatched(struct Machine *m) {
+  return !m->metal && !IsJitDisabled(&m->system->jit);
+}
+
+void InitICache(struct ICache *c) {
+  memset(c, 0, sizeof(*c));
+  unassert(!pthread_mutex_init(&c->lock, 0));
+}
+
+void DestroyICache(struct ICache *c) {
+  long i, j;
+  struct ICachePage *pages;
+  struct ICacheLine *line, *next;
+  if ((pages = atomic_load_explicit(&c->pages, memory_order_relaxed))) {
+    for (i = 0; i < kICacheSize; ++i) {
+      for (j = 0; j < ARRAYLEN(pages[i].lines); ++j) {
+        free(atomic_load_explicit(pages[i].lines + j, memory_order_relaxed));
+      }
+    }
+    free(pages);
+  }
+  for (line = c->free; line; line = next) {
+    next = line->next;
+    free(line);
+  }
+  unassert(!pthread_mutex_destroy(&c->lock));
+}
+
+static inline long GetICacheSlot(u64 pc) {
+  _Static_assert(IS2POW(kICacheSize), "");
+  return (pc >> 12) & (kICacheSize - 1);
+}
+
+static inline u64 GetICacheTag(u64 pc, int omode) {
+  return (pc & -4096) | 2048 | omode;
+}
+
+// drops all entries in slot, which must be done while holding lock.
+// its lines go on the free list, and may be reused right away, which
+// lookups still reading them will find out by checking the seqlock
+static void EvictICachePage(struct ICache *c, struct ICachePage *p, u64 tag) {
+  long i;
+  unsigned seq;
+  struct ICacheLine *line;
+  seq = atomic_load_explicit(&p->seq, memory_order_relaxed);
+  unassert(~seq & 1);
+  atomic_store_explicit(&p->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (i = 0; i < ARRAYLEN(p->lines); ++i) {
+    if ((line = atomic_load_explicit(p->lines + i, memory_order_relaxed))) {
+      atomic_store_explicit(p->lines + i, 0, memory_order_relaxed);
+      atomic_store_explicit(&line->valid, 0, memory_order_relaxed);
+      line->next = c->free;
+      c->free = line;
+    }
+  }
+  atomic_store_explicit(&p->tag, tag, memory_order_relaxed);
+  atomic_store_explicit(&p->seq, seq + 2, memory_order_release);
+}
+
+void InvalidateICachePage(struct ICache *c, i64 page) {
+  struct ICachePage *p, *pages;
+  if (!atomic_load_explicit(&c->pages, memory_order_acquire)) return;
+  LOCK(&c->lock);
+  pages = atomic_load_explicit(&c->pages, memory_order_relaxed);
+  p = pages + GetICacheSlot(page);
+  if ((atomic_load_explicit(&p->tag, memory_order_relaxed) & -4096) ==
+      (page & -4096)) {
+    EvictICachePage(c, p, 0);
+  }
+  UNLOCK(&c->lock);
+}
+
+void ResetICache(struct ICache *c) {
+  long i;
+  struct ICachePage *pages;
+  if (!atomic_load_explicit(&c->pages, memory_order_acquire)) return;
+  STATISTIC(++icache_resets);
+  LOCK(&c->lock);
+  pages = atomic_load_explicit(&c->pages, memory_order_relaxed);
+  for (i = 0; i < kICacheSize; ++i) {
+    if (atomic_load_explicit(&pages[i].tag, memory_order_relaxed)) {
+      EvictICachePage(c, pages + i, 0);
+    }
+  }
+  UNLOCK(&c->lock);
+}
+
+// returns true if slot still holds the generation of code at pc that
+// a thread's private copy of its instruction had been decoded from
+static bool IsICacheCurrent(struct ICache *c, u64 pc, int omode,
+                            unsigned seq) {
+  struct ICachePage *p, *pages;
+  if (seq & 1) return false;
+  if (!(pages = atomic_load_explicit(&c->pages, memory_order_acquire))) {
+    return false;
+  }
+  p = pages + GetICacheSlot(pc);
+  if (atomic_load_explicit(&p->seq, memory_order_acquire) != seq ||
+      atomic_load_explicit(&p->tag, memory_order_relaxed) !=
+          GetICacheTag(pc, omode)) {
+    return false;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&p->seq, memory_order_relaxed) == seq;
+}
+
+static bool LookupICache(struct ICache *c, u64 pc, int omode, u64 *out,
+                         unsigned *out_seq) {
+  unsigned seq;
+  struct ICacheLine *line;
+  struct ICachePage *p, *pages;
+  if (!(pages = atomic_load_explicit(&c->pages, memory_order_acquire))) {
+    return false;
+  }
+  p = pages + GetICacheSlot(pc);
+  seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+  if (seq & 1) return false;
+  if (atomic_load_explicit(&p->tag, memory_order_relaxed) !=
+      GetICacheTag(pc, omode)) {
+    return false;
+  }
+  if (!(line = atomic_load_explicit(p->lines + ((pc & 4095) >> 6),
+                                    memory_order_acquire))) {
+    return false;
+  }
+  if (!(atomic_load_explicit(&line->valid, memory_order_acquire) &
+        ((u64)1 << (pc & 63)))) {
+    return false;
+  }
+  memcpy(out, line->ops[pc & 63], kInstructionBytes);
+  atomic_thread_fence(memory_order_acquire);
+  *out_seq = seq;
+  return atomic_load_explicit(&p->seq, memory_order_relaxed) == seq;
+}
+
+// gets line from the free list, or allocates a new one until there's
+// kICacheLines of them, and then evicts other slots round robin until
+// one of them gives its lines back. must be called while holding lock
+static struct ICacheLine *GetICacheLine(struct ICache *c,
+                                        struct ICachePage *pages,
+                                        struct ICachePage *keep) {
+  long i;
+  struct ICachePage *p;
+  struct ICacheLine *line;
+  if (!c->free && c->lines < kICacheLines &&
+      (line = (struct ICacheLine *)calloc(1, sizeof(*line)))) {
+    ++c->lines;
+    return line;
+  }
+  for (i = 0; !c->free && i < kICacheSize; ++i) {
+    p = pages + c->hand;
+    c->hand = (c->hand + 1) & (kICacheSize - 1);
+    if (p != keep && atomic_load_explicit(&p->tag, memory_order_relaxed)) {
+      STATISTIC(++icache_evictions);
+      EvictICachePage(c, p, 0);
+    }
+  }
+  if ((line = c->free)) {
+    c->free = line->next;
+  }
+  return line;
+}
+
+// returns generation of slot the instruction went into, or odd if it
+// couldn't be inserted
+static unsigned InsertICache(struct ICache *c, u64 pc, int omode,
+                             const u64 *in) {
+  u64 tag, bit;
+  unsigned seq = 1;
+  struct ICacheLine *line;
+  struct ICachePage *p, *pages;
+  _Atomic(struct ICacheLine *) *linep;
+  LOCK(&c->lock);
+  if (!(pages = atomic_load_explicit(&c->pages, memory_order_relaxed))) {
+    if (!(pages = (struct ICachePage *)calloc(kICacheSize, sizeof(*pages)))) {
+      goto Finished;
+    }
+    atomic_store_explicit(&c->pages, pages, memory_order_release);
+  }
+  p = pages + GetICacheSlot(pc);
+  tag = GetICacheTag(pc, omode);
+  if (atomic_load_explicit(&p->tag, memory_order_relaxed) != tag) {
+    STATISTIC(++icache_evictions);
+    EvictICachePage(c, p, tag);
+  }
+  linep = p->lines + ((pc & 4095) >> 6);
+  if (!(line = atomic_load_explicit(linep, memory_order_relaxed))) {
+    if (!(line = GetICacheLine(c, pages, p))) {
+      goto Finished;
+    }
+    atomic_store_explicit(linep, line, memory_order_release);
+  }
+  bit = (u64)1 << (pc & 63);
+  if (!(atomic_load_explicit(&line->valid, memory_order_relaxed) & bit)) {
+    memcpy(line->ops[pc & 63], in, kInstructionBytes);
+    atomic_store_explicit(
+        &line->valid,
+        atomic_load_explicit(&line->valid, memory_order_relaxed) | bit,
+        memory_order_release);
+  }
+  seq = atomic_load_explicit(&p->seq, memory_order_relaxed);
+Finished:
+  UNLOCK(&c->lock);
+  return seq;
+}
+
+static int ReadInstruction(struct Machine *m, u64 *out, u8 *p, unsigned n) {
   struct XedDecodedInst xedd[1];
   STATISTIC(++instructions_decoded);
   if (!DecodeInstruction(xedd, p, n, m->mode.omode)) {
-    memcpy(m->xedd, xedd, kInstructionBytes);
+    memcpy(out, xedd, kInstructionBytes);
     return 0;
   } else {
     return kMachineDecodeError;
   }
 }
 
-static int LoadInstructionSlow(struct Machine *m, u64 ip) {
+static int LoadInstructionSlow(struct Machine *m, u64 *out, u64 ip) {
   u8 *addr;
   unsigned i;
   u8 copy[15], *toil;
@@ -64,43 +284,95 @@ static int LoadInstructionSlow(struct Machine *m, u64 ip) {
     if ((toil = LookupAddress2(m, ip + i, PAGE_XD, 0))) {
       memcpy(copy, addr, i);
       memcpy(copy + i, toil, 15 - i);
-      return ReadInstruction(m, copy, 15);
+      return ReadInstruction(m, out, copy, 15);
     } else {
-      return ReadInstruction(m, addr, i);
+      return ReadInstruction(m, out, addr, i);
     }
   } else {
     return kMachineSegmentationFault;
   }
 }
 
+static u8 *GetInstructionAddress(struct Machine *m, u64 pc) {
+  u8 *page;
+  if (pc - (pc & 4095) == m->opcache->codevirt && m->opcache->codehost) {
+    return m->opcache->codehost + (pc & 4095);
+  } else if ((page = LookupAddress2(m, pc - (pc & 4095), PAGE_XD, 0))) {
+    m->opcache->codevirt = pc - (pc & 4095);
+    m->opcache->codehost = page;
+    return page + (pc & 4095);
+  } else {
+    return 0;
+  }
+}
+
+// decodes instruction at pc into out by way of the system icache, and
+// sets seq to the generation of its slot, or odd if it isn't in there
+static int FetchInstruction(struct Machine *m, u64 pc, u8 *addr, u64 *out,
+                            unsigned *seq) {
+  int rc;
+  if (LookupICache(&m->system->icache, pc, m->mode.omode, out, seq) &&
+      (IsICacheWatched(m) ||
+       IsOpcodeEqual((struct XedDecodedInst *)out, addr))) {
+    STATISTIC(++instructions_cached);
+    return 0;
+  }
+  if (!(rc = ReadInstruction(m, out, addr, 15))) {
+    *seq = InsertICache(&m->system->icache, pc, m->mode.omode, out);
+  }
+  return rc;
+}
+
 int LoadInstruction2(struct Machine *m, u64 pc) {
-  unsigned key;
-  u8 *addr, *page;
-  if (atomic_load_explicit(&m->opcache->invalidated, memory_order_acquire)) {
+  int rc;
+  u8 *addr;
+  struct OpCache *c = m->opcache;
+  if (atomic_load_explicit(&c->invalidated, memory_order_acquire)) {
     ResetInstructionCache(m);
-    atomic_store_explicit(&m->opcache->invalidated, false,
-                          memory_order_relaxed);
+    atomic_store_explicit(&c->invalidated, false, memory_order_relaxed);
   }
-  key = pc & (ARRAYLEN(m->opcache->icache) - 1);
-  m->xedd = (struct XedDecodedInst *)m->opcache->icache[key];
+  m->xedd = (struct XedDecodedInst *)c->icache;
   if ((pc & 4095) + 15 <= 4096) {
-    if (pc - (pc & 4095) == m->opcache->codevirt && m->opcache->codehost) {
-      addr = m->opcache->codehost + (pc & 4095);
-    } else if ((page = LookupAddress2(m, pc - (pc & 4095), PAGE_XD, 0))) {
-      m->opcache->codevirt = pc - (pc & 4095);
-      m->opcache->codehost = page;
-      addr = page + (pc & 4095);
-    } else {
+    if (!(addr = GetInstructionAddress(m, pc))) {
       return kMachineSegmentationFault;
     }
-    if (IsOpcodeEqual(m->xedd, addr)) {
+    if (IsICacheWatched(m)
+            ? pc == c->icachepc && IsICacheCurrent(&m->system->icache, pc,
+                                                   m->mode.omode, c->icacheseq)
+            : IsOpcodeEqual(m->xedd, addr)) {
       STATISTIC(++instructions_cached);
       return 0;
+    }
+    if (!(rc = FetchInstruction(m, pc, addr, c->icache, &c->icacheseq))) {
+      c->icachepc = pc;
     } else {
-      return ReadInstruction(m, addr, 15);
+      c->icachepc = -1;
+    }
+    return rc;
+  } else {
+    c->icachepc = -1;
+    return LoadInstructionSlow(m, c->icache, pc);
+  }
+}
+
+/**
+ * Decodes instruction at `pc` into `xedd`, for looking ahead.
+ *
+ * This is like LoadInstruction2() except it leaves `m->xedd` alone,
+ * which still holds the instruction that's being executed.
+ */
+int SpeculateInstruction(struct Machine *m, u64 pc,
+                         struct XedDecodedInst *xedd) {
+  u8 *addr;
+  unsigned seq;
+  u64 *out = (u64 *)xedd;
+  if ((pc & 4095) + 15 <= 4096) {
+    if (!(addr = GetInstructionAddress(m, pc))) {
+      return kMachineSegmentationFault;
     }
+    return FetchInstruction(m, pc, addr, out, &seq);
   } else {
-    return LoadInstructionSlow(m, pc);
+    return LoadInstructionSlow(m, out, pc);
   }
 }
 
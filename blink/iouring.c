@@ -0,0 +1,1459 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bitscan.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/flag.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/signal.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#ifdef HAVE_EPOLL_PWAIT1
+#include <sys/epoll.h>
+#endif
+
+// io_uring is emulated, since guest buffers need to be translated and
+// pinned by blink, and guest descriptors may not exist on the host. An
+// sqe is performed by io_uring_enter() using the normal system call
+// implementations. Operations that would block are queued until poll()
+// says their descriptor is ready, and they're retried whenever a guest
+// thread enters the ring, or polls it. File i/o that can block without
+// a notion of readiness, e.g. fsync() or reading a regular file, is
+// handed to a bounded pool of worker threads instead, which use bounce
+// buffers, so they never touch guest memory that could be unmapped;
+// the guest thread that reaps their results copies them out. A ring's
+// descriptor is pollable through a host epoll that watches its queued
+// operations and completions. The rings live in an anonymous shared
+// file, which the guest maps through the normal mmap() path, with the
+// queue and completion rings in a single mapping, i.e. the feature
+// IORING_FEAT_SINGLE_MMAP, followed by the submission queue entries.
+
+#define IOURING_CONTAINER(e) DLL_CONTAINER(struct IoUring, elem, e)
+#define IOURING_OP_CONTAINER(e) DLL_CONTAINER(struct IoUringOp, elem, e)
+#define IOURING_WORK_CONTAINER(e) DLL_CONTAINER(struct IoUringOp, work, e)
+
+#define kSqOffHead    0
+#define kSqOffTail    4
+#define kSqOffMask    8
+#define kSqOffEntries 12
+#define kSqOffFlags   16
+#define kSqOffDropped 20
+#define kSqOffArray   64
+
+#define kCqOffHead     0
+#define kCqOffTail     4
+#define kCqOffMask     8
+#define kCqOffEntries  12
+#define kCqOffOverflow 16
+#define kCqOffFlags    20
+#define kCqOffCqes     64
+
+struct IoUringOp {
+  struct io_uring_sqe_linux sqe;
+  struct IoUringOp *after;   // linked predecessor that must finish first
+  struct IoUring *ring;      // ring the operation was submitted to
+  struct timespec deadline;  // for IORING_OP_TIMEOUT
+  u64 target;                // completion count ending IORING_OP_TIMEOUT
+  int waitfd;                // host fd to poll, or -1 if unpollable
+  int armfd;                 // dup of waitfd watched by ring's epoll
+  int hostfd;                // dup of host fd used by a worker thread
+  i32 res;                   // result, once done
+  short waitevents;          // host poll() events to wait for
+  bool done;                 //
+  bool queued;               // handed to a worker thread
+  _Atomic(bool) finished;    // set by the worker when queued op is done
+  u8 *buf;                   // bounce buffer of worker
+  size_t size;               // bytes in bounce buffer
+  struct iovec_linux *iov;   // guest buffers, for copying out reads
+  u32 iovlen;                //
+  struct Dll elem;           // in ring's ops list
+  struct Dll work;           // in worker queue
+};
+
+struct IoUring {
+  int fildes;            // guest descriptor of ring
+  int refs;              // guarded by g_iourings.lock
+  bool closed;           // guarded by g_iourings.lock
+  bool busy;             // making progress, which may poll other rings
+  bool ready;            // readyfds holds a byte
+  u32 sqentries;         //
+  u32 cqentries;         //
+  u32 cqoff;             // offset of completion ring in map
+  u64 posted;            // completions posted so far
+  u8 *map;               // sq and cq rings
+  size_t mapsize;        //
+  u8 *sqes;              // submission queue entries
+  size_t sqessize;       //
+  size_t sqesoff;        // offset of sqes in backing file
+  int wakefds[2];        // pipe written by workers when they finish
+  int readyfds[2];       // pipe holding a byte while cq isn't empty
+  int pollfd;            // host epoll signaling the ring, or -1
+  struct Dll *ops;       // queued operations, in submission order
+  pthread_mutex_t_ lock;  // serializes submission and completion
+  struct Dll elem;
+};
+
+static struct IoUrings {
+  pthread_mutex_t_ lock;
+  struct Dll *list;
+} g_iourings = {PTHREAD_MUTEX_INITIALIZER_};
+
+#ifdef HAVE_THREADS
+// threads performing operations which may block for a while, without
+// a notion of readiness. they're spawned as needed, up to a limit, and
+// linger once spawned, waiting for more work
+static struct IoUringWorkers {
+  pthread_once_t_ once;
+  pthread_mutex_t_ lock;
+  pthread_cond_t_ cond;
+  int threads;          // workers spawned
+  int idle;             // workers waiting for an operation
+  struct Dll *queue;    // operations waiting for a worker
+  struct Dll *running;  // operations being performed by workers
+} g_ioworkers = {
+    PTHREAD_ONCE_INIT_,
+    PTHREAD_MUTEX_INITIALIZER_,
+    PTHREAD_COND_INITIALIZER,
+};
+#endif
+
+static u32 RoundUpTwoPow(u32 x) {
+  return x > 1 ? (u32)2 << bsr(x - 1) : 1;
+}
+
+static struct IoUring *GetIoUringUnlocked(int fildes) {
+  struct Dll *e;
+  struct IoUring *r;
+  for (e = dll_first(g_iourings.list); e; e = dll_next(g_iourings.list, e)) {
+    r = IOURING_CONTAINER(e);
+    if (r->fildes == fildes) return r;
+  }
+  return 0;
+}
+
+static struct IoUring *AcquireIoUring(int fildes) {
+  struct IoUring *r;
+  LOCK(&g_iourings.lock);
+  if ((r = GetIoUringUnlocked(fildes))) ++r->refs;
+  UNLOCK(&g_iourings.lock);
+  return r;
+}
+
+static void CloseRingFds(struct IoUring *r) {
+  if (r->pollfd != -1) close(r->pollfd);
+  if (r->readyfds[0] != -1) close(r->readyfds[0]);
+  if (r->readyfds[1] != -1) close(r->readyfds[1]);
+  if (r->wakefds[0] != -1) close(r->wakefds[0]);
+  if (r->wakefds[1] != -1) close(r->wakefds[1]);
+}
+
+static void DisarmOp(struct IoUring *r, struct IoUringOp *op) {
+  if (op->armfd == -1) return;
+#ifdef HAVE_EPOLL_PWAIT1
+  // the registration is keyed by the open file, which the guest may
+  // still hold, so closing our duplicate wouldn't be enough to end it
+  epoll_ctl(r->pollfd, EPOLL_CTL_DEL, op->armfd, 0);
+#endif
+  close(op->armfd);
+  op->armfd = -1;
+}
+
+static void FreeOp(struct IoUring *r, struct IoUringOp *op) {
+  DisarmOp(r, op);
+  if (op->hostfd != -1) close(op->hostfd);
+  free(op->iov);
+  free(op->buf);
+  free(op);
+}
+
+static void FreeIoUring(struct IoUring *r) {
+  struct Dll *e;
+  while ((e = dll_first(r->ops))) {
+    dll_remove(&r->ops, e);
+    FreeOp(r, IOURING_OP_CONTAINER(e));
+  }
+  munmap(r->sqes, r->sqessize);
+  munmap(r->map, r->mapsize);
+  CloseRingFds(r);
+  unassert(!pthread_mutex_destroy(&r->lock));
+  free(r);
+}
+
+static void ReleaseIoUring(struct IoUring *r) {
+  bool gone;
+  LOCK(&g_iourings.lock);
+  gone = !--r->refs && r->closed;
+  UNLOCK(&g_iourings.lock);
+  if (gone) FreeIoUring(r);
+}
+
+static u32 LoadRing(struct IoUring *r, u32 off) {
+  u32 x = Read32(r->map + off);
+  atomic_thread_fence(memory_order_acquire);
+  return x;
+}
+
+static void StoreRing(struct IoUring *r, u32 off, u32 x) {
+  atomic_thread_fence(memory_order_release);
+  Write32(r->map + off, x);
+}
+
+static u32 CountCompletions(struct IoUring *r) {
+  return LoadRing(r, r->cqoff + kCqOffTail) -
+         LoadRing(r, r->cqoff + kCqOffHead);
+}
+
+// Creates a nonblocking pipe, outside the range of guest descriptors.
+static int CreatePipe(int fds[2]) {
+  int i;
+  if (pipe(fds) == -1) return -1;
+  for (i = 0; i < 2; ++i) {
+    fds[i] = MoveBlinkFd(fds[i], true);
+  }
+  if (fds[0] == -1 || fds[1] == -1) {
+    if (fds[0] != -1) close(fds[0]);
+    if (fds[1] != -1) close(fds[1]);
+    fds[0] = fds[1] = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static void RingPipe(int fd) {
+  int olderr = errno;
+  (void)!write(fd, "", 1);
+  errno = olderr;
+}
+
+static void DrainPipe(int fd) {
+  char buf[64];
+  int olderr = errno;
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+  errno = olderr;
+}
+
+// Makes the ring's epoll readable iff completions are available. Since
+// the guest consumes them without telling us, it may be stale until a
+// thread next makes progress on the ring, which epoll_wait() ensures.
+static void SyncReady(struct IoUring *r) {
+  bool ready;
+  if (r->pollfd == -1) return;
+  ready = CountCompletions(r) > 0;
+  if (ready && !r->ready) {
+    RingPipe(r->readyfds[1]);
+  } else if (!ready && r->ready) {
+    DrainPipe(r->readyfds[0]);
+  }
+  r->ready = ready;
+}
+
+// Locks `r` unless it's in use, e.g. it's making progress on an op
+// that polls the ring itself, in which case it's best left alone.
+static bool TryLockIoUring(struct IoUring *r) {
+#ifdef HAVE_THREADS
+  if (pthread_mutex_trylock(&r->lock)) return false;
+#endif
+  if (r->busy) {
+    UNLOCK(&r->lock);
+    return false;
+  }
+  return true;
+}
+
+static void PostCompletion(struct IoUring *r, u64 user_data, i32 res) {
+  u8 *cqe;
+  u32 head, tail;
+  head = LoadRing(r, r->cqoff + kCqOffHead);
+  tail = Read32(r->map + r->cqoff + kCqOffTail);
+  ++r->posted;
+  if (tail - head >= r->cqentries) {
+    LOGF("io_uring completion queue overflowed");
+    Write32(r->map + r->cqoff + kCqOffOverflow,
+            Read32(r->map + r->cqoff + kCqOffOverflow) + 1);
+    return;
+  }
+  cqe = r->map + r->cqoff + kCqOffCqes +
+        (tail & (r->cqentries - 1)) * sizeof(struct io_uring_cqe_linux);
+  Write64(cqe, user_data);
+  Write32(cqe + 8, res);
+  Write32(cqe + 12, 0);
+  StoreRing(r, r->cqoff + kCqOffTail, tail + 1);
+}
+
+// Completes `op` and settles any operations that were linked to it.
+static void CompleteOp(struct IoUring *r, struct IoUringOp *op, i32 res) {
+  struct Dll *e;
+  struct IoUringOp *succ;
+  op->done = true;
+  op->res = res;
+  PostCompletion(r, Read64(op->sqe.user_data), res);
+  for (e = dll_first(r->ops); e; e = dll_next(r->ops, e)) {
+    succ = IOURING_OP_CONTAINER(e);
+    if (succ->after != op || succ->done) continue;
+    succ->after = 0;
+    if (res < 0 && !(op->sqe.flags & IOSQE_IO_HARDLINK_LINUX)) {
+      CompleteOp(r, succ, -ECANCELED_LINUX);
+    }
+  }
+}
+
+// Cancels the first pending operation that matches, returning zero, or
+// a negative errno if there isn't one, or a worker already started it.
+static i32 CancelOp(struct IoUring *r, u64 user_data, int opcode) {
+  struct Dll *e;
+  struct IoUringOp *op;
+  for (e = dll_first(r->ops); e; e = dll_next(r->ops, e)) {
+    op = IOURING_OP_CONTAINER(e);
+    if (!op->done && Read64(op->sqe.user_data) == user_data &&
+        (opcode == -1 || op->sqe.opcode == opcode)) {
+      if (op->queued) return -EALREADY_LINUX;
+      CompleteOp(r, op, -ECANCELED_LINUX);
+      return 0;
+    }
+  }
+  return -ENOENT_LINUX;
+}
+
+static short XlatPollEvents(int ev) {
+  return (((ev & POLLIN_LINUX) ? POLLIN : 0) |    //
+          ((ev & POLLOUT_LINUX) ? POLLOUT : 0) |  //
+          ((ev & POLLPRI_LINUX) ? POLLPRI : 0));
+}
+
+static int UnxlatPollEvents(short ev) {
+  return (((ev & POLLIN) ? POLLIN_LINUX : 0) |    //
+          ((ev & POLLOUT) ? POLLOUT_LINUX : 0) |  //
+          ((ev & POLLPRI) ? POLLPRI_LINUX : 0) |  //
+          ((ev & POLLERR) ? POLLERR_LINUX : 0) |  //
+          ((ev & POLLHUP) ? POLLHUP_LINUX : 0) |  //
+          ((ev & POLLNVAL) ? POLLNVAL_LINUX : 0));
+}
+
+// Returns host revents if `fildes` is ready, or zero if `op` must wait.
+static short PollOp(struct Machine *m, struct IoUringOp *op, int fildes,
+                    short events) {
+  int rc;
+  struct Fd *fd;
+  struct pollfd pfd;
+  const struct FdCb *cb;
+  int (*poll_impl)(struct pollfd *, nfds_t, int);
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes))) {
+    unassert(cb = fd->cb);
+    unassert(poll_impl = fd->cb->poll);
+  } else {
+    cb = 0;
+    poll_impl = 0;
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return POLLNVAL;
+  pfd.fd = fildes;
+  pfd.events = events;
+  pfd.revents = 0;
+  do {
+    rc = poll_impl(&pfd, 1, 0);
+  } while (rc == -1 && errno == EINTR);
+  if (rc == 1 && pfd.revents) return pfd.revents;
+  if (rc) return POLLERR;
+  op->waitfd = GetPollableFd(cb, fildes);
+  op->waitevents = events;
+  return 0;
+}
+
+static i32 Result(i64 rc) {
+  if (rc == -1) return -XlatErrno(errno);
+  return rc;
+}
+
+static bool IsReadOp(const struct IoUringOp *op) {
+  return op->sqe.opcode == IORING_OP_READ_LINUX ||
+         op->sqe.opcode == IORING_OP_READV_LINUX;
+}
+
+#ifdef HAVE_THREADS
+
+static void PerformWork(struct IoUringOp *op) {
+  ssize_t rc;
+  i64 off = Read64(op->sqe.off);
+  switch (op->sqe.opcode) {
+    case IORING_OP_READ_LINUX:
+    case IORING_OP_READV_LINUX:
+      if (off == -1) {
+        rc = read(op->hostfd, op->buf, op->size);
+      } else {
+        rc = pread(op->hostfd, op->buf, op->size, off);
+      }
+      break;
+    case IORING_OP_WRITE_LINUX:
+    case IORING_OP_WRITEV_LINUX:
+      if (off == -1) {
+        rc = write(op->hostfd, op->buf, op->size);
+      } else {
+        rc = pwrite(op->hostfd, op->buf, op->size, off);
+      }
+      break;
+    case IORING_OP_FSYNC_LINUX:
+#if !defined(__APPLE__) && !defined(__HAIKU__)
+      if (Read32(op->sqe.op_flags) & IORING_FSYNC_DATASYNC_LINUX) {
+        rc = fdatasync(op->hostfd);
+        break;
+      }
+#endif
+      rc = fsync(op->hostfd);  // see SysFdatasync()
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  op->res = Result(rc);
+}
+
+static void *IoUringWorker(void *arg) {
+  struct Dll *e;
+  struct IoUring *r;
+  struct IoUringOp *op;
+  LOCK(&g_ioworkers.lock);
+  for (;;) {
+    if (!(e = dll_first(g_ioworkers.queue))) {
+      ++g_ioworkers.idle;
+      unassert(!pthread_cond_wait(&g_ioworkers.cond, &g_ioworkers.lock));
+      --g_ioworkers.idle;
+      continue;
+    }
+    dll_remove(&g_ioworkers.queue, e);
+    dll_make_last(&g_ioworkers.running, e);
+    UNLOCK(&g_ioworkers.lock);
+    op = IOURING_WORK_CONTAINER(e);
+    r = op->ring;
+    PerformWork(op);
+    // once it's finished, the guest thread reaping it may free `op` at
+    // any moment, but our reference on the ring keeps its pipe open
+    LOCK(&g_ioworkers.lock);
+    dll_remove(&g_ioworkers.running, e);
+    atomic_store_explicit(&op->finished, true, memory_order_release);
+    UNLOCK(&g_ioworkers.lock);
+    RingPipe(r->wakefds[1]);
+    ReleaseIoUring(r);
+    LOCK(&g_ioworkers.lock);
+  }
+  return 0;
+}
+
+static void LockIoUringWorkers(void) {
+  LOCK(&g_iourings.lock);
+  LOCK(&g_ioworkers.lock);
+}
+
+static void UnlockIoUringWorkers(void) {
+  UNLOCK(&g_ioworkers.lock);
+  UNLOCK(&g_iourings.lock);
+}
+
+// the child of fork() has none of the workers, so operations that had
+// been handed to them fail. their references on rings are dropped, but
+// a ring that's closed isn't freed, since its lock may be inconsistent
+static void CancelWork(struct Dll **list) {
+  struct Dll *e;
+  struct IoUringOp *op;
+  while ((e = dll_first(*list))) {
+    dll_remove(list, e);
+    op = IOURING_WORK_CONTAINER(e);
+    op->res = -ECANCELED_LINUX;
+    atomic_store_explicit(&op->finished, true, memory_order_relaxed);
+    --op->ring->refs;
+  }
+}
+
+static void IoUringWorkersAfterForkChild(void) {
+  CancelWork(&g_ioworkers.queue);
+  CancelWork(&g_ioworkers.running);
+  g_ioworkers.threads = 0;
+  g_ioworkers.idle = 0;
+  unassert(!pthread_cond_init(&g_ioworkers.cond, 0));
+  UnlockIoUringWorkers();
+}
+
+static void InitIoUringWorkers(void) {
+  unassert(!pthread_atfork(LockIoUringWorkers,    //
+                           UnlockIoUringWorkers,  //
+                           IoUringWorkersAfterForkChild));
+}
+
+// Hands `op` to a worker, spawning one if they're all busy and there's
+// room for more. Returns false if there aren't any workers at all.
+static bool QueueWork(struct IoUringOp *op) {
+  bool ok;
+  pthread_t th;
+  pthread_attr_t attr;
+  sigset_t block, oldmask;
+  unassert(!pthread_once_(&g_ioworkers.once, InitIoUringWorkers));
+  LOCK(&g_ioworkers.lock);
+  if (!g_ioworkers.idle && g_ioworkers.threads < kIoUringWorkers) {
+    // workers block all signals, so they're never picked to handle one
+    unassert(!sigfillset(&block));
+    unassert(!pthread_sigmask(SIG_BLOCK, &block, &oldmask));
+    unassert(!pthread_attr_init(&attr));
+    unassert(!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+    if (!pthread_create(&th, &attr, IoUringWorker, 0)) {
+      ++g_ioworkers.threads;
+    }
+    unassert(!pthread_attr_destroy(&attr));
+    unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+  }
+  if ((ok = g_ioworkers.threads > 0)) {
+    dll_init(&op->work);
+    dll_make_last(&g_ioworkers.queue, &op->work);
+    unassert(!pthread_cond_signal(&g_ioworkers.cond));
+  }
+  UNLOCK(&g_ioworkers.lock);
+  return ok;
+}
+
+// Copies the guest buffers of a read or write into a bounce buffer, so
+// a worker can perform it without touching guest memory.
+static bool PrepareBuffers(struct Machine *m, struct IoUringOp *op) {
+  u32 i;
+  size_t size;
+  u32 len = Read32(op->sqe.len);
+  i64 addr = Read64(op->sqe.addr);
+  const struct iovec_linux *giov;
+  if (op->sqe.opcode == IORING_OP_READ_LINUX ||
+      op->sqe.opcode == IORING_OP_WRITE_LINUX) {
+    if (!(op->iov = (struct iovec_linux *)malloc(sizeof(*op->iov)))) {
+      return false;
+    }
+    Write64(op->iov[0].base, addr);
+    Write64(op->iov[0].len, len);
+    op->iovlen = 1;
+  } else {
+    if (len > IOV_MAX_LINUX) return false;
+    if (!(giov = (const struct iovec_linux *)SchlepR(m, addr,
+                                                     len * sizeof(*giov))) ||
+        !(op->iov = (struct iovec_linux *)malloc(len * sizeof(*op->iov)))) {
+      return false;
+    }
+    memcpy(op->iov, giov, len * sizeof(*giov));
+    op->iovlen = len;
+  }
+  for (size = i = 0; i < op->iovlen; ++i) {
+    // linux won't transfer more than this at once either
+    if ((size += Read64(op->iov[i].len)) > 0x7ffff000) return false;
+  }
+  // page aligned, so files opened with O_DIRECT can still be used
+  if (size && posix_memalign((void **)&op->buf, 4096, size)) {
+    op->buf = 0;
+    return false;
+  }
+  op->size = size;
+  if (IsReadOp(op)) return true;
+  for (size = i = 0; i < op->iovlen; size += Read64(op->iov[i++].len)) {
+    if (CopyFromUserRead(m, op->buf + size, Read64(op->iov[i].base),
+                         Read64(op->iov[i].len)) == -1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Hands `op` to a worker, if it's file i/o which could block a while,
+// without a notion of readiness, e.g. fsync() or reading regular files.
+// Returns false if it should be performed synchronously instead, which
+// is also how any of the errors it could raise end up being reported.
+static bool OffloadOp(struct Machine *m, struct IoUring *r,
+                      struct IoUringOp *op) {
+  bool ok;
+  struct Fd *fd;
+  struct stat st;
+  int hostfd, fildes;
+  const struct FdCb *cb = 0;
+  switch (op->sqe.opcode) {
+    case IORING_OP_READ_LINUX:
+    case IORING_OP_READV_LINUX:
+    case IORING_OP_WRITE_LINUX:
+    case IORING_OP_WRITEV_LINUX:
+      if (Read32(op->sqe.op_flags) || (i64)Read64(op->sqe.off) < -1) {
+        return false;
+      }
+      break;
+    case IORING_OP_FSYNC_LINUX:
+      if (Read32(op->sqe.op_flags) & ~IORING_FSYNC_DATASYNC_LINUX) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  fildes = Read32(op->sqe.fd);
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes))) cb = fd->cb;
+  UNLOCK(&m->system->fds.lock);
+  if (cb != &kFdCbHost || (hostfd = VfsHostFd(fildes)) == -1 ||
+      fstat(hostfd, &st) == -1) {
+    return false;
+  }
+  if (op->sqe.opcode != IORING_OP_FSYNC_LINUX &&
+      ((!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) ||
+       !PrepareBuffers(m, op))) {
+    ok = false;
+  } else if ((op->hostfd = fcntl(hostfd, F_DUPFD_CLOEXEC, kMinBlinkFd)) ==
+             -1) {
+    ok = false;
+  } else {
+    LOCK(&g_iourings.lock);
+    ++r->refs;
+    UNLOCK(&g_iourings.lock);
+    op->queued = true;
+    if (!(ok = QueueWork(op))) {
+      op->queued = false;
+      ReleaseIoUring(r);
+    }
+  }
+  if (!ok) {
+    if (op->hostfd != -1) close(op->hostfd);
+    op->hostfd = -1;
+    free(op->iov);
+    op->iov = 0;
+    free(op->buf);
+    op->buf = 0;
+  }
+  return ok;
+}
+
+#else
+
+static bool OffloadOp(struct Machine *m, struct IoUring *r,
+                      struct IoUringOp *op) {
+  return false;
+}
+
+#endif /* HAVE_THREADS */
+
+// Copies out what a worker read, and completes the operation.
+static void FinishOp(struct Machine *m, struct IoUring *r,
+                     struct IoUringOp *op) {
+  u32 i;
+  u64 n;
+  i32 res;
+  size_t off;
+  if ((res = op->res) > 0 && IsReadOp(op)) {
+    for (off = i = 0; i < op->iovlen && off < res; ++i, off += n) {
+      n = MIN(Read64(op->iov[i].len), res - off);
+      if (CopyToUserWrite(m, Read64(op->iov[i].base), op->buf + off, n) ==
+          -1) {
+        res = -EFAULT_LINUX;
+        break;
+      }
+    }
+  }
+  close(op->hostfd);
+  op->hostfd = -1;
+  op->queued = false;
+  CompleteOp(r, op, res);
+}
+
+// Asks the ring's epoll to watch the descriptor `op` is waiting on.
+static void ArmOp(struct IoUring *r, struct IoUringOp *op) {
+#ifdef HAVE_EPOLL_PWAIT1
+  struct epoll_event ev;
+  if (r->pollfd == -1 || op->waitfd == -1 || op->armfd != -1) return;
+  // our duplicate has its own registration, so it can't collide with
+  // one for another op waiting on the same descriptor
+  if ((op->armfd = fcntl(op->waitfd, F_DUPFD_CLOEXEC, kMinBlinkFd)) == -1) {
+    return;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (((op->waitevents & POLLIN) ? EPOLLIN : 0) |
+               ((op->waitevents & POLLOUT) ? EPOLLOUT : 0) |
+               ((op->waitevents & POLLPRI) ? EPOLLPRI : 0));
+  if (epoll_ctl(r->pollfd, EPOLL_CTL_ADD, op->armfd, &ev) == -1) {
+    close(op->armfd);
+    op->armfd = -1;
+  }
+#endif
+}
+
+// Performs `op`, returning false if it needs to wait.
+static bool PerformOp(struct Machine *m, struct IoUring *r,
+                      struct IoUringOp *op) {
+  i64 res;
+  short revents;
+  const struct io_uring_sqe_linux *sqe = &op->sqe;
+  i32 fildes = Read32(sqe->fd);
+  i64 off = Read64(sqe->off);
+  i64 addr = Read64(sqe->addr);
+  u32 len = Read32(sqe->len);
+  i32 flags = Read32(sqe->op_flags);
+  op->waitfd = -1;
+  op->waitevents = 0;
+  if (OffloadOp(m, r, op)) return false;
+  switch (sqe->opcode) {
+    case IORING_OP_NOP_LINUX:
+      res = 0;
+      break;
+    case IORING_OP_READV_LINUX:
+      if (!PollOp(m, op, fildes, POLLIN)) return false;
+      res = Result(SysPreadv2(m, fildes, addr, len, off, flags));
+      break;
+    case IORING_OP_WRITEV_LINUX:
+      if (!PollOp(m, op, fildes, POLLOUT)) return false;
+      res = Result(SysPwritev2(m, fildes, addr, len, off, flags));
+      break;
+    case IORING_OP_READ_LINUX:
+      if (!PollOp(m, op, fildes, POLLIN)) return false;
+      if (off == -1) {
+        res = Result(SysRead(m, fildes, addr, len));
+      } else {
+        res = Result(SysPread(m, fildes, addr, len, off));
+      }
+      break;
+    case IORING_OP_WRITE_LINUX:
+      if (!PollOp(m, op, fildes, POLLOUT)) return false;
+      if (off == -1) {
+        res = Result(SysWrite(m, fildes, addr, len));
+      } else {
+        res = Result(SysPwrite(m, fildes, addr, len, off));
+      }
+      break;
+    case IORING_OP_FSYNC_LINUX:
+      if (flags & ~IORING_FSYNC_DATASYNC_LINUX) {
+        res = -EINVAL_LINUX;
+      } else if (flags & IORING_FSYNC_DATASYNC_LINUX) {
+        res = Result(SysFdatasync(m, fildes));
+      } else {
+        res = Result(SysFsync(m, fildes));
+      }
+      break;
+    case IORING_OP_POLL_ADD_LINUX:
+      if (len & IORING_POLL_ADD_MULTI_LINUX) {
+        res = -EINVAL_LINUX;
+        break;
+      }
+      if (!(revents = PollOp(m, op, fildes, XlatPollEvents(flags)))) {
+        return false;
+      }
+      if (revents & POLLNVAL) {
+        res = -EBADF_LINUX;
+        break;
+      }
+      res = UnxlatPollEvents(revents) &
+            (flags | POLLERR_LINUX | POLLHUP_LINUX | POLLNVAL_LINUX);
+      break;
+    case IORING_OP_POLL_REMOVE_LINUX:
+      res = CancelOp(r, addr, IORING_OP_POLL_ADD_LINUX);
+      break;
+    case IORING_OP_TIMEOUT_LINUX:
+      if (op->target && r->posted >= op->target) {
+        res = 0;
+      } else if (CompareTime(GetTime(), op->deadline) >= 0) {
+        res = -ETIME_LINUX;
+      } else {
+        return false;
+      }
+      break;
+    case IORING_OP_TIMEOUT_REMOVE_LINUX:
+      res = CancelOp(r, addr, IORING_OP_TIMEOUT_LINUX);
+      break;
+    case IORING_OP_ASYNC_CANCEL_LINUX:
+      res = CancelOp(r, addr, -1);
+      break;
+    case IORING_OP_ACCEPT_LINUX:
+      if (!PollOp(m, op, fildes, POLLIN)) return false;
+      res = Result(SysAccept4(m, fildes, addr, off, flags));
+      break;
+    case IORING_OP_CLOSE_LINUX:
+      if (fildes == r->fildes) {
+        res = -EBADF_LINUX;
+      } else {
+        res = Result(SysClose(m, fildes));
+      }
+      break;
+    case IORING_OP_SEND_LINUX:
+      if (!PollOp(m, op, fildes, POLLOUT)) return false;
+      res = Result(SysSendto(m, fildes, addr, len, flags, 0, 0));
+      break;
+    case IORING_OP_RECV_LINUX:
+      if (!PollOp(m, op, fildes, POLLIN)) return false;
+      res = Result(SysRecvfrom(m, fildes, addr, len, flags, 0, 0));
+      break;
+    default:
+      LOGF("io_uring opcode %d not supported yet", sqe->opcode);
+      res = -EINVAL_LINUX;
+      break;
+  }
+  CompleteOp(r, op, res);
+  return true;
+}
+
+// Performs queued operations until all remaining ones must wait.
+static void ProgressIoUring(struct Machine *m, struct IoUring *r) {
+  bool progress;
+  struct Dll *e, *e2;
+  struct IoUringOp *op;
+  r->busy = true;
+  // workers ring the pipe after they finish, so this can't lose a wakeup
+  DrainPipe(r->wakefds[0]);
+  do {
+    progress = false;
+    for (e = dll_first(r->ops); e; e = dll_next(r->ops, e)) {
+      op = IOURING_OP_CONTAINER(e);
+      if (op->done || op->after) continue;
+      if (op->queued) {
+        if (atomic_load_explicit(&op->finished, memory_order_acquire)) {
+          FinishOp(m, r, op);
+          progress = true;
+        }
+      } else if (PerformOp(m, r, op)) {
+        progress = true;
+      } else {
+        ArmOp(r, op);
+      }
+    }
+    for (e = dll_first(r->ops); e; e = e2) {
+      e2 = dll_next(r->ops, e);
+      op = IOURING_OP_CONTAINER(e);
+      if (op->done) {
+        dll_remove(&r->ops, e);
+        FreeOp(r, op);
+      }
+    }
+  } while (progress && r->ops);
+  SyncReady(r);
+  r->busy = false;
+}
+
+static int PrepareTimeout(struct Machine *m, struct IoUring *r,
+                          struct IoUringOp *op) {
+  struct timespec ts;
+  const struct timespec_linux *gt;
+  if (Read32(op->sqe.len) != 1 ||
+      (Read32(op->sqe.op_flags) & ~IORING_TIMEOUT_ABS_LINUX)) {
+    return -EINVAL_LINUX;
+  }
+  if (!(gt = (const struct timespec_linux *)SchlepR(
+            m, Read64(op->sqe.addr), sizeof(*gt)))) {
+    return -EFAULT_LINUX;
+  }
+  ts.tv_sec = Read64(gt->sec);
+  ts.tv_nsec = Read64(gt->nsec);
+  if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+    return -EINVAL_LINUX;
+  }
+  if (Read32(op->sqe.op_flags) & IORING_TIMEOUT_ABS_LINUX) {
+    // absolute timeouts are expressed using CLOCK_MONOTONIC
+    if (CompareTime(ts, GetMonotonic()) > 0) {
+      op->deadline = AddTime(GetTime(), SubtractTime(ts, GetMonotonic()));
+    } else {
+      op->deadline = GetZeroTime();
+    }
+  } else {
+    op->deadline = AddTime(GetTime(), ts);
+  }
+  if (Read64(op->sqe.off)) {
+    op->target = r->posted + Read64(op->sqe.off);
+  }
+  return 0;
+}
+
+// Consumes up to `want` entries from the submission queue.
+static u32 SubmitIoUring(struct Machine *m, struct IoUring *r, u32 want) {
+  i32 err;
+  u32 head, tail, index, count;
+  struct IoUringOp *op, *link;
+  head = Read32(r->map + kSqOffHead);
+  tail = LoadRing(r, kSqOffTail);
+  for (link = 0, count = 0; count < want && head != tail; ++head) {
+    index = Read32(r->map + kSqOffArray + (head & (r->sqentries - 1)) * 4);
+    if (index >= r->sqentries) {
+      Write32(r->map + kSqOffDropped, Read32(r->map + kSqOffDropped) + 1);
+      continue;
+    }
+    if (!(op = (struct IoUringOp *)calloc(1, sizeof(*op)))) break;
+    op->ring = r;
+    op->armfd = -1;
+    op->hostfd = -1;
+    memcpy(&op->sqe, r->sqes + index * sizeof(op->sqe), sizeof(op->sqe));
+    dll_init(&op->elem);
+    dll_make_last(&r->ops, &op->elem);
+    if ((op->after = link) && link->done) {
+      op->after = 0;
+      if (link->res < 0 && !(link->sqe.flags & IOSQE_IO_HARDLINK_LINUX)) {
+        CompleteOp(r, op, -ECANCELED_LINUX);
+      }
+    }
+    link = (op->sqe.flags & (IOSQE_IO_LINK_LINUX | IOSQE_IO_HARDLINK_LINUX))
+               ? op
+               : 0;
+    ++count;
+    if (op->done) {
+      err = 0;
+    } else if (op->sqe.flags & (IOSQE_FIXED_FILE_LINUX | IOSQE_BUFFER_SELECT_LINUX)) {
+      LOGF("io_uring sqe flags %#x not supported yet", op->sqe.flags);
+      err = -EINVAL_LINUX;
+    } else if (op->sqe.opcode == IORING_OP_TIMEOUT_LINUX) {
+      err = PrepareTimeout(m, r, op);
+    } else {
+      err = 0;
+    }
+    if (err) {
+      op->after = 0;
+      CompleteOp(r, op, err);
+    }
+  }
+  StoreRing(r, kSqOffHead, head);
+  ProgressIoUring(m, r);
+  return count;
+}
+
+// Waits until an operation queued on `r` might be able to make progress.
+static bool WaitIoUring(struct Machine *m, struct IoUring *r,
+                        struct timespec deadline) {
+  int n;
+  bool killed;
+  bool pollable;
+  struct Dll *e;
+  struct pollfd *wfds;
+  struct IoUringOp *op;
+  LOCK(&r->lock);
+  for (n = 0, e = dll_first(r->ops); e; e = dll_next(r->ops, e)) ++n;
+  if (!(wfds = (struct pollfd *)malloc((n + 2) * sizeof(*wfds)))) {
+    UNLOCK(&r->lock);
+    return false;
+  }
+  for (pollable = true, n = 0, e = dll_first(r->ops); e;
+       e = dll_next(r->ops, e)) {
+    op = IOURING_OP_CONTAINER(e);
+    if (op->after) continue;
+    if (op->sqe.opcode == IORING_OP_TIMEOUT_LINUX) {
+      if (CompareTime(op->deadline, deadline) < 0) {
+        deadline = op->deadline;
+      }
+    } else if (op->waitevents) {
+      if (op->waitfd == -1) pollable = false;
+      wfds[n].fd = op->waitfd;
+      wfds[n].events = op->waitevents;
+      wfds[n].revents = 0;
+      ++n;
+    }
+  }
+  wfds[n].fd = r->wakefds[0];
+  wfds[n].events = POLLIN;
+  wfds[n].revents = 0;
+  ++n;
+  UNLOCK(&r->lock);
+  killed = WaitForFds(m, wfds, n, pollable, deadline);
+  free(wfds);
+  return killed;
+}
+
+static int IoUringClose(int fildes) {
+  struct IoUring *r;
+  LOCK(&g_iourings.lock);
+  if ((r = GetIoUringUnlocked(fildes))) {
+    dll_remove(&g_iourings.list, &r->elem);
+    r->closed = true;
+    if (r->refs) r = 0;
+  }
+  UNLOCK(&g_iourings.lock);
+  if (r) FreeIoUring(r);
+  return VfsClose(fildes);
+}
+
+static ssize_t IoUringReadv(int fildes, const struct iovec *iov, int iovcnt) {
+  return einval();
+}
+
+static ssize_t IoUringWritev(int fildes, const struct iovec *iov,
+                             int iovcnt) {
+  return einval();
+}
+
+// The ring descriptor is readable whenever completions are available.
+// Since no kernel threads work on the ring, polling it makes whatever
+// progress it can, and GetPollableFd() says what to wait on otherwise.
+static int IoUringPoll(struct pollfd *fds, nfds_t nfds, int ms) {
+  nfds_t i;
+  int ready;
+  struct IoUring *r;
+  for (ready = i = 0; i < nfds; ++i) {
+    if ((r = AcquireIoUring(fds[i].fd))) {
+      if (g_machine && TryLockIoUring(r)) {
+        ProgressIoUring(g_machine, r);
+        UNLOCK(&r->lock);
+      }
+      fds[i].revents = POLLOUT | (CountCompletions(r) ? POLLIN : 0);
+      fds[i].revents &= fds[i].events;
+      ReleaseIoUring(r);
+    } else {
+      fds[i].revents = POLLNVAL;
+    }
+    if (fds[i].revents) ++ready;
+  }
+  return ready;
+}
+
+static int IoUringTcgetattr(int fildes, struct termios *tio) {
+  return enotty();
+}
+
+static int IoUringTcsetattr(int fildes, int how, const struct termios *tio) {
+  return enotty();
+}
+
+static int IoUringTcgetwinsize(int fildes, struct winsize *ws) {
+  return enotty();
+}
+
+static int IoUringTcsetwinsize(int fildes, const struct winsize *ws) {
+  return enotty();
+}
+
+const struct FdCb kFdCbIoUring = {
+    .close = IoUringClose,
+    .readv = IoUringReadv,
+    .writev = IoUringWritev,
+    .poll = IoUringPoll,
+    .tcgetattr = IoUringTcgetattr,
+    .tcsetattr = IoUringTcsetattr,
+    .tcgetwinsize = IoUringTcgetwinsize,
+    .tcsetwinsize = IoUringTcsetwinsize,
+};
+
+static int CreateRingFile(size_t size) {
+  int fd;
+  if ((fd = CreateMemfd("io_uring", false, true)) == -1) return -1;
+  if (ftruncate(fd, size) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Creates the host descriptors threads wait on for the ring. A worker
+// writes to a pipe once it's finished, and where there's epoll, one is
+// created that also watches the descriptors of operations that aren't
+// ready, and a pipe that's readable while the completion queue isn't
+// empty, so the guest can wait on the ring through poll() and epoll.
+static int CreateRingFds(struct IoUring *r) {
+#ifdef HAVE_EPOLL_PWAIT1
+  struct epoll_event ev;
+#endif
+  if (CreatePipe(r->wakefds) == -1) return -1;
+#ifdef HAVE_EPOLL_PWAIT1
+  if (CreatePipe(r->readyfds) == -1 ||
+      (r->pollfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+      (r->pollfd = MoveBlinkFd(r->pollfd, false)) == -1) {
+    return -1;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  if (epoll_ctl(r->pollfd, EPOLL_CTL_ADD, r->wakefds[0], &ev) == -1 ||
+      epoll_ctl(r->pollfd, EPOLL_CTL_ADD, r->readyfds[0], &ev) == -1) {
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+int SysIoUringSetup(struct Machine *m, u32 entries, i64 paramsaddr) {
+  u32 flags;
+  struct Fd *fd;
+  struct IoUring *r;
+  int lim, hostfd, fildes;
+  struct io_uring_params_linux p;
+  if (CopyFromUserRead(m, &p, paramsaddr, sizeof(p)) == -1) return -1;
+  flags = Read32(p.flags);
+  if (flags & ~(IORING_SETUP_CQSIZE_LINUX | IORING_SETUP_CLAMP_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "io_uring_setup", flags);
+    return einval();
+  }
+  if (!entries) return einval();
+  if (entries > kMaxUringSize) {
+    if (!(flags & IORING_SETUP_CLAMP_LINUX)) return einval();
+    entries = kMaxUringSize;
+  }
+  entries = RoundUpTwoPow(entries);
+  if (flags & IORING_SETUP_CQSIZE_LINUX) {
+    if (!Read32(p.cq_entries)) return einval();
+    if (Read32(p.cq_entries) > kMaxUringSize * 2) {
+      if (!(flags & IORING_SETUP_CLAMP_LINUX)) return einval();
+      Write32(p.cq_entries, kMaxUringSize * 2);
+    }
+    Write32(p.cq_entries, RoundUpTwoPow(Read32(p.cq_entries)));
+    if (Read32(p.cq_entries) < entries) return einval();
+  } else {
+    Write32(p.cq_entries, entries * 2);
+  }
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  if (!(r = (struct IoUring *)calloc(1, sizeof(*r)))) return enomem();
+  r->sqentries = entries;
+  r->cqentries = Read32(p.cq_entries);
+  r->cqoff = ROUNDUP(kSqOffArray + r->sqentries * 4, 64);
+  r->mapsize = r->cqoff + kCqOffCqes +
+               r->cqentries * sizeof(struct io_uring_cqe_linux);
+  r->sqessize = r->sqentries * sizeof(struct io_uring_sqe_linux);
+  r->sqesoff = ROUNDUP(r->mapsize, FLAG_pagesize);
+  r->wakefds[0] = r->wakefds[1] = -1;
+  r->readyfds[0] = r->readyfds[1] = -1;
+  r->pollfd = -1;
+  if ((hostfd = CreateRingFile(r->sqesoff + r->sqessize)) == -1) {
+    free(r);
+    return -1;
+  }
+  if ((r->map = (u8 *)mmap(0, r->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           hostfd, 0)) == MAP_FAILED) {
+    close(hostfd);
+    free(r);
+    return -1;
+  }
+  if ((r->sqes = (u8 *)mmap(0, r->sqessize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, hostfd, r->sqesoff)) ==
+      MAP_FAILED) {
+    munmap(r->map, r->mapsize);
+    close(hostfd);
+    free(r);
+    return -1;
+  }
+  Write32(r->map + kSqOffMask, r->sqentries - 1);
+  Write32(r->map + kSqOffEntries, r->sqentries);
+  Write32(r->map + r->cqoff + kCqOffMask, r->cqentries - 1);
+  Write32(r->map + r->cqoff + kCqOffEntries, r->cqentries);
+  unassert(!pthread_mutex_init(&r->lock, 0));
+  dll_init(&r->elem);
+  if (CreateRingFds(r) == -1) {
+    FreeIoUring(r);
+    close(hostfd);
+    return -1;
+  }
+  if ((fildes = VfsWrapFd(hostfd)) == -1) {
+    FreeIoUring(r);
+    close(hostfd);
+    return -1;
+  }
+  if (fildes >= lim) {
+    FreeIoUring(r);
+    VfsClose(fildes);
+    return emfile();
+  }
+  r->fildes = fildes;
+  Write32(p.sq_entries, r->sqentries);
+  Write32(p.features,
+          IORING_FEAT_SINGLE_MMAP_LINUX | IORING_FEAT_SUBMIT_STABLE_LINUX |
+              IORING_FEAT_RW_CUR_POS_LINUX | IORING_FEAT_EXT_ARG_LINUX);
+  memset(&p.sq_off, 0, sizeof(p.sq_off));
+  Write32(p.sq_off.head, kSqOffHead);
+  Write32(p.sq_off.tail, kSqOffTail);
+  Write32(p.sq_off.ring_mask, kSqOffMask);
+  Write32(p.sq_off.ring_entries, kSqOffEntries);
+  Write32(p.sq_off.flags, kSqOffFlags);
+  Write32(p.sq_off.dropped, kSqOffDropped);
+  Write32(p.sq_off.array, kSqOffArray);
+  memset(&p.cq_off, 0, sizeof(p.cq_off));
+  Write32(p.cq_off.head, r->cqoff + kCqOffHead);
+  Write32(p.cq_off.tail, r->cqoff + kCqOffTail);
+  Write32(p.cq_off.ring_mask, r->cqoff + kCqOffMask);
+  Write32(p.cq_off.ring_entries, r->cqoff + kCqOffEntries);
+  Write32(p.cq_off.overflow, r->cqoff + kCqOffOverflow);
+  Write32(p.cq_off.cqes, r->cqoff + kCqOffCqes);
+  Write32(p.cq_off.flags, r->cqoff + kCqOffFlags);
+  if (CopyToUserWrite(m, paramsaddr, &p, sizeof(p)) == -1) {
+    FreeIoUring(r);
+    VfsClose(fildes);
+    return -1;
+  }
+  LOCK(&g_iourings.lock);
+  dll_make_last(&g_iourings.list, &r->elem);
+  UNLOCK(&g_iourings.lock);
+  LOCK(&m->system->fds.lock);
+  unassert(fd = AddFd(&m->system->fds, fildes, O_RDWR | O_CLOEXEC));
+  fd->cb = &kFdCbIoUring;
+  fd->path = strdup("anon_inode:[io_uring]");
+  UNLOCK(&m->system->fds.lock);
+  return fildes;
+}
+
+static bool IsIoUring(struct Machine *m, i32 fildes) {
+  bool res;
+  struct Fd *fd;
+  LOCK(&m->system->fds.lock);
+  res = (fd = GetFd(&m->system->fds, fildes)) && fd->cb == &kFdCbIoUring;
+  UNLOCK(&m->system->fds.lock);
+  return res;
+}
+
+// Translates the offset of an mmap() of ring `fildes`, which is one of
+// the magic offsets linux defines, into an offset of its backing file,
+// where the rings come first, followed by the submission queue entries.
+// The offset is returned as is if the descriptor isn't a ring.
+i64 GetIoUringMapOffset(struct Machine *m, i32 fildes, i64 offset) {
+  i64 res;
+  struct IoUring *r;
+  if (!IsIoUring(m, fildes)) return offset;
+  if (!(r = AcquireIoUring(fildes))) return ebadf();
+  switch (offset) {
+    case IORING_OFF_SQ_RING_LINUX:
+    case IORING_OFF_CQ_RING_LINUX:
+      res = 0;
+      break;
+    case IORING_OFF_SQES_LINUX:
+      res = r->sqesoff;
+      break;
+    default:
+      res = einval();
+      break;
+  }
+  ReleaseIoUring(r);
+  return res;
+}
+
+// Returns host descriptor that's readable when ring `fildes` may be able
+// to make progress, or -1 if it isn't a ring, or there's no such thing.
+int GetIoUringPollFd(i32 fildes) {
+  int fd;
+  struct IoUring *r;
+  if (!(r = AcquireIoUring(fildes))) return -1;
+  fd = r->pollfd;
+  ReleaseIoUring(r);
+  return fd;
+}
+
+// Makes what progress it can on every ring, since a guest waiting with
+// epoll could be watching any of them through their host descriptors.
+void ProgressIoUrings(struct Machine *m) {
+  int i, n;
+  struct Dll *e;
+  struct IoUring **rings = 0;
+  LOCK(&g_iourings.lock);
+  for (n = 0, e = dll_first(g_iourings.list); e;
+       e = dll_next(g_iourings.list, e)) {
+    ++n;
+  }
+  if (n && (rings = (struct IoUring **)malloc(n * sizeof(*rings)))) {
+    for (i = 0, e = dll_first(g_iourings.list); e;
+         e = dll_next(g_iourings.list, e)) {
+      rings[i] = IOURING_CONTAINER(e);
+      ++rings[i++]->refs;
+    }
+  } else {
+    n = 0;
+  }
+  UNLOCK(&g_iourings.lock);
+  for (i = 0; i < n; ++i) {
+    if (TryLockIoUring(rings[i])) {
+      ProgressIoUring(m, rings[i]);
+      UNLOCK(&rings[i]->lock);
+    }
+    ReleaseIoUring(rings[i]);
+  }
+  free(rings);
+}
+
+static struct IoUring *GetIoUring(struct Machine *m, i32 fildes) {
+  struct Fd *fd;
+  struct IoUring *r;
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes)) && fd->cb != &kFdCbIoUring) {
+    fd = 0;
+    eopnotsupp();
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return 0;
+  if (!(r = AcquireIoUring(fildes))) ebadf();
+  return r;
+}
+
+static int LoadEnterArg(struct Machine *m, u32 flags, i64 arg, u64 argsz,
+                        i64 *sigmaskaddr, struct timespec *deadline) {
+  struct timespec ts;
+  const struct timespec_linux *gt;
+  const struct io_uring_getevents_arg_linux *ga;
+  *deadline = GetMaxTime();
+  *sigmaskaddr = 0;
+  if (!(flags & IORING_ENTER_EXT_ARG_LINUX)) {
+    if (arg && argsz != 8) return einval();
+    *sigmaskaddr = arg;
+    return 0;
+  }
+  if (!arg) return 0;
+  if (argsz != sizeof(*ga)) return einval();
+  if (!(ga = (const struct io_uring_getevents_arg_linux *)SchlepR(
+            m, arg, sizeof(*ga)))) {
+    return -1;
+  }
+  if ((*sigmaskaddr = Read64(ga->sigmask)) && Read32(ga->sigmask_sz) != 8) {
+    return einval();
+  }
+  if (Read64(ga->ts)) {
+    if (!(gt = (const struct timespec_linux *)SchlepR(m, Read64(ga->ts),
+                                                      sizeof(*gt)))) {
+      return -1;
+    }
+    ts.tv_sec = Read64(gt->sec);
+    ts.tv_nsec = Read64(gt->nsec);
+    if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+      return einval();
+    }
+    *deadline = AddTime(GetTime(), ts);
+  }
+  return 0;
+}
+
+int SysIoUringEnter(struct Machine *m, i32 fildes, u32 to_submit,
+                    u32 min_complete, u32 flags, i64 arg, u64 argsz) {
+  int rc;
+  u32 submitted;
+  u64 oldmask = 0;
+  i64 sigmaskaddr;
+  struct IoUring *r;
+  struct timespec deadline;
+  const struct sigset_linux *sm;
+  if (flags &
+      ~(IORING_ENTER_GETEVENTS_LINUX | IORING_ENTER_SQ_WAKEUP_LINUX |
+        IORING_ENTER_SQ_WAIT_LINUX | IORING_ENTER_EXT_ARG_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "io_uring_enter", flags);
+    return einval();
+  }
+  if (LoadEnterArg(m, flags, arg, argsz, &sigmaskaddr, &deadline) == -1) {
+    return -1;
+  }
+  if (!(r = GetIoUring(m, fildes))) return -1;
+  LOCK(&r->lock);
+  submitted = SubmitIoUring(m, r, to_submit);
+  UNLOCK(&r->lock);
+  rc = 0;
+  if (flags & IORING_ENTER_GETEVENTS_LINUX) {
+    if (sigmaskaddr) {
+      if ((sm = (const struct sigset_linux *)SchlepR(m, sigmaskaddr,
+                                                     sizeof(*sm)))) {
+        oldmask = m->sigmask;
+        m->sigmask = Read64(sm->sigmask);
+        SIG_LOGF("sigmask push %" PRIx64, m->sigmask);
+      } else {
+        sigmaskaddr = 0;
+        rc = -1;
+      }
+    }
+    while (!rc && CountCompletions(r) < min_complete) {
+      if (CheckInterrupt(m, false)) {
+        rc = eintr();
+      } else if (CompareTime(GetTime(), deadline) >= 0) {
+#ifdef ETIME
+        errno = ETIME;
+#else
+        errno = ETIMEDOUT;
+#endif
+        rc = -1;
+      } else if (WaitIoUring(m, r, deadline)) {
+        rc = eintr();
+      } else {
+        LOCK(&r->lock);
+        ProgressIoUring(m, r);
+        UNLOCK(&r->lock);
+      }
+    }
+    if (sigmaskaddr) {
+      m->sigmask = oldmask;
+      SIG_LOGF("sigmask pop %" PRIx64, m->sigmask);
+    }
+  }
+  ReleaseIoUring(r);
+  if (submitted) return submitted;
+  return rc;
+}
+
+static int ProbeIoUring(struct Machine *m, i64 addr, u32 nr_args) {
+  int i, n;
+  u8 *buf;
+  size_t size;
+  struct io_uring_probe_linux *probe;
+  struct io_uring_probe_op_linux *ops;
+  if (nr_args > 256) nr_args = 256;
+  size = sizeof(*probe) + nr_args * sizeof(*ops);
+  if (!(buf = (u8 *)AddToFreeList(m, calloc(1, size)))) return enomem();
+  probe = (struct io_uring_probe_linux *)buf;
+  ops = (struct io_uring_probe_op_linux *)(buf + sizeof(*probe));
+  n = MIN(nr_args, IORING_OP_LAST_LINUX);
+  probe->last_op = IORING_OP_LAST_LINUX - 1;
+  probe->ops_len = n;
+  for (i = 0; i < n; ++i) {
+    ops[i].op = i;
+    switch (i) {
+      case IORING_OP_NOP_LINUX:
+      case IORING_OP_READV_LINUX:
+      case IORING_OP_WRITEV_LINUX:
+      case IORING_OP_FSYNC_LINUX:
+      case IORING_OP_POLL_ADD_LINUX:
+      case IORING_OP_POLL_REMOVE_LINUX:
+      case IORING_OP_TIMEOUT_LINUX:
+      case IORING_OP_TIMEOUT_REMOVE_LINUX:
+      case IORING_OP_ACCEPT_LINUX:
+      case IORING_OP_ASYNC_CANCEL_LINUX:
+      case IORING_OP_CLOSE_LINUX:
+      case IORING_OP_READ_LINUX:
+      case IORING_OP_WRITE_LINUX:
+      case IORING_OP_SEND_LINUX:
+      case IORING_OP_RECV_LINUX:
+        Write16(ops[i].flags, IO_URING_OP_SUPPORTED_LINUX);
+        break;
+      default:
+        break;
+    }
+  }
+  return CopyToUserWrite(m, addr, buf, size);
+}
+
+int SysIoUringRegister(struct Machine *m, i32 fildes, u32 opcode, i64 arg,
+                       u32 nr_args) {
+  int rc;
+  struct IoUring *r;
+  if (!(r = GetIoUring(m, fildes))) return -1;
+  switch (opcode) {
+    case IORING_REGISTER_PROBE_LINUX:
+      rc = ProbeIoUring(m, arg, nr_args);
+      break;
+    default:
+      LOGF("io_uring_register opcode %u not supported yet", opcode);
+      rc = einval();
+      break;
+  }
+  ReleaseIoUring(r);
+  return rc;
+}
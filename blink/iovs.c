@@ -103,6 +103,7 @@ int AppendIovsReal(struct Machine *m, struct Iovs *ib, i64 addr, u64 size,
     mask |= PAGE_RW;
     need |= PAGE_RW;
   }
+  if (PinPageRange(m, addr, size) == -1) return -1;
   while (size && ib->i < GetIovMax()) {
     if (!(real = LookupAddress2(m, addr, mask, need))) return efault();
     have = 4096 - (addr & 4095);
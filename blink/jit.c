@@ -1009,7 +1009,7 @@ static unsigned RehashJitHooks(struct Jit *jit) {
 
 // @assume jit->lock
 static bool SetJitHookUnlocked(struct Jit *jit, u64 virt, int cas,
-                               intptr_t funcaddr) {
+                               intptr_t funcaddr, u64 lines) {
   uintptr_t key;
   int func, oldfunc;
   struct JitPage *jp;
@@ -1068,7 +1068,7 @@ static bool SetJitHookUnlocked(struct Jit *jit, u64 virt, int cas,
     STATISTIC(jit_hash_elements = MAX(jit_hash_elements, jit->hooks.i));
   }
   if (func && (jp = GetOrCreateJitPage(jit, virt))) {
-    jp->bitset |= (u64)1 << ((virt & 4095) >> 6);
+    jp->bitset |= (u64)1 << ((virt & 4095) >> 6) | lines;
   }
   kgen = BeginUpdate(&jit->keygen);
   atomic_store_explicit(virts + spot, virt, memory_order_release);
@@ -1077,10 +1077,11 @@ static bool SetJitHookUnlocked(struct Jit *jit, u64 virt, int cas,
   return true;
 }
 
-static bool SetJitHook(struct Jit *jit, u64 virt, int cas, intptr_t funcaddr) {
+static bool SetJitHook(struct Jit *jit, u64 virt, int cas, intptr_t funcaddr,
+                       u64 lines) {
   bool res;
   LockJit(jit);
-  res = SetJitHookUnlocked(jit, virt, cas, funcaddr);
+  res = SetJitHookUnlocked(jit, virt, cas, funcaddr, lines);
   UnlockJit(jit);
   return res;
 }
@@ -1224,6 +1225,39 @@ int ResetJitPage(struct Jit *jit, i64 virt) {
   return res;
 }
 
+/**
+ * Clears JIT paths installed to memory page if their code was modified.
+ *
+ * This is a finer grained version of ResetJitPage() for self-modifying
+ * code. Paths are only discarded if one of the modified 64-byte lines
+ * holds instructions that were translated. Otherwise, paths other threads
+ * are currently building are told to start over, since they could have
+ * decoded bytes which haven't been recorded in the page bitset yet.
+ *
+ * @param virt is virtual address of 4096-byte page (needn't be aligned)
+ * @param dirty is bitset of 64-byte lines in page that've been modified
+ * @return 1 if page was reset, 0 if it wasn't, or -1 w/ errno
+ */
+int ResetJitPageLines(struct Jit *jit, i64 virt, u64 dirty) {
+  int res;
+  unsigned gen;
+  struct JitPage *jp;
+  if (IsJitDisabled(jit)) return einval();
+  LockJit(jit);
+  if ((jp = GetJitPage(jit, virt & -4096)) && (jp->bitset & dirty)) {
+    ResetJitPageUnlocked(jit, virt);
+    res = 1;
+  } else {
+    if (jit->threaded) {
+      gen = BeginUpdate(&jit->pagegen);
+      EndUpdate(&jit->pagegen, gen);
+    }
+    res = 0;
+  }
+  UnlockJit(jit);
+  return res;
+}
+
 // @assume jit->lock
 static void ForceJitBlocksToRetire(struct Jit *jit) {
   int i;
@@ -1349,11 +1383,13 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
   }
   if (jb) {
     jb->virt = opt_virt;
+    jb->lines = 0;
     unassert(!(jb->start & (kJitAlign - 1)));
     unassert(jb->start == jb->index);
     jb->pagegen = atomic_load_explicit(&jit->pagegen, memory_order_acquire);
     if (jb->virt && jit->staging) {
-      unassert(SetJitHook(jit, jb->virt, 0, DecodeJitFunc(jit->staging)));
+      unassert(
+          SetJitHook(jit, jb->virt, 0, DecodeJitFunc(jit->staging), 0));
     } else {
       JIT_LOGF("marking jit block %p as protected due to manual mode", jb);
       jb->isprotected = true;
@@ -1445,11 +1481,11 @@ static void FixupJitJumps(struct JitBlock *jb, struct Dll *list,
 }
 
 static bool UpdateJitHook(struct Jit *jit, struct JitBlock *jb, u64 virt,
-                          uintptr_t funcaddr) {
+                          uintptr_t funcaddr, u64 lines) {
   struct Dll *jumps;
   unassert(funcaddr);
   jumps = GetJitJumps(jit, jb, virt);
-  if (SetJitHook(jit, virt, jit->staging, funcaddr)) {
+  if (SetJitHook(jit, virt, jit->staging, funcaddr, lines)) {
     FixupJitJumps(jb, jumps, funcaddr);
     return true;
   } else {
@@ -1460,7 +1496,7 @@ static bool UpdateJitHook(struct Jit *jit, struct JitBlock *jb, u64 virt,
 
 static void AbandonJitHook(struct Jit *jit, u64 virt) {
   if (virt && jit->staging) {
-    SetJitHook(jit, virt, 0, 0);
+    SetJitHook(jit, virt, 0, 0, 0);
   }
 }
 
@@ -1505,7 +1541,8 @@ int CommitJit_(struct Jit *jit, struct JitBlock *jb) {
       unassert(js->index >= jb->committed);
       if (js->index <= blockoff) {
         if (!ShallNotPass(js->pagegen, &jit->pagegen)) {
-          UpdateJitHook(jit, jb, js->virt, (uintptr_t)jb->addr + js->start);
+          UpdateJitHook(jit, jb, js->virt, (uintptr_t)jb->addr + js->start,
+                        js->lines);
         } else {
           AbandonJitHook(jit, js->virt);
         }
@@ -1661,7 +1698,7 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
         // operating system permits us to use rwx memory
         addr = jb->addr + jb->start;
         sys_icache_invalidate(addr, jb->index - jb->start);
-        if (!UpdateJitHook(jit, jb, jb->virt, (uintptr_t)addr)) {
+        if (!UpdateJitHook(jit, jb, jb->virt, (uintptr_t)addr, jb->lines)) {
           // we lost race with another thread creating path at same addr
           return AbandonJit(jit, jb);
         }
@@ -1672,6 +1709,7 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
         js->start = jb->start;
         js->index = jb->index;
         js->pagegen = jb->pagegen;
+        js->lines = jb->lines;
         dll_make_last(&jb->staged, &js->elem);
       }
     } else {
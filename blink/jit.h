@@ -6,6 +6,7 @@
 #include "blink/atomic.h"
 #include "blink/builtin.h"
 #include "blink/dll.h"
+#include "blink/macros.h"
 #include "blink/thread.h"
 #include "blink/tunables.h"
 #include "blink/types.h"
@@ -158,6 +159,7 @@ struct JitStage {
   long start;
   long index;
   u64 virt;
+  u64 lines;
   unsigned pagegen;
   struct Dll elem;
 };
@@ -176,13 +178,14 @@ struct JitFreeds {
 
 struct JitPage {
   i64 page;
-  u64 bitset;
+  u64 bitset;  // 64-byte lines of page holding translated code
   struct Dll elem;
 };
 
 struct JitBlock {
   u8 *addr;
   i64 virt;
+  u64 lines;
   long start;
   long index;
   long committed;
@@ -251,6 +254,7 @@ bool RecordJitJump(struct JitBlock *, u64, int);
 bool RecordJitEdge(struct Jit *, i64, i64);
 uintptr_t GetJitHook(struct Jit *, u64);
 int ResetJitPage(struct Jit *, i64);
+int ResetJitPageLines(struct Jit *, i64, u64);
 
 int CommitJit_(struct Jit *, struct JitBlock *);
 void ReinsertJitBlock_(struct Jit *, struct JitBlock *);
@@ -274,6 +278,22 @@ static inline uintptr_t GetJitPc(const struct JitBlock *jb) {
   return (uintptr_t)jb->addr + jb->index;
 }
 
+/**
+ * Records that JIT block contains translation of guest code.
+ *
+ * The recorded lines are used to determine if writes to a code page
+ * should cause its JIT paths to be discarded.
+ *
+ * @param virt is address of guest instruction
+ * @param size is byte length of guest instruction
+ */
+static inline void AddJitLines(struct JitBlock *jb, i64 virt, long size) {
+  unsigned a, b;
+  a = (virt & 4095) >> 6;
+  b = MIN(((virt & 4095) + size - 1) >> 6, 63);
+  jb->lines |= (((u64)2 << b) - 1) & -((u64)1 << a);
+}
+
 /**
  * Returns true if DisableJit() was called or AcquireJit() had failed.
  */
@@ -44,6 +44,7 @@
 #include "blink/random.h"
 #include "blink/tunables.h"
 #include "blink/util.h"
+#include "blink/vdso.h"
 #include "blink/vfs.h"
 #include "blink/x86.h"
 
@@ -717,6 +718,7 @@ void LoadProgram(struct Machine *m, char *execfn, char *prog, char **args,
     elf->interpreter = 0;
     elf->at_phdr = 0;
     elf->at_base = -1;
+    elf->at_sysinfo_ehdr = 0;
     elf->at_phent = 56;
     free(g_progname);
     g_progname = strdup(prog);
@@ -812,6 +814,7 @@ error: unsupported executable; we need:\n\
       exit(EXIT_FAILURE_EXEC_FAILED);
     }
     m->system->loaded = true;  // in case rwx stack is smc write-protected :'(
+    elf->at_sysinfo_ehdr = LoadVdso(m);
     LoadArgv(m, execfn, prog, args, vars, elf->rng);
   }
   pagesize = FLAG_pagesize;
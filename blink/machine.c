@@ -53,6 +53,7 @@
 #include "blink/thread.h"
 #include "blink/time.h"
 #include "blink/util.h"
+#include "blink/vdso.h"
 #include "blink/x86.h"
 #include "blink/xlat.h"
 
@@ -350,7 +351,7 @@ static void OpMovAlOb(P) {
 static void OpMovObAl(P) {
   i64 addr = AddressOb(A);
   SetReadAddr(m, addr, 1);
-  Store8(ResolveAddress(m, addr), Get8(m->ax));
+  Store8(ResolveWritableAddress(m, addr), Get8(m->ax));
 }
 
 static void OpMovRaxOvqp(P) {
@@ -362,7 +363,7 @@ static void OpMovRaxOvqp(P) {
 static void OpMovOvqpRax(P) {
   i64 v = DataSegment(A, disp);
   SetWriteAddr(m, v, 1 << RegLog2(rde));
-  WriteMemory(rde, ResolveAddress(m, v), Get64(m->ax));
+  WriteMemory(rde, ResolveWritableAddress(m, v), Get64(m->ax));
 }
 
 static void OpMovEbGb(P) {
@@ -1810,7 +1811,7 @@ static const nexgen32e_f kNexgen32e[] = {
     /*10B*/ OpUd,                    //
     /*10C*/ OpUd,                    //
     /*10D*/ OpHintNopEv,             //
-    /*10E*/ OpUd,                    //
+    /*10E*/ OpVdso,                  //
     /*10F*/ OpUd,                    //
     /*110*/ OpMov0f10,               // #89   (0.004629%)
     /*111*/ OpMovWpsVps,             // #104  (0.001831%)
@@ -2239,7 +2240,7 @@ void Actor(struct Machine *mm) {
 #endif
   for (g_machine = mm, m = mm;;) {
 #ifndef __CYGWIN__
-    STATISTIC(++interps);
+    MACHINE_STATISTIC(m, interps);
 #endif
     if (!atomic_load_explicit(&m->attention, memory_order_acquire)) {
       ExecuteInstruction(m);
@@ -2261,7 +2262,7 @@ void Blink(struct Machine *m) {
     m->canhalt = false;
     m->nofault = false;
     m->insyscall = false;
-    CollectPageLocks(m);
+    CollectPagePins(m);
     CollectGarbage(m, 0);
     if (IsMakingPath(m)) {
       AbandonPath(m);
@@ -18,6 +18,7 @@
 #include "blink/jit.h"
 #include "blink/linux.h"
 #include "blink/log.h"
+#include "blink/stats.h"
 #include "blink/thread.h"
 #include "blink/tsan.h"
 #include "blink/tunables.h"
@@ -101,8 +102,6 @@
 #define PAGE_GROW  0x0010000000000000  // for future support of MAP_GROWSDOWN
 #define PAGE_MUG   0x0020000000000000  // host page magic mapped individually
 #define PAGE_FILE  0x0040000000000000  // page has tracking bit in s->filemap
-#define PAGE_LOCK  0x0080000000000000  // a bit used to increment lock counts
-#define PAGE_LOCKS 0x7f80000000000000  // a page can be locked by 255 threads
 #define PAGE_XD    0x8000000000000000  // disable executing memory if bit set
 
 #define SREG_ES 0
@@ -116,9 +115,8 @@
 #define A                m, rde, disp, uimm0
 #define DISPATCH_NOTHING m, 0, 0, 0
 
-#define MACHINE_CONTAINER(e)  DLL_CONTAINER(struct Machine, elem, e)
-#define FILEMAP_CONTAINER(e)  DLL_CONTAINER(struct FileMap, elem, e)
-#define HOSTPAGE_CONTAINER(e) DLL_CONTAINER(struct HostPage, elem, e)
+#define MACHINE_CONTAINER(e) DLL_CONTAINER(struct Machine, elem, e)
+#define FILEMAP_CONTAINER(e) DLL_CONTAINER(struct FileMap, elem, e)
 
 #if defined(NOLINEAR) || defined(__SANITIZE_THREAD__) ||                       \
     defined(__CYGWIN__) || defined(__NetBSD__) || defined(__COSMOPOLITAN__) || \
@@ -160,30 +158,38 @@ struct FreeList {
   void **p;
 };
 
-struct HostPage {
-  u8 *page;
-  struct HostPage *next;
-};
-
 struct HostPages {
   size_t n;
   size_t c;
   u8 **p;
 };
 
-struct PageLock {
-  i64 page;
-  u8 *pslot;
+// interval of guest memory [lo,hi) pinned by a system call, which
+// munmap() won't free until released. slots are empty if lo >= hi
+struct PagePin {
+  _Atomic(i64) lo;
+  _Atomic(i64) hi;
   int sysdepth;
 };
 
-struct SmcQueue {
-  i64 p[kSmcQueueSize];
+struct SmcPage {
+  i64 page;  // guest page that became writable
+  u8 *old;   // its content beforehand
 };
 
-struct PageLocks {
+struct SmcQueue {
   int i, n;
-  struct PageLock *p;
+  u8 *old;
+  struct SmcPage *p;
+};
+
+// intervals pinned by a thread's system calls. the first chunk of slots
+// is inline, and more are chained on as needed, which are kept until
+// the machine is scrubbed, so other threads can scan them lock-free
+struct PagePins {
+  int n;  // number of nonempty slots (only counted in the first chunk)
+  struct PagePin p[kPagePinSlots];
+  _Atomic(struct PagePins *) more;
 };
 
 struct FileMap {
@@ -250,6 +256,7 @@ struct Elf {
   i64 at_phent;
   i64 at_entry;
   i64 at_phnum;
+  i64 at_sysinfo_ehdr;
 };
 
 struct OpCache {
@@ -259,7 +266,36 @@ struct OpCache {
   u32 stashsize;  // for writes that overlap page
   bool writable;
   _Atomic(bool) invalidated;
-  u64 icache[512][kInstructionBytes / 8];
+  u64 icachepc;                       // guest address of icache, or -1
+  unsigned icacheseq;                 // seq of its icache page, or odd
+  u64 icache[kInstructionBytes / 8];  // thread's copy of decoded insn
+};
+
+// decoded instructions for one 64-byte line of guest code, indexed
+// by the offset of the first byte, where valid holds one bit each
+struct ICacheLine {
+  _Atomic(u64) valid;
+  struct ICacheLine *next;  // free list [ICache::lock]
+  u64 ops[64][kInstructionBytes / 8];
+};
+
+// cached page of guest code, seq is a seqlock that's odd while the
+// slot is being retagged or invalidated, so it also serves as the
+// generation of the page's code. lines go back to the free list when
+// the slot is evicted, but they're never freed while the cache lives
+struct ICachePage {
+  _Atomic(unsigned) seq;
+  _Atomic(u64) tag;
+  _Atomic(struct ICacheLine *) lines[64];
+};
+
+// direct mapped decoded instruction cache shared by all threads
+struct ICache {
+  _Atomic(struct ICachePage *) pages;
+  struct ICacheLine *free;  // evicted lines to reuse [lock]
+  int lines;                // lines allocated, up to kICacheLines [lock]
+  int hand;                 // next slot to evict for its lines [lock]
+  pthread_mutex_t_ lock;
 };
 
 struct System {
@@ -292,26 +328,37 @@ struct System {
   long codesize;
   _Atomic(long) rss;
   _Atomic(long) vss;
+  _Atomic(i64) fencelo;  // [fencelo,fencehi) is being unmapped
+  _Atomic(i64) fencehi;  // zero if no munmap() is in progress
+  unsigned pinsgen;      // bumped when pins are released [pins_lock]
   struct Dis *dis;
   struct Dll *filemaps;
   struct MachineMemstat memstat;
   struct Dll *machines;
+  struct Dll *parked;  // idle threads for clone() to reuse [machines_lock]
+  int nparked;         // [machines_lock]
+  bool noparking;      // [machines_lock]
   uintptr_t ender;
   struct Jit jit;
   struct Fds fds;
+  struct ICache icache;
   struct Elf elf;
   sigset_t exec_sigmask;
   struct sigaction_linux hands[64];
   u64 blinksigs;  // signals blink itself handles
+  _Atomicish(u64) signals;  // pending delivery to any thread [sig_lock]
   struct rlimit_linux rlim[RLIM_NLIMITS_LINUX];
+  int umask;  // file mode creation mask of guest [umask_lock]
 #ifdef HAVE_THREADS
   pthread_cond_t_ machines_cond;
+  pthread_cond_t_ parked_cond;
   pthread_mutex_t_ machines_lock;
-  pthread_cond_t_ pagelocks_cond;
-  pthread_mutex_t_ pagelocks_lock;
+  pthread_cond_t_ pins_cond;
+  pthread_mutex_t_ pins_lock;
   pthread_mutex_t_ exec_lock;
   pthread_mutex_t_ sig_lock;
   pthread_mutex_t_ mmap_lock;
+  pthread_mutex_t_ umask_lock;
 #endif
   void (*onfilemap)(struct System *, struct FileMap *);
   void (*onsymbols)(struct System *);
@@ -415,7 +462,7 @@ struct Machine {               //
   u32 mxcsr;                             // SIMD status control register
   pthread_t thread;                      // POSIX thread of this machine
   struct FreeList freelist;              // to make system calls simpler
-  struct PageLocks pagelocks;            // track page table entry locks
+  struct PagePins pins;                  // memory held by system calls
   struct JitPath path;                   // under construction jit route
   _Atomicish(u64) signals;               // [attention] pending delivery
   _Atomicish(u64) sigmask;               // signals that've been blocked
@@ -424,14 +471,18 @@ struct Machine {               //
   struct System *system;                 //
   int sigdepth;                          //
   int sysdepth;                          //
+  int waitfd;                            // wake pipe read end, or -1
+  _Atomic(int) wakefd;                   // wake pipe write end, or -1
   _Atomic(bool) killed;                  // [attention] slay this thread
   _Atomic(bool) invalidated;             // the tlb must be flushed
   bool restored;                         // [attention] rt_sigreturn()'d
+  bool profiled;                         // [attention] SIGPROF'd by blink
   bool selfmodifying;                    // [attention] need usmc restore
   bool reserving;                        //
   bool insyscall;                        //
   bool nofault;                          //
   bool canhalt;                          //
+  bool parked;                           // [machines_lock] thread pooled
   bool metal;                            //
   bool interrupted;                      //
   bool issigsuspend;                     //
@@ -450,6 +501,7 @@ struct Machine {               //
   struct Dll elem;                       //
   struct SmcQueue smcqueue;              //
   struct OpCache opcache[1];             //
+  _Alignas(64) struct MachineStats stats;  // [owned] see stats.h
 };  //
 
 extern struct HostPages g_hostpages;
@@ -463,12 +515,15 @@ void FreeSystem(struct System *);
 void SignalActor(struct Machine *);
 void SetMachineMode(struct Machine *, struct XedMachineMode);
 struct Machine *NewMachine(struct System *, struct Machine *);
+void SumMachineStats(struct System *, struct MachineStats *);
 i64 AreAllPagesUnlocked(struct System *) nosideeffect;
 bool IsOrphan(struct Machine *) nosideeffect;
 _Noreturn void Blink(struct Machine *);
 _Noreturn void Actor(struct Machine *);
 void Jitter(P, const char *, ...);
 void FreeMachine(struct Machine *);
+bool RecycleMachine(struct Machine *);
+void UnparkMachine(struct Machine *);
 void InvalidateSystem(struct System *, bool, bool);
 void RemoveOtherThreads(struct System *);
 void KillOtherThreads(struct System *);
@@ -476,13 +531,19 @@ void ResetCpu(struct Machine *);
 void ResetTlb(struct Machine *);
 void CollectGarbage(struct Machine *, size_t);
 void ResetInstructionCache(struct Machine *);
+void InitICache(struct ICache *);
+void DestroyICache(struct ICache *);
+void ResetICache(struct ICache *);
+void InvalidateICachePage(struct ICache *, i64);
 nexgen32e_f GetOp(long);
 void LoadInstruction(struct Machine *, u64);
 int LoadInstruction2(struct Machine *, u64);
+int SpeculateInstruction(struct Machine *, u64, struct XedDecodedInst *);
 void ExecuteInstruction(struct Machine *);
 u64 AllocatePageTable(struct System *);
 u64 AllocateAnonymousPage(struct System *);
-void FreeAnonymousPage(struct System *, u8 *);
+void FreeAnonymousPage(struct System *, u64);
+u8 *GetZeroPage(void);
 u64 FindPageTableEntry(struct Machine *, u64);
 bool CheckMemoryInvariants(struct System *) nosideeffect dontdiscard;
 i64 ReserveVirtual(struct System *, i64, i64, u64, int, i64, bool, bool);
@@ -522,9 +583,12 @@ u8 *BeginLoadStore(struct Machine *, i64, size_t, void *[2], u8 *);
 u8 *BeginStore(struct Machine *, i64, size_t, void *[2], u8 *);
 u8 *BeginStoreNp(struct Machine *, i64, size_t, void *[2], u8 *);
 int GetFileDescriptorLimit(struct System *);
-bool HasPageLock(const struct Machine *, i64) nosideeffect;
-void CollectPageLocks(struct Machine *);
+bool HasPagePin(const struct Machine *, i64) nosideeffect;
+int PinPageRange(struct Machine *, i64, u64);
+void CollectPagePins(struct Machine *);
+void FreePagePins(struct Machine *);
 u8 *LookupAddress(struct Machine *, i64);
+u8 *LookupWritableAddress(struct Machine *, i64);
 u8 *LookupAddress2(struct Machine *, i64, u64, u64);
 u8 *SpyAddress(struct Machine *, i64);
 u8 *Load(struct Machine *, i64, size_t, u8 *);
@@ -532,6 +596,7 @@ u8 *MallocPage(void);
 u8 *RealAddress(struct Machine *, i64);
 u8 *ReserveAddress(struct Machine *, i64, size_t, bool);
 u8 *ResolveAddress(struct Machine *, i64);
+u8 *ResolveWritableAddress(struct Machine *, i64);
 u8 *GetAddress(struct Machine *, i64);
 void CommitStash(struct Machine *);
 int CopyFromUser(struct Machine *, void *, i64, u64);
@@ -557,7 +622,8 @@ long GetMaxVss(struct System *);
 
 void FlushSmcQueue(struct Machine *);
 bool IsPageInSmcQueue(struct Machine *, i64);
-void AddPageToSmcQueue(struct Machine *, i64);
+void AddPageToSmcQueue(struct Machine *, i64, const u8 *);
+void DestroySmcQueue(struct SmcQueue *);
 i64 ProtectRwxMemory(struct System *, i64, i64, i64, long, int);
 void HandleFatalSystemSignal(struct Machine *, const siginfo_t *);
 bool IsSelfModifyingCodeSegfault(struct Machine *, const siginfo_t *);
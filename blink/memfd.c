@@ -0,0 +1,132 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/vfs.h"
+
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
+
+#define SEALS_LINUX                                            \
+  (F_SEAL_SEAL_LINUX | F_SEAL_SHRINK_LINUX | F_SEAL_GROW_LINUX | \
+   F_SEAL_WRITE_LINUX | F_SEAL_FUTURE_WRITE_LINUX)
+
+// memfd_create() hands out an anonymous file that lives in memory, so
+// it can be shared with MAP_SHARED across fork() and sent over unix
+// sockets. we use the host memfd, which also enforces sealing. other
+// platforms get an unlinked temporary file, whose seals are recorded
+// on the descriptor. they're reported, but not enforced, in that case.
+// the host descriptor is close-on-exec iff the guest's is, since exec
+// of the guest is an exec of blink
+
+int CreateMemfd(const char *name, bool sealable, bool cloexec) {
+#ifdef HAVE_MEMFD_CREATE
+  return memfd_create(name, (cloexec ? MFD_CLOEXEC : 0) |
+                                (sealable ? MFD_ALLOW_SEALING : 0));
+#else
+  int fd;
+  const char *tmpdir;
+  char path[PATH_MAX];
+  if (!(tmpdir = getenv("TMPDIR")) || !*tmpdir) tmpdir = "/tmp";
+  snprintf(path, sizeof(path), "%s/blink.memfd.XXXXXX", tmpdir);
+  if ((fd = mkstemp(path)) == -1) return -1;
+  unlink(path);
+  if (cloexec && fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+int SysMemfdCreate(struct Machine *m, i64 nameaddr, u32 flags) {
+  struct Fd *fd;
+  const char *name;
+  int lim, oflags, fildes;
+  char path[MFD_NAME_MAX_LINUX + 32];
+  if (flags & ~(MFD_CLOEXEC_LINUX | MFD_ALLOW_SEALING_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "memfd_create", flags);
+    return einval();
+  }
+  if (!(name = LoadStr(m, nameaddr))) return -1;
+  if (strlen(name) > MFD_NAME_MAX_LINUX) return einval();
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  oflags = O_RDWR;
+  if (flags & MFD_CLOEXEC_LINUX) oflags |= O_CLOEXEC;
+  if ((fildes = CreateMemfd(name, flags & MFD_ALLOW_SEALING_LINUX,
+                            flags & MFD_CLOEXEC_LINUX)) != -1 &&
+      (fildes = VfsWrapFd(fildes)) != -1) {
+    if (fildes >= lim) {
+      VfsClose(fildes);
+      fildes = emfile();
+    } else {
+      // linux names the file this way in /proc/self/fd and maps
+      snprintf(path, sizeof(path), "/memfd:%s (deleted)", name);
+      LOCK(&m->system->fds.lock);
+      unassert(fd = AddFd(&m->system->fds, fildes, oflags));
+      fd->path = strdup(path);
+      fd->seals = flags & MFD_ALLOW_SEALING_LINUX ? 0 : F_SEAL_SEAL_LINUX;
+      UNLOCK(&m->system->fds.lock);
+    }
+  }
+  return fildes;
+}
+
+// implements F_ADD_SEALS and F_GET_SEALS
+// @assume fd->lock
+int SysFcntlSeals(struct Fd *fd, i32 cmd, i64 arg) {
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+  _Static_assert(F_SEAL_SEAL == F_SEAL_SEAL_LINUX, "");
+  _Static_assert(F_SEAL_SHRINK == F_SEAL_SHRINK_LINUX, "");
+  _Static_assert(F_SEAL_GROW == F_SEAL_GROW_LINUX, "");
+  _Static_assert(F_SEAL_WRITE == F_SEAL_WRITE_LINUX, "");
+  if (cmd == F_GET_SEALS_LINUX) {
+    return VfsFcntl(fd->fildes, F_GET_SEALS);
+  } else {
+    if (arg & ~SEALS_LINUX) return einval();
+    return VfsFcntl(fd->fildes, F_ADD_SEALS, (int)arg);
+  }
+#else
+  if (!fd->path || strncmp(fd->path, "/memfd:", 7)) return einval();
+  if (cmd == F_GET_SEALS_LINUX) {
+    return fd->seals;
+  } else {
+    if (arg & ~SEALS_LINUX) return einval();
+    if (fd->seals & F_SEAL_SEAL_LINUX) return eperm();
+    if (!(fd->oflags & O_ACCMODE)) return eperm();
+    fd->seals |= arg;
+    return 0;
+  }
+#endif
+}
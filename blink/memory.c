@@ -18,6 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -103,7 +104,7 @@ u64 HandlePageFault(struct Machine *m, u8 *pslot, u64 entry) {
         m->system->memstat.reserved -= 1;
         entry = x;
       } else {
-        FreeAnonymousPage(m->system, (u8 *)(uintptr_t)(page & PAGE_TA));
+        FreeAnonymousPage(m->system, page);
         entry = LoadPte(pslot);
         m->system->rss -= 1;
       }
@@ -112,73 +113,240 @@ u64 HandlePageFault(struct Machine *m, u8 *pslot, u64 entry) {
   return entry;
 }
 
-bool HasPageLock(const struct Machine *m, i64 page) {
+static bool IsPagePinEmpty(const struct PagePin *p) {
+  return atomic_load_explicit(&p->lo, memory_order_relaxed) >=
+         atomic_load_explicit(&p->hi, memory_order_relaxed);
+}
+
+static struct PagePins *GetNextPagePins(const struct PagePins *b) {
+  return atomic_load_explicit(&b->more, memory_order_acquire);
+}
+
+// returns true if [lo,hi) lies within one interval pinned by the thread
+static bool HasPagePins(const struct Machine *m, i64 lo, i64 hi) {
   int i;
-  unassert(!(page & 4095));
-  for (i = m->pagelocks.i; i--;) {
-    if (m->pagelocks.p[i].page == page) {
-      return true;
+  const struct PagePins *b;
+  if (!m->pins.n) return false;
+  for (b = &m->pins; b; b = GetNextPagePins(b)) {
+    for (i = 0; i < kPagePinSlots; ++i) {
+      if (atomic_load_explicit(&b->p[i].lo, memory_order_relaxed) <= lo &&
+          hi <= atomic_load_explicit(&b->p[i].hi, memory_order_relaxed)) {
+        return true;
+      }
     }
   }
   return false;
 }
 
-static bool RecordPageLock(struct Machine *m, i64 page, u8 *pslot) {
-  unassert(m->sysdepth > 0);
-  unassert(!m->pagelocks.i ||
-           m->pagelocks.p[m->pagelocks.i - 1].sysdepth <= m->sysdepth);
-  if (m->pagelocks.i == m->pagelocks.n) {
-    int n2;
-    struct PageLock *p2;
-    p2 = m->pagelocks.p;
-    n2 = m->pagelocks.n;
-    n2 += 3;
-    n2 += n2 >> 1;
-    if ((p2 = (struct PageLock *)realloc(p2, n2 * sizeof(*p2)))) {
-      m->pagelocks.p = p2;
-      m->pagelocks.n = n2;
-    } else {
-      return false;
+bool HasPagePin(const struct Machine *m, i64 page) {
+  unassert(!(page & 4095));
+  return HasPagePins(m, page, page + 4096);
+}
+
+// changes interval of pin. other threads may observe the two stores
+// separately, so lo and hi are changed in whichever order guarantees
+// the intermediate interval is a superset of the old or new interval
+static void SetPagePin(struct PagePin *p, i64 lo, i64 hi) {
+  if (lo < atomic_load_explicit(&p->lo, memory_order_relaxed)) {
+    atomic_store_explicit(&p->lo, lo, memory_order_seq_cst);
+    atomic_store_explicit(&p->hi, hi, memory_order_seq_cst);
+  } else {
+    atomic_store_explicit(&p->hi, hi, memory_order_seq_cst);
+    atomic_store_explicit(&p->lo, lo, memory_order_seq_cst);
+  }
+}
+
+// returns empty slot, chaining on a new chunk of them if all are used.
+// chunks are zeroed before they're published, so they're seen empty
+// @return pin slot, or NULL w/ ENOMEM
+static struct PagePin *GetEmptyPagePin(struct Machine *m) {
+  int i;
+  struct PagePins *b, *c;
+  for (b = &m->pins;; b = c) {
+    for (i = 0; i < kPagePinSlots; ++i) {
+      if (IsPagePinEmpty(b->p + i)) {
+        return b->p + i;
+      }
+    }
+    if (!(c = GetNextPagePins(b))) {
+      if (!(c = (struct PagePins *)calloc(1, sizeof(*c)))) {
+        enomem();
+        return 0;
+      }
+      atomic_store_explicit(&b->more, c, memory_order_release);
     }
   }
-  m->pagelocks.p[m->pagelocks.i].page = page;
-  m->pagelocks.p[m->pagelocks.i].pslot = pslot;
-  m->pagelocks.p[m->pagelocks.i].sysdepth = m->sysdepth;
-  ++m->pagelocks.i;
-  STATISTIC(++page_locks);
-  return true;
 }
 
-static void ReleasePageLock(u8 *pslot) {
-  u64 entry;
-  do {
-    entry = LoadPte(pslot);
-    unassert(entry & PAGE_V);
-    unassert(entry & PAGE_LOCKS);
-  } while (!CasPte(pslot, entry, entry - PAGE_LOCK));
+// adds [lo,hi) to the intervals pinned by this thread's system call.
+// it only widens an interval it overlaps or is adjacent to, so pinning
+// a large buffer costs one pair of stores for the whole of it, while
+// pinning buffers that are spread out never pins the memory between
+// @return pin slot, or NULL w/ ENOMEM
+static struct PagePin *AddPagePins(struct Machine *m, i64 lo, i64 hi,
+                                   struct PagePin *saved) {
+  int i;
+  i64 plo, phi;
+  struct PagePin *p;
+  struct PagePins *b;
+  for (b = &m->pins; m->pins.n && b; b = GetNextPagePins(b)) {
+    for (i = 0; i < kPagePinSlots; ++i) {
+      p = b->p + i;
+      plo = atomic_load_explicit(&p->lo, memory_order_relaxed);
+      phi = atomic_load_explicit(&p->hi, memory_order_relaxed);
+      if (plo < phi && lo <= phi && plo <= hi) {
+        saved->lo = plo;
+        saved->hi = phi;
+        saved->sysdepth = p->sysdepth;
+        SetPagePin(p, MIN(lo, plo), MAX(hi, phi));
+        p->sysdepth = MIN(p->sysdepth, m->sysdepth);
+        return p;
+      }
+    }
+  }
+  if (!(p = GetEmptyPagePin(m))) return 0;
+  saved->lo = saved->hi = 0;
+  SetPagePin(p, lo, hi);
+  p->sysdepth = m->sysdepth;
+  ++m->pins.n;
+  return p;
+}
+
+static void RemovePagePin(struct Machine *m, struct PagePin *p,
+                          const struct PagePin *saved) {
+  SetPagePin(p, saved->lo, saved->hi);
+  if (saved->lo < saved->hi) {
+    p->sysdepth = saved->sysdepth;
+  } else {
+    --m->pins.n;
+  }
+}
+
+static bool IsInFence(struct System *s, i64 lo, i64 hi) {
+  i64 fencelo, fencehi;
+  fencehi = atomic_load_explicit(&s->fencehi, memory_order_seq_cst);
+  fencelo = atomic_load_explicit(&s->fencelo, memory_order_seq_cst);
+  return fencelo < fencehi && lo < fencehi && fencelo < hi;
+}
+
+static bool HasFencedPins(struct Machine *m, struct PagePin *except,
+                          const struct PagePin *saved) {
+  int i;
+  i64 lo, hi;
+  struct PagePin *p;
+  struct PagePins *b;
+  for (b = &m->pins; b; b = GetNextPagePins(b)) {
+    for (i = 0; i < kPagePinSlots; ++i) {
+      p = b->p + i;
+      if (p == except) {
+        lo = saved->lo;
+        hi = saved->hi;
+      } else {
+        lo = atomic_load_explicit(&p->lo, memory_order_relaxed);
+        hi = atomic_load_explicit(&p->hi, memory_order_relaxed);
+      }
+      if (lo < hi && IsInFence(m->system, lo, hi)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// pins pages [lo,hi) so they can't be unmapped until the system call
+// returns. munmap() announces the range it's removing before checking
+// every thread's pins. so after we publish our pin, if it isn't fenced,
+// then the unmapping thread is guaranteed to wait for us. otherwise
+// we back out and wait for munmap() to finish, unless we're already
+// holding pins it's waiting on, in which case we're safe to proceed
+// @return 0 on success, or -1 w/ ENOMEM
+static int PinPages(struct Machine *m, i64 lo, i64 hi) {
+  struct PagePin *p, saved;
+  struct System *s = m->system;
+  unassert(m->sysdepth > 0);
+  for (;;) {
+    if (!(p = AddPagePins(m, lo, hi, &saved))) return -1;
+    if (!IsInFence(s, lo, hi) || HasFencedPins(m, p, &saved)) {
+      MACHINE_STATISTIC(m, page_pins);
+      return 0;
+    }
+    RemovePagePin(m, p, &saved);
+    STATISTIC(++page_pin_waits);
+    LOCK(&s->pins_lock);
+    ++s->pinsgen;
+    unassert(!pthread_cond_broadcast(&s->pins_cond));
+    while (IsInFence(s, lo, hi)) {
+      unassert(!pthread_cond_wait(&s->pins_cond, &s->pins_lock));
+    }
+    UNLOCK(&s->pins_lock);
+  }
+}
+
+// pins the pages a system call is about to access in [virt,virt+size)
+// all at once, rather than one at a time as each is looked up. it's a
+// no-op outside system calls, and bad addresses are left for the page
+// table walk to report
+// @return 0 on success, or -1 w/ ENOMEM
+int PinPageRange(struct Machine *m, i64 virt, u64 size) {
+  i64 lo, hi;
+  if (!m->insyscall || m->nofault || !size) return 0;
+  if (!(-0x800000000000 <= virt && virt < 0x800000000000)) return 0;
+  lo = virt & -4096;
+  if (size > 0x800000000000 - virt) {
+    hi = 0x800000000000;
+  } else {
+    hi = ROUNDUP(virt + (i64)size, 4096);
+  }
+  if (HasPagePins(m, lo, hi)) return 0;
+  return PinPages(m, lo, hi);
 }
 
-static bool HasOutdatedPageLocks(struct Machine *m) {
-  return m->pagelocks.i &&
-         m->pagelocks.p[m->pagelocks.i - 1].sysdepth > m->sysdepth;
+void CollectPagePins(struct Machine *m) {
+  int i;
+  bool released;
+  struct PagePin *p;
+  struct PagePins *b;
+  struct System *s = m->system;
+  if (!m->pins.n) return;
+  released = false;
+  for (b = &m->pins; b; b = GetNextPagePins(b)) {
+    for (i = 0; i < kPagePinSlots; ++i) {
+      p = b->p + i;
+      if (!IsPagePinEmpty(p) && p->sysdepth > m->sysdepth) {
+        SetPagePin(p, 0, 0);
+        --m->pins.n;
+        released = true;
+      }
+    }
+  }
+  if (released && atomic_load_explicit(&s->fencehi, memory_order_seq_cst)) {
+    LOCK(&s->pins_lock);
+    ++s->pinsgen;
+    unassert(!pthread_cond_broadcast(&s->pins_cond));
+    UNLOCK(&s->pins_lock);
+  }
 }
 
-void CollectPageLocks(struct Machine *m) {
-  if (HasOutdatedPageLocks(m)) {
-    LOCK(&m->system->pagelocks_lock);
-    do ReleasePageLock(m->pagelocks.p[--m->pagelocks.i].pslot);
-    while (HasOutdatedPageLocks(m));
-    unassert(!pthread_cond_broadcast(&m->system->pagelocks_cond));
-    UNLOCK(&m->system->pagelocks_lock);
+// frees the chunks of slots chained on by GetEmptyPagePin(), which is
+// only safe once the machine has been removed from s->machines
+void FreePagePins(struct Machine *m) {
+  struct PagePins *b, *c;
+  unassert(!m->pins.n);
+  for (b = GetNextPagePins(&m->pins); b; b = c) {
+    c = GetNextPagePins(b);
+    free(b);
   }
+  atomic_store_explicit(&m->pins.more, 0, memory_order_relaxed);
 }
 
 // returns page directory entry associated with virtual address
+// @param writing is true if the caller is about to store to the page,
+//     which is the only case where anonymous memory gets committed;
+//     otherwise a PAGE_RSRV entry is returned, which reads as zeroes
 // @return raw page directory entry contents, or zero w/ errno
 // @raise EFAULT if a valid 4096 page didn't exist at address
 // @raise ENOMEM if memory couldn't be allocated internally
-// @raise EAGAIN if too many locks are held on a page
-u64 FindPageTableEntry(struct Machine *m, u64 page) {
+static u64 FindPageTableEntry2(struct Machine *m, u64 page, bool writing) {
   u8 *pslot;
   i64 table;
   u64 entry;
@@ -190,17 +358,24 @@ u64 FindPageTableEntry(struct Machine *m, u64 page) {
   }
   tlbkey = (page >> 12) & (ARRAYLEN(m->tlb) - 1);
   if (LIKELY(m->tlb[tlbkey].page == page &&
-             ((entry = m->tlb[tlbkey].entry) & PAGE_V))) {
-    STATISTIC(++tlb_hits);
+             ((entry = m->tlb[tlbkey].entry) & PAGE_V) &&
+             !(writing && (entry & PAGE_RSRV)))) {
+    MACHINE_STATISTIC(m, tlb_hits);
     return entry;
   }
-  STATISTIC(++tlb_misses);
+  MACHINE_STATISTIC(m, tlb_misses);
   unassert(!(page & 4095));
   if (!(-0x800000000000 <= (i64)page && (i64)page < 0x800000000000)) {
     m->segvcode = SEGV_MAPERR_LINUX;
     return (u64)(uintptr_t)efault0();
   }
-TryAgain:
+  // system calls pin the pages they access
+  // this prevents race conditions w/ munmap
+  // it must happen before the page table walk
+  if (m->insyscall && !m->nofault && !HasPagePin(m, page) &&
+      PinPages(m, page, page + 4096) == -1) {
+    return 0;
+  }
   unassert((entry = m->system->cr3));
   level = 39;
   do {
@@ -226,32 +401,10 @@ TryAgain:
       break;
     }
   } while ((level -= 9) >= 12);
-  if ((entry & PAGE_RSRV) && !(entry = HandlePageFault(m, pslot, entry))) {
+  if ((entry & PAGE_RSRV) && ((entry & PAGE_HOST) || writing) &&
+      !(entry = HandlePageFault(m, pslot, entry))) {
     return 0;
   }
-  // system calls lock the pages they access
-  // this prevents race conditions w/ munmap
-  if (m->insyscall && !m->nofault && !HasPageLock(m, page)) {
-    if ((entry & PAGE_LOCKS) < PAGE_LOCKS) {
-      if (CasPte(pslot, entry, entry + PAGE_LOCK)) {
-        unassert(LoadPte(pslot) & PAGE_LOCKS);
-        if (RecordPageLock(m, page, pslot)) {
-          entry += PAGE_LOCK;
-        } else {
-          ReleasePageLock(pslot);
-          m->segvcode = SEGV_MAPERR_LINUX;
-          return 0;
-        }
-      } else {
-        goto TryAgain;
-      }
-    } else {
-      LOGF("too many threads locked page %#" PRIx64, page);
-      m->segvcode = SEGV_MAPERR_LINUX;
-      errno = EAGAIN;
-      return 0;
-    }
-  }
   m->tlb[tlbkey].page = page;
   m->tlb[tlbkey].entry = entry;
   return entry;
@@ -260,12 +413,44 @@ MapError:
   return (uintptr_t)efault0();
 }
 
-u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
+u64 FindPageTableEntry(struct Machine *m, u64 page) {
+  return FindPageTableEntry2(m, page, false);
+}
+
+// returns page table entry of virt if it permits the access
+static u64 FindPermittedPage(struct Machine *m, i64 virt, u64 mask, u64 need,
+                             bool writing) {
+  u64 entry;
+  if (!(entry = FindPageTableEntry2(m, virt & -4096, writing))) {
+    return 0;
+  }
+  if ((entry & mask) != need) {
+    m->segvcode = SEGV_ACCERR_LINUX;
+    return (uintptr_t)efault0();
+  }
+  return entry;
+}
+
+// queues user page for self-modifying code checks if this access may
+// write to memory the jit might have translated
+static void WatchPageForStores(struct Machine *m, i64 virt, u64 entry,
+                               u64 need, const u8 *host) {
+#ifndef DISABLE_JIT
+  if ((need & PAGE_RW) &&
+      (entry & (PAGE_U | PAGE_RW | PAGE_XD)) == (PAGE_U | PAGE_RW) &&
+      !IsJitDisabled(&m->system->jit) && !IsPageInSmcQueue(m, virt)) {
+    AddPageToSmcQueue(m, virt, host);
+  }
+#endif
+}
+
+static u8 *LookupAddress3(struct Machine *m, i64 virt, u64 mask, u64 need,
+                          bool writing) {
   u8 *host;
   u64 entry;
   if (!m->metal || m->mode.omode == XED_MODE_LONG ||
       (m->mode.genmode != XED_GEN_MODE_REAL && (m->system->cr0 & CR0_PG))) {
-    if (!(entry = FindPageTableEntry(m, virt & -4096))) {
+    if (!(entry = FindPermittedPage(m, virt, mask, need, writing))) {
       return 0;
     }
   } else if (virt >= 0 && virt <= 0xffffffff &&
@@ -276,18 +461,16 @@ u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
     m->segvcode = SEGV_MAPERR_LINUX;
     return (u8 *)efault0();
   }
-  if ((entry & mask) != need) {
-    m->segvcode = SEGV_ACCERR_LINUX;
-    return (u8 *)efault0();
+  if ((entry & (PAGE_RSRV | PAGE_HOST)) == PAGE_RSRV) {
+    // anonymous memory that hasn't been written yet is backed by one
+    // shared page of zeroes. it's mapped read-only on the host, so if
+    // a store ever sneaks through without write intent, it'll crash.
+    unassert(!writing);
+    STATISTIC(++page_zero_reads);
+    return GetZeroPage() + (virt & 4095);
   }
-#ifndef DISABLE_JIT
-  if ((need & PAGE_RW) &&
-      (entry & (PAGE_U | PAGE_RW | PAGE_XD)) == (PAGE_U | PAGE_RW) &&
-      !IsJitDisabled(&m->system->jit) && !IsPageInSmcQueue(m, virt)) {
-    AddPageToSmcQueue(m, virt);
-  }
-#endif
   if ((host = GetPageAddress(m->system, entry, false))) {
+    WatchPageForStores(m, virt, entry, need, host);
     return host + (virt & 4095);
   } else {
     m->segvcode = SEGV_MAPERR_LINUX;
@@ -295,12 +478,23 @@ u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
   }
 }
 
+u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
+  return LookupAddress3(m, virt, mask, need, !!(need & PAGE_RW));
+}
+
 u8 *LookupAddress(struct Machine *m, i64 virt) {
   u64 need = 0;
   if (Cpl(m) == 3) need = PAGE_U;
   return LookupAddress2(m, virt, need, need);
 }
 
+// same as LookupAddress() but the caller intends to modify the memory
+u8 *LookupWritableAddress(struct Machine *m, i64 virt) {
+  u64 need = 0;
+  if (Cpl(m) == 3) need = PAGE_U | PAGE_RW;
+  return LookupAddress3(m, virt, need, need, true);
+}
+
 flattencalls u8 *GetAddress(struct Machine *m, i64 v) {
   if (HasLinearMapping()) return ToHost(v);
   return LookupAddress(m, v);
@@ -332,6 +526,17 @@ u8 *ResolveAddress(struct Machine *m, i64 v) {
   ThrowSegmentationFault(m, v);
 }
 
+// same as ResolveAddress() but memory is going to be modified, which
+// lets us notice self-modifying code when linear memory isn't in use
+u8 *ResolveWritableAddress(struct Machine *m, i64 v) {
+  u8 *r;
+  u64 need = 0;
+  if (HasLinearMapping()) return ToHost(v);
+  if (Cpl(m) == 3) need = PAGE_U | PAGE_RW;
+  if ((r = LookupAddress3(m, v, need, need, true))) return r;
+  ThrowSegmentationFault(m, v);
+}
+
 bool IsValidMemory(struct Machine *m, i64 virt, i64 size, int prot) {
   i64 p, pe;
   u64 pte, mask, need;
@@ -367,13 +572,53 @@ bool IsValidMemory(struct Machine *m, i64 virt, i64 size, int prot) {
   return true;
 }
 
+// resolves the longest prefix of [virt,virt+size) that is contiguous in
+// host memory, so bulk copies don't have to be chunked by page. that's
+// always the whole range when linear memory is in use. the pages after
+// the first are looked up without raising, since the caller will visit
+// them again anyway, if the range turns out to be fragmented.
+// @param got receives number of bytes at result, which is nonzero
+// @return host pointer of virt, or NULL w/ EFAULT or ENOMEM
+static u8 *LookupContiguous(struct Machine *m, i64 virt, u64 size, u64 mask,
+                            u64 need, bool writing, u64 *got) {
+  u8 *p, *q;
+  u64 have, entry;
+  if (PinPageRange(m, virt, size) == -1) return 0;
+  if (HasLinearMapping() && !m->metal) {
+    // guest memory is host memory, so the range is contiguous as soon
+    // as every page in it is mapped with the permissions we need
+    for (have = 0; have < size; have += 4096 - ((virt + have) & 4095)) {
+      if (!(entry = FindPermittedPage(m, virt + have, mask, need, writing))) {
+        if (!have) return 0;
+        break;
+      }
+      WatchPageForStores(m, virt + have, entry, need,
+                         ToHost((virt + have) & -4096));
+    }
+    *got = MIN(have, size);
+    return ToHost(virt);
+  }
+  if (!(p = LookupAddress3(m, virt, mask, need, writing))) return 0;
+  have = 4096 - (virt & 4095);
+  if (!m->metal) {
+    for (; have < size; have += 4096) {
+      if (!(q = LookupAddress3(m, virt + have, mask, need, writing)) ||
+          q != p + have) {
+        STATISTIC(++copy_fragments);
+        break;
+      }
+    }
+  }
+  *got = MIN(have, size);
+  return p;
+}
+
 int VirtualCopy(struct Machine *m, i64 v, char *r, u64 n, bool d) {
   u8 *p;
-  u64 k;
-  k = 4096 - (v & 4095);
+  u64 k, mask;
+  mask = Cpl(m) == 3 ? PAGE_U : 0;
   while (n) {
-    k = MIN(k, n);
-    if (!(p = LookupAddress(m, v))) return -1;
+    if (!(p = LookupContiguous(m, v, n, mask, mask, !d, &k))) return -1;
     if (d) {
       memcpy(r, p, k);
     } else if (!IsRomAddress(m, p)) {
@@ -382,7 +627,6 @@ int VirtualCopy(struct Machine *m, i64 v, char *r, u64 n, bool d) {
     n -= k;
     r += k;
     v += k;
-    k = 4096;
   }
   return 0;
 }
@@ -441,7 +685,7 @@ u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
     need = 0;
   }
   if ((v & 4095) + n <= 4096) {
-    if ((res = LookupAddress2(m, v, mask, need))) {
+    if ((res = LookupAddress3(m, v, mask, need, writable))) {
       if (!IsRomAddress(m, res)) return res;
       p1 = res;
       m->stashaddr = v;
@@ -463,8 +707,8 @@ u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
   m->opcache->writable = writable;
   res = m->opcache->stash;
   k = 4096 - (v & 4095);
-  if ((p1 = LookupAddress2(m, v, mask, need))) {
-    if ((p2 = LookupAddress2(m, v + k, mask, need))) {
+  if ((p1 = LookupAddress3(m, v, mask, need, writable))) {
+    if ((p2 = LookupAddress3(m, v + k, mask, need, writable))) {
       IGNORE_RACES_START();
       memcpy(res, p1, k);
       memcpy(res + k, p2, n - k);
@@ -482,9 +726,11 @@ static u8 *AccessRam2(struct Machine *m, i64 v, size_t n, void *p[2], u8 *tmp,
                       bool copy, bool protect_rom) {
   u8 *a, *b;
   unsigned k;
+  u8 *(*resolve)(struct Machine *, i64);
   unassert(n <= 4096);
+  resolve = copy ? ResolveAddress : ResolveWritableAddress;
   if ((v & 4095) + n <= 4096) {
-    a = ResolveAddress(m, v);
+    a = resolve(m, v);
     if (!protect_rom || !IsRomAddress(m, a)) return a;
     if (copy) memcpy(tmp, a, n);
     return tmp;
@@ -493,8 +739,8 @@ static u8 *AccessRam2(struct Machine *m, i64 v, size_t n, void *p[2], u8 *tmp,
   k = 4096;
   k -= v & 4095;
   unassert(k <= 4096);
-  a = ResolveAddress(m, v);
-  b = ResolveAddress(m, v + k);
+  a = resolve(m, v);
+  b = resolve(m, v + k);
   if (copy) {
     memcpy(tmp, a, k);
     memcpy(tmp + k, b, n - k);
@@ -575,30 +821,31 @@ void *AddToFreeList(struct Machine *m, void *mem) {
 }
 
 // Returns pointer to memory in guest memory. If the memory overlaps a
-// page boundary, then it's copied, and the temporary memory is pushed
-// to the free list. Returns NULL w/ EFAULT or ENOMEM on error.
+// page boundary that isn't contiguous on the host, then it's copied and
+// the temporary memory is pushed to the free list. Returns NULL w/ EFAULT
+// or ENOMEM on error.
 void *Schlep(struct Machine *m, i64 addr, size_t size, u64 mask, u64 need) {
   char *copy;
-  size_t have;
-  void *res, *page;
+  void *page;
+  u64 k, have;
+  bool writing;
   if (!size) return 0;
-  if (!(page = LookupAddress2(m, addr, mask, need))) return 0;
-  have = 4096 - (addr & 4095);
-  if (size <= have) {
-    res = page;
-  } else {
-    if (!(copy = (char *)malloc(size))) return 0;
-    memcpy(copy, page, have);
-    for (; have < size; have += 4096) {
-      if (!(page = LookupAddress2(m, addr + have, mask, need))) {
-        free(copy);
-        return 0;
-      }
-      memcpy(copy + have, page, MIN(4096, size - have));
+  writing = !!(need & PAGE_RW);
+  if (!(page = LookupContiguous(m, addr, size, mask, need, writing, &k))) {
+    return 0;
+  }
+  if (k == size) return page;
+  if (!(copy = (char *)malloc(size))) return 0;
+  for (have = 0;;) {
+    memcpy(copy + have, page, k);
+    if ((have += k) == size) break;
+    if (!(page = LookupContiguous(m, addr + have, size - have, mask, need,
+                                  writing, &k))) {
+      free(copy);
+      return 0;
     }
-    res = AddToFreeList(m, copy);
   }
-  return res;
+  return AddToFreeList(m, copy);
 }
 
 void *SchlepR(struct Machine *m, i64 addr, size_t size) {
@@ -618,22 +865,29 @@ void *SchlepRW(struct Machine *m, i64 addr, size_t size) {
 }
 
 // Returns pointer to string in guest memory. If the string overlaps a
-// page boundary, then it's copied, and the temporary memory is pushed
-// to the free list. Returns NULL w/ EFAULT or ENOMEM on error.
+// page boundary that isn't contiguous on the host, then it's copied and
+// the temporary memory is pushed to the free list. Returns NULL w/ EFAULT
+// or ENOMEM on error.
 char *LoadStr(struct Machine *m, i64 addr) {
-  size_t have;
-  char *copy, *page, *p;
-  have = 4096 - (addr & 4095);
+  size_t have, n;
+  char *copy, *base, *page, *p;
   if (!addr) return 0;
-  if (!(page = (char *)LookupAddress2(m, addr, PAGE_U, PAGE_U))) return 0;
-  if ((p = (char *)memchr(page, '\0', have))) {
-    SetReadAddr(m, addr, p - page + 1);
-    return page;
+  if (!(base = (char *)LookupAddress2(m, addr, PAGE_U, PAGE_U))) return 0;
+  for (page = base, have = 0, n = 4096 - (addr & 4095);; n = 4096) {
+    if ((p = (char *)memchr(page, '\0', n))) {
+      SetReadAddr(m, addr, have + (p - page) + 1);
+      return base;
+    }
+    have += n;
+    if (!(page = (char *)LookupAddress2(m, addr + have, PAGE_U, PAGE_U))) {
+      return 0;
+    }
+    if (m->metal || page != base + have) break;
   }
+  STATISTIC(++copy_fragments);
   if (!(copy = (char *)malloc(have + 4096))) return 0;
-  memcpy(copy, page, have);
+  memcpy(copy, base, have);
   for (;;) {
-    if (!(page = (char *)LookupAddress2(m, addr + have, PAGE_U, PAGE_U))) break;
     if ((p = (char *)memccpy(copy + have, page, '\0', 4096))) {
       SetReadAddr(m, addr, have + (p - (copy + have)) + 1);
       return (char *)AddToFreeList(m, copy);
@@ -641,6 +895,7 @@ char *LoadStr(struct Machine *m, i64 addr) {
     have += 4096;
     if (!(p = (char *)realloc(copy, have + 4096))) break;
     copy = p;
+    if (!(page = (char *)LookupAddress2(m, addr + have, PAGE_U, PAGE_U))) break;
   }
   free(copy);
   return 0;
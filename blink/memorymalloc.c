@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "blink/assert.h"
@@ -29,6 +30,7 @@
 #include "blink/debug.h"
 #include "blink/errno.h"
 #include "blink/fds.h"
+#include "blink/flag.h"
 #include "blink/jit.h"
 #include "blink/linux.h"
 #include "blink/log.h"
@@ -37,6 +39,9 @@
 #include "blink/map.h"
 #include "blink/pml4t.h"
 #include "blink/random.h"
+#include "blink/signal.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
 #include "blink/thread.h"
 #include "blink/timespec.h"
 #include "blink/types.h"
@@ -45,9 +50,14 @@
 
 struct Allocator {
   pthread_mutex_t_ lock;
-  struct HostPage *pages GUARDED_BY(lock);
+  pthread_once_t_ zero_once;
+  u8 *zero;
+  size_t n GUARDED_BY(lock);
+  size_t c GUARDED_BY(lock);
+  u64 *pages GUARDED_BY(lock);
 } g_allocator = {
     PTHREAD_MUTEX_INITIALIZER_,
+    PTHREAD_ONCE_INIT_,
 };
 
 struct Machine g_bssmachine;
@@ -61,15 +71,7 @@ static void ClearPage(void *p) {
   FillPage(p, 0);
 }
 
-static struct HostPage *NewHostPage(void) {
-  return (struct HostPage *)malloc(sizeof(struct HostPage));
-}
-
-static void FreeHostPage(struct HostPage *hp) {
-  free(hp);
-}
-
-static u64 TrackHostPage(u8 *ptr) {
+static u64 TrackHostPageLocked(u8 *ptr) {
   u64 entry;
   if (HasLinearMapping()) {
     return (uintptr_t)ptr;
@@ -86,16 +88,44 @@ static u64 TrackHostPage(u8 *ptr) {
   }
 }
 
-void FreeAnonymousPage(struct System *s, u8 *page) {
-  struct HostPage *h;
-  unassert((h = NewHostPage()));
+static u64 TrackHostPage(u8 *ptr) {
+  u64 entry;
+  LOCK(&g_allocator.lock);
+  entry = TrackHostPageLocked(ptr);
+  UNLOCK(&g_allocator.lock);
+  return entry;
+}
+
+static void PushAnonymousPage(u64 page) {
+  if (g_allocator.n == g_allocator.c) {
+    g_allocator.c += 64;
+    g_allocator.c += g_allocator.c >> 1;
+    unassert(g_allocator.pages = (u64 *)realloc(
+                 g_allocator.pages, g_allocator.c * sizeof(*g_allocator.pages)));
+  }
+  g_allocator.pages[g_allocator.n++] = page;
+}
+
+// recycles a zero'd anonymous page. the page keeps its g_hostpages
+// index in non-linear mode, so it can be handed out again later on
+void FreeAnonymousPage(struct System *s, u64 entry) {
   LOCK(&g_allocator.lock);
-  h->page = page;
-  h->next = g_allocator.pages;
-  g_allocator.pages = h;
+  PushAnonymousPage(entry & PAGE_TA);
   UNLOCK(&g_allocator.lock);
 }
 
+static void InitZeroPage(void) {
+  unassert((g_allocator.zero = (u8 *)AllocateBig(
+                FLAG_pagesize, PROT_READ, MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0)));
+}
+
+// returns read-only host page of zeroes, which is shared by all the
+// anonymous guest pages that have been reserved but not yet written
+u8 *GetZeroPage(void) {
+  unassert(!pthread_once_(&g_allocator.zero_once, InitZeroPage));
+  return g_allocator.zero;
+}
+
 static size_t GetBigSize(size_t n) {
   unassert(n);
   long z = FLAG_pagesize;
@@ -120,8 +150,8 @@ void *AllocateBig(size_t n, int prot, int flags, int fd, off_t off) {
   return p != MAP_FAILED ? p : 0;
 }
 
-static void FreePageTable(struct System *s, u8 *page) {
-  FreeAnonymousPage(s, page);
+static void FreePageTable(struct System *s, u64 entry) {
+  FreeAnonymousPage(s, entry);
   s->memstat.tables -= 1;
   s->rss -= 1;
 }
@@ -129,6 +159,7 @@ static void FreePageTable(struct System *s, u8 *page) {
 static bool FreeEmptyPageTables(struct System *s, u64 pt, long level) {
   u8 *mi;
   long i;
+  u64 entry;
   bool isempty = true;
   mi = GetPageAddress(s, pt, level == 1);
   for (i = 0; i < 512; ++i) {
@@ -137,20 +168,20 @@ static bool FreeEmptyPageTables(struct System *s, u64 pt, long level) {
         isempty = false;
       }
     } else {
-      pt = LoadPte(mi + i * 8);
-      if (pt & PAGE_V) {
-        if (FreeEmptyPageTables(s, pt, level + 1)) {
+      entry = LoadPte(mi + i * 8);
+      if (entry & PAGE_V) {
+        if (FreeEmptyPageTables(s, entry, level + 1)) {
           StorePte(mi + i * 8, 0);
         } else {
           isempty = false;
         }
       } else {
-        unassert(!pt);
+        unassert(!entry);
       }
     }
   }
   if (isempty) {
-    FreePageTable(s, mi);
+    FreePageTable(s, pt);
   }
   return isempty;
 }
@@ -222,6 +253,15 @@ struct System *NewSystem(struct XedMachineMode mode) {
   }
   memset(s, 0, sizeof(*s));
   s->mode = mode;
+  if (g_machine) {
+    // execve() keeps the umask of the process
+    s->umask = GetUmask(g_machine->system);
+  } else {
+    // there's no way to read the umask without changing it, which is
+    // only safe before the guest has had a chance to create threads
+    s->umask = umask(0);
+    umask(s->umask);
+  }
   if (s->mode.omode == XED_MODE_REAL) {
     u8 *real =
         Mmap(NULL, ROUNDUP(kRealSize, FLAG_pagesize), PROT_READ | PROT_WRITE,
@@ -239,13 +279,16 @@ struct System *NewSystem(struct XedMachineMode mode) {
   InitJit(&s->jit, (uintptr_t)JitlessDispatch);
 #endif
   InitFds(&s->fds);
+  InitICache(&s->icache);
   unassert(!pthread_mutex_init(&s->sig_lock, 0));
   unassert(!pthread_mutex_init(&s->mmap_lock, 0));
   unassert(!pthread_mutex_init(&s->exec_lock, 0));
+  unassert(!pthread_mutex_init(&s->umask_lock, 0));
   unassert(!pthread_cond_init(&s->machines_cond, 0));
+  unassert(!pthread_cond_init(&s->parked_cond, 0));
   unassert(!pthread_mutex_init(&s->machines_lock, 0));
-  unassert(!pthread_cond_init(&s->pagelocks_cond, 0));
-  unassert(!pthread_mutex_init(&s->pagelocks_lock, 0));
+  unassert(!pthread_cond_init(&s->pins_cond, 0));
+  unassert(!pthread_mutex_init(&s->pins_lock, 0));
   s->blinksigs = (u64)1 << (SIGSYS_LINUX - 1) |   //
                  (u64)1 << (SIGILL_LINUX - 1) |   //
                  (u64)1 << (SIGFPE_LINUX - 1) |   //
@@ -261,17 +304,46 @@ struct System *NewSystem(struct XedMachineMode mode) {
   return s;
 }
 
-static void FreeMachineUnlocked(struct Machine *m) {
-  THR_LOGF("pid=%d tid=%d FreeMachine", m->system->pid, m->tid);
+// releases everything a machine holds, except its own memory
+static void ScrubMachine(struct Machine *m) {
   UnlockRobustFutexes(m);
   if (IsMakingPath(m)) {
     AbandonJit(&m->system->jit, m->path.jb);
   }
   m->sysdepth = 0;
-  CollectPageLocks(m);
+  CollectPagePins(m);
+  FreePagePins(m);
   CollectGarbage(m, 0);
-  free(m->pagelocks.p);
+  CloseWakeFds(m);
+#ifndef DISABLE_JIT
+  DestroySmcQueue(&m->smcqueue);
+#endif
   free(m->freelist.p);
+  m->freelist.p = 0;
+}
+
+// keeps the counts of a machine that's leaving s->machines
+// the caller must hold machines_lock
+static void RetireMachineStats(struct Machine *m) {
+  AddMachineStats(&g_machinestats, &m->stats);
+}
+
+/**
+ * Adds statistics of machines that exist, to those that existed.
+ *
+ * The caller must hold `machines_lock`. Counters are read while their
+ * threads are still incrementing them, so they're only approximate.
+ */
+void SumMachineStats(struct System *s, struct MachineStats *st) {
+  struct Dll *e;
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    AddMachineStats(st, &MACHINE_CONTAINER(e)->stats);
+  }
+}
+
+static void FreeMachineUnlocked(struct Machine *m) {
+  THR_LOGF("pid=%d tid=%d FreeMachine", m->system->pid, m->tid);
+  ScrubMachine(m);
   free(m);
   if (g_machine == m) {
     g_machine = 0;
@@ -313,11 +385,13 @@ StartOver:
                  m->tid);
         atomic_store_explicit(&m->killed, true, memory_order_release);
         atomic_store_explicit(&m->attention, true, memory_order_release);
+        WakeMachine(m);
         if (t < 10) {
           pthread_kill(m->thread, SIGSYS);
         } else {
           LOGF("kill9'd thread after 10 tries");
           pthread_kill(m->thread, SIGKILL);
+          RetireMachineStats(m);
           dll_remove(&s->machines, e);
           UNLOCK(&s->machines_lock);
           goto StartOver;
@@ -341,10 +415,30 @@ void RemoveOtherThreads(struct System *s) {
     g = dll_next(s->machines, e);
     m = MACHINE_CONTAINER(e);
     if (m != g_machine) {
+      RetireMachineStats(m);
       dll_remove(&s->machines, e);
       FreeMachineUnlocked(m);
     }
   }
+  // parked machines were scrubbed already and their threads are gone
+  while ((e = dll_first(s->parked))) {
+    dll_remove(&s->parked, e);
+    free(MACHINE_CONTAINER(e));
+  }
+  s->nparked = 0;
+  unassert(!pthread_cond_init(&s->parked_cond, 0));
+  UNLOCK(&s->machines_lock);
+#endif
+}
+
+static void DrainParkedMachines(struct System *s) {
+#ifdef HAVE_THREADS
+  LOCK(&s->machines_lock);
+  s->noparking = true;
+  unassert(!pthread_cond_broadcast(&s->parked_cond));
+  while (s->nparked) {
+    unassert(!pthread_cond_wait(&s->machines_cond, &s->machines_lock));
+  }
   UNLOCK(&s->machines_lock);
 #endif
 }
@@ -352,17 +446,21 @@ void RemoveOtherThreads(struct System *s) {
 void FreeSystem(struct System *s) {
   THR_LOGF("pid=%d FreeSystem", s->pid);
   unassert(dll_is_empty(s->machines));  // Use KillOtherThreads & FreeMachine
+  DrainParkedMachines(s);
   FreeHostPages(s);
   unassert(!pthread_mutex_destroy(&s->machines_lock));
   unassert(!pthread_cond_destroy(&s->machines_cond));
-  unassert(!pthread_mutex_destroy(&s->pagelocks_lock));
-  unassert(!pthread_cond_destroy(&s->pagelocks_cond));
+  unassert(!pthread_cond_destroy(&s->parked_cond));
+  unassert(!pthread_mutex_destroy(&s->pins_lock));
+  unassert(!pthread_cond_destroy(&s->pins_cond));
   unassert(!pthread_mutex_destroy(&s->exec_lock));
+  unassert(!pthread_mutex_destroy(&s->umask_lock));
   unassert(!pthread_mutex_destroy(&s->mmap_lock));
   // TODO(jart): Figure out why sig_lock sometimes fails to destroy
   (void)pthread_mutex_destroy(&s->sig_lock);
   free(s->elf.interpreter);
   DestroyFds(&s->fds);
+  DestroyICache(&s->icache);
   free(s->elf.execfn);
   free(s->elf.prog);
   FreeFileMaps(s);
@@ -372,22 +470,47 @@ void FreeSystem(struct System *s) {
   free(s);
 }
 
+/**
+ * Creates new machine.
+ *
+ * If `parent` is specified, then the new machine is a thread that will
+ * inherit its state. Such a machine may be taken from the pool of ones
+ * which RecycleMachine() parked, in which case `m->parked` will be set
+ * and the caller must call UnparkMachine() rather than spawning it.
+ */
 struct Machine *NewMachine(struct System *system, struct Machine *parent) {
   _Static_assert(IS2POW(kMaxThreadIds), "");
+  struct Dll *e;
   struct Machine *m;
+  pthread_t thread;
+  bool parked = false;
   unassert(system);
   unassert(!parent || system == parent->system);
-  if (posix_memalign((void **)&m, _Alignof(struct Machine), sizeof(*m))) {
-    enomem();
-    return 0;
-  }
   // TODO(jart): We shouldn't be doing expensive ops in an allocator.
   LOCK(&system->machines_lock);
+  if (parent && (e = dll_first(system->parked))) {
+    dll_remove(&system->parked, e);
+    --system->nparked;
+    m = MACHINE_CONTAINER(e);
+    thread = m->thread;
+    parked = true;
+    STATISTIC(++machines_recycled);
+  } else {
+    UNLOCK(&system->machines_lock);
+    if (posix_memalign((void **)&m, _Alignof(struct Machine), sizeof(*m))) {
+      enomem();
+      return 0;
+    }
+    LOCK(&system->machines_lock);
+  }
   if (parent) {
     memcpy(m, parent, sizeof(*m));
     memset(&m->path, 0, sizeof(m->path));
     memset(&m->freelist, 0, sizeof(m->freelist));
-    memset(&m->pagelocks, 0, sizeof(m->pagelocks));
+    memset(&m->pins, 0, sizeof(m->pins));
+    memset(&m->smcqueue, 0, sizeof(m->smcqueue));
+    memset(&m->stats, 0, sizeof(m->stats));
+    m->selfmodifying = false;
     ResetInstructionCache(m);
     m->insyscall = false;
     m->nofault = false;
@@ -400,10 +523,14 @@ struct Machine *NewMachine(struct System *system, struct Machine *parent) {
   }
   m->ctid = 0;
   m->oplen = 0;
+  m->waitfd = -1;
+  m->wakefd = -1;
   m->system = system;
   m->mode = system->mode;
   m->thread = pthread_self();
   Write32(m->sigaltstack.flags, SS_DISABLE_LINUX);
+  if (parked) m->thread = thread;
+  m->parked = parked;
   if (parent) {
     m->tid = (system->next_tid++ & (kMaxThreadIds - 1)) + kMinThreadId;
   } else {
@@ -432,8 +559,9 @@ void FreeMachine(struct Machine *m) {
   if (m) {
     unassert((s = m->system));
     m->sysdepth = 0;
-    CollectPageLocks(m);
+    CollectPagePins(m);
     LOCK(&s->machines_lock);
+    RetireMachineStats(m);
     dll_remove(&s->machines, &m->elem);
     if (!(orphan = dll_is_empty(s->machines))) {
       unassert(!pthread_cond_signal(&s->machines_cond));
@@ -448,37 +576,104 @@ void FreeMachine(struct Machine *m) {
   }
 }
 
+/**
+ * Frees machine, or parks its host thread so clone() can reuse it.
+ *
+ * This is called by a thread that's exiting. If the pool isn't full,
+ * then the calling thread will sleep until NewMachine() hands it back
+ * with a new register context, in which case true is returned and the
+ * caller should start running the guest thread again. Otherwise false
+ * is returned, `m` has been freed, and the caller must exit.
+ */
+bool RecycleMachine(struct Machine *m) {
+#ifdef HAVE_THREADS
+  sigset_t ss;
+  struct System *s = m->system;
+  if (FLAG_threadpool > 0 &&
+      !atomic_load_explicit(&m->killed, memory_order_acquire)) {
+    m->sysdepth = 0;
+    CollectPagePins(m);
+    LOCK(&s->machines_lock);
+    if (!s->noparking && s->nparked < FLAG_threadpool &&
+        dll_next(s->machines, dll_first(s->machines))) {
+      THR_LOGF("pid=%d tid=%d RecycleMachine", s->pid, m->tid);
+      RetireMachineStats(m);
+      dll_remove(&s->machines, &m->elem);
+      unassert(!pthread_cond_signal(&s->machines_cond));
+      ++s->nparked;
+      UNLOCK(&s->machines_lock);
+      ScrubMachine(m);
+      // host signals must go to threads that are running guest code
+      sigfillset(&ss);
+      unassert(!pthread_sigmask(SIG_SETMASK, &ss, 0));
+      LOCK(&s->machines_lock);
+      if (!s->noparking) {
+        m->parked = true;
+        dll_make_first(&s->parked, &m->elem);
+        do {
+          unassert(!pthread_cond_wait(&s->parked_cond, &s->machines_lock));
+        } while (m->parked && !s->noparking);
+      }
+      if (m->parked || s->noparking) {
+        // system is being destroyed, so we were never handed back
+        if (m->parked) dll_remove(&s->parked, &m->elem);
+        --s->nparked;
+        unassert(!pthread_cond_signal(&s->machines_cond));
+        UNLOCK(&s->machines_lock);
+        free(m);
+        if (g_machine == m) {
+          g_machine = 0;
+        }
+        return false;
+      }
+      UNLOCK(&s->machines_lock);
+      return true;
+    }
+    UNLOCK(&s->machines_lock);
+  }
+#endif
+  FreeMachine(m);
+  return false;
+}
+
+/**
+ * Wakes the host thread of a machine NewMachine() took from the pool.
+ */
+void UnparkMachine(struct Machine *m) {
+#ifdef HAVE_THREADS
+  struct System *s = m->system;
+  LOCK(&s->machines_lock);
+  unassert(m->parked);
+  m->parked = false;
+  unassert(!pthread_cond_broadcast(&s->parked_cond));
+  UNLOCK(&s->machines_lock);
+#endif
+}
+
 u64 AllocateAnonymousPage(struct System *s) {
   u8 *page;
   size_t i, n;
-  struct HostPage *h;
+  u64 entry;
   LOCK(&g_allocator.lock);
-  if ((h = g_allocator.pages)) {
-    g_allocator.pages = h->next;
-    UNLOCK(&g_allocator.lock);
-    page = h->page;
-    FreeHostPage(h);
-    goto Finished;
-  } else {
+  if (!g_allocator.n) {
+    // refill the pool in bulk, so that the host mmap() call and the
+    // page tracking costs are amortized across a batch of faults
     UNLOCK(&g_allocator.lock);
+    n = 64;
+    page = (u8 *)AllocateBig(n * 4096, PROT_READ | PROT_WRITE,
+                             MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0);
+    if (!page) return -1;
+    LOCK(&g_allocator.lock);
+    for (i = n; i--;) {
+      PushAnonymousPage(TrackHostPageLocked(page + i * 4096));
+    }
+    STATISTIC(++page_pool_refills);
   }
-  n = 64;
-  page = (u8 *)AllocateBig(n * 4096, PROT_READ | PROT_WRITE,
-                           MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0);
-  if (!page) return -1;
-  LOCK(&g_allocator.lock);
-  for (i = n; i-- > 1;) {
-    unassert((h = NewHostPage()));
-    h->page = page + i * 4096;
-    h->next = g_allocator.pages;
-    g_allocator.pages = h;
-  }
+  entry = g_allocator.pages[--g_allocator.n];
   UNLOCK(&g_allocator.lock);
-Finished:
   s->rss += 1;
-  i = TrackHostPage(page);
-  unassert(!(i & ~PAGE_TA));
-  return i | PAGE_HOST | PAGE_U | PAGE_RW | PAGE_V;
+  unassert(!(entry & ~PAGE_TA));
+  return entry | PAGE_HOST | PAGE_U | PAGE_RW | PAGE_V;
 }
 
 u64 AllocatePageTable(struct System *s) {
@@ -517,6 +712,9 @@ void InvalidateSystem(struct System *s, bool tlb, bool icache) {
     }
     UNLOCK(&s->machines_lock);
   }
+  if (icache) {
+    ResetICache(&s->icache);
+  }
 }
 
 struct FileMap *AddFileMap(struct System *s, i64 virt, i64 size,
@@ -554,7 +752,7 @@ static void AddFileMapViaMap(struct System *s, i64 virt, i64 size, int fildes,
   struct Fd *fd;
   struct FileMap *fm;
   LOCK(&s->fds.lock);
-  path = (fd = GetFd(&s->fds, fildes)) ? strdup(fd->path) : 0;
+  path = (fd = GetFd(&s->fds, fildes)) && fd->path ? strdup(fd->path) : 0;
   UNLOCK(&s->fds.lock);
   fm = AddFileMap(s, virt, size, path, offset);
   free(path);
@@ -608,23 +806,66 @@ static void UnmarkFilePage(struct System *s, i64 virt) {
   }
 }
 
-static void WaitForPageToNotBeLocked(struct System *s, i64 virt, u8 *pte) {
-  unassert(g_machine);
-#ifdef DEBUG
-  unassert(!IsOrphan(g_machine));
-  unassert(!HasPageLock(g_machine, virt & -4096));
-#endif
-  LOCK(&s->pagelocks_lock);
-  while (LoadPte(pte) & PAGE_LOCKS) {
-    unassert(!pthread_cond_wait(&s->pagelocks_cond, &s->pagelocks_lock));
+static bool HasPinnedPages(struct System *s, i64 lo, i64 hi) {
+  int i;
+  i64 plo, phi;
+  struct Dll *e;
+  struct Machine *m;
+  struct PagePins *b;
+  bool res = false;
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e && !res; e = dll_next(s->machines, e)) {
+    m = MACHINE_CONTAINER(e);
+    if (m == g_machine) continue;
+    for (b = &m->pins; b && !res;
+         b = atomic_load_explicit(&b->more, memory_order_acquire)) {
+      for (i = 0; i < kPagePinSlots; ++i) {
+        plo = atomic_load_explicit(&b->p[i].lo, memory_order_seq_cst);
+        phi = atomic_load_explicit(&b->p[i].hi, memory_order_seq_cst);
+        if (plo < phi && plo < hi && lo < phi) {
+          res = true;
+          break;
+        }
+      }
+    }
+  }
+  UNLOCK(&s->machines_lock);
+  return res;
+}
+
+// announces [virt,virt+size) is about to be unmapped, and then waits
+// for other threads to finish any system calls that have pinned pages
+// within that interval. new pins are prevented until UnfencePages().
+// the caller must hold mmap_lock, which ensures only one fence exists
+static void FencePages(struct System *s, i64 virt, i64 size) {
+  unsigned gen;
+  atomic_store_explicit(&s->fencelo, virt, memory_order_seq_cst);
+  atomic_store_explicit(&s->fencehi, virt + size, memory_order_seq_cst);
+  for (;;) {
+    LOCK(&s->pins_lock);
+    gen = s->pinsgen;
+    UNLOCK(&s->pins_lock);
+    if (!HasPinnedPages(s, virt, virt + size)) break;
+    STATISTIC(++page_pin_waits);
+    LOCK(&s->pins_lock);
+    while (s->pinsgen == gen) {
+      unassert(!pthread_cond_wait(&s->pins_cond, &s->pins_lock));
+    }
+    UNLOCK(&s->pins_lock);
   }
-  UNLOCK(&s->pagelocks_lock);
+}
+
+static void UnfencePages(struct System *s) {
+  atomic_store_explicit(&s->fencehi, 0, memory_order_seq_cst);
+  atomic_store_explicit(&s->fencelo, 0, memory_order_seq_cst);
+  LOCK(&s->pins_lock);
+  unassert(!pthread_cond_broadcast(&s->pins_cond));
+  UNLOCK(&s->pins_lock);
 }
 
 static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
                      bool *executable_code_was_made_non_executable,
                      long *rss_delta) {
-  u8 *page;
   long pagesize;
   unassert(entry & PAGE_V);
   if (entry & PAGE_FILE) UnmarkFilePage(s, virt);
@@ -639,8 +880,8 @@ static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
   if ((entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) == PAGE_HOST) {
     unassert(~entry & PAGE_RSRV);
     s->memstat.committed -= 1;
-    ClearPage((page = FindHostPage(entry)));
-    FreeAnonymousPage(s, page);
+    ClearPage(FindHostPage(entry));
+    FreeAnonymousPage(s, entry);
     --*rss_delta;
     return false;
   } else if ((entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) ==
@@ -714,12 +955,7 @@ static void RemoveVirtual(struct System *s, i64 virt, i64 size,
       if (i > 12) continue;
     LastLevel:
       if (pt & PAGE_V) {
-        for (;;) {
-          if (pt & PAGE_LOCKS) {
-            WaitForPageToNotBeLocked(s, virt, pp);
-          } else if (CasPte(pp, pt, 0)) {
-            break;
-          }
+        while (!CasPte(pp, pt, 0)) {
           pt = LoadPte(pp);
           unassert(pt & PAGE_V);
         }
@@ -749,7 +985,7 @@ static void RemoveVirtual(struct System *s, i64 virt, i64 size,
         // crawl an old pointer to a free page table. free page
         // tables may be crawled because they always get zero'd
         // before being put into a freelist fifo that cools off
-        FreePageTable(s, GetPageAddress(s, LoadPte(pde), i == 39));
+        FreePageTable(s, LoadPte(pde));
         StorePte(pde, 0);
       }
       break;
@@ -798,6 +1034,7 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
   int demand;
   int method;
   i64 result;
+  bool fenced;
   bool mutated;
   void *got, *want;
   long i, pagesize;
@@ -846,11 +1083,16 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
   // remove existing mapping
   vss_delta = 0;
   rss_delta = 0;
+  fenced = false;
   mutated = false;
   executable_code_was_made_non_executable = false;
   pages = ROUNDUP(size, 4096) / 4096;
   if (HasLinearMapping() && FLAG_vabits <= 47) {
     if (fixedmap) {
+      // the kernel replaces the old memory in place, so system calls
+      // using it must finish before it happens, just like munmap()
+      FencePages(s, virt, size);
+      fenced = true;
       method = MAP_FIXED;
     } else if (virt) {
       method = MAP_DEMAND;
@@ -864,9 +1106,11 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
       demand = MAP_FIXED;
     }
     memset(&ranges, 0, sizeof(ranges));
+    FencePages(s, virt, size);
     RemoveVirtual(s, virt, size, &ranges,
                   &executable_code_was_made_non_executable, &mutated,
                   &vss_delta, &rss_delta);
+    UnfencePages(s);
     if (ranges.i) {
       // linear mappings exist within the requested interval
       if (ranges.i == 1 &&          //
@@ -906,6 +1150,7 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
                     fd, offset, "linear")) != want) {
       if (got == MAP_FAILED && errno == ENOMEM && !mutated) {
         LOGF("host system returned ENOMEM");
+        if (fenced) UnfencePages(s);
         return -1;
       } else if (got != MAP_FAILED && !want) {
         virt = ToGuest(got);
@@ -1001,15 +1246,8 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
         } else {
           entry = flags | PAGE_V;
         }
-        for (;;) {
-          pt = LoadPte(mi);
-          if (pt & PAGE_LOCKS) {
-            unassert(pt & PAGE_V);
-            WaitForPageToNotBeLocked(s, virt, mi);
-          } else if (CasPte(mi, pt, entry)) {
-            break;
-          }
-        }
+        do pt = LoadPte(mi);
+        while (!CasPte(mi, pt, entry));
         if (pt & PAGE_V) {
           FreePage(s, virt, pt, 4096, &executable_code_was_made_non_executable,
                    &rss_delta);
@@ -1024,6 +1262,7 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
 #endif
           InvalidateSystem(s, !!rss_delta,
                            executable_code_was_made_non_executable);
+          if (fenced) UnfencePages(s);
           return result;
         }
         if (++ti == 512) break;
@@ -1076,6 +1315,7 @@ int FreeVirtual(struct System *s, i64 virt, i64 size) {
   rss_delta = 0;
   memset(&ranges, 0, sizeof(ranges));
   executable_code_was_made_non_executable = false;
+  FencePages(s, virt, size);
   RemoveVirtual(s, virt, size, &ranges,
                 &executable_code_was_made_non_executable, &mutated, &vss_delta,
                 &rss_delta);
@@ -1089,6 +1329,7 @@ int FreeVirtual(struct System *s, i64 virt, i64 size) {
       rc = einval();
     }
   }
+  UnfencePages(s);
   free(ranges.p);
   s->vss += vss_delta;
   s->rss += rss_delta;
@@ -293,27 +293,35 @@ u8 *GetModrmRegisterXmmPointerWrite16(P) {
   return GetModrmRegisterXmmPointerWrite(A, 16);
 }
 
-static u8 *GetVectorAddress(P, size_t n) {
+static u8 *GetVectorAddress(P, size_t n, bool writable) {
   u8 *p;
   i64 v;
   if (IsModrmRegister(rde)) {
     p = XmmRexbRm(m, rde);
   } else {
     v = ComputeAddress(A);
-    SetReadAddr(m, v, n);
-    if ((v & (n - 1)) || !(p = LookupAddress(m, v))) {
-      ThrowSegmentationFault(m, v);
+    if (v & (n - 1)) ThrowSegmentationFault(m, v);
+    if (writable) {
+      SetWriteAddr(m, v, n);
+      p = ResolveWritableAddress(m, v);
+    } else {
+      SetReadAddr(m, v, n);
+      p = ResolveAddress(m, v);
     }
   }
   return p;
 }
 
 u8 *GetMmxAddress(P) {
-  return GetVectorAddress(A, 8);
+  return GetVectorAddress(A, 8, false);
 }
 
 u8 *GetXmmAddress(P) {
-  return GetVectorAddress(A, 16);
+  return GetVectorAddress(A, 16, false);
+}
+
+u8 *GetXmmAddressWrite(P) {
+  return GetVectorAddress(A, 16, true);
 }
 
 u8 *GetModrmReadBW(P) {
@@ -84,6 +84,7 @@ u8 *GetModrmRegisterXmmPointerWrite16(P);
 u8 *GetModrmRegisterXmmPointerWrite4(P);
 u8 *GetModrmRegisterXmmPointerWrite8(P);
 u8 *GetXmmAddress(P) returnsaligned((16));
+u8 *GetXmmAddressWrite(P) returnsaligned((16));
 u8 *GetMmxAddress(P) returnsaligned((8));
 
 #endif /* BLINK_MODRM_H_ */
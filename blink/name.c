@@ -292,7 +292,7 @@ const char *DescribeMopcode(int code) {
     XLAT(0x10B, "OpUd");
     XLAT(0x10C, "OpUd");
     XLAT(0x10D, "OpHintNopEv");
-    XLAT(0x10E, "OpUd");
+    XLAT(0x10E, "OpVdso");
     XLAT(0x10F, "OpUd");
     XLAT(0x110, "OpMov0f10");
     XLAT(0x111, "OpMovWpsVps");
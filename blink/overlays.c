@@ -32,16 +32,187 @@
 #include "blink/fspath.h"
 #include "blink/likely.h"
 #include "blink/log.h"
+#include "blink/stats.h"
 #include "blink/syscall.h"
 #include "blink/thompike.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/types.h"
 #include "blink/util.h"
 
 #ifndef DISABLE_OVERLAYS
 
 #define UNREACHABLE "(unreachable)"
 
+#define CACHE_LOOKUP   1  // result may be answered by and saved to the cache
+#define CACHE_NOFOLLOW 2  // final component isn't followed if it's a symlink
+#define CACHE_FORGET   4  // may create or remove the path on success
+#define CACHE_FLUSH    8  // may change what other paths resolve to
+
+// Remembers which overlay an absolute path was found in, or that it
+// wasn't found in any of them, so each path operation doesn't have to
+// ask the host about every layer. A remembered layer is only a hint
+// that gets tried first; if the file isn't there anymore we search all
+// the layers again. Paths that weren't found are trusted until they're
+// created by us, or until they expire, since another process might've
+// created them. Following symlinks can find a different layer than not
+// following them, so the two kinds of lookup are remembered apart.
+struct OverlayEntry {
+  struct OverlayEntry *next;
+  struct timespec expires;
+  u64 hash;
+  int layer;  // or -1 if not found, in which case err is the errno
+  int err;
+  bool nofollow;
+  size_t len;
+  char path[];
+};
+
+struct OverlayCache {
+  pthread_mutex_t_ lock;
+  int count GUARDED_BY(lock);
+  struct OverlayEntry *hash[kOverlayHash] GUARDED_BY(lock);
+};
+
 static char **g_overlays;
 
+static struct OverlayCache g_overlaycache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void LockOverlayCache(void) {
+  LOCK(&g_overlaycache.lock);
+}
+
+static void UnlockOverlayCache(void) {
+  UNLOCK(&g_overlaycache.lock);
+}
+
+static u64 HashOverlayPath(const char *path, size_t len, bool nofollow) {
+  size_t i;
+  u64 h = 0xcbf29ce484222325 ^ nofollow;
+  for (i = 0; i < len; ++i) {
+    h = (h ^ (path[i] & 255)) * 0x100000001b3;
+  }
+  return h;
+}
+
+static void FlushOverlayCacheLocked(void) {
+  int i;
+  struct OverlayEntry *e, *next;
+  for (i = 0; i < kOverlayHash; ++i) {
+    for (e = g_overlaycache.hash[i]; e; e = next) {
+      next = e->next;
+      free(e);
+    }
+    g_overlaycache.hash[i] = 0;
+  }
+  g_overlaycache.count = 0;
+}
+
+// Forgets everything the overlay cache knows, which is needed when we
+// can't tell which paths an operation might've changed, e.g. rename(),
+// or when a child process may have changed the host file system.
+void OverlaysFlushCache(void) {
+  LOCK(&g_overlaycache.lock);
+  if (g_overlaycache.count) {
+    STATISTIC(++overlay_flushes);
+    FlushOverlayCacheLocked();
+  }
+  UNLOCK(&g_overlaycache.lock);
+}
+
+static void ForgetOverlayPath(const char *path) {
+  int i;
+  u64 hash;
+  size_t len;
+  struct OverlayEntry *e, **ep;
+  len = strlen(path);
+  LOCK(&g_overlaycache.lock);
+  for (i = 0; i < 2; ++i) {
+    hash = HashOverlayPath(path, len, i);
+    for (ep = g_overlaycache.hash + hash % kOverlayHash; (e = *ep);) {
+      if (e->hash == hash && e->nofollow == i && e->len == len &&
+          !memcmp(e->path, path, len)) {
+        *ep = e->next;
+        --g_overlaycache.count;
+        free(e);
+      } else {
+        ep = &e->next;
+      }
+    }
+  }
+  UNLOCK(&g_overlaycache.lock);
+}
+
+// Returns layer that `path` was last found in, or -1 w/ errno if it's
+// known to not exist in any of them, or -2 if we don't know.
+static int GetOverlayLayer(const char *path, bool nofollow) {
+  u64 hash;
+  size_t len;
+  int layer = -2;
+  struct timespec now;
+  struct OverlayEntry *e, **ep;
+  len = strlen(path);
+  hash = HashOverlayPath(path, len, nofollow);
+  now = GetMonotonic();
+  LOCK(&g_overlaycache.lock);
+  for (ep = g_overlaycache.hash + hash % kOverlayHash; (e = *ep);
+       ep = &e->next) {
+    if (e->hash == hash && e->nofollow == nofollow && e->len == len &&
+        !memcmp(e->path, path, len)) {
+      if (CompareTime(now, e->expires) >= 0) {
+        *ep = e->next;
+        --g_overlaycache.count;
+        free(e);
+        break;
+      }
+      STATISTIC(++overlay_hits);
+      if ((layer = e->layer) == -1) errno = e->err;
+      break;
+    }
+  }
+  UNLOCK(&g_overlaycache.lock);
+  if (layer == -2) STATISTIC(++overlay_misses);
+  return layer;
+}
+
+static void SetOverlayLayer(const char *path, bool nofollow, int layer,
+                            int err) {
+  size_t len;
+  struct OverlayEntry *e, **ep;
+  len = strlen(path);
+  if (!(e = (struct OverlayEntry *)malloc(sizeof(*e) + len + 1))) return;
+  e->expires = AddTime(GetMonotonic(), FromMilliseconds(kOverlayTtlMs));
+  e->hash = HashOverlayPath(path, len, nofollow);
+  e->layer = layer;
+  e->err = err;
+  e->nofollow = nofollow;
+  e->len = len;
+  memcpy(e->path, path, len + 1);
+  LOCK(&g_overlaycache.lock);
+  if (g_overlaycache.count >= kOverlayPaths) {
+    STATISTIC(++overlay_flushes);
+    FlushOverlayCacheLocked();
+  }
+  ep = g_overlaycache.hash + e->hash % kOverlayHash;
+  e->next = *ep;
+  *ep = e;
+  ++g_overlaycache.count;
+  UNLOCK(&g_overlaycache.lock);
+}
+
+// Updates cache after an operation on `path` succeeded.
+static void ChangedOverlayPath(const char *path, int how) {
+  if ((how & CACHE_FLUSH) || ((how & CACHE_FORGET) && path[0] != '/')) {
+    // we don't know the absolute path of relative names
+    OverlaysFlushCache();
+  } else if (how & CACHE_FORGET) {
+    ForgetOverlayPath(path);
+  }
+}
+
 static void FreeStrings(char **ss) {
   size_t i;
   if (!ss) return;
@@ -75,6 +246,7 @@ static char **SplitString(const char *s, int c) {
 }
 
 static void FreeOverlays(void) {
+  OverlaysFlushCache();
   FreeStrings(g_overlays);
   g_overlays = 0;
 }
@@ -139,6 +311,9 @@ int SetOverlays(const char *config, bool cd_into_chroot) {
   }
   if (!once) {
     atexit(FreeOverlays);
+    unassert(!pthread_atfork(LockOverlayCache,    //
+                             UnlockOverlayCache,  //
+                             UnlockOverlayCache));
     once = 1;
   }
   FreeOverlays();
@@ -206,104 +381,142 @@ int OverlaysChdir(const char *path) {
   return Chdir(path);
 }
 
+static bool IsMissingErrno(void) {
+  return errno == ENOENT || errno == ENOTDIR;
+}
+
+// opens `path` in the i'th overlay, returning -2 if it should be skipped
+static int OpenOverlay(size_t i, const char *path, int flags, int mode) {
+  int fd, dirfd;
+  if (!*g_overlays[i]) {
+    return open(path, flags, mode);
+  }
+  dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+  if (dirfd == -1) {
+    if (IsUnrecoverableErrno()) {
+      return -1;
+    } else {
+      LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
+      return -2;
+    }
+  }
+  if ((fd = openat(dirfd, !path[1] ? "." : path + 1, flags, mode)) != -1) {
+    unassert(dup2(fd, dirfd) == dirfd);
+    if (flags & O_CLOEXEC) {
+      unassert(!fcntl(dirfd, F_SETFD, FD_CLOEXEC));
+    }
+    unassert(!close(fd));
+    return dirfd;
+  }
+  unassert(!close(dirfd));
+  return -1;
+}
+
 int OverlaysOpen(int dirfd, const char *path, int flags, int mode) {
   int fd;
-  size_t i;
-  int err = -1;
+  int i, err = -1;
+  bool nofollow = !!(flags & O_NOFOLLOW);
   if (!path) return efault();
   if (!*path) return enoent();
   if (path[0] != '/' && path[0]) {
-    return openat(dirfd, path, flags, mode);
+    if ((fd = openat(dirfd, path, flags, mode)) != -1 && (flags & O_CREAT)) {
+      ChangedOverlayPath(path, CACHE_FORGET);
+    }
+    return fd;
+  }
+  if (!(flags & O_CREAT)) {
+    if ((i = GetOverlayLayer(path, nofollow)) >= 0) {
+      if ((fd = OpenOverlay(i, path, flags, mode)) >= 0) return fd;
+      if (fd == -1 && !IsMissingErrno()) return -1;
+      ForgetOverlayPath(path);
+    } else if (i == -1) {
+      return -1;
+    }
   }
   for (i = 0; g_overlays[i]; ++i) {
-    if (!*g_overlays[i]) {
-      if ((fd = open(path, flags, mode)) != -1) {
-        return fd;
-      }
-      if (errno != ENOENT && errno != ENOTDIR) {
-        return -1;
-      }
-      if (err == -1) {
-        err = errno;
-      }
-    } else {
-      dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-      if (dirfd == -1) {
-        if (IsUnrecoverableErrno()) {
-          return -1;
-        } else {
-          LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
-          continue;
-        }
-      }
-      if ((fd = openat(dirfd, !path[1] ? "." : path + 1, flags, mode)) != -1) {
-        unassert(dup2(fd, dirfd) == dirfd);
-        if (flags & O_CLOEXEC) {
-          unassert(!fcntl(dirfd, F_SETFD, FD_CLOEXEC));
-        }
-        unassert(!close(fd));
-        return dirfd;
-      }
-      if (err == -1) {
-        err = errno;
-      }
-      unassert(!close(dirfd));
-      if (errno != ENOENT && errno != ENOTDIR) {
-        return -1;
+    if ((fd = OpenOverlay(i, path, flags, mode)) >= 0) {
+      if (flags & O_CREAT) {
+        ChangedOverlayPath(path, CACHE_FORGET);
+      } else {
+        SetOverlayLayer(path, nofollow, i, 0);
       }
+      return fd;
     }
+    if (fd == -2) continue;
+    if (!IsMissingErrno()) return -1;
+    if (err == -1) err = errno;
   }
   unassert(err != -1);
+  if (!(flags & O_CREAT)) SetOverlayLayer(path, nofollow, -1, err);
   errno = err;
   return -1;
 }
 
+// runs operation in the i'th overlay, returning -2 if it should be skipped
+static ssize_t RunOverlay(size_t i, const char *path, void *args,
+                          ssize_t fgenericat(int, const char *, void *)) {
+  int dirfd;
+  ssize_t rc;
+  if (!*g_overlays[i]) {
+    return fgenericat(AT_FDCWD, path, args);
+  }
+  dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+  if (dirfd == -1) {
+    if (IsUnrecoverableErrno()) {
+      return -1;
+    } else {
+      LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
+      return -2;
+    }
+  }
+  rc = fgenericat(dirfd, !path[1] ? "." : path + 1, args);
+  unassert(!close(dirfd));
+  return rc;
+}
+
 static ssize_t OverlaysGeneric(int dirfd, const char *path, void *args,
-                               ssize_t fgenericat(int, const char *, void *)) {
+                               ssize_t fgenericat(int, const char *, void *),
+                               int how) {
   _Static_assert(sizeof(ssize_t) >= sizeof(int), "");
-  size_t i;
+  int i;
   ssize_t rc;
   int err = -1;
+  bool nofollow = !!(how & CACHE_NOFOLLOW);
   if (!path) return efault();
   if (!*path) return enoent();
   if (path[0] != '/' && path[0]) {
-    return fgenericat(dirfd, path, args);
+    if ((rc = fgenericat(dirfd, path, args)) != -1) {
+      ChangedOverlayPath(path, how);
+    }
+    return rc;
   }
-  for (i = 0; g_overlays[i]; ++i) {
-    if (!*g_overlays[i]) {
-      if ((rc = fgenericat(AT_FDCWD, path, args)) != -1) {
-        return rc;
-      }
-      if (err == -1) {
-        err = errno;
-      }
-      if (err != ENOENT && err != ENOTDIR) {
-        return -1;
-      }
-    } else {
-      dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-      if (dirfd == -1) {
-        if (IsUnrecoverableErrno()) {
-          return -1;
-        } else {
-          LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
-          continue;
-        }
-      }
-      if ((rc = fgenericat(dirfd, !path[1] ? "." : path + 1, args)) != -1) {
-        unassert(!close(dirfd));
+  if (how & CACHE_LOOKUP) {
+    if ((i = GetOverlayLayer(path, nofollow)) >= 0) {
+      if ((rc = RunOverlay(i, path, args, fgenericat)) >= 0) {
+        ChangedOverlayPath(path, how);
         return rc;
       }
-      if (err == -1) {
-        err = errno;
-      }
-      unassert(!close(dirfd));
-      if (errno != ENOENT && errno != ENOTDIR) {
-        return -1;
+      if (rc == -1 && !IsMissingErrno()) return -1;
+      ForgetOverlayPath(path);
+    } else if (i == -1) {
+      return -1;
+    }
+  }
+  for (i = 0; g_overlays[i]; ++i) {
+    if ((rc = RunOverlay(i, path, args, fgenericat)) >= 0) {
+      if (how & (CACHE_FORGET | CACHE_FLUSH)) {
+        ChangedOverlayPath(path, how);
+      } else if (how & CACHE_LOOKUP) {
+        SetOverlayLayer(path, nofollow, i, 0);
       }
+      return rc;
     }
+    if (rc == -2) continue;
+    if (!IsMissingErrno()) return -1;
+    if (err == -1) err = errno;
   }
   unassert(err != -1);
+  if (how & CACHE_LOOKUP) SetOverlayLayer(path, nofollow, -1, err);
   errno = err;
   return -1;
 }
@@ -322,7 +535,9 @@ static ssize_t Stat(int dirfd, const char *path, void *vargs) {
 
 int OverlaysStat(int dirfd, const char *path, struct stat *st, int flags) {
   struct Stat args = {st, flags};
-  return OverlaysGeneric(dirfd, path, &args, Stat);
+  return OverlaysGeneric(dirfd, path, &args, Stat,
+                         CACHE_LOOKUP |
+                             (flags & AT_SYMLINK_NOFOLLOW ? CACHE_NOFOLLOW : 0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -339,7 +554,9 @@ static ssize_t Access(int dirfd, const char *path, void *vargs) {
 
 int OverlaysAccess(int dirfd, const char *path, mode_t mode, int flags) {
   struct Access args = {mode, flags};
-  return OverlaysGeneric(dirfd, path, &args, Access);
+  return OverlaysGeneric(dirfd, path, &args, Access,
+                         CACHE_LOOKUP |
+                             (flags & AT_SYMLINK_NOFOLLOW ? CACHE_NOFOLLOW : 0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -355,7 +572,8 @@ static ssize_t Unlink(int dirfd, const char *path, void *vargs) {
 
 int OverlaysUnlink(int dirfd, const char *path, int flags) {
   struct Unlink args = {flags};
-  return OverlaysGeneric(dirfd, path, &args, Unlink);
+  return OverlaysGeneric(dirfd, path, &args, Unlink,
+                         CACHE_LOOKUP | CACHE_NOFOLLOW | CACHE_FORGET);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -371,7 +589,7 @@ static ssize_t Mkdir(int dirfd, const char *path, void *vargs) {
 
 int OverlaysMkdir(int dirfd, const char *path, mode_t mode) {
   struct Mkdir args = {mode};
-  return OverlaysGeneric(dirfd, path, &args, Mkdir);
+  return OverlaysGeneric(dirfd, path, &args, Mkdir, CACHE_FORGET);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -387,7 +605,7 @@ static ssize_t Mkfifo(int dirfd, const char *path, void *vargs) {
 
 int OverlaysMkfifo(int dirfd, const char *path, mode_t mode) {
   struct Mkfifo args = {mode};
-  return OverlaysGeneric(dirfd, path, &args, Mkfifo);
+  return OverlaysGeneric(dirfd, path, &args, Mkfifo, CACHE_FORGET);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -404,7 +622,11 @@ static ssize_t Chmod(int dirfd, const char *path, void *vargs) {
 
 int OverlaysChmod(int dirfd, const char *path, mode_t mode, int flags) {
   struct Chmod args = {mode, flags};
-  return OverlaysGeneric(dirfd, path, &args, Chmod);
+  // permissions of a directory decide if looking beneath it fails with
+  // EACCES rather than ENOENT, which changes what layer is used
+  return OverlaysGeneric(dirfd, path, &args, Chmod,
+                         CACHE_LOOKUP | CACHE_FLUSH |
+                             (flags & AT_SYMLINK_NOFOLLOW ? CACHE_NOFOLLOW : 0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -423,7 +645,9 @@ static ssize_t Chown(int dirfd, const char *path, void *vargs) {
 int OverlaysChown(int dirfd, const char *path, uid_t uid, gid_t gid,
                   int flags) {
   struct Chown args = {uid, gid, flags};
-  return OverlaysGeneric(dirfd, path, &args, Chown);
+  return OverlaysGeneric(dirfd, path, &args, Chown,
+                         CACHE_LOOKUP | CACHE_FLUSH |
+                             (flags & AT_SYMLINK_NOFOLLOW ? CACHE_NOFOLLOW : 0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -439,7 +663,8 @@ static ssize_t Symlink(int dirfd, const char *path, void *vargs) {
 
 int OverlaysSymlink(const char *target, int dirfd, const char *path) {
   struct Symlink args = {target};
-  return OverlaysGeneric(dirfd, path, &args, Symlink);
+  // paths beneath the new link may now resolve in this layer
+  return OverlaysGeneric(dirfd, path, &args, Symlink, CACHE_FLUSH);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -456,7 +681,8 @@ static ssize_t Readlink(int dirfd, const char *path, void *vargs) {
 
 ssize_t OverlaysReadlink(int dirfd, const char *path, char *buf, size_t size) {
   struct Readlink args = {buf, size};
-  return OverlaysGeneric(dirfd, path, &args, Readlink);
+  return OverlaysGeneric(dirfd, path, &args, Readlink,
+                         CACHE_LOOKUP | CACHE_NOFOLLOW);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -474,7 +700,9 @@ static ssize_t Utime(int dirfd, const char *path, void *vargs) {
 int OverlaysUtime(int dirfd, const char *path, const struct timespec times[2],
                   int flags) {
   struct Utime args = {times, flags};
-  return OverlaysGeneric(dirfd, path, &args, Utime);
+  return OverlaysGeneric(dirfd, path, &args, Utime,
+                         CACHE_LOOKUP |
+                             (flags & AT_SYMLINK_NOFOLLOW ? CACHE_NOFOLLOW : 0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -565,7 +793,13 @@ static ssize_t Rename(int srcdirfd, const char *srcpath, int dstdirfd,
 
 int OverlaysRename(int srcdirfd, const char *srcpath, int dstdirfd,
                    const char *dstpath) {
-  return OverlaysGeneric2(srcdirfd, srcpath, dstdirfd, dstpath, 0, Rename);
+  int rc;
+  // everything beneath the destination may now resolve differently
+  if ((rc = OverlaysGeneric2(srcdirfd, srcpath, dstdirfd, dstpath, 0,
+                             Rename)) != -1) {
+    OverlaysFlushCache();
+  }
+  return rc;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -583,7 +817,12 @@ static ssize_t Link(int srcdirfd, const char *srcpath, int dstdirfd,
 int OverlaysLink(int srcdirfd, const char *srcpath, int dstdirfd,
                  const char *dstpath, int flags) {
   struct Link args = {flags};
-  return OverlaysGeneric2(srcdirfd, srcpath, dstdirfd, dstpath, &args, Link);
+  int rc;
+  if ((rc = OverlaysGeneric2(srcdirfd, srcpath, dstdirfd, dstpath, &args,
+                             Link)) != -1) {
+    ChangedOverlayPath(dstpath, CACHE_FORGET);
+  }
+  return rc;
 }
 
 #endif /* DISABLE_OVERLAYS */
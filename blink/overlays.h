@@ -8,6 +8,7 @@
 #define DEFAULT_OVERLAYS ":o"
 
 int OverlaysChdir(const char *);
+void OverlaysFlushCache(void);
 int SetOverlays(const char *, bool);
 char *OverlaysGetcwd(char *, size_t);
 int OverlaysUnlink(int, const char *, int);
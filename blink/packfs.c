@@ -0,0 +1,1048 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/packfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/stats.h"
+#include "blink/thread.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+
+#if defined(__APPLE__) || defined(__NetBSD__)
+#define st_atim st_atimespec
+#define st_ctim st_ctimespec
+#define st_mtim st_mtimespec
+#endif
+
+#ifndef DISABLE_VFS
+
+// packfs serves a read-only tree of files out of a single image file,
+// so a guest sysroot can be shipped and mounted as one file, and none
+// of its lookups need to touch the host filesystem. the whole image is
+// mapped into memory when it's mounted; directories are sorted tables
+// that are binary searched in place. files are either stored as they
+// are, or as deflated chunks that are inflated when they're read. the
+// files mkpackfs expects to be mapped, e.g. executables and libraries,
+// are stored uncompressed and page aligned, so that mmap() can map the
+// image itself into the guest, which costs no copying or extra memory.
+
+struct PackfsDevice {
+  const u8 *base;
+  size_t size;
+  size_t pagesize;
+  u32 nodes;
+  u32 align;
+  u32 chunksize;
+  u64 nodetab;
+  bool mappable;  // aligned extents are aligned to host pages too
+  int fd;
+  char *source;
+};
+
+// most recently inflated chunk of a compressed file
+struct PackfsChunk {
+  u64 index;
+  u8 *data;  // null if none
+};
+
+// open file description, which dup() shares
+struct PackfsFile {
+  pthread_mutex_t_ lock;
+  _Atomic(u32) refs;
+  int oflags;
+  off_t pos;
+  struct PackfsChunk chunk;
+};
+
+struct PackfsInfo {
+  struct PackfsDevice *fs;
+  struct PackfsFile *file;  // null unless opened
+  u32 node;
+};
+
+// returns pointer to `len` bytes at `off` of image, or null if that's
+// beyond its end, which means the image is corrupt
+static const u8 *PackfsGetData(struct PackfsDevice *fs, u64 off, u64 len) {
+  if (off > fs->size || len > fs->size - off) {
+    LOGF("packfs image %s is corrupt", fs->source);
+    eio();
+    return 0;
+  }
+  return fs->base + off;
+}
+
+static const struct PackfsNode *PackfsGetNode(struct PackfsDevice *fs,
+                                              u32 node) {
+  if (!node || node >= fs->nodes) return (const struct PackfsNode *)0;
+  return (const struct PackfsNode *)(fs->base + fs->nodetab +
+                                     (u64)node * sizeof(struct PackfsNode));
+}
+
+static const struct PackfsNode *PackfsInfoNode(struct VfsInfo *info) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  return PackfsGetNode(pi->fs, pi->node);
+}
+
+static int PackfsCheckAccess(const struct PackfsNode *n, int mode) {
+  if (mode & W_OK) return erofs();
+  return VfsCheckAccess(Read32(n->mode), Read32(n->uid), Read32(n->gid), mode);
+}
+
+// binary searches the entries of `dir` for `name`, returning its node
+static u32 PackfsLookup(struct PackfsDevice *fs, const struct PackfsNode *dir,
+                        const char *name) {
+  int c;
+  u32 len;
+  const u8 *s;
+  const struct PackfsDirent *ents;
+  size_t namelen = strlen(name);
+  u64 l, r, m, count = Read64(dir->size);
+  if (count > fs->size / sizeof(struct PackfsDirent)) return eio(), 0;
+  if (!(ents = (const struct PackfsDirent *)PackfsGetData(
+            fs, Read64(dir->offset), count * sizeof(struct PackfsDirent)))) {
+    return 0;
+  }
+  for (l = 0, r = count; l < r;) {
+    m = l + (r - l) / 2;
+    len = Read32(ents[m].namelen);
+    if (!(s = PackfsGetData(fs, Read64(ents[m].name), len))) return 0;
+    if (!(c = memcmp(name, s, MIN(namelen, len)))) {
+      c = namelen < len ? -1 : namelen > len;
+    }
+    if (!c) {
+      if (!PackfsGetNode(fs, Read32(ents[m].node))) return eio(), 0;
+      return Read32(ents[m].node);
+    }
+    if (c < 0) {
+      r = m;
+    } else {
+      l = m + 1;
+    }
+  }
+  return enoent(), 0;
+}
+
+// looks up `name` in `parent`, returning its node
+static u32 PackfsFind(struct VfsInfo *parent, const char *name) {
+  u32 x;
+  bool slashed;
+  char leaf[VFS_NAME_MAX];
+  const struct PackfsNode *dir;
+  struct PackfsInfo *pi = (struct PackfsInfo *)parent->data;
+  if (!(dir = PackfsGetNode(pi->fs, pi->node))) return eio(), 0;
+  slashed = VfsTrimName(name, leaf);
+  if (!strcmp(leaf, ".") || !strcmp(leaf, "/")) return pi->node;
+  if (!S_ISDIR(Read32(dir->mode))) return enotdir(), 0;
+  if (PackfsCheckAccess(dir, X_OK) == -1) return 0;
+  if (!(x = PackfsLookup(pi->fs, dir, leaf))) return 0;
+  if (slashed && !S_ISDIR(Read32(PackfsGetNode(pi->fs, x)->mode))) {
+    return enotdir(), 0;
+  }
+  return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// inflates chunk `c` of compressed file `n` into `out`, which has room
+// for the uncompressed size of that chunk, i.e. `len`
+static int PackfsInflateChunk(struct PackfsDevice *fs,
+                              const struct PackfsNode *n, u64 c, u8 *out,
+                              u64 len) {
+  const u8 *tab, *p;
+  u64 lo, hi;
+  if (!(tab = PackfsGetData(fs, Read64(n->offset) + c * 8, 16))) return -1;
+  lo = Read64(tab);
+  hi = Read64(tab + 8);
+  if (hi < lo || hi - lo > UINT_MAX || !(p = PackfsGetData(fs, lo, hi - lo))) {
+    return eio();
+  }
+  if (hi - lo == len) {
+    memcpy(out, p, len);
+  } else if (!TryInflate(out, len, p, hi - lo)) {
+    LOGF("packfs image %s has corrupt chunk", fs->source);
+    return eio();
+  }
+  STATISTIC(++packfs_inflated_chunks);
+  return 0;
+}
+
+// reads file `n` at `off`. the most recently inflated chunk of a file
+// that's compressed is kept in `chunk`, so small reads are cheap
+static ssize_t PackfsReadNode(struct PackfsDevice *fs,
+                              const struct PackfsNode *n,
+                              struct PackfsChunk *chunk, void *buf, size_t len,
+                              u64 off) {
+  const u8 *p;
+  size_t got, amt;
+  u64 c, skip, chunklen, size = Read64(n->size);
+  if (off >= size) return 0;
+  len = MIN(len, size - off);
+  if (!(Read32(n->flags) & PACKFS_COMPRESSED)) {
+    if (!(p = PackfsGetData(fs, Read64(n->offset) + off, len))) return -1;
+    memcpy(buf, p, len);
+    return len;
+  }
+  for (got = 0; got < len; got += amt) {
+    c = (off + got) / fs->chunksize;
+    skip = (off + got) % fs->chunksize;
+    chunklen = MIN(fs->chunksize, size - c * fs->chunksize);
+    amt = MIN(len - got, chunklen - skip);
+    if (!skip && amt == chunklen) {
+      // whole chunks are inflated right where they're wanted
+      if (PackfsInflateChunk(fs, n, c, (u8 *)buf + got, chunklen) == -1) break;
+      continue;
+    }
+    if (!chunk->data || chunk->index != c) {
+      if (!chunk->data && !(chunk->data = (u8 *)malloc(fs->chunksize))) {
+        enomem();
+        break;
+      }
+      if (PackfsInflateChunk(fs, n, c, chunk->data, chunklen) == -1) {
+        free(chunk->data);
+        chunk->data = 0;
+        break;
+      }
+      chunk->index = c;
+    }
+    memcpy((u8 *)buf + got, chunk->data + skip, amt);
+  }
+  return got ? (ssize_t)got : (len ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int PackfsCreateInfo(struct VfsDevice *device, struct VfsInfo *parent,
+                            const char *name, u32 node,
+                            struct VfsInfo **output) {
+  struct PackfsInfo *pi;
+  struct PackfsDevice *fs = (struct PackfsDevice *)device->data;
+  *output = NULL;
+  if (!(pi = (struct PackfsInfo *)malloc(sizeof(*pi)))) return enomem();
+  pi->fs = fs;
+  pi->file = NULL;
+  pi->node = node;
+  if (VfsCreateInfo(output) == -1) {
+    free(pi);
+    return -1;
+  }
+  (*output)->data = pi;
+  (*output)->ino = node;
+  (*output)->mode = Read32(PackfsGetNode(fs, node)->mode);
+  unassert(!VfsAcquireDevice(device, &(*output)->device));
+  if (parent) {
+    (*output)->dev = parent->dev;
+    unassert(!VfsAcquireInfo(parent, &(*output)->parent));
+  }
+  if (name) {
+    if (!((*output)->name = strdup(name))) {
+      unassert(!VfsFreeInfo(*output));
+      *output = NULL;
+      return enomem();
+    }
+    (*output)->namelen = strlen(name);
+  }
+  return 0;
+}
+
+// makes another info for the same file as `info`, with `file` open
+static int PackfsCloneInfo(struct VfsInfo *info, struct PackfsFile *file,
+                           struct VfsInfo **output) {
+  struct PackfsInfo *pi;
+  *output = NULL;
+  if (!(pi = (struct PackfsInfo *)malloc(sizeof(*pi)))) return enomem();
+  if (VfsCreateInfo(output) == -1) {
+    free(pi);
+    return -1;
+  }
+  *pi = *(struct PackfsInfo *)info->data;
+  pi->file = file;
+  (*output)->data = pi;
+  (*output)->ino = info->ino;
+  (*output)->dev = info->dev;
+  (*output)->mode = info->mode;
+  unassert(!VfsAcquireDevice(info->device, &(*output)->device));
+  unassert(!VfsAcquireInfo(info->parent, &(*output)->parent));
+  if (info->name) {
+    if (!((*output)->name = strdup(info->name))) {
+      pi->file = NULL;
+      unassert(!VfsFreeInfo(*output));
+      *output = NULL;
+      return enomem();
+    }
+    (*output)->namelen = info->namelen;
+  }
+  return 0;
+}
+
+static int PackfsFreeDevice(void *data) {
+  struct PackfsDevice *fs = (struct PackfsDevice *)data;
+  if (fs) {
+    if (fs->base) munmap((void *)fs->base, fs->size);
+    if (fs->fd != -1) close(fs->fd);
+    free(fs->source);
+    free(fs);
+  }
+  return 0;
+}
+
+// checks the header of the image, so that later only the offsets of
+// the contents need to be checked, and only as they are accessed
+static int PackfsCheckHeader(struct PackfsDevice *fs) {
+  const struct PackfsNode *root;
+  const struct PackfsHeader *h = (const struct PackfsHeader *)fs->base;
+  if (fs->size < sizeof(*h) || memcmp(h->magic, PACKFS_MAGIC, 8)) {
+    LOGF("%s isn't a packfs image", fs->source);
+    return einval();
+  }
+  if (Read32(h->version) != PACKFS_VERSION) {
+    LOGF("%s is packfs version %u but we need %d", fs->source,
+         Read32(h->version), PACKFS_VERSION);
+    return einval();
+  }
+  fs->align = Read32(h->align);
+  fs->chunksize = Read32(h->chunksize);
+  fs->nodes = Read32(h->nodes);
+  fs->nodetab = Read64(h->nodetab);
+  if (Read64(h->size) != fs->size || !fs->align ||
+      (fs->align & (fs->align - 1)) || !fs->chunksize ||
+      fs->chunksize > 16 * 1024 * 1024 || fs->nodes <= PACKFS_ROOT ||
+      !PackfsGetData(fs, fs->nodetab,
+                     (u64)fs->nodes * sizeof(struct PackfsNode))) {
+    LOGF("packfs image %s is corrupt or truncated", fs->source);
+    return eio();
+  }
+  root = PackfsGetNode(fs, PACKFS_ROOT);
+  if (!S_ISDIR(Read32(root->mode))) {
+    LOGF("packfs image %s has no root directory", fs->source);
+    return eio();
+  }
+  fs->mappable = !(fs->align % fs->pagesize);
+  return 0;
+}
+
+static int PackfsInit(const char *source, u64 flags, const void *data,
+                      struct VfsDevice **device, struct VfsMount **mount) {
+  struct PackfsDevice *fs;
+  struct stat st;
+  void *base;
+  *device = NULL;
+  *mount = NULL;
+  if (!source) return efault();
+  if (!(fs = (struct PackfsDevice *)calloc(1, sizeof(*fs)))) {
+    return enomem();
+  }
+  fs->pagesize = sysconf(_SC_PAGESIZE);
+  if ((fs->fd = open(source, O_RDONLY | O_CLOEXEC)) == -1 ||
+      fstat(fs->fd, &st) == -1) {
+    goto cleananddie;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    einval();
+    goto cleananddie;
+  }
+  if (!(fs->source = realpath(source, NULL))) {
+    goto cleananddie;
+  }
+  if (st.st_size > SIZE_MAX / 2) {
+    efbig();
+    goto cleananddie;
+  }
+  fs->size = st.st_size;
+  if (fs->size) {
+    if ((base = mmap(0, fs->size, PROT_READ, MAP_SHARED, fs->fd, 0)) ==
+        MAP_FAILED) {
+      goto cleananddie;
+    }
+    fs->base = (const u8 *)base;
+  }
+  if (PackfsCheckHeader(fs) == -1) {
+    goto cleananddie;
+  }
+  if (VfsCreateDevice(device) == -1) {
+    goto cleananddie;
+  }
+  (*device)->data = fs;
+  (*device)->ops = &g_packfs.ops;
+  if (!(*mount = (struct VfsMount *)malloc(sizeof(struct VfsMount)))) {
+    enomem();
+    goto cleananddie;
+  }
+  if (PackfsCreateInfo(*device, NULL, NULL, PACKFS_ROOT, &(*mount)->root) ==
+      -1) {
+    goto cleananddie;
+  }
+  // Weak reference.
+  (*device)->root = (*mount)->root;
+  VFS_LOGF("Mounted packfs image %s with %u nodes", fs->source, fs->nodes);
+  return 0;
+cleananddie:
+  free(*mount);
+  *mount = NULL;
+  if (*device) {
+    unassert(!VfsFreeDevice(*device));
+    *device = NULL;
+  } else {
+    PackfsFreeDevice(fs);
+  }
+  return -1;
+}
+
+static void PackfsReleaseFile(struct PackfsFile *f) {
+  if (atomic_fetch_sub(&f->refs, 1) != 1) return;
+  unassert(!pthread_mutex_destroy(&f->lock));
+  free(f->chunk.data);
+  free(f);
+}
+
+static int PackfsFreeInfo(void *data) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)data;
+  if (pi) {
+    if (pi->file) PackfsReleaseFile(pi->file);
+    free(pi);
+  }
+  return 0;
+}
+
+static int PackfsReadmountentry(struct VfsDevice *device, char **spec,
+                                char **type, char **mntops) {
+  struct PackfsDevice *fs = (struct PackfsDevice *)device->data;
+  *spec = strdup(fs->source);
+  *type = strdup("packfs");
+  *mntops = strdup("ro");
+  if (!*spec || !*type || !*mntops) {
+    free(*spec);
+    free(*type);
+    free(*mntops);
+    return enomem();
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int PackfsFinddir(struct VfsInfo *parent, const char *name,
+                         struct VfsInfo **output) {
+  u32 x;
+  VFS_LOGF("PackfsFinddir(%p, \"%s\", %p)", parent, name, output);
+  if (!strcmp(name, ".")) {
+    unassert(!VfsAcquireInfo(parent, output));
+    return 0;
+  }
+  if (!(x = PackfsFind(parent, name))) return -1;
+  return PackfsCreateInfo(parent->device, parent, name, x, output);
+}
+
+static ssize_t PackfsReadlink(struct VfsInfo *info, char **output) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  const struct PackfsNode *n;
+  const u8 *p;
+  u64 size;
+  *output = NULL;
+  if (!(n = PackfsInfoNode(info))) return eio();
+  if (!S_ISLNK(Read32(n->mode))) return einval();
+  size = Read64(n->size);
+  if (!(p = PackfsGetData(pi->fs, Read64(n->offset), size))) return -1;
+  if (!(*output = (char *)malloc(size + 1))) return enomem();
+  memcpy(*output, p, size);
+  (*output)[size] = 0;
+  return size;
+}
+
+static int PackfsMkdir(struct VfsInfo *parent, const char *name, mode_t mode) {
+  VFS_LOGF("PackfsMkdir(%p, \"%s\", %o)", parent, name, mode);
+  if (PackfsFind(parent, name)) return eexist();
+  return erofs();
+}
+
+static int PackfsOpen(struct VfsInfo *parent, const char *name, int flags,
+                      int mode, struct VfsInfo **output) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)parent->data;
+  const struct PackfsNode *n;
+  struct PackfsFile *f;
+  u32 x, nmode;
+  int rc;
+  VFS_LOGF("PackfsOpen(%p, \"%s\", %d, %o)", parent, name, flags, mode);
+  *output = NULL;
+  if (!(x = PackfsFind(parent, name))) {
+    if (errno == ENOENT && (flags & O_CREAT)) erofs();
+    return -1;
+  }
+  n = PackfsGetNode(pi->fs, x);
+  nmode = Read32(n->mode);
+  if ((flags & O_CREAT) && (flags & O_EXCL)) {
+    return eexist();
+  } else if (S_ISLNK(nmode)) {
+    return eloop();
+  } else if (S_ISDIR(nmode) &&
+             ((flags & O_ACCMODE) != O_RDONLY || (flags & O_CREAT))) {
+    return eisdir();
+  } else if ((flags & O_DIRECTORY) && !S_ISDIR(nmode)) {
+    return enotdir();
+  } else if ((flags & O_ACCMODE) != O_RDONLY) {
+    return erofs();
+  } else if (PackfsCheckAccess(n, R_OK) == -1) {
+    return -1;
+  }
+  if (!(f = (struct PackfsFile *)calloc(1, sizeof(*f)))) return enomem();
+  f->refs = 1;
+  f->oflags = flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+  unassert(!pthread_mutex_init(&f->lock, 0));
+  if (x == pi->node) {
+    // opening the directory itself, e.g. the mount root
+    rc = PackfsCloneInfo(parent, f, output);
+  } else {
+    rc = PackfsCreateInfo(parent->device, parent, name, x, output);
+  }
+  if (rc == -1) {
+    PackfsReleaseFile(f);
+    return -1;
+  }
+  ((struct PackfsInfo *)(*output)->data)->file = f;
+  return 0;
+}
+
+static int PackfsAccess(struct VfsInfo *parent, const char *name, mode_t mode,
+                        int flags) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)parent->data;
+  u32 x;
+  if (!(x = PackfsFind(parent, name))) return -1;
+  return mode == F_OK ? 0 : PackfsCheckAccess(PackfsGetNode(pi->fs, x), mode);
+}
+
+static void PackfsStatNode(struct VfsInfo *info, u32 x, struct stat *st) {
+  struct PackfsDevice *fs = ((struct PackfsInfo *)info->data)->fs;
+  const struct PackfsNode *n = PackfsGetNode(fs, x);
+  memset(st, 0, sizeof(*st));
+  st->st_dev = info->device->dev;
+  st->st_ino = x;
+  st->st_mode = Read32(n->mode);
+  st->st_nlink = Read32(n->nlink);
+  st->st_uid = Read32(n->uid);
+  st->st_gid = Read32(n->gid);
+  st->st_rdev = 0;
+  // linux reports 20 bytes per directory entry, counting . and ..
+  st->st_size = S_ISDIR(st->st_mode) ? (Read64(n->size) + 2) * 20
+                                     : Read64(n->size);
+  st->st_blksize = fs->pagesize;
+  st->st_blocks = ROUNDUP(Read64(n->stored), 512) / 512;
+  st->st_mtim.tv_sec = Read64(n->mtime);
+  st->st_mtim.tv_nsec = Read32(n->mtimensec);
+  st->st_atim = st->st_mtim;
+  st->st_ctim = st->st_mtim;
+}
+
+static int PackfsStat(struct VfsInfo *parent, const char *name,
+                      struct stat *st, int flags) {
+  u32 x;
+  if (!(x = PackfsFind(parent, name))) return -1;
+  PackfsStatNode(parent, x, st);
+  return 0;
+}
+
+static int PackfsFstat(struct VfsInfo *info, struct stat *st) {
+  PackfsStatNode(info, ((struct PackfsInfo *)info->data)->node, st);
+  return 0;
+}
+
+static int PackfsChmod(struct VfsInfo *parent, const char *name, mode_t mode,
+                       int flags) {
+  if (!PackfsFind(parent, name)) return -1;
+  return erofs();
+}
+
+static int PackfsFchmod(struct VfsInfo *info, mode_t mode) {
+  return erofs();
+}
+
+static int PackfsChown(struct VfsInfo *parent, const char *name, uid_t uid,
+                       gid_t gid, int flags) {
+  if (!PackfsFind(parent, name)) return -1;
+  return erofs();
+}
+
+static int PackfsFchown(struct VfsInfo *info, uid_t uid, gid_t gid) {
+  return erofs();
+}
+
+static int PackfsFtruncate(struct VfsInfo *info, off_t length) {
+  return einval();
+}
+
+static int PackfsClose(struct VfsInfo *info) {
+  // the open file is released once the last reference goes away
+  return 0;
+}
+
+static int PackfsLink(struct VfsInfo *olddir, const char *oldname,
+                      struct VfsInfo *newdir, const char *newname, int flags) {
+  if (!PackfsFind(olddir, oldname)) return -1;
+  return erofs();
+}
+
+static int PackfsUnlink(struct VfsInfo *parent, const char *name, int flags) {
+  if (!PackfsFind(parent, name)) return -1;
+  return erofs();
+}
+
+static int PackfsRename(struct VfsInfo *olddir, const char *oldname,
+                        struct VfsInfo *newdir, const char *newname) {
+  if (!PackfsFind(olddir, oldname)) return -1;
+  return erofs();
+}
+
+static int PackfsSymlink(const char *target, struct VfsInfo *parent,
+                         const char *name) {
+  if (PackfsFind(parent, name)) return eexist();
+  return erofs();
+}
+
+static int PackfsUtime(struct VfsInfo *parent, const char *name,
+                       const struct timespec times[2], int flags) {
+  if (!PackfsFind(parent, name)) return -1;
+  return erofs();
+}
+
+static int PackfsFutime(struct VfsInfo *info, const struct timespec times[2]) {
+  return erofs();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// reads the open file `info`, at its position if `off` is -1
+static ssize_t PackfsTransfer(struct VfsInfo *info, const struct iovec *iov,
+                              int iovcnt, off_t off) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  struct PackfsFile *f = pi->file;
+  const struct PackfsNode *n;
+  ssize_t rc, total;
+  size_t len;
+  off_t pos;
+  int i;
+  if (!f) return ebadf();
+  if (S_ISDIR(info->mode)) return eisdir();
+  for (len = i = 0; i < iovcnt; ++i) {
+    if ((len += iov[i].iov_len) > SSIZE_MAX) return einval();
+  }
+  n = PackfsInfoNode(info);
+  // the lock is held for pread() too, since it guards the chunk cache
+  LOCK(&f->lock);
+  pos = off == -1 ? f->pos : off;
+  for (total = i = 0; i < iovcnt; ++i) {
+    rc = PackfsReadNode(pi->fs, n, &f->chunk, iov[i].iov_base, iov[i].iov_len,
+                        pos);
+    if (rc == -1) {
+      if (!total) total = -1;
+      break;
+    }
+    total += rc;
+    pos += rc;
+    if (rc < iov[i].iov_len) break;
+  }
+  if (off == -1 && total != -1) f->pos = pos;
+  UNLOCK(&f->lock);
+  return total;
+}
+
+static ssize_t PackfsRead(struct VfsInfo *info, void *buf, size_t len) {
+  struct iovec iov = {buf, len};
+  return PackfsTransfer(info, &iov, 1, -1);
+}
+
+static ssize_t PackfsWrite(struct VfsInfo *info, const void *buf, size_t len) {
+  return ebadf();
+}
+
+static ssize_t PackfsPread(struct VfsInfo *info, void *buf, size_t len,
+                           off_t off) {
+  struct iovec iov = {buf, len};
+  if (off < 0) return einval();
+  return PackfsTransfer(info, &iov, 1, off);
+}
+
+static ssize_t PackfsPwrite(struct VfsInfo *info, const void *buf, size_t len,
+                            off_t off) {
+  return ebadf();
+}
+
+static ssize_t PackfsReadv(struct VfsInfo *info, const struct iovec *iov,
+                           int iovcnt) {
+  return PackfsTransfer(info, iov, iovcnt, -1);
+}
+
+static ssize_t PackfsWritev(struct VfsInfo *info, const struct iovec *iov,
+                            int iovcnt) {
+  return ebadf();
+}
+
+static ssize_t PackfsPreadv(struct VfsInfo *info, const struct iovec *iov,
+                            int iovcnt, off_t off) {
+  if (off < 0) return einval();
+  return PackfsTransfer(info, iov, iovcnt, off);
+}
+
+static ssize_t PackfsPwritev(struct VfsInfo *info, const struct iovec *iov,
+                             int iovcnt, off_t off) {
+  return ebadf();
+}
+
+static off_t PackfsSeek(struct VfsInfo *info, off_t off, int whence) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  off_t pos = -1;
+  if (!f) return ebadf();
+  LOCK(&f->lock);
+  switch (whence) {
+    case SEEK_SET:
+      pos = off;
+      break;
+    case SEEK_CUR:
+      pos = f->pos + off;
+      break;
+    case SEEK_END:
+      if (!S_ISDIR(info->mode)) {
+        pos = Read64(PackfsInfoNode(info)->size) + off;
+      }
+      break;
+    default:
+      break;
+  }
+  if (pos < 0) {
+    pos = einval();
+  } else {
+    f->pos = pos;
+  }
+  UNLOCK(&f->lock);
+  return pos;
+}
+
+static int PackfsFsync(struct VfsInfo *info) {
+  return 0;
+}
+
+// nothing in the image can change, so there's nothing for a lock to
+// protect, and locks are granted without keeping track of them
+static int PackfsFlock(struct VfsInfo *info, int op) {
+  switch (op & ~LOCK_NB) {
+    case LOCK_SH:
+    case LOCK_EX:
+    case LOCK_UN:
+      return 0;
+    default:
+      return einval();
+  }
+}
+
+static int PackfsFcntl(struct VfsInfo *info, int cmd, va_list args) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  struct flock *lk;
+  int rc;
+  if (!f) return ebadf();
+  if (cmd == F_GETFD) {
+    rc = 0;
+  } else if (cmd == F_SETFD) {
+    rc = 0;
+  } else if (cmd == F_GETFL) {
+    rc = f->oflags;
+  } else if (cmd == F_SETFL) {
+    LOCK(&f->lock);
+    f->oflags = (f->oflags & ~(O_APPEND | O_NONBLOCK)) |
+                (va_arg(args, int) & (O_APPEND | O_NONBLOCK));
+    UNLOCK(&f->lock);
+    rc = 0;
+  } else if (cmd == F_SETLK || cmd == F_SETLKW) {
+    lk = va_arg(args, struct flock *);
+    rc = lk->l_type == F_WRLCK ? ebadf() : 0;
+  } else if (cmd == F_GETLK) {
+    lk = va_arg(args, struct flock *);
+    lk->l_type = F_UNLCK;
+    rc = 0;
+  } else {
+    rc = einval();
+  }
+  return rc;
+}
+
+static int PackfsDup(struct VfsInfo *info, struct VfsInfo **newinfo) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  if (PackfsCloneInfo(info, f, newinfo) == -1) return -1;
+  if (f) atomic_fetch_add(&f->refs, 1);
+  return 0;
+}
+
+#ifdef HAVE_DUP3
+static int PackfsDup3(struct VfsInfo *info, struct VfsInfo **newinfo,
+                      int flags) {
+  // O_CLOEXEC is already handled by the syscall layer.
+  return PackfsDup(info, newinfo);
+}
+#endif
+
+static int PackfsPoll(struct VfsInfo **infos, struct pollfd *fds, nfds_t nfds,
+                      int timeout) {
+  nfds_t i;
+  int rc = 0;
+  // regular files never block
+  for (i = 0; i < nfds; ++i) {
+    fds[i].revents = fds[i].events & (POLLIN | POLLOUT);
+    rc += !!fds[i].revents;
+  }
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int PackfsOpendir(struct VfsInfo *info, struct VfsInfo **output) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  if (!S_ISDIR(info->mode) || !pi->file) return enotdir();
+  unassert(!VfsAcquireInfo(info, output));
+  return 0;
+}
+
+#ifdef HAVE_SEEKDIR
+static void PackfsSeekdir(struct VfsInfo *info, long offset) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  LOCK(&f->lock);
+  f->pos = offset;
+  UNLOCK(&f->lock);
+}
+
+static long PackfsTelldir(struct VfsInfo *info) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  long pos;
+  LOCK(&f->lock);
+  pos = f->pos;
+  UNLOCK(&f->lock);
+  return pos;
+}
+#endif
+
+static struct dirent *PackfsReaddir(struct VfsInfo *info) {
+  static _Thread_local char buf[sizeof(struct dirent) + VFS_NAME_MAX];
+  struct dirent *de = (struct dirent *)buf;
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  struct PackfsFile *f = pi->file;
+  const struct PackfsNode *dir, *n = 0;
+  const struct PackfsDirent *ent;
+  const u8 *name;
+  u32 x = 0, len;
+  dir = PackfsGetNode(pi->fs, pi->node);
+  LOCK(&f->lock);
+  if (f->pos == 0) {
+    x = pi->node;
+    strcpy(de->d_name, ".");
+  } else if (f->pos == 1) {
+    x = pi->node == PACKFS_ROOT && info->parent ? info->parent->ino
+                                                : Read32(dir->parent);
+    strcpy(de->d_name, "..");
+  } else if (f->pos - 2 < Read64(dir->size) &&
+             (ent = (const struct PackfsDirent *)PackfsGetData(
+                  pi->fs,
+                  Read64(dir->offset) +
+                      (f->pos - 2) * sizeof(struct PackfsDirent),
+                  sizeof(struct PackfsDirent))) &&
+             (len = Read32(ent->namelen)) < VFS_NAME_MAX &&
+             (name = PackfsGetData(pi->fs, Read64(ent->name), len))) {
+    x = Read32(ent->node);
+    memcpy(de->d_name, name, len);
+    de->d_name[len] = 0;
+  }
+  if (x && (n = f->pos < 2 ? dir : PackfsGetNode(pi->fs, x))) {
+    ++f->pos;
+    de->d_ino = x;
+#ifdef DT_UNKNOWN
+    if (S_ISDIR(Read32(n->mode))) {
+      de->d_type = DT_DIR;
+    } else if (S_ISREG(Read32(n->mode))) {
+      de->d_type = DT_REG;
+    } else if (S_ISLNK(Read32(n->mode))) {
+      de->d_type = DT_LNK;
+    } else {
+      de->d_type = DT_UNKNOWN;
+    }
+#endif
+  }
+  UNLOCK(&f->lock);
+  return n ? de : NULL;
+}
+
+static void PackfsRewinddir(struct VfsInfo *info) {
+  struct PackfsFile *f = ((struct PackfsInfo *)info->data)->file;
+  LOCK(&f->lock);
+  f->pos = 0;
+  UNLOCK(&f->lock);
+}
+
+static int PackfsClosedir(struct VfsInfo *info) {
+  unassert(!VfsFreeInfo(info));
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// aligned files are mapped straight from the image, which is private
+// since nothing may change it, so shared mappings behave the same. the
+// pages past the end of the file are anonymous, since the host would
+// raise SIGBUS for them. anything else is read into anonymous memory
+static void *PackfsMmap(struct VfsInfo *info, void *addr, size_t len,
+                        int prot, int flags, off_t offset) {
+  struct PackfsInfo *pi = (struct PackfsInfo *)info->data;
+  struct PackfsDevice *fs = pi->fs;
+  struct PackfsChunk chunk = {0};
+  const struct PackfsNode *n;
+  u64 size, filebytes;
+  ssize_t rc;
+  u8 *p;
+  VFS_LOGF("PackfsMmap(%p, %p, %zu, %d, %d, %ld)", info, addr, len, prot,
+           flags, (long)offset);
+  if (!pi->file) return ebadf(), MAP_FAILED;
+  if (!S_ISREG(info->mode)) return enodev(), MAP_FAILED;
+  if (offset < 0 || offset % fs->pagesize) return einval(), MAP_FAILED;
+  if ((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+    return eacces(), MAP_FAILED;
+  }
+  n = PackfsInfoNode(info);
+  size = Read64(n->size);
+  filebytes = size > (u64)offset ? MIN(len, size - offset) : 0;
+  flags = (flags & ~(MAP_SHARED | MAP_PRIVATE)) | MAP_PRIVATE | MAP_ANONYMOUS;
+  if (fs->mappable && (Read32(n->flags) & PACKFS_ALIGNED)) {
+    if ((p = (u8 *)mmap(addr, len, prot, flags, -1, 0)) == MAP_FAILED) {
+      return MAP_FAILED;
+    }
+    filebytes = ROUNDUP(filebytes, fs->pagesize);
+    if (filebytes &&
+        (!PackfsGetData(fs, Read64(n->offset) + offset, filebytes) ||
+         mmap(p, filebytes, prot, MAP_PRIVATE | MAP_FIXED, fs->fd,
+              Read64(n->offset) + offset) == MAP_FAILED)) {
+      munmap(p, len);
+      return MAP_FAILED;
+    }
+    STATISTIC(packfs_mapped_pages += filebytes / fs->pagesize);
+    return p;
+  }
+  if ((p = (u8 *)mmap(addr, len, PROT_READ | PROT_WRITE, flags, -1, 0)) ==
+      MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  rc = PackfsReadNode(fs, n, &chunk, p, filebytes, offset);
+  free(chunk.data);
+  if ((u64)rc != filebytes || mprotect(p, len, prot) == -1) {
+    munmap(p, len);
+    return MAP_FAILED;
+  }
+  STATISTIC(packfs_copied_pages += ROUNDUP(filebytes, fs->pagesize) /
+                                    fs->pagesize);
+  return p;
+}
+
+static int PackfsMunmap(struct VfsInfo *info, void *addr, size_t len) {
+  // Do nothing. The host should handle all the cleanup.
+  return 0;
+}
+
+static int PackfsMprotect(struct VfsInfo *info, void *addr, size_t len,
+                          int prot) {
+  // Do nothing, as the host should handle the protection details.
+  return 0;
+}
+
+static int PackfsMsync(struct VfsInfo *info, void *addr, size_t len,
+                       int flags) {
+  // Do nothing, the file can't change.
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct VfsSystem g_packfs = {.name = "packfs",
+                             .nodev = false,
+                             .dcache = true,
+                             .ops = {
+                                 .Init = PackfsInit,
+                                 .Freeinfo = PackfsFreeInfo,
+                                 .Freedevice = PackfsFreeDevice,
+                                 .Readmountentry = PackfsReadmountentry,
+                                 .Finddir = PackfsFinddir,
+                                 .Readlink = PackfsReadlink,
+                                 .Mkdir = PackfsMkdir,
+                                 .Mkfifo = PackfsMkdir,
+                                 .Open = PackfsOpen,
+                                 .Access = PackfsAccess,
+                                 .Stat = PackfsStat,
+                                 .Fstat = PackfsFstat,
+                                 .Chmod = PackfsChmod,
+                                 .Fchmod = PackfsFchmod,
+                                 .Chown = PackfsChown,
+                                 .Fchown = PackfsFchown,
+                                 .Ftruncate = PackfsFtruncate,
+                                 .Close = PackfsClose,
+                                 .Link = PackfsLink,
+                                 .Unlink = PackfsUnlink,
+                                 .Read = PackfsRead,
+                                 .Write = PackfsWrite,
+                                 .Pread = PackfsPread,
+                                 .Pwrite = PackfsPwrite,
+                                 .Readv = PackfsReadv,
+                                 .Writev = PackfsWritev,
+                                 .Preadv = PackfsPreadv,
+                                 .Pwritev = PackfsPwritev,
+                                 .Seek = PackfsSeek,
+                                 .Fsync = PackfsFsync,
+                                 .Fdatasync = PackfsFsync,
+                                 .Flock = PackfsFlock,
+                                 .Fcntl = PackfsFcntl,
+                                 .Ioctl = NULL,
+                                 .Dup = PackfsDup,
+#ifdef HAVE_DUP3
+                                 .Dup3 = PackfsDup3,
+#endif
+                                 .Poll = PackfsPoll,
+                                 .Opendir = PackfsOpendir,
+#ifdef HAVE_SEEKDIR
+                                 .Seekdir = PackfsSeekdir,
+                                 .Telldir = PackfsTelldir,
+#endif
+                                 .Readdir = PackfsReaddir,
+                                 .Rewinddir = PackfsRewinddir,
+                                 .Closedir = PackfsClosedir,
+                                 .Rename = PackfsRename,
+                                 .Utime = PackfsUtime,
+                                 .Futime = PackfsFutime,
+                                 .Symlink = PackfsSymlink,
+                                 .Mmap = PackfsMmap,
+                                 .Munmap = PackfsMunmap,
+                                 .Mprotect = PackfsMprotect,
+                                 .Msync = PackfsMsync,
+                             }};
+
+#endif /* DISABLE_VFS */
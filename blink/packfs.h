@@ -0,0 +1,56 @@
+#ifndef BLINK_PACKFS_H_
+#define BLINK_PACKFS_H_
+
+#include "blink/types.h"
+#include "blink/vfs.h"
+
+// packfs image format, which tool/mkpackfs.c writes. all integers are
+// little endian, and all offsets are relative to the start of the file
+
+#define PACKFS_MAGIC   "BLINKPAK"
+#define PACKFS_VERSION 1
+#define PACKFS_ROOT    1  // node number of the root directory
+
+#define PACKFS_ALIGNED    1  // contents start and end on an align boundary
+#define PACKFS_COMPRESSED 2  // contents are raw deflate chunks
+
+struct PackfsHeader {
+  u8 magic[8];
+  u8 version[4];
+  u8 align[4];      // alignment of extents with PACKFS_ALIGNED
+  u8 chunksize[4];  // uncompressed size of each compressed chunk
+  u8 nodes[4];      // size of node table, whose first entry is unused
+  u8 nodetab[8];    // offset of node table
+  u8 size[8];       // size of image
+  u8 reserved[24];
+};
+
+struct PackfsNode {
+  u8 mode[4];
+  u8 uid[4];
+  u8 gid[4];
+  u8 nlink[4];
+  u8 parent[4];  // containing directory
+  u8 flags[4];
+  u8 size[8];  // bytes of content, or number of directory entries
+  // directories point to their entries, symlinks to their target and
+  // files to their contents, or to a table of chunk offsets for files
+  // that are compressed, where chunk i ends where chunk i+1 begins; a
+  // chunk that's as long as its uncompressed size is stored as it is
+  u8 offset[8];
+  u8 stored[8];  // bytes used in image
+  u8 mtime[8];
+  u8 mtimensec[4];
+  u8 reserved[4];
+};
+
+// entries of a directory are sorted by name, compared as bytes
+struct PackfsDirent {
+  u8 node[4];
+  u8 namelen[4];
+  u8 name[8];  // offset of name, which isn't nul terminated
+};
+
+extern struct VfsSystem g_packfs;
+
+#endif  // BLINK_PACKFS_H_
@@ -33,6 +33,7 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/overlays.h"
+#include "blink/perfmap.h"
 #include "blink/rde.h"
 #include "blink/stats.h"
 #include "blink/vfs.h"
@@ -594,16 +595,21 @@ void CompletePath(P) {
 }
 
 void FinishPath(struct Machine *m) {
+  const u8 *code;
+  long size;
   unassert(IsMakingPath(m));
   FlushCod(m->path.jb);
+  code = m->path.jb->addr + m->path.jb->start;
+  size = m->path.jb->index - m->path.jb->start;
   STATISTIC(path_longest_bytes =
                 MAX(path_longest_bytes, m->path.jb->index - m->path.jb->start));
   STATISTIC(path_longest = MAX(path_longest, m->path.elements));
   STATISTIC(AVERAGE(path_average_elements, m->path.elements));
   STATISTIC(AVERAGE(path_average_bytes, m->path.jb->index - m->path.jb->start));
   if (FinishJit(&m->system->jit, m->path.jb)) {
-    STATISTIC(++path_count);
+    MACHINE_STATISTIC(m, path_count);
     JIP_LOGF("staged path to %" PRIx64, m->path.start);
+    WritePerfMap(m, m->path.start, code, size);
   } else {
     JIP_LOGF("path starting at %" PRIx64 " couldn't be installed",
              m->path.start);
@@ -639,6 +645,7 @@ void AddPath_StartOp(P) {
   Jitter(A, "qmq", LogCpu);
 #endif
   BeginCod(m, GetPc(m));
+  AddJitLines(m->path.jb, GetPc(m), Oplength(rde));
 #ifndef NDEBUG
   if (FLAG_statistics) {
     Jitter(A,
@@ -0,0 +1,275 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/builtin.h"
+#include "blink/dis.h"
+#include "blink/flag.h"
+#include "blink/jit.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/map.h"
+#include "blink/perfmap.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+#ifdef __linux
+#include <sys/syscall.h>
+#endif
+
+/**
+ * @fileoverview Host profiler support for generated code.
+ *
+ * When `$BLINK_PERF` contains `map`, each path that's committed to JIT
+ * memory gets a line in /tmp/perf-PID.map, which `perf report` uses to
+ * name addresses in anonymous executable memory. When it has `jitdump`
+ * then /tmp/jit-PID.dump is written instead, which also has the code,
+ * so `perf inject --jit` can annotate it, and it remains accurate when
+ * JIT memory gets recycled. Paths are named by guest address, followed
+ * by the guest function containing it, if the program has symbols.
+ *
+ *     BLINK_PERF=jitdump perf record -k mono blink prog
+ *     perf inject --jit -i perf.data -o perf.jit.data
+ *     perf report -i perf.jit.data
+ */
+
+#ifdef HAVE_JIT
+
+#define JITDUMP_MAGIC     0x4A695444
+#define JITDUMP_VERSION   1
+#define JITDUMP_CODE_LOAD 0
+
+#if defined(__x86_64__)
+#define JITDUMP_MACH 62  // EM_X86_64
+#elif defined(__aarch64__)
+#define JITDUMP_MACH 183  // EM_AARCH64
+#endif
+
+struct JitDumpHeader {
+  u32 magic;
+  u32 version;
+  u32 total_size;
+  u32 elf_mach;
+  u32 pad1;
+  u32 pid;
+  u64 timestamp;
+  u64 flags;
+};
+
+struct JitDumpCodeLoad {
+  u32 id;
+  u32 total_size;
+  u64 timestamp;
+  u32 pid;
+  u32 tid;
+  u64 vma;
+  u64 code_addr;
+  u64 code_size;
+  u64 code_index;
+};
+
+static struct PerfMap {
+  bool enabled;
+  int pid;
+  int mapfd;
+  int dumpfd;
+  _Atomic(u64) index;
+} g_perfmap = {
+    .mapfd = -1,
+    .dumpfd = -1,
+};
+
+static u64 GetPerfTimestamp(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// copies what an earlier process wrote, after fork(), since the child
+// is still able to run the code that was generated by its parent
+static void CopyPerfFile(int dst, int src, off_t off) {
+  ssize_t rc;
+  char buf[4096];
+  while ((rc = pread(src, buf, sizeof(buf), off)) > 0) {
+    if (write(dst, buf, rc) != rc) break;
+    off += rc;
+  }
+}
+
+static int OpenPerfFile(const char *fmt, int old, off_t skip) {
+  int fd, fd2;
+  char path[64];
+  snprintf(path, sizeof(path), fmt, g_perfmap.pid);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                 0644)) == -1) {
+    LOGF("%s: open failed: %s", path, DescribeHostErrno(errno));
+  } else {
+    fd2 = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd);
+    close(fd);
+    fd = fd2;
+  }
+  if (old != -1) {
+    if (fd != -1) CopyPerfFile(fd, old, skip);
+    close(old);
+  }
+  return fd;
+}
+
+static int OpenJitDump(int old) {
+  int fd;
+  void *map;
+  struct JitDumpHeader hdr = {
+      .magic = JITDUMP_MAGIC,
+      .version = JITDUMP_VERSION,
+      .total_size = sizeof(hdr),
+      .elf_mach = JITDUMP_MACH,
+      .pid = g_perfmap.pid,
+      .timestamp = GetPerfTimestamp(),
+  };
+  if ((fd = OpenPerfFile("/tmp/jit-%d.dump", -1, 0)) != -1 &&
+      write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    close(fd);
+    fd = -1;
+  }
+  if (old != -1) {
+    if (fd != -1) CopyPerfFile(fd, old, sizeof(hdr));
+    close(old);
+  }
+  if (fd == -1) return -1;
+  // perf finds the dump by noticing it was mapped into an exec region
+  if ((map = Mmap(0, FLAG_pagesize, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0,
+                  "jitdump")) == MAP_FAILED) {
+    LOGF("jitdump: mmap failed: %s", DescribeHostErrno(errno));
+  }
+  return fd;
+}
+
+static void OpenPerfMap(void) {
+  int pid = getpid();
+  if (g_perfmap.pid == pid) return;
+  if (g_perfmap.pid) {
+    // the parent may append records while we're copying its files, so
+    // our code indices must be distinct from the ones that it'll use
+    g_perfmap.index = (u64)pid << 32;
+  }
+  g_perfmap.pid = pid;
+  if (strstr(FLAG_perf, "map")) {
+    g_perfmap.mapfd = OpenPerfFile("/tmp/perf-%d.map", g_perfmap.mapfd, 0);
+  }
+  if (strstr(FLAG_perf, "jitdump")) {
+    g_perfmap.dumpfd = OpenJitDump(g_perfmap.dumpfd);
+  }
+  g_perfmap.enabled = g_perfmap.mapfd != -1 || g_perfmap.dumpfd != -1;
+}
+
+/**
+ * Prepares `s` for describing its generated code to host profilers.
+ *
+ * This should be called once the program is loaded, and again in the
+ * child after fork(), in which case the parent's records are copied.
+ * It does nothing unless `$BLINK_PERF` was specified.
+ */
+void SetupPerfMap(struct System *s) {
+  if (!FLAG_perf || IsJitDisabled(&s->jit)) return;
+  OpenPerfMap();
+  LoadSharedSymbols(s);
+}
+
+static void GetPerfMapName(struct System *s, i64 virt, char *buf, int size) {
+  long sym;
+  LOCK(&s->mmap_lock);
+  if (s->dis && (sym = DisFindSym(s->dis, virt)) != -1) {
+    if (virt == s->dis->syms.p[sym].addr) {
+      snprintf(buf, size, "%" PRIx64 " %s", virt, s->dis->syms.p[sym].name);
+    } else {
+      snprintf(buf, size, "%" PRIx64 " %s+%#" PRIx64, virt,
+               s->dis->syms.p[sym].name, virt - s->dis->syms.p[sym].addr);
+    }
+  } else {
+    snprintf(buf, size, "%" PRIx64, virt);
+  }
+  UNLOCK(&s->mmap_lock);
+}
+
+// perf attributes each record to the host thread that compiled it
+static u32 GetPerfTid(void) {
+#if defined(__linux) && defined(SYS_gettid)
+  return syscall(SYS_gettid);
+#else
+  return g_perfmap.pid;
+#endif
+}
+
+static void WriteJitDump(const char *name, const u8 *code, long size) {
+  u8 *p;
+  long namelen, total;
+  struct JitDumpCodeLoad rec;
+  namelen = strlen(name) + 1;
+  total = sizeof(rec) + namelen + size;
+  if (!(p = (u8 *)malloc(total))) return;
+  rec.id = JITDUMP_CODE_LOAD;
+  rec.total_size = total;
+  rec.timestamp = GetPerfTimestamp();
+  rec.pid = g_perfmap.pid;
+  rec.tid = GetPerfTid();
+  rec.vma = (uintptr_t)code;
+  rec.code_addr = (uintptr_t)code;
+  rec.code_size = size;
+  rec.code_index = atomic_fetch_add_explicit(&g_perfmap.index, 1,
+                                             memory_order_relaxed);
+  memcpy(p, &rec, sizeof(rec));
+  memcpy(p + sizeof(rec), name, namelen);
+  memcpy(p + sizeof(rec) + namelen, code, size);
+  // appending each record with one write keeps threads from mixing them
+  (void)!write(g_perfmap.dumpfd, p, total);
+  free(p);
+}
+
+/**
+ * Records that guest path at `virt` was compiled to `size` bytes of host
+ * `code` which is about to go live.
+ */
+void WritePerfMap(struct Machine *m, i64 virt, const u8 *code, long size) {
+  int n;
+  char name[DIS_MAX_SYMBOL_LENGTH + 64];
+  char line[sizeof(name) + 48];
+  if (!g_perfmap.enabled) return;
+  GetPerfMapName(m->system, virt, name, sizeof(name));
+  if (g_perfmap.mapfd != -1) {
+    n = snprintf(line, sizeof(line), "%" PRIxPTR " %lx %s\n", (uintptr_t)code,
+                 size, name);
+    (void)!write(g_perfmap.mapfd, line, MIN(n, sizeof(line) - 1));
+  }
+  if (g_perfmap.dumpfd != -1) {
+    WriteJitDump(name, code, size);
+  }
+}
+
+#endif /* HAVE_JIT */
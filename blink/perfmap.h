@@ -0,0 +1,9 @@
+#ifndef BLINK_PERFMAP_H_
+#define BLINK_PERFMAP_H_
+#include "blink/machine.h"
+#include "blink/types.h"
+
+void SetupPerfMap(struct System *);
+void WritePerfMap(struct Machine *, i64, const u8 *, long);
+
+#endif /* BLINK_PERFMAP_H_ */
@@ -67,3 +67,79 @@ int FindContiguousMemoryRanges(struct Machine *m,
   }
   return 0;
 }
+
+static bool IsFileMapPage(struct FileMap *fm, i64 page) {
+  u64 i;
+  if (page < fm->virt || page >= fm->virt + fm->size) return false;
+  i = (page - fm->virt) / 4096;
+  return !!(fm->present[i / 64] & ((u64)1 << (i % 64)));
+}
+
+static int AppendMemoryMapping(struct System *s, struct MemoryMappings *maps,
+                               i64 page, u64 entry) {
+  u64 flags;
+  struct FileMap *fm;
+  struct MemoryMapping *p, *last;
+  fm = 0;
+  last = maps->i ? maps->p + maps->i - 1 : 0;
+  flags = entry & (PAGE_U | PAGE_RW | PAGE_XD);
+  if (entry & PAGE_FILE) {
+    // most pages belong to the same file map as the page before them
+    if (last && last->fm && IsFileMapPage(last->fm, page)) {
+      fm = last->fm;
+    } else {
+      fm = GetFileMap(s, page);
+    }
+  }
+  if (!last || page != last->b || flags != last->flags || fm != last->fm) {
+    if (maps->i == maps->n) {
+      if (!(p = (struct MemoryMapping *)realloc(
+                maps->p, (maps->n + (maps->n >> 1) + 16) * sizeof(*p)))) {
+        return -1;
+      }
+      maps->p = p;
+      maps->n += (maps->n >> 1) + 16;
+    }
+    last = maps->p + maps->i++;
+    last->a = page;
+    last->b = page;
+    last->flags = flags;
+    last->rss = 0;
+    last->fm = fm;
+  }
+  last->b += 4096;
+  last->rss += !(entry & PAGE_RSRV);
+  return 0;
+}
+
+static int FindMemoryMappingsImpl(struct System *s,
+                                  struct MemoryMappings *maps, i64 addr,
+                                  unsigned level, u64 pt, i64 a, i64 b) {
+  u64 entry;
+  i64 i, page;
+  for (i = a; i < b; ++i) {
+    entry = LoadPte(GetPageAddress(s, pt, level == 39) + i * 8);
+    if (!(entry & PAGE_V)) continue;
+    page = (addr | i << level) << 16 >> 16;
+    if (level == 12) {
+      if (AppendMemoryMapping(s, maps, page, entry) == -1) return -1;
+    } else if (FindMemoryMappingsImpl(s, maps, page, level - 9, entry, 0,
+                                      512) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// groups the pages of the address space into the mappings that would
+// be listed by /proc/self/maps, in ascending order. the caller should
+// hold mmap_lock and free maps->p when done.
+int FindMemoryMappings(struct System *s, struct MemoryMappings *maps) {
+  maps->i = 0;
+  if (s->mode.omode != XED_MODE_LONG) return 0;
+  if (FindMemoryMappingsImpl(s, maps, 0, 39, s->cr3, 0, 256) == -1 ||
+      FindMemoryMappingsImpl(s, maps, 0, 39, s->cr3, 256, 512) == -1) {
+    return -1;
+  }
+  return 0;
+}
@@ -12,7 +12,21 @@ struct ContiguousMemoryRanges {
   struct ContiguousMemoryRange *p;
 };
 
+struct MemoryMapping {
+  i64 a;               // address of first page
+  i64 b;               // address after last page
+  u64 flags;           // PAGE_U, PAGE_RW, and PAGE_XD of every page
+  long rss;            // number of pages that aren't PAGE_RSRV
+  struct FileMap *fm;  // valid only while mmap_lock is held
+};
+
+struct MemoryMappings {
+  unsigned i, n;
+  struct MemoryMapping *p;
+};
+
 int FindContiguousMemoryRanges(struct Machine *,
                                struct ContiguousMemoryRanges *);
+int FindMemoryMappings(struct System *, struct MemoryMappings *);
 
 #endif /* BLINK_PML4T_H_ */
@@ -19,14 +19,23 @@
 #include "blink/procfs.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "blink/atomic.h"
+#include "blink/endian.h"
 #include "blink/errno.h"
+#include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/pml4t.h"
+#include "blink/stats.h"
 #include "blink/timespec.h"
+#include "blink/tsan.h"
 #include "blink/vfs.h"
 
 #ifdef __EMSCRIPTEN__
@@ -97,6 +106,12 @@ enum {
   PROCFS_SELF_INO,
   PROCFS_SYS_INO,
   PROCFS_UPTIME_INO,
+  PROCFS_BLINK_INO,
+  PROCFS_LAST_ROOT_INO = PROCFS_BLINK_INO,
+
+  PROCFS_BLINK_JIT_INO,
+  PROCFS_BLINK_STATS_INO,
+  PROCFS_BLINK_THREADS_INO,
 
   PROCFS_FIRST_PID_INO
 };
@@ -109,12 +124,21 @@ enum {
   PROCFS_SELF_TYPE,
   PROCFS_SYS_TYPE,
   PROCFS_UPTIME_TYPE,
+  PROCFS_BLINK_TYPE,
+  PROCFS_BLINK_JIT_TYPE,
+  PROCFS_BLINK_STATS_TYPE,
+  PROCFS_BLINK_THREADS_TYPE,
 
   PROCFS_PIDDIR_TYPE,
   PROCFS_PIDDIR_EXE_TYPE,
   PROCFS_PIDDIR_CWD_TYPE,
   PROCFS_PIDDIR_ROOT_TYPE,
   PROCFS_PIDDIR_MOUNTS_TYPE,
+  PROCFS_PIDDIR_MAPS_TYPE,
+  PROCFS_PIDDIR_SMAPS_TYPE,
+  PROCFS_PIDDIR_STAT_TYPE,
+  PROCFS_PIDDIR_STATM_TYPE,
+  PROCFS_PIDDIR_STATUS_TYPE,
   PROCFS_PIDDIR_FDDIR_TYPE,
   PROCFS_PIDDIR_LAST_TYPE = PROCFS_PIDDIR_FDDIR_TYPE
 };
@@ -125,12 +149,21 @@ static ssize_t ProcfsToSelfReadlink(struct VfsInfo *, char **);
 static int ProcfsMeminfoRead(struct VfsInfo *, struct ProcfsOpenFile *);
 static int ProcfsUptimeRead(struct VfsInfo *, struct ProcfsOpenFile *);
 static int ProcfsFilesystemsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsBlinkReaddir(struct VfsInfo *, struct dirent *);
+static int ProcfsBlinkJitRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsBlinkStatsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsBlinkThreadsRead(struct VfsInfo *, struct ProcfsOpenFile *);
 
 static int ProcfsPiddirReaddir(struct VfsInfo *, struct dirent *);
 static ssize_t ProcfsPiddirExeReadlink(struct VfsInfo *, char **);
 static ssize_t ProcfsPiddirCwdReadlink(struct VfsInfo *, char **);
 static ssize_t ProcfsPiddirRootReadlink(struct VfsInfo *, char **);
 static int ProcfsPiddirMountsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirMapsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirSmapsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirStatRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirStatmRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirStatusRead(struct VfsInfo *, struct ProcfsOpenFile *);
 
 static struct ProcfsInfo g_defaultinfos[] = {
     [PROCFS_ROOT_INO] = {PROCFS_ROOT_INO, S_IFDIR | 0555, 0, 0,
@@ -152,6 +185,18 @@ static struct ProcfsInfo g_defaultinfos[] = {
     [PROCFS_UPTIME_INO] = {PROCFS_UPTIME_INO, S_IFREG | 0444, 0, 0,
                            PROCFS_UPTIME_TYPE, "uptime",
                            .read = ProcfsUptimeRead},
+    [PROCFS_BLINK_INO] = {PROCFS_BLINK_INO, S_IFDIR | 0555, 0, 0,
+                          PROCFS_BLINK_TYPE, "blink",
+                          .readdir = ProcfsBlinkReaddir},
+    [PROCFS_BLINK_JIT_INO] = {PROCFS_BLINK_JIT_INO, S_IFREG | 0444, 0, 0,
+                              PROCFS_BLINK_JIT_TYPE, "jit",
+                              .read = ProcfsBlinkJitRead},
+    [PROCFS_BLINK_STATS_INO] = {PROCFS_BLINK_STATS_INO, S_IFREG | 0444, 0, 0,
+                                PROCFS_BLINK_STATS_TYPE, "stats",
+                                .read = ProcfsBlinkStatsRead},
+    [PROCFS_BLINK_THREADS_INO] = {PROCFS_BLINK_THREADS_INO, S_IFREG | 0444, 0,
+                                  0, PROCFS_BLINK_THREADS_TYPE, "threads",
+                                  .read = ProcfsBlinkThreadsRead},
 };
 
 static struct ProcfsInfo g_piddirinfos[] = {
@@ -171,6 +216,24 @@ static struct ProcfsInfo g_piddirinfos[] = {
         PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
                                PROCFS_PIDDIR_MOUNTS_TYPE, "mounts",
                                .read = ProcfsPiddirMountsRead},
+    [PROCFS_PIDDIR_MAPS_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0, PROCFS_PIDDIR_MAPS_TYPE,
+                               "maps", .read = ProcfsPiddirMapsRead},
+    [PROCFS_PIDDIR_SMAPS_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
+                               PROCFS_PIDDIR_SMAPS_TYPE, "smaps",
+                               .read = ProcfsPiddirSmapsRead},
+    [PROCFS_PIDDIR_STAT_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0, PROCFS_PIDDIR_STAT_TYPE,
+                               "stat", .read = ProcfsPiddirStatRead},
+    [PROCFS_PIDDIR_STATM_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
+                               PROCFS_PIDDIR_STATM_TYPE, "statm",
+                               .read = ProcfsPiddirStatmRead},
+    [PROCFS_PIDDIR_STATUS_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
+                               PROCFS_PIDDIR_STATUS_TYPE, "status",
+                               .read = ProcfsPiddirStatusRead},
     [PROCFS_PIDDIR_FDDIR_TYPE - PROCFS_PIDDIR_TYPE] = {0, S_IFDIR | 0555, 0, 0,
                                                        PROCFS_PIDDIR_FDDIR_TYPE,
                                                        "fd"},
@@ -324,6 +387,9 @@ static int ProcfsFinddir(struct VfsInfo *parent, const char *name,
                          struct VfsInfo **output) {
   struct ProcfsInfo *procparent = (struct ProcfsInfo *)parent->data;
   struct ProcfsInfo *procoutput = NULL;
+  char dirname[PROCFS_NAME_MAX];
+  bool isdir = false;
+  size_t len;
   int i, pid;
   VFS_LOGF("ProcfsFinddir(parent=%p (%s), name=\"%s\", output=%p)", parent,
            parent->name, name, output);
@@ -332,9 +398,21 @@ static int ProcfsFinddir(struct VfsInfo *parent, const char *name,
     return 0;
   }
   *output = NULL;
+  // names from paths with a trailing slash, e.g. /proc/blink/, must be
+  // directories, or symlinks that the caller will resolve to one
+  len = strlen(name);
+  if (len > 1 && name[len - 1] == '/') {
+    if (len > sizeof(dirname)) {
+      return enoent();
+    }
+    memcpy(dirname, name, len - 1);
+    dirname[len - 1] = '\0';
+    name = dirname;
+    isdir = true;
+  }
   switch (procparent->type) {
     case PROCFS_ROOT_TYPE:
-      for (i = PROCFS_ROOT_INO + 1; i < PROCFS_FIRST_PID_INO; ++i) {
+      for (i = PROCFS_ROOT_INO + 1; i <= PROCFS_LAST_ROOT_INO; ++i) {
         if (!strcmp(name, g_defaultinfos[i].name)) {
           if (ProcfsCreateDefaultInfo(
                   &procoutput, (struct ProcfsDevice *)parent->device->data,
@@ -356,6 +434,18 @@ static int ProcfsFinddir(struct VfsInfo *parent, const char *name,
       }
       // TODO(trungnt): PID-specific directories of other processes.
       break;
+    case PROCFS_BLINK_TYPE:
+      for (i = PROCFS_LAST_ROOT_INO + 1; i < PROCFS_FIRST_PID_INO; ++i) {
+        if (!strcmp(name, g_defaultinfos[i].name)) {
+          if (ProcfsCreateDefaultInfo(
+                  &procoutput, (struct ProcfsDevice *)parent->device->data,
+                  i) == -1) {
+            goto cleananddie;
+          }
+          break;
+        }
+      }
+      break;
     case PROCFS_PIDDIR_TYPE:
       for (i = 1; i <= PROCFS_PIDDIR_LAST_TYPE - PROCFS_PIDDIR_TYPE; ++i) {
         if (!strcmp(name, g_piddirinfos[i].name)) {
@@ -372,6 +462,10 @@ static int ProcfsFinddir(struct VfsInfo *parent, const char *name,
     enoent();
     goto cleananddie;
   }
+  if (isdir && !S_ISDIR(procoutput->mode) && !S_ISLNK(procoutput->mode)) {
+    enotdir();
+    goto cleananddie;
+  }
   if (VfsCreateInfo(output) == -1) {
     goto cleananddie;
   }
@@ -575,8 +669,8 @@ static int ProcfsStatImpl(struct VfsDevice *device, struct ProcfsInfo *info,
   st->st_mode = info->mode;
   st->st_nlink = 1;
   if (info->ino < PROCFS_FIRST_PID_INO) {
-    st->st_uid = g_defaultinfos[info->type].uid;
-    st->st_gid = g_defaultinfos[info->type].gid;
+    st->st_uid = g_defaultinfos[info->ino].uid;
+    st->st_gid = g_defaultinfos[info->ino].gid;
   } else {
     st->st_uid = info->uid;
     st->st_gid = info->gid;
@@ -621,7 +715,7 @@ static int ProcfsFchmod(struct VfsInfo *info, mode_t mode) {
     return eperm();
   } else {
     procinfo->mode = (procinfo->mode & ~07777) | (mode & 07777);
-    g_defaultinfos[procinfo->type].mode = procinfo->mode;
+    g_defaultinfos[procinfo->ino].mode = procinfo->mode;
     return 0;
   }
 }
@@ -647,11 +741,11 @@ static int ProcfsFchown(struct VfsInfo *info, uid_t uid, gid_t gid) {
   } else {
     if (uid != -1) {
       procinfo->uid = uid;
-      g_defaultinfos[procinfo->type].uid = uid;
+      g_defaultinfos[procinfo->ino].uid = uid;
     }
     if (gid != -1) {
       procinfo->gid = gid;
-      g_defaultinfos[procinfo->type].gid = gid;
+      g_defaultinfos[procinfo->ino].gid = gid;
     }
     return 0;
   }
@@ -1041,8 +1135,8 @@ static int ProcfsRootReaddir(struct VfsInfo *info, struct dirent *de) {
 #endif
     strcpy(de->d_name, ".");
     ret = 0;
-  } else if (dir->index >= PROCFS_FIRST_PID_INO) {
-    if (dir->index == PROCFS_FIRST_PID_INO) {
+  } else if (dir->index > PROCFS_LAST_ROOT_INO) {
+    if (dir->index == PROCFS_LAST_ROOT_INO + 1) {
       // In the limited version, there's only one PID visible here.
       // For the complete implementation, we have to query the PID table.
       de->d_ino = PROCFS_FIRST_PID_INO;
@@ -1091,6 +1185,9 @@ static int ProcfsPiddirReaddir(struct VfsInfo *info, struct dirent *de) {
     if (ProcfsInfoToDirent(&g_piddirinfos[dir->index - 1], de) == -1) {
       ret = -1;
     }
+    // the table doesn't know the inode, which readdir() treats as unused
+    // when zero, so use the same numbers ProcfsCreatePiddirInfo() does
+    de->d_ino = info->ino + (dir->index - 1);
     ret = 0;
   }
   ++dir->index;
@@ -1098,6 +1195,36 @@ static int ProcfsPiddirReaddir(struct VfsInfo *info, struct dirent *de) {
   return ret;
 }
 
+static int ProcfsBlinkReaddir(struct VfsInfo *info, struct dirent *de) {
+  struct ProcfsInfo *procinfo = (struct ProcfsInfo *)info->data;
+  struct ProcfsOpenDir *dir = procinfo->opendir;
+  int ret = 0;
+  LOCK(&dir->lock);
+  if (dir->index == 0) {
+    de->d_ino = info->parent->ino;
+#ifdef DT_DIR
+    de->d_type = DT_DIR;
+#endif
+    strcpy(de->d_name, "..");
+    ret = 0;
+  } else if (dir->index == 1) {
+    de->d_ino = info->ino;
+#ifdef DT_DIR
+    de->d_type = DT_DIR;
+#endif
+    strcpy(de->d_name, ".");
+    ret = 0;
+  } else if (dir->index + PROCFS_LAST_ROOT_INO - 1 >= PROCFS_FIRST_PID_INO) {
+    ret = enoent();
+  } else {
+    ret = ProcfsInfoToDirent(
+        &g_defaultinfos[dir->index + PROCFS_LAST_ROOT_INO - 1], de);
+  }
+  ++dir->index;
+  UNLOCK(&dir->lock);
+  return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static ssize_t ProcfsSelfReadlink(struct VfsInfo *info, char **buf) {
@@ -1410,6 +1537,518 @@ static int ProcfsPiddirMountsRead(struct VfsInfo *info,
   return 0;
 }
 
+// Linux pads the columns before the pathname to this width.
+#define PROCFS_MAPS_PATH_COLUMN 73
+
+static size_t ProcfsFormatMapping(char *p, size_t n, struct MemoryMapping *map,
+                                  bool smaps) {
+  size_t i;
+  i64 offset;
+  long size, rss, anon;
+  struct FileMap *fm = map->fm;
+  offset = fm && fm->offset != -1 ? fm->offset + (map->a - fm->virt) : 0;
+  i = snprintf(p, n, "%08" PRIx64 "-%08" PRIx64 " %c%c%cp %08" PRIx64
+               " 00:00 0",
+               map->a, map->b, map->flags & PAGE_U ? 'r' : '-',
+               map->flags & PAGE_RW ? 'w' : '-',
+               map->flags & PAGE_XD ? '-' : 'x', offset);
+  if (fm) {
+    i += snprintf(p + MIN(i, n), n - MIN(i, n), "%*s%s",
+                  i < PROCFS_MAPS_PATH_COLUMN
+                      ? (int)(PROCFS_MAPS_PATH_COLUMN - i)
+                      : 1,
+                  "", fm->path);
+  }
+  i += snprintf(p + MIN(i, n), n - MIN(i, n), "\n");
+  if (!smaps) return i;
+  size = (map->b - map->a) / 1024;
+  rss = map->rss * 4;
+  // pages mapped from a file are clean as far as we can tell
+  anon = !fm || fm->offset == -1 ? rss : 0;
+  i += snprintf(p + MIN(i, n), n - MIN(i, n),
+                "Size:           %8ld kB\n"
+                "KernelPageSize: %8d kB\n"
+                "MMUPageSize:    %8d kB\n"
+                "Rss:            %8ld kB\n"
+                "Pss:            %8ld kB\n"
+                "Shared_Clean:   %8d kB\n"
+                "Shared_Dirty:   %8d kB\n"
+                "Private_Clean:  %8ld kB\n"
+                "Private_Dirty:  %8ld kB\n"
+                "Referenced:     %8ld kB\n"
+                "Anonymous:      %8ld kB\n"
+                "Swap:           %8d kB\n"
+                "Locked:         %8d kB\n"
+                "VmFlags: %s%s%s\n",
+                size, 4, 4, rss, rss, 0, 0, rss - anon, anon, rss, anon, 0, 0,
+                map->flags & PAGE_U ? "rd " : "",
+                map->flags & PAGE_RW ? "wr " : "",
+                map->flags & PAGE_XD ? "" : "ex ");
+  return i;
+}
+
+static int ProcfsPiddirMapsReadImpl(struct ProcfsOpenFile *openfile,
+                                    bool smaps) {
+  size_t byteswritten = 0;
+  size_t bytesleft = sizeof(openfile->readbuf);
+  size_t ret;
+  struct MemoryMappings maps = {0};
+  struct System *s;
+  unsigned i;
+  if (openfile->readbufend > sizeof(openfile->readbuf)) {
+    return 0;
+  }
+  if (!g_machine) {
+    return eperm();
+  }
+  s = g_machine->system;
+  // file maps are only stable while mmap_lock is held
+  LOCK(&s->mmap_lock);
+  if (FindMemoryMappings(s, &maps) == -1) {
+    UNLOCK(&s->mmap_lock);
+    free(maps.p);
+    return enomem();
+  }
+  for (i = openfile->index; i < maps.i; ++i) {
+    ret = ProcfsFormatMapping(openfile->readbuf + byteswritten, bytesleft,
+                              maps.p + i, smaps);
+    if (ret >= bytesleft) {
+      if (byteswritten) break;
+      // truncate entries that could never fit, e.g. very long paths
+      ret = bytesleft - 1;
+      openfile->readbuf[ret - 1] = '\n';
+    }
+    byteswritten += ret;
+    bytesleft -= ret;
+    ++openfile->index;
+  }
+  UNLOCK(&s->mmap_lock);
+  free(maps.p);
+  if (i >= maps.i && byteswritten == 0) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+  } else {
+    openfile->readbufstart = 0;
+    openfile->readbufend = byteswritten;
+  }
+  return 0;
+}
+
+static int ProcfsPiddirMapsRead(struct VfsInfo *info,
+                                struct ProcfsOpenFile *openfile) {
+  return ProcfsPiddirMapsReadImpl(openfile, false);
+}
+
+static int ProcfsPiddirSmapsRead(struct VfsInfo *info,
+                                 struct ProcfsOpenFile *openfile) {
+  return ProcfsPiddirMapsReadImpl(openfile, true);
+}
+
+struct ProcfsProcess {
+  const char *name;
+  int threads;
+  long vss;    // pages
+  long rss;    // pages
+  long text;   // pages
+  long stack;  // pages
+  i64 codestart;
+  i64 codeend;
+  i64 stacktop;
+  i64 brk;
+  u64 blocked;
+  u64 pending;
+  u64 ignored;
+  u64 caught;
+  struct rusage self;
+  struct rusage children;
+};
+
+// the caller must hold mmap_lock
+static struct FileMap *ProcfsFindFileMap(struct System *s, const char *path) {
+  struct Dll *e;
+  for (e = dll_first(s->filemaps); e; e = dll_next(s->filemaps, e)) {
+    if (!strcmp(FILEMAP_CONTAINER(e)->path, path)) {
+      return FILEMAP_CONTAINER(e);
+    }
+  }
+  return 0;
+}
+
+static int ProcfsGetProcess(struct ProcfsProcess *p) {
+  int i;
+  u64 handler;
+  struct Dll *e;
+  struct System *s;
+  struct FileMap *fm;
+  if (!g_machine) {
+    return eperm();
+  }
+  memset(p, 0, sizeof(*p));
+  s = g_machine->system;
+  p->name = g_selfexeinfo && g_selfexeinfo->name ? g_selfexeinfo->name
+                                                  : "blink";
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    ++p->threads;
+  }
+  UNLOCK(&s->machines_lock);
+  LOCK(&s->mmap_lock);
+  p->vss = s->vss;
+  p->rss = s->rss;
+  p->text = ROUNDUP(s->codesize, 4096) / 4096;
+  p->codestart = s->codestart;
+  p->codeend = s->codestart + s->codesize;
+  p->brk = (fm = ProcfsFindFileMap(s, "[heap]")) ? fm->virt : s->brk;
+  if ((fm = ProcfsFindFileMap(s, "[stack]"))) {
+    p->stack = fm->size / 4096;
+    p->stacktop = fm->virt + fm->size;
+  }
+  UNLOCK(&s->mmap_lock);
+  p->blocked = g_machine->sigmask;
+  p->pending = g_machine->signals;
+  for (i = 0; i < ARRAYLEN(s->hands); ++i) {
+    handler = Read64(s->hands[i].handler);
+    if (handler == SIG_IGN_LINUX) {
+      p->ignored |= (u64)1 << i;
+    } else if (handler != SIG_DFL_LINUX) {
+      p->caught |= (u64)1 << i;
+    }
+  }
+  getrusage(RUSAGE_SELF, &p->self);
+  getrusage(RUSAGE_CHILDREN, &p->children);
+  return 0;
+}
+
+// converts to the USER_HZ clock ticks Linux uses for process times
+static long ProcfsTicks(struct timeval tv) {
+  return tv.tv_sec * 100 + tv.tv_usec / 10000;
+}
+
+static int ProcfsPiddirStatRead(struct VfsInfo *info,
+                                struct ProcfsOpenFile *openfile) {
+  struct ProcfsProcess p;
+  if (openfile->index > 0) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+    return 0;
+  }
+  if (ProcfsGetProcess(&p) == -1) {
+    return -1;
+  }
+  openfile->readbufstart = 0;
+  openfile->readbufend = snprintf(
+      openfile->readbuf, sizeof(openfile->readbuf),
+      "%d (%.15s) R %d %d %d 0 -1 0 %ld %ld %ld %ld %ld %ld %ld %ld 20 0 %d "
+      "0 0 %lu %ld %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+      " 0 0 %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+      " 0 0 0 17 0 0 0 0 0 0 0 0 %" PRIu64 " 0 0 0 0 0\n",
+      getpid(), p.name, getppid(), getpgrp(), getsid(0),
+      p.self.ru_minflt, p.children.ru_minflt, p.self.ru_majflt,
+      p.children.ru_majflt, ProcfsTicks(p.self.ru_utime),
+      ProcfsTicks(p.self.ru_stime), ProcfsTicks(p.children.ru_utime),
+      ProcfsTicks(p.children.ru_stime), p.threads, p.vss * 4096ul, p.rss,
+      Read64(g_machine->system->rlim[RLIMIT_RSS_LINUX].cur), (u64)p.codestart,
+      (u64)p.codeend, (u64)p.stacktop, p.pending, p.blocked, p.ignored,
+      p.caught, (u64)p.brk);
+  openfile->index = 1;
+  return 0;
+}
+
+static int ProcfsPiddirStatmRead(struct VfsInfo *info,
+                                 struct ProcfsOpenFile *openfile) {
+  struct ProcfsProcess p;
+  if (openfile->index > 0) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+    return 0;
+  }
+  if (ProcfsGetProcess(&p) == -1) {
+    return -1;
+  }
+  openfile->readbufstart = 0;
+  openfile->readbufend =
+      snprintf(openfile->readbuf, sizeof(openfile->readbuf),
+               "%ld %ld 0 %ld 0 %ld 0\n", p.vss, p.rss, p.text,
+               MAX(p.vss - p.text, 0));
+  openfile->index = 1;
+  return 0;
+}
+
+static int ProcfsPiddirStatusRead(struct VfsInfo *info,
+                                  struct ProcfsOpenFile *openfile) {
+  struct ProcfsProcess p;
+  if (openfile->index > 0) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+    return 0;
+  }
+  if (ProcfsGetProcess(&p) == -1) {
+    return -1;
+  }
+  openfile->readbufstart = 0;
+  openfile->readbufend = snprintf(
+      openfile->readbuf, sizeof(openfile->readbuf),
+      "Name:\t%.15s\n"
+      "State:\tR (running)\n"
+      "Tgid:\t%d\n"
+      "Pid:\t%d\n"
+      "PPid:\t%d\n"
+      "TracerPid:\t0\n"
+      "Uid:\t%d\t%d\t%d\t%d\n"
+      "Gid:\t%d\t%d\t%d\t%d\n"
+      "VmSize:\t%8ld kB\n"
+      "VmRSS:\t%8ld kB\n"
+      "VmData:\t%8ld kB\n"
+      "VmStk:\t%8ld kB\n"
+      "VmExe:\t%8ld kB\n"
+      "Threads:\t%d\n"
+      "SigPnd:\t%016" PRIx64 "\n"
+      "ShdPnd:\t%016" PRIx64 "\n"
+      "SigBlk:\t%016" PRIx64 "\n"
+      "SigIgn:\t%016" PRIx64 "\n"
+      "SigCgt:\t%016" PRIx64 "\n",
+      p.name, getpid(), getpid(), getppid(), getuid(), geteuid(), geteuid(),
+      geteuid(), getgid(), getegid(), getegid(), getegid(), p.vss * 4,
+      p.rss * 4, MAX(p.vss - p.text - p.stack, 0) * 4, p.stack * 4, p.text * 4,
+      p.threads, (u64)0, p.pending, p.blocked, p.ignored, p.caught);
+  openfile->index = 1;
+  return 0;
+}
+
+// fills the read buffer with as many whole records as will fit. format
+// renders the record at index like snprintf() and returns 0 past the end
+static int ProcfsReadRecords(struct ProcfsOpenFile *openfile,
+                             size_t format(char *, size_t, size_t, void *),
+                             void *arg) {
+  size_t byteswritten = 0;
+  size_t bytesleft = sizeof(openfile->readbuf);
+  size_t ret;
+  if (openfile->readbufend > sizeof(openfile->readbuf)) {
+    return 0;
+  }
+  while ((ret = format(openfile->readbuf + byteswritten, bytesleft,
+                       openfile->index, arg))) {
+    if (ret >= bytesleft) {
+      if (byteswritten) break;
+      ret = bytesleft - 1;
+      openfile->readbuf[ret - 1] = '\n';
+    }
+    byteswritten += ret;
+    bytesleft -= ret;
+    ++openfile->index;
+  }
+  if (!byteswritten) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+  } else {
+    openfile->readbufstart = 0;
+    openfile->readbufend = byteswritten;
+  }
+  return 0;
+}
+
+struct ProcfsStatistic {
+  const char *name;
+  long *counter;
+  struct Average *average;
+  size_t offset;  // into struct MachineStats, if neither of the above
+};
+
+static const struct ProcfsStatistic kProcfsStatistics[] = {
+#define DEFINE_COUNTER(S)         {#S, &S, 0, 0},
+#define DEFINE_AVERAGE(S)         {#S, 0, &S, 0},
+#define DEFINE_MACHINE_COUNTER(S) {#S, 0, 0, offsetof(struct MachineStats, S)},
+#include "blink/stats.inc"
+#undef DEFINE_MACHINE_COUNTER
+#undef DEFINE_AVERAGE
+#undef DEFINE_COUNTER
+};
+
+static void ProcfsGetMachineStats(struct MachineStats *st) {
+  struct System *s = g_machine->system;
+  LOCK(&s->machines_lock);
+  *st = g_machinestats;
+  SumMachineStats(s, st);
+  UNLOCK(&s->machines_lock);
+}
+
+static size_t ProcfsFormatStatistic(char *p, size_t n,
+                                    const struct ProcfsStatistic *stat,
+                                    const struct MachineStats *st) {
+  double average;
+  if (stat->counter) {
+    return snprintf(p, n, "%-32s %ld\n", stat->name,
+                    GET_COUNTER(*stat->counter));
+  } else if (stat->average) {
+    IGNORE_RACES_START();
+    average = stat->average->a;
+    IGNORE_RACES_END();
+    return snprintf(p, n, "%-32s %.6g\n", stat->name, average);
+  } else {
+    return snprintf(p, n, "%-32s %ld\n", stat->name,
+                    *(const long *)((const char *)st + stat->offset));
+  }
+}
+
+static size_t ProcfsFormatStatistics(char *p, size_t n, size_t i, void *arg) {
+  if (i >= ARRAYLEN(kProcfsStatistics)) return 0;
+  return ProcfsFormatStatistic(p, n, kProcfsStatistics + i,
+                               (const struct MachineStats *)arg);
+}
+
+static int ProcfsBlinkStatsRead(struct VfsInfo *info,
+                                struct ProcfsOpenFile *openfile) {
+  struct MachineStats st;
+  if (!g_machine) {
+    return eperm();
+  }
+  ProcfsGetMachineStats(&st);
+  return ProcfsReadRecords(openfile, ProcfsFormatStatistics, &st);
+}
+
+struct ProcfsJit {
+  bool enabled;
+  bool threaded;
+  long blocks;
+  long used;
+  long pages;
+  unsigned hooks;
+  unsigned capacity;
+  struct MachineStats stats;
+};
+
+static bool IsJitStatistic(const struct ProcfsStatistic *stat) {
+  return !strncmp(stat->name, "jit_", 4) || !strncmp(stat->name, "path_", 5) ||
+         !strcmp(stat->name, "instructions_jitted");
+}
+
+static size_t ProcfsFormatJit(char *p, size_t n, size_t i, void *arg) {
+  size_t j;
+  struct ProcfsJit *jit = (struct ProcfsJit *)arg;
+  switch (i) {
+    case 0:
+      return snprintf(p, n, "%-32s %d\n", "enabled", jit->enabled);
+    case 1:
+      return snprintf(p, n, "%-32s %d\n", "threaded", jit->threaded);
+    case 2:
+      return snprintf(p, n, "%-32s %ld\n", "blocks", jit->blocks);
+    case 3:
+      return snprintf(p, n, "%-32s %ld\n", "code_bytes", jit->used);
+    case 4:
+      return snprintf(p, n, "%-32s %ld\n", "code_bytes_max",
+                      (long)kJitMemorySize);
+    case 5:
+      return snprintf(p, n, "%-32s %ld\n", "pages", jit->pages);
+    case 6:
+      return snprintf(p, n, "%-32s %u\n", "hooks", jit->hooks);
+    case 7:
+      return snprintf(p, n, "%-32s %u\n", "hooks_capacity", jit->capacity);
+    default:
+      for (i -= 8, j = 0; j < ARRAYLEN(kProcfsStatistics); ++j) {
+        if (IsJitStatistic(kProcfsStatistics + j) && !i--) {
+          return ProcfsFormatStatistic(p, n, kProcfsStatistics + j,
+                                       &jit->stats);
+        }
+      }
+      return 0;
+  }
+}
+
+static int ProcfsBlinkJitRead(struct VfsInfo *info,
+                              struct ProcfsOpenFile *openfile) {
+  struct Dll *e;
+  struct Jit *jit;
+  struct ProcfsJit pj = {0};
+  if (!g_machine) {
+    return eperm();
+  }
+  jit = &g_machine->system->jit;
+  pj.enabled = !IsJitDisabled(jit);
+  pj.threaded = jit->threaded;
+  LOCK(&jit->lock);
+  for (e = dll_first(jit->blocks); e; e = dll_next(jit->blocks, e)) {
+    ++pj.blocks;
+    pj.used += JITBLOCK_CONTAINER(e)->index;
+  }
+  for (e = dll_first(jit->pages); e; e = dll_next(jit->pages, e)) {
+    ++pj.pages;
+  }
+  pj.hooks = jit->hooks.i;
+  pj.capacity = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
+  UNLOCK(&jit->lock);
+  ProcfsGetMachineStats(&pj.stats);
+  return ProcfsReadRecords(openfile, ProcfsFormatJit, &pj);
+}
+
+struct ProcfsThread {
+  int tid;
+  bool insyscall;
+  u64 ip;
+  u64 sp;
+  u64 pending;
+  u64 blocked;
+};
+
+struct ProcfsThreads {
+  int n;
+  struct ProcfsThread *p;
+};
+
+static size_t ProcfsFormatThread(char *p, size_t n, size_t i, void *arg) {
+  struct ProcfsThread *t;
+  struct ProcfsThreads *threads = (struct ProcfsThreads *)arg;
+  if (!i) {
+    return snprintf(p, n, "%-8s %-16s %-16s %-7s %-16s %s\n", "tid", "rip",
+                    "rsp", "state", "pending", "blocked");
+  }
+  if (i > threads->n) return 0;
+  t = threads->p + i - 1;
+  return snprintf(p, n,
+                  "%-8d %016" PRIx64 " %016" PRIx64 " %-7s %016" PRIx64
+                  " %016" PRIx64 "\n",
+                  t->tid, t->ip, t->sp, t->insyscall ? "syscall" : "running",
+                  t->pending, t->blocked);
+}
+
+static int ProcfsBlinkThreadsRead(struct VfsInfo *info,
+                                  struct ProcfsOpenFile *openfile) {
+  int rc;
+  struct Dll *e;
+  struct System *s;
+  struct Machine *m;
+  struct ProcfsThread *t;
+  struct ProcfsThreads threads = {0};
+  if (!g_machine) {
+    return eperm();
+  }
+  s = g_machine->system;
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    ++threads.n;
+  }
+  if (!(threads.p = (struct ProcfsThread *)calloc(threads.n, sizeof(*t)))) {
+    UNLOCK(&s->machines_lock);
+    return enomem();
+  }
+  // the registers of other threads are sampled as they run
+  IGNORE_RACES_START();
+  for (t = threads.p, e = dll_first(s->machines); e;
+       e = dll_next(s->machines, e), ++t) {
+    m = MACHINE_CONTAINER(e);
+    t->tid = m->tid;
+    t->insyscall = m->insyscall;
+    t->ip = m->ip;
+    t->sp = Read64(m->sp);
+    t->pending = m->signals;
+    t->blocked = m->sigmask;
+  }
+  IGNORE_RACES_END();
+  UNLOCK(&s->machines_lock);
+  rc = ProcfsReadRecords(openfile, ProcfsFormatThread, &threads);
+  free(threads.p);
+  return rc;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct VfsSystem g_procfs = {.name = "proc",
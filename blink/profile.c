@@ -0,0 +1,289 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/dis.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/linux.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/profile.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Sampling profiler for guest code.
+ *
+ * When `$BLINK_PROFILE` names a file, a SIGPROF interval timer asks
+ * whichever thread is burning cpu to record where the guest is. Each
+ * sample is the guest instruction pointer plus the return addresses
+ * found by walking the guest's frame pointer chain, which are named
+ * using the symbols of every ELF image that's been loaded. Identical
+ * stacks are counted together, and written at exit in the folded
+ * format that flamegraph.pl and speedscope accept.
+ *
+ *     BLINK_PROFILE=prog.folded blink prog
+ *     flamegraph.pl prog.folded >prog.svg
+ *
+ * Forked children write their own profile, to the same path with their
+ * process id appended. Guest programs need to be compiled with frame
+ * pointers, e.g. -fno-omit-frame-pointer, to get useful stacks.
+ */
+
+struct ProfileStack {
+  u64 hash;
+  long count;
+  char *folded;
+};
+
+static struct Profiler {
+  int pid;
+  int origin;
+  long count;
+  long capacity;
+  struct ProfileStack *stacks;
+  pthread_mutex_t_ lock;
+} g_profile = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void OnSigProf(int sig, siginfo_t *si, void *ptr) {
+  struct Machine *m;
+  if ((m = g_machine)) {
+    // sampling waits for the next instruction or path boundary, since
+    // the machine state might be halfway through changing right now
+    m->profiled = true;
+    atomic_store_explicit(&m->attention, true, memory_order_release);
+  }
+}
+
+static void SetProfileTimer(long interval) {
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  it.it_interval.tv_usec = interval;
+  it.it_value.tv_usec = interval;
+  setitimer(ITIMER_PROF, &it, 0);
+}
+
+static void ClearProfile(void) {
+  long i;
+  for (i = 0; i < g_profile.capacity; ++i) {
+    free(g_profile.stacks[i].folded);
+  }
+  free(g_profile.stacks);
+  g_profile.stacks = 0;
+  g_profile.capacity = 0;
+  g_profile.count = 0;
+}
+
+/**
+ * Starts sampling the guest program running in `s`.
+ *
+ * This should be called once the program is loaded, and again in the
+ * child after fork(), since interval timers aren't inherited. It does
+ * nothing unless `$BLINK_PROFILE` was specified.
+ */
+void SetupProfiler(struct System *s) {
+  int pid;
+  struct sigaction sa;
+  if (!FLAG_profile) return;
+  if ((pid = getpid()) != g_profile.pid) {
+    if (!g_profile.pid) {
+      g_profile.origin = pid;
+    } else {
+      // samples taken by the parent belong in the parent's profile
+      unassert(!pthread_mutex_init(&g_profile.lock, 0));
+      ClearProfile();
+    }
+    g_profile.pid = pid;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = OnSigProf;
+    sigfillset(&sa.sa_mask);
+    unassert(!sigaction(SIGPROF, &sa, 0));
+  }
+  // the guest isn't allowed to change how blink uses this signal
+  s->blinksigs |= (u64)1 << (SIGPROF_LINUX - 1);
+  SetProfileTimer(1000000 / kProfileHz);
+  LoadSharedSymbols(s);
+}
+
+// walks the guest frame pointer chain, like GetBacktrace() does, while
+// the caller holds the mmap lock so the stack memory can't disappear
+static int UnwindGuestStack(struct Machine *m, i64 pc[kProfileDepth]) {
+  u8 *r;
+  int n = 0;
+  i64 sp, bp, rp;
+  pc[n++] = m->cs.base + MaskAddress(m->mode.omode, m->ip);
+  if (m->mode.omode != XED_MODE_LONG) return n;
+  bp = Get64(m->bp);
+  sp = Get64(m->sp);
+  while (n < kProfileDepth) {
+    if (!bp || bp < sp || (bp & 7)) break;
+    if (((m->ss.base + bp) & 4095) > 4096 - 16) break;
+    if (!(r = LookupAddress(m, m->ss.base + bp))) break;
+    if (!(rp = Read64(r + 8))) break;
+    pc[n++] = rp;
+    sp = bp;
+    bp = Read64(r);
+  }
+  return n;
+}
+
+// appends the name of the function containing `pc` to the folded stack
+static int NameFrame(struct System *s, i64 pc, char *p, int n) {
+  long sym;
+  const char *name;
+  struct FileMap *fm;
+  if (s->dis && (sym = DisFindSym(s->dis, pc)) != -1) {
+    return snprintf(p, n, "%s", s->dis->syms.p[sym].name);
+  } else if ((fm = GetFileMap(s, pc)) && fm->path) {
+    if ((name = strrchr(fm->path, '/'))) {
+      ++name;
+    } else {
+      name = fm->path;
+    }
+    return snprintf(p, n, "[%s]", name);
+  } else {
+    return snprintf(p, n, "[unknown]");
+  }
+}
+
+static u64 HashProfileStack(const char *s) {
+  u64 h = 0xcbf29ce484222325;
+  for (; *s; ++s) {
+    h = (h ^ (*s & 255)) * 0x100000001b3;
+  }
+  return h;
+}
+
+static bool GrowProfile(void) {
+  long i, j, n;
+  struct ProfileStack *p;
+  n = g_profile.capacity ? g_profile.capacity * 2 : 256;
+  if (!(p = (struct ProfileStack *)calloc(n, sizeof(*p)))) return false;
+  for (i = 0; i < g_profile.capacity; ++i) {
+    if (!g_profile.stacks[i].folded) continue;
+    for (j = g_profile.stacks[i].hash & (n - 1); p[j].folded;
+         j = (j + 1) & (n - 1)) {
+    }
+    p[j] = g_profile.stacks[i];
+  }
+  free(g_profile.stacks);
+  g_profile.stacks = p;
+  g_profile.capacity = n;
+  return true;
+}
+
+static void CountProfileStack(const char *folded) {
+  u64 h;
+  long i;
+  h = HashProfileStack(folded);
+  LOCK(&g_profile.lock);
+  if ((g_profile.count + 1) * 2 <= g_profile.capacity || GrowProfile()) {
+    for (i = h & (g_profile.capacity - 1); g_profile.stacks[i].folded;
+         i = (i + 1) & (g_profile.capacity - 1)) {
+      if (g_profile.stacks[i].hash == h &&
+          !strcmp(g_profile.stacks[i].folded, folded)) {
+        break;
+      }
+    }
+    if (g_profile.stacks[i].folded) {
+      ++g_profile.stacks[i].count;
+    } else if ((g_profile.stacks[i].folded = strdup(folded))) {
+      g_profile.stacks[i].hash = h;
+      g_profile.stacks[i].count = 1;
+      ++g_profile.count;
+    }
+  }
+  UNLOCK(&g_profile.lock);
+}
+
+/**
+ * Records where `m` is, after SIGPROF asked for its attention.
+ */
+void TakeProfileSample(struct Machine *m) {
+  int i, n, o;
+  struct System *s;
+  i64 pc[kProfileDepth];
+  char folded[kProfileDepth * 64];
+  m->profiled = false;
+  s = m->system;
+  o = 0;
+  LOCK(&s->mmap_lock);
+  BEGIN_NO_PAGE_FAULTS;
+  n = UnwindGuestStack(m, pc);
+  END_NO_PAGE_FAULTS;
+  // flame graphs want the root first. return addresses are backed up
+  // by one byte so a call at the end of a function gets named right
+  for (i = n; i-- && o < sizeof(folded) - 1;) {
+    if (i < n - 1) folded[o++] = ';';
+    o += NameFrame(s, pc[i] - !!i, folded + o, sizeof(folded) - o);
+  }
+  UNLOCK(&s->mmap_lock);
+  folded[MIN(o, sizeof(folded) - 1)] = 0;
+  CountProfileStack(folded);
+}
+
+/**
+ * Writes the stacks sampled so far, which should happen before exit.
+ */
+void WriteProfile(void) {
+  long i;
+  FILE *f;
+  int fd, n;
+  char path[PATH_MAX];
+  if (!g_profile.pid || g_profile.pid != getpid()) return;
+  SetProfileTimer(0);
+  if (g_profile.pid == g_profile.origin) {
+    n = snprintf(path, sizeof(path), "%s", FLAG_profile);
+  } else {
+    n = snprintf(path, sizeof(path), "%s.%d", FLAG_profile, g_profile.pid);
+  }
+  if (n >= sizeof(path)) return;
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1 ||
+      !(f = fdopen(fd, "w"))) {
+    LOGF("%s: open failed: %s", path, DescribeHostErrno(errno));
+    if (fd != -1) close(fd);
+    return;
+  }
+  LOCK(&g_profile.lock);
+  for (i = 0; i < g_profile.capacity; ++i) {
+    if (g_profile.stacks[i].folded) {
+      fprintf(f, "%s %ld\n", g_profile.stacks[i].folded,
+              g_profile.stacks[i].count);
+    }
+  }
+  UNLOCK(&g_profile.lock);
+  if (fclose(f)) {
+    LOGF("%s: write failed: %s", path, DescribeHostErrno(errno));
+  }
+}
@@ -0,0 +1,9 @@
+#ifndef BLINK_PROFILE_H_
+#define BLINK_PROFILE_H_
+#include "blink/machine.h"
+
+void SetupProfiler(struct System *);
+void TakeProfileSample(struct Machine *);
+void WriteProfile(void);
+
+#endif /* BLINK_PROFILE_H_ */
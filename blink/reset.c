@@ -99,7 +99,7 @@ void ResetCpu(struct Machine *m) {
 }
 
 void ResetTlb(struct Machine *m) {
-  STATISTIC(++tlb_resets);
+  MACHINE_STATISTIC(m, tlb_resets);
   memset(m->tlb, 0, sizeof(m->tlb));
   m->opcache->codevirt = 0;
   m->opcache->codehost = 0;
@@ -108,6 +108,8 @@ void ResetTlb(struct Machine *m) {
 void ResetInstructionCache(struct Machine *m) {
   STATISTIC(++icache_resets);
   memset(m->opcache->icache, 0, sizeof(m->opcache->icache));
+  m->opcache->icachepc = -1;
+  m->opcache->icacheseq = 1;
   m->opcache->codevirt = 0;
   m->opcache->codehost = 0;
 }
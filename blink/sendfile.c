@@ -0,0 +1,249 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/limits.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+// sendfile(), splice(), tee() and copy_file_range() let the host kernel
+// move the data when both descriptors are plain host files, pipes or
+// sockets. Descriptors provided by virtual filesystems (e.g. procfs) or
+// emulated by blink get copied through a bounce buffer instead.
+
+#define kMaxHostTransfer 0x7ffff000  // what linux will move in one call
+
+#define kSpliceFlags                                  \
+  (SPLICE_F_MOVE_LINUX | SPLICE_F_NONBLOCK_LINUX |    \
+   SPLICE_F_MORE_LINUX | SPLICE_F_GIFT_LINUX)
+
+// Returns host descriptor whose data the host kernel can move directly,
+// or -1 if `fildes` is emulated and must be copied through userspace.
+static int GetHostFd(struct Machine *m, i32 fildes) {
+  struct Fd *fd;
+  const struct FdCb *cb;
+  LOCK(&m->system->fds.lock);
+  cb = (fd = GetFd(&m->system->fds, fildes)) && !fd->dirstream ? fd->cb : 0;
+  UNLOCK(&m->system->fds.lock);
+  if (cb != &kFdCbHost) return -1;
+  return VfsHostFd(fildes);
+}
+
+#ifdef HAVE_SPLICE
+static unsigned XlatSpliceFlags(u32 flags) {
+  return ((flags & SPLICE_F_MOVE_LINUX ? SPLICE_F_MOVE : 0) |
+          (flags & SPLICE_F_NONBLOCK_LINUX ? SPLICE_F_NONBLOCK : 0) |
+          (flags & SPLICE_F_MORE_LINUX ? SPLICE_F_MORE : 0) |
+          (flags & SPLICE_F_GIFT_LINUX ? SPLICE_F_GIFT : 0));
+}
+#endif
+
+static int LoadOffset(struct Machine *m, i64 addr, u8 **p, off_t *off) {
+  i64 x;
+  if (!addr) {
+    *p = 0;
+    return 0;
+  }
+  if (!(*p = (u8 *)SchlepRW(m, addr, 8))) return -1;
+  if ((x = Read64(*p)) < 0) return einval();
+  if (x > NUMERIC_MAX(off_t)) return eoverflow();
+  *off = x;
+  return 0;
+}
+
+// Copies up to `count` bytes from `infd` to `outfd` through a buffer,
+// at `*inoff` or `*outoff` if non-null, otherwise at the file position.
+static i64 CopyBuffered(struct Machine *m, i32 infd, off_t *inoff, i32 outfd,
+                        off_t *outoff, u64 count) {
+  u8 *buf;
+  u64 toto;
+  ssize_t got, wrote;
+  size_t chunk, maxchunk = 65536;
+  if (!(buf = (u8 *)AddToFreeList(m, malloc(maxchunk)))) return -1;
+  for (toto = 0; toto < count;) {
+    chunk = MIN(count - toto, maxchunk);
+    if (inoff) {
+      got = VfsPread(infd, buf, chunk, *inoff);
+    } else {
+      got = VfsRead(infd, buf, chunk);
+    }
+    if (got == -1) goto OnFailure;
+    if (inoff) *inoff += got;
+    if (got == 0) break;
+    STATISTIC(++sendfile_buffered);
+    while (got > 0) {
+      if (outoff) {
+        wrote = VfsPwrite(outfd, buf, got, *outoff);
+      } else {
+        wrote = VfsWrite(outfd, buf, got);
+      }
+      if (wrote == -1) goto OnFailure;
+      if (outoff) *outoff += wrote;
+      toto += wrote;
+      got -= wrote;
+    }
+  }
+  return toto;
+OnFailure:
+  if (toto) {
+    LOGF("buffered copy partial failure: %s", DescribeHostErrno(errno));
+    return toto;
+  } else {
+    return -1;
+  }
+}
+
+i64 SysSendfile(struct Machine *m, i32 out_fd, i32 in_fd, i64 offsetaddr,
+                u64 count) {
+  i64 rc;
+  u8 *offsetp;
+  off_t offset = 0;
+  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
+  if (LoadOffset(m, offsetaddr, &offsetp, &offset) == -1) return -1;
+  if (offsetp && (u64)offset + count > NUMERIC_MAX(off_t)) {
+    return eoverflow();
+  }
+#ifdef HAVE_SENDFILE
+  int hin, hout;
+  if ((hin = GetHostFd(m, in_fd)) != -1 &&
+      (hout = GetHostFd(m, out_fd)) != -1) {
+    count = MIN(count, kMaxHostTransfer);
+    RESTARTABLE(rc = sendfile(hout, hin, offsetp ? &offset : 0, count));
+    // linux may refuse some descriptor types, e.g. if in_fd is a pipe
+    if (rc != -1 || (errno != EINVAL && errno != ENOSYS)) {
+      if (rc != -1) STATISTIC(++sendfile_host);
+      if (offsetp) Write64(offsetp, offset);
+      return rc;
+    }
+  }
+#endif
+  rc = CopyBuffered(m, in_fd, offsetp ? &offset : 0, out_fd, 0, count);
+  if (offsetp) Write64(offsetp, offset);
+  return rc;
+}
+
+i64 SysSplice(struct Machine *m, i32 fd_in, i64 off_in_addr, i32 fd_out,
+              i64 off_out_addr, u64 len, u32 flags) {
+  i64 rc;
+  u8 *inp, *outp;
+  off_t inoff = 0, outoff = 0;
+  if (flags & ~kSpliceFlags) {
+    LOGF("unsupported %s flags: %#x", "splice", flags);
+    return einval();
+  }
+  if (CheckFdAccess(m, fd_out, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, fd_in, false, EBADF) == -1) return -1;
+  if (LoadOffset(m, off_in_addr, &inp, &inoff) == -1) return -1;
+  if (LoadOffset(m, off_out_addr, &outp, &outoff) == -1) return -1;
+#ifdef HAVE_SPLICE
+  int hin, hout;
+  if ((hin = GetHostFd(m, fd_in)) != -1 &&
+      (hout = GetHostFd(m, fd_out)) != -1) {
+    len = MIN(len, kMaxHostTransfer);
+    RESTARTABLE(rc = splice(hin, inp ? &inoff : 0, hout, outp ? &outoff : 0,
+                            len, XlatSpliceFlags(flags)));
+    if (rc != -1) STATISTIC(++sendfile_host);
+    if (inp) Write64(inp, inoff);
+    if (outp) Write64(outp, outoff);
+    return rc;
+  }
+#endif
+  if (inp && outp) return einval();  // one of them must be a pipe
+  rc = CopyBuffered(m, fd_in, inp ? &inoff : 0, fd_out, outp ? &outoff : 0,
+                    len);
+  if (inp) Write64(inp, inoff);
+  if (outp) Write64(outp, outoff);
+  return rc;
+}
+
+i64 SysTee(struct Machine *m, i32 fd_in, i32 fd_out, u64 len, u32 flags) {
+  if (flags & ~kSpliceFlags) {
+    LOGF("unsupported %s flags: %#x", "tee", flags);
+    return einval();
+  }
+  if (CheckFdAccess(m, fd_out, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, fd_in, false, EBADF) == -1) return -1;
+#ifdef HAVE_SPLICE
+  i64 rc;
+  int hin, hout;
+  if ((hin = GetHostFd(m, fd_in)) != -1 &&
+      (hout = GetHostFd(m, fd_out)) != -1) {
+    len = MIN(len, kMaxHostTransfer);
+    RESTARTABLE(rc = tee(hin, hout, len, XlatSpliceFlags(flags)));
+    if (rc != -1) STATISTIC(++sendfile_host);
+    return rc;
+  }
+#endif
+  // duplicating pipe data without consuming it needs the host kernel
+  return einval();
+}
+
+i64 SysCopyFileRange(struct Machine *m, i32 fd_in, i64 off_in_addr, i32 fd_out,
+                     i64 off_out_addr, u64 len, u32 flags) {
+  i64 rc;
+  u8 *inp, *outp;
+  off_t inoff = 0, outoff = 0;
+  if (flags) return einval();
+  if (CheckFdAccess(m, fd_out, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, fd_in, false, EBADF) == -1) return -1;
+  if (LoadOffset(m, off_in_addr, &inp, &inoff) == -1) return -1;
+  if (LoadOffset(m, off_out_addr, &outp, &outoff) == -1) return -1;
+#ifdef HAVE_COPY_FILE_RANGE
+  int hin, hout;
+  if ((hin = GetHostFd(m, fd_in)) != -1 &&
+      (hout = GetHostFd(m, fd_out)) != -1) {
+    len = MIN(len, kMaxHostTransfer);
+    RESTARTABLE(rc = copy_file_range(hin, inp ? &inoff : 0, hout,
+                                     outp ? &outoff : 0, len, 0));
+    // older linux kernels can't copy between filesystems
+    if (rc != -1 ||
+        (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP)) {
+      if (rc != -1) STATISTIC(++sendfile_host);
+      if (inp) Write64(inp, inoff);
+      if (outp) Write64(outp, outoff);
+      return rc;
+    }
+  }
+#endif
+  rc = CopyBuffered(m, fd_in, inp ? &inoff : 0, fd_out, outp ? &outoff : 0,
+                    len);
+  if (inp) Write64(inp, inoff);
+  if (outp) Write64(outp, outoff);
+  return rc;
+}
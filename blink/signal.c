@@ -18,6 +18,8 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/signal.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,8 +33,10 @@
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/macros.h"
+#include "blink/profile.h"
 #include "blink/syscall.h"
 #include "blink/thread.h"
+#include "blink/tunables.h"
 #include "blink/util.h"
 #include "blink/xlat.h"
 
@@ -221,13 +225,19 @@ void SigRestore(struct Machine *m) {
 static int ConsumeSignalImpl(struct Machine *m, int *delivered, bool *restart) {
   int sig;
   i64 handler;
-  u64 signals;
+  u64 bit, signals;
   if (delivered) *delivered = 0;
   if (restart) *restart = true;
-  // look for a pending signal that isn't currently masked
-  while ((signals = m->signals & ~m->sigmask)) {
+  // look for a pending signal that isn't currently masked, preferring
+  // ones directed at this thread over ones any thread could take
+  while ((signals = (m->signals | m->system->signals) & ~m->sigmask)) {
     sig = bsr(signals) + 1;
-    m->signals &= ~((u64)1 << (sig - 1));
+    bit = (u64)1 << (sig - 1);
+    if (m->signals & bit) {
+      m->signals &= ~bit;
+    } else {
+      m->system->signals &= ~bit;
+    }
     handler = Read64(m->system->hands[sig - 1].handler);
     if (handler == SIG_DFL_LINUX) {
       if (IsSignalIgnoredByDefault(sig)) {
@@ -268,7 +278,82 @@ void EnqueueSignal(struct Machine *m, int sig) {
     m->signals |= 1ul << (sig - 1);
     if ((m->signals & ~m->sigmask)) {
       atomic_store_explicit(&m->attention, true, memory_order_release);
+      WakeMachine(m);
+    }
+    WakeSignalfds(sig);
+  }
+}
+
+// Queues a signal directed at the process as a whole, which the host
+// happened to deliver on the thread of `m`. Whichever thread has it
+// unblocked first will take it.
+void EnqueueProcessSignal(struct Machine *m, int sig) {
+  if (m && (1 <= sig && sig <= 64)) {
+    m->system->signals |= 1ul << (sig - 1);
+    if ((m->system->signals & ~m->sigmask)) {
+      atomic_store_explicit(&m->attention, true, memory_order_release);
+      WakeMachine(m);
     }
+    WakeSignalfds(sig);
+  }
+}
+
+// Wakes a thread that's blocked in poll() on its GetWaitFd(m) pipe. It's
+// safe to call this from signal handlers and from other threads.
+void WakeMachine(struct Machine *m) {
+  int fd;
+  if ((fd = atomic_load_explicit(&m->wakefd, memory_order_acquire)) != -1) {
+    int olderr = errno;
+    (void)!write(fd, "", 1);
+    errno = olderr;
+  }
+}
+
+// Moves a descriptor blink owns above the range the guest can use, and
+// closes the original. Returns -1 if the host ran out of descriptors.
+int MoveBlinkFd(int fd, bool nonblock) {
+  int fd2;
+  fd2 = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd);
+  close(fd);
+  if (fd2 != -1 && nonblock) fcntl(fd2, F_SETFL, O_NONBLOCK);
+  return fd2;
+}
+
+// Returns read end of the wake pipe of the calling thread, which gets
+// lazily created. Returns -1 if the host ran out of file descriptors.
+int GetWaitFd(struct Machine *m) {
+  int fds[2];
+  if (m->waitfd == -1 && !pipe(fds)) {
+    if ((fds[0] = MoveBlinkFd(fds[0], true)) == -1) {
+      close(fds[1]);
+      return -1;
+    }
+    if ((fds[1] = MoveBlinkFd(fds[1], true)) == -1) {
+      close(fds[0]);
+      return -1;
+    }
+    m->waitfd = fds[0];
+    atomic_store_explicit(&m->wakefd, fds[1], memory_order_release);
+  }
+  return m->waitfd;
+}
+
+void DrainWaitFd(struct Machine *m) {
+  char buf[64];
+  if (m->waitfd != -1) {
+    while (read(m->waitfd, buf, sizeof(buf)) > 0) {
+    }
+  }
+}
+
+void CloseWakeFds(struct Machine *m) {
+  int fd;
+  if ((fd = atomic_exchange(&m->wakefd, -1)) != -1) {
+    close(fd);
+  }
+  if (m->waitfd != -1) {
+    close(m->waitfd);
+    m->waitfd = -1;
   }
 }
 
@@ -281,10 +366,12 @@ void CheckForSignals(struct Machine *m) {
     FlushSmcQueue(m);
     m->selfmodifying = false;
 #endif
-  } else if (m->signals & ~m->sigmask) {
+  } else if ((m->signals | m->system->signals) & ~m->sigmask) {
     if ((sig = ConsumeSignal(m, 0, 0))) {
       TerminateSignal(m, sig, 0);
     }
+  } else if (m->profiled) {
+    TakeProfileSample(m);
   } else {
     atomic_store_explicit(&m->attention, false, memory_order_relaxed);
   }
@@ -8,6 +8,12 @@ void SigRestore(struct Machine *);
 bool IsSignalIgnoredByDefault(int);
 void OnSignal(int, siginfo_t *, void *);
 void EnqueueSignal(struct Machine *, int);
+void EnqueueProcessSignal(struct Machine *, int);
+void WakeMachine(struct Machine *);
+int GetWaitFd(struct Machine *);
+int MoveBlinkFd(int, bool);
+void DrainWaitFd(struct Machine *);
+void CloseWakeFds(struct Machine *);
 void DeliverSignal(struct Machine *, int, int);
 void TerminateSignal(struct Machine *, int, int);
 int ConsumeSignal(struct Machine *, int *, bool *);
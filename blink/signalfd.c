@@ -0,0 +1,353 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bitscan.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/ndelay.h"
+#include "blink/signal.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+// signalfd() is emulated, since guest signals are queued by blink
+// rather than the host kernel. Each descriptor is the read end of a
+// host pipe, which makes it pollable with poll() or epoll. Whenever a
+// signal in its mask is enqueued, a byte gets written to the pipe. The
+// pipe is only a doorbell: reads consume the signals pending for the
+// calling thread or the whole process, then empty the pipe, ringing it
+// again if any remain, so it stays readable only while there's work.
+
+struct Signalfd {
+  _Atomic(u64) mask;    // signals accepted by this descriptor
+  _Atomic(int) wakefd;  // pipe write end, or zero if slot is free
+  int fildes;           // guest descriptor, i.e. the read end
+};
+
+static struct Signalfds {
+  pthread_mutex_t_ lock;
+  struct Signalfd p[kMaxSignalfds];
+} g_signalfds = {PTHREAD_MUTEX_INITIALIZER_};
+
+static void RingSignalfd(int wakefd) {
+  int olderr = errno;
+  (void)!write(wakefd, "", 1);
+  errno = olderr;
+}
+
+// Notifies signalfd() descriptors that `sig` was enqueued. It's called
+// by EnqueueSignal(), which could be running inside a signal handler.
+void WakeSignalfds(int sig) {
+  int i, fd;
+  for (i = 0; i < kMaxSignalfds; ++i) {
+    if ((fd = atomic_load_explicit(&g_signalfds.p[i].wakefd,
+                                   memory_order_acquire)) &&
+        (atomic_load_explicit(&g_signalfds.p[i].mask, memory_order_relaxed) &
+         ((u64)1 << (sig - 1)))) {
+      RingSignalfd(fd);
+    }
+  }
+}
+
+static struct Signalfd *GetSignalfd(int fildes) {
+  int i;
+  for (i = 0; i < kMaxSignalfds; ++i) {
+    if (g_signalfds.p[i].wakefd && g_signalfds.p[i].fildes == fildes) {
+      return g_signalfds.p + i;
+    }
+  }
+  ebadf();
+  return 0;
+}
+
+// Returns signals the calling thread could take through a signalfd.
+static u64 GetPendingSignals(struct System *s) {
+  return g_machine->signals | s->signals;
+}
+
+// Removes a pending signal in `mask` that was either directed at the
+// calling thread, or at the process as a whole.
+static int TakePendingSignal(struct System *s, u64 mask) {
+  int sig;
+  u64 pending;
+  LOCK(&s->sig_lock);
+  if ((pending = g_machine->signals & mask)) {
+    sig = bsf(pending) + 1;
+    g_machine->signals &= ~((u64)1 << (sig - 1));
+  } else if ((pending = s->signals & mask)) {
+    sig = bsf(pending) + 1;
+    s->signals &= ~((u64)1 << (sig - 1));
+  } else {
+    sig = 0;
+  }
+  UNLOCK(&s->sig_lock);
+  return sig;
+}
+
+// Empties the doorbell pipe without blocking, then rings it again if
+// signals in `mask` remain. Reading only happens here, under the lock,
+// after poll() says there's something to read, so it never blocks even
+// when the guest didn't ask for O_NONBLOCK.
+static void DrainSignalfd(struct System *s, int fildes, u64 mask) {
+  char buf[64];
+  struct pollfd pfd;
+  struct Signalfd *sfd;
+  int olderr = errno;
+  LOCK(&g_signalfds.lock);
+  if ((sfd = GetSignalfd(fildes))) {
+    pfd.fd = fildes;
+    pfd.events = POLLIN;
+    while (VfsPoll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN) &&
+           VfsRead(fildes, buf, sizeof(buf)) == sizeof(buf)) {
+    }
+    if (GetPendingSignals(s) & mask) {
+      RingSignalfd(sfd->wakefd);
+    }
+  }
+  UNLOCK(&g_signalfds.lock);
+  errno = olderr;
+}
+
+static int SignalfdClose(int fildes) {
+  int wakefd;
+  struct Signalfd *sfd;
+  LOCK(&g_signalfds.lock);
+  if ((sfd = GetSignalfd(fildes))) {
+    wakefd = atomic_exchange(&sfd->wakefd, 0);
+  } else {
+    wakefd = 0;
+  }
+  UNLOCK(&g_signalfds.lock);
+  if (wakefd) close(wakefd);
+  return VfsClose(fildes);
+}
+
+static ssize_t SignalfdReadv(int fildes, const struct iovec *iov, int iovcnt) {
+  u64 mask = 0;
+  ssize_t rc, got;
+  struct pollfd pfd;
+  struct Signalfd *sfd;
+  size_t i, j, n, size;
+  struct System *s = g_machine->system;
+  struct signalfd_siginfo_linux si[16];
+  LOCK(&g_signalfds.lock);
+  if ((sfd = GetSignalfd(fildes))) {
+    mask = sfd->mask;
+  }
+  UNLOCK(&g_signalfds.lock);
+  if (!sfd) return -1;
+  for (size = i = 0; i < iovcnt; ++i) {
+    size += iov[i].iov_len;
+  }
+  if (!(n = MIN(size / sizeof(si[0]), ARRAYLEN(si)))) {
+    return einval();
+  }
+  for (;;) {
+    for (got = 0; got < n; ++got) {
+      int sig;
+      if (!(sig = TakePendingSignal(s, mask))) break;
+      memset(si + got, 0, sizeof(si[got]));
+      Write32(si[got].signo, sig);
+      Write32(si[got].code, SI_USER_LINUX);
+    }
+    if (got) break;
+    // the doorbell may have been rung for a signal that another thread
+    // took, or which was directed at another thread
+    DrainSignalfd(s, fildes, mask);
+    if ((rc = VfsFcntl(fildes, F_GETFL, 0)) == -1) return -1;
+    if (rc & O_NDELAY) return eagain();
+    if ((pfd.fd = VfsHostFd(fildes)) == -1) return -1;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) == -1) return -1;
+  }
+  DrainSignalfd(s, fildes, mask);
+  for (size = got * sizeof(si[0]), j = i = 0; i < iovcnt && j < size; ++i) {
+    n = MIN(iov[i].iov_len, size - j);
+    memcpy(iov[i].iov_base, (char *)si + j, n);
+    j += n;
+  }
+  return size;
+}
+
+static ssize_t SignalfdWritev(int fildes, const struct iovec *iov,
+                              int iovcnt) {
+  return einval();
+}
+
+static int SignalfdTcgetattr(int fildes, struct termios *tio) {
+  return enotty();
+}
+
+static int SignalfdTcsetattr(int fildes, int how, const struct termios *tio) {
+  return enotty();
+}
+
+static int SignalfdTcgetwinsize(int fildes, struct winsize *ws) {
+  return enotty();
+}
+
+static int SignalfdTcsetwinsize(int fildes, const struct winsize *ws) {
+  return enotty();
+}
+
+const struct FdCb kFdCbSignalfd = {
+    .close = SignalfdClose,
+    .readv = SignalfdReadv,
+    .writev = SignalfdWritev,
+    .poll = VfsPoll,
+    .tcgetattr = SignalfdTcgetattr,
+    .tcsetattr = SignalfdTcsetattr,
+    .tcgetwinsize = SignalfdTcgetwinsize,
+    .tcsetwinsize = SignalfdTcsetwinsize,
+};
+
+// Routes signals in `mask` through blink. Otherwise the host would take
+// the default action on signals the guest has blocked but not caught.
+static void CatchSignals(struct System *s, u64 mask) {
+  int sig, syssig;
+  struct sigaction sa;
+  LOCK(&s->sig_lock);
+  for (; mask; mask &= mask - 1) {
+    sig = bsf(mask) + 1;
+    if (Read64(s->hands[sig - 1].handler) == SIG_DFL_LINUX &&
+        !(s->blinksigs & ((u64)1 << (sig - 1))) &&
+        (syssig = XlatSignal(sig)) != -1) {
+      memset(&sa, 0, sizeof(sa));
+      sigfillset(&sa.sa_mask);
+      sa.sa_flags = SA_SIGINFO;
+      sa.sa_sigaction = OnSignal;
+      sigaction(syssig, &sa, 0);
+    }
+  }
+  UNLOCK(&s->sig_lock);
+}
+
+static int UpdateSignalfd(struct Machine *m, i32 fildes, u64 mask) {
+  struct Fd *fd;
+  struct Signalfd *sfd;
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes)) && fd->cb != &kFdCbSignalfd) {
+    fd = 0;
+    einval();
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return -1;
+  CatchSignals(m->system, mask);
+  LOCK(&g_signalfds.lock);
+  if ((sfd = GetSignalfd(fildes))) {
+    sfd->mask = mask;
+    if (GetPendingSignals(m->system) & mask) RingSignalfd(sfd->wakefd);
+  }
+  UNLOCK(&g_signalfds.lock);
+  return sfd ? fildes : -1;
+}
+
+static int CreateSignalfd(struct Machine *m, u64 mask, i32 flags) {
+  struct Fd *fd;
+  struct Signalfd *sfd;
+  int i, lim, oflags, fds[2];
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  CatchSignals(m->system, mask);
+  if (pipe(fds) == -1) return -1;
+  if ((fds[1] = MoveBlinkFd(fds[1], true)) == -1) {
+    close(fds[0]);
+    return -1;
+  }
+  oflags = O_RDONLY;
+  if (flags & SFD_CLOEXEC_LINUX) {
+    oflags |= O_CLOEXEC;
+    unassert(!fcntl(fds[0], F_SETFD, FD_CLOEXEC));
+  }
+  if (flags & SFD_NONBLOCK_LINUX) {
+    oflags |= O_NDELAY;
+    unassert(!fcntl(fds[0], F_SETFL, O_NDELAY));
+  }
+  if ((fds[0] = VfsWrapFd(fds[0])) == -1) {
+    close(fds[1]);
+    return -1;
+  }
+  if (fds[0] >= lim) {
+    VfsClose(fds[0]);
+    close(fds[1]);
+    return emfile();
+  }
+  LOCK(&g_signalfds.lock);
+  for (sfd = 0, i = 0; i < kMaxSignalfds; ++i) {
+    if (!g_signalfds.p[i].wakefd) {
+      sfd = g_signalfds.p + i;
+      sfd->fildes = fds[0];
+      sfd->mask = mask;
+      atomic_store_explicit(&sfd->wakefd, fds[1], memory_order_release);
+      if (GetPendingSignals(m->system) & mask) RingSignalfd(fds[1]);
+      break;
+    }
+  }
+  UNLOCK(&g_signalfds.lock);
+  if (!sfd) {
+    LOGF("too many signalfd() descriptors");
+    VfsClose(fds[0]);
+    close(fds[1]);
+    return emfile();
+  }
+  LOCK(&m->system->fds.lock);
+  unassert(fd = AddFd(&m->system->fds, fds[0], oflags));
+  fd->cb = &kFdCbSignalfd;
+  UNLOCK(&m->system->fds.lock);
+  return fds[0];
+}
+
+int SysSignalfd4(struct Machine *m, i32 fildes, i64 maskaddr, u64 masksize,
+                 i32 flags) {
+  u64 mask;
+  const struct sigset_linux *ss;
+  if (flags & ~(SFD_CLOEXEC_LINUX | SFD_NONBLOCK_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "signalfd4", flags);
+    return einval();
+  }
+  if (masksize != 8) return einval();
+  if (!(ss = (const struct sigset_linux *)SchlepR(m, maskaddr, sizeof(*ss)))) {
+    return -1;
+  }
+  mask = Read64(ss->sigmask);
+  mask &= ~((u64)1 << (SIGKILL_LINUX - 1) | (u64)1 << (SIGSTOP_LINUX - 1));
+  if (fildes == -1) {
+    return CreateSignalfd(m, mask, flags);
+  } else {
+    return UpdateSignalfd(m, fildes, mask);
+  }
+}
+
+int SysSignalfd(struct Machine *m, i32 fildes, i64 maskaddr, u64 masksize) {
+  return SysSignalfd4(m, fildes, maskaddr, masksize, 0);
+}
@@ -16,9 +16,13 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+#include <sys/mman.h>
+
 #include "blink/assert.h"
 #include "blink/builtin.h"
 #include "blink/flag.h"
+#include "blink/jit.h"
 #include "blink/log.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
@@ -51,17 +55,57 @@ static int UnprotectSelfModifyingCode(struct System *s, i64 vaddr, i64 size) {
   return ProtectHostPages(s, vaddr, size, PROT_READ | PROT_WRITE);
 }
 
+static size_t GetSmcQueueBytes(int n) {
+  return ROUNDUP(n * sizeof(struct SmcPage), 4096) + (size_t)n * 4096;
+}
+
+// doubles the capacity of the queue
+// this uses mmap() directly since it may be called by a signal handler
+// @asyncsignalsafe
+static bool GrowSmcQueue(struct SmcQueue *q) {
+  int i, n2;
+  u8 *mem, *old2;
+  struct SmcPage *p2;
+  n2 = q->n ? q->n * 2 : kSmcQueueSize;
+  mem = (u8 *)mmap(0, GetSmcQueueBytes(n2), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS_, -1, 0);
+  if (mem == MAP_FAILED) return false;
+  p2 = (struct SmcPage *)mem;
+  old2 = mem + ROUNDUP(n2 * sizeof(struct SmcPage), 4096);
+  if (q->n) {
+    memcpy(old2, q->old, (size_t)q->i * 4096);
+    for (i = 0; i < q->i; ++i) {
+      p2[i].page = q->p[i].page;
+      p2[i].old = old2 + (q->p[i].old - q->old);
+    }
+    munmap(q->p, GetSmcQueueBytes(q->n));
+  }
+  q->p = p2;
+  q->old = old2;
+  q->n = n2;
+  return true;
+}
+
+void DestroySmcQueue(struct SmcQueue *q) {
+  if (q->n) {
+    unassert(!munmap(q->p, GetSmcQueueBytes(q->n)));
+  }
+  memset(q, 0, sizeof(*q));
+}
+
 // @asyncsignalsafe
 bool IsPageInSmcQueue(struct Machine *m, i64 page) {
   int i;
-  i64 tmp;
+  struct SmcPage tmp;
+  struct SmcQueue *q = &m->smcqueue;
   page &= -4096;
-  STATISTIC(++smc_checks);
-  for (i = 0; i < kSmcQueueSize; ++i) {
-    if ((tmp = m->smcqueue.p[i]) == page) {
+  MACHINE_STATISTIC(m, smc_checks);
+  for (i = 0; i < q->i; ++i) {
+    if (q->p[i].page == page) {
       if (i) {
-        m->smcqueue.p[i - 0] = m->smcqueue.p[i - 1];
-        m->smcqueue.p[i - 1] = tmp;
+        tmp = q->p[i];
+        q->p[i - 0] = q->p[i - 1];
+        q->p[i - 1] = tmp;
       }
       return true;
     }
@@ -69,42 +113,95 @@ bool IsPageInSmcQueue(struct Machine *m, i64 page) {
   return false;
 }
 
-// @asyncsignalsafe
-void AddPageToSmcQueue(struct Machine *m, i64 page) {
-  int i;
+// drops everything that was decoded from the dirty lines of page
+static void ResetSmcPage(struct Machine *m, i64 page, u64 dirty) {
+  InvalidateICachePage(&m->system->icache, page);
+  if (!IsJitDisabled(&m->system->jit)) {
+    if (ResetJitPageLines(&m->system->jit, page, dirty) == 1) {
+      MACHINE_STATISTIC(m, smc_resets);
+    }
+  }
+  if (IsMakingPath(m) && (m->path.start & -4096) == page &&
+      (m->path.jb->lines & dirty)) {
+    AbandonPath(m);
+  }
+}
+
+/**
+ * Schedules guest page for self-modifying code invalidation.
+ *
+ * The original content of the page is saved, so that FlushSmcQueue()
+ * can later figure out which 64-byte lines were actually written. This
+ * must be called before the guest is permitted to modify the page. If
+ * the queue can't grow, then the page is flushed right away instead.
+ *
+ * @param page is guest virtual address of 4096-byte page
+ * @param host is host memory of that page, as it is right now
+ * @asyncsignalsafe
+ */
+void AddPageToSmcQueue(struct Machine *m, i64 page, const u8 *host) {
+  struct SmcQueue *q = &m->smcqueue;
   page &= -4096;
-  for (i = 0; i < kSmcQueueSize; ++i) {
-    if (!m->smcqueue.p[i]) {
-      STATISTIC(++smc_enqueued);
-      m->smcqueue.p[i] = page;
-      m->selfmodifying = true;
-      atomic_store_explicit(&m->attention, true, memory_order_release);
-      return;
+  if (q->i == q->n && !GrowSmcQueue(q)) {
+    // there's no room to snapshot the page, so we can't learn later on
+    // which lines got changed. discard all the code decoded from it now
+    // since it's about to be modified, and let the guest proceed.
+    LOGF("failed to grow self-modifying code page queue");
+    STATISTIC(++smc_overflows);
+    ResetSmcPage(m, page, -1);
+    return;
+  }
+  STATISTIC(++smc_enqueued);
+  // slots [0,i) are a permutation of pages [0,i) so slot i is free
+  q->p[q->i].page = page;
+  q->p[q->i].old = q->old + (size_t)q->i * 4096;
+  memcpy(q->p[q->i++].old, host, 4096);
+  m->selfmodifying = true;
+  atomic_store_explicit(&m->attention, true, memory_order_release);
+}
+
+// returns bitset of 64-byte lines that differ between two pages
+static u64 GetModifiedLines(const u8 *old, const u8 *now) {
+  int i;
+  u64 dirty = 0;
+  for (i = 0; i < 64; ++i) {
+    if (memcmp(old + i * 64, now + i * 64, 64)) {
+      dirty |= (u64)1 << i;
     }
   }
-  ERRF("self-modifying code page queue exhausted");
-  Abort();
+  return dirty;
+}
+
+static const u8 *GetSmcPage(struct Machine *m, i64 page) {
+  const u8 *host;
+  if (HasLinearMapping()) return ToHost(page);
+  BEGIN_NO_PAGE_FAULTS;
+  host = SpyAddress(m, page);
+  END_NO_PAGE_FAULTS;
+  return host;
 }
 
 void FlushSmcQueue(struct Machine *m) {
   int i;
   i64 page;
+  u64 dirty;
+  const u8 *now;
+  struct SmcQueue *q = &m->smcqueue;
   unassert(m->selfmodifying);
-  STATISTIC(++smc_flushes);
-  for (i = 0; i < kSmcQueueSize; ++i) {
-    if ((page = m->smcqueue.p[i])) {
-      m->smcqueue.p[i] = 0;
-      if (!IsJitDisabled(&m->system->jit)) {
-        if (HasLinearMapping()) {
-          unassert(!ProtectSelfModifyingCode(m->system, page, 1));
-        }
-        ResetJitPage(&m->system->jit, page);
-      }
-      if (IsMakingPath(m) && (m->path.start & -4096) == (page & -4096)) {
-        AbandonPath(m);
-      }
+  MACHINE_STATISTIC(m, smc_flushes);
+  for (i = 0; i < q->i; ++i) {
+    page = q->p[i].page;
+    if (HasLinearMapping() && !IsJitDisabled(&m->system->jit)) {
+      unassert(!ProtectSelfModifyingCode(m->system, page, 1));
+    }
+    if ((now = GetSmcPage(m, page))) {
+      dirty = GetModifiedLines(q->p[i].old, now);
+    } else {
+      dirty = -1;
     }
+    if (dirty) ResetSmcPage(m, page, dirty);
   }
+  q->i = 0;
 }
 
 i64 ProtectRwxMemory(struct System *s, i64 rc, i64 virt, i64 size,
@@ -130,7 +227,7 @@ i64 ProtectRwxMemory(struct System *s, i64 rc, i64 virt, i64 size,
 // @asyncsignalsafe
 bool IsSelfModifyingCodeSegfault(struct Machine *m, const siginfo_t *si) {
   u64 pte;
-  i64 vaddr;
+  i64 vaddr, page;
   SIG_LOGF("IsSelfModifyingCodeSegfault()");
   unassert(m->system->loaded);
   if (si->si_signo != SIGSEGV) return false;
@@ -142,13 +239,18 @@ bool IsSelfModifyingCodeSegfault(struct Machine *m, const siginfo_t *si) {
     return false;
   }
   STATISTIC(++smc_segfaults);
+  // the host page might hold several guest pages, all of which are
+  // going to become writable, so we need to snapshot each of them
+  for (page = ROUNDDOWN(vaddr, FLAG_pagesize);
+       page < ROUNDDOWN(vaddr, FLAG_pagesize) + FLAG_pagesize; page += 4096) {
+    if (!IsPageInSmcQueue(m, page)) {
+      AddPageToSmcQueue(m, page, ToHost(page));
+    }
+  }
   if (UnprotectSelfModifyingCode(m->system, vaddr, 1)) {
     ERRF("failed to unprotect self modifying code");
     return false;
   }
-  if (!IsPageInSmcQueue(m, vaddr)) {
-    AddPageToSmcQueue(m, vaddr);
-  }
   return true;
 }
 
@@ -102,7 +102,7 @@ static void MovdqaVdqWdq(P) {
 static void MovdqaWdqVdq(P) {
   u8 *dst;
   IGNORE_RACES_START();
-  dst = GetXmmAddress(A);
+  dst = GetXmmAddressWrite(A);
   if (!IsRomAddress(m, dst)) {
     memcpy(dst, XmmRexrReg(m, rde), 16);
   }
@@ -265,7 +265,7 @@ static void MovsdWpsVps(P) {
   IGNORE_RACES_END();
   if (IsMakingPath(m)) {
     Jitter(A,
-           "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
+           "z4W"    // res0 = GetXmmOrMemPointer(RexbRm) for writing
            "a2i"    // arg2 = RexrReg(rde)
            "s0a1="  // arg1 = machine
            "t"      // arg0 = res0
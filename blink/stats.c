@@ -18,28 +18,70 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/stats.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "blink/log.h"
+#include "blink/machine.h"
 
 #define DEFINE_AVERAGE(S) struct Average S;
 #define DEFINE_COUNTER(S) long S;
+#define DEFINE_MACHINE_COUNTER(S)
 #include "blink/stats.inc"
+#undef DEFINE_MACHINE_COUNTER
 #undef DEFINE_AVERAGE
 #undef DEFINE_COUNTER
 
+struct MachineStats g_machinestats;
+
 #define APPEND(...) o += snprintf(b + o, o > n ? 0 : n - o, __VA_ARGS__)
 
+void AddMachineStats(struct MachineStats *x, const struct MachineStats *y) {
+  IGNORE_RACES_START();
+#define DEFINE_COUNTER(S)
+#define DEFINE_AVERAGE(S)
+#define DEFINE_MACHINE_COUNTER(S) x->S += y->S;
+#include "blink/stats.inc"
+#undef DEFINE_MACHINE_COUNTER
+#undef DEFINE_AVERAGE
+#undef DEFINE_COUNTER
+  IGNORE_RACES_END();
+}
+
+// sums the counters of all machines, without blocking, since this may
+// be called while aborting with machines_lock held by this thread
+static void GetStatsForPrinting(struct MachineStats *st) {
+  struct System *s;
+  memset(st, 0, sizeof(*st));
+  AddMachineStats(st, &g_machinestats);
+  if (!g_machine) return;
+  s = g_machine->system;
+#ifdef HAVE_THREADS
+  if (pthread_mutex_trylock(&s->machines_lock)) {
+    AddMachineStats(st, &g_machine->stats);
+    return;
+  }
+#endif
+  SumMachineStats(s, st);
+  UNLOCK(&s->machines_lock);
+}
+
 void PrintStats(void) {
-#ifndef NDEBUG
   char b[4096];
   int n = sizeof(b);
   int o = 0;
+  struct MachineStats st;
   b[0] = 0;
+  GetStatsForPrinting(&st);
 #define DEFINE_COUNTER(S) \
-  if (S) APPEND("%-32s = %ld\n", #S, S);
+  if (GET_COUNTER(S)) APPEND("%-32s = %ld\n", #S, GET_COUNTER(S));
 #define DEFINE_AVERAGE(S) \
   if (S.a) APPEND("%-32s = %.6g\n", #S, S.a);
+#define DEFINE_MACHINE_COUNTER(S) \
+  if (st.S) APPEND("%-32s = %ld\n", #S, st.S);
 #include "blink/stats.inc"
-#undef S
+#undef DEFINE_MACHINE_COUNTER
+#undef DEFINE_AVERAGE
+#undef DEFINE_COUNTER
   WriteErrorString(b);
-#endif
 }
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 #include "blink/builtin.h"
+#include "blink/likely.h"
 #include "blink/tsan.h"
 
 #ifndef NDEBUG
@@ -24,6 +25,16 @@
 #define COSTLY_STATISTIC(x) (void)0
 #endif
 
+// machine statistics are counted in a block that's owned by the thread
+// so they don't bounce cache lines between cores. they're cheap enough
+// to be kept in release builds, where they're only counted if -Z is set
+#ifndef NDEBUG
+#define MACHINE_STATISTIC(m, S) (++(m)->stats.S)
+#else
+#define MACHINE_STATISTIC(m, S) \
+  (UNLIKELY(FLAG_statistics) ? (void)++(m)->stats.S : (void)0)
+#endif
+
 #define AVERAGE(S, x) S.a += ((x)-S.a) / ++S.i
 
 #ifndef NDEBUG
@@ -42,19 +53,35 @@
 #define GET_COUNTER(S) 0L
 #endif
 
-#define DEFINE_COUNTER(S) extern long S;
-#define DEFINE_AVERAGE(S) extern struct Average S;
-#include "blink/stats.inc"
-#undef DEFINE_COUNTER
-#undef DEFINE_AVERAGE
-
 struct Average {
   double a;
   long i;
 };
 
+struct MachineStats {
+#define DEFINE_COUNTER(S)
+#define DEFINE_AVERAGE(S)
+#define DEFINE_MACHINE_COUNTER(S) long S;
+#include "blink/stats.inc"
+#undef DEFINE_MACHINE_COUNTER
+#undef DEFINE_AVERAGE
+#undef DEFINE_COUNTER
+};
+
+#define DEFINE_COUNTER(S)         extern long S;
+#define DEFINE_AVERAGE(S)         extern struct Average S;
+#define DEFINE_MACHINE_COUNTER(S)
+#include "blink/stats.inc"
+#undef DEFINE_MACHINE_COUNTER
+#undef DEFINE_AVERAGE
+#undef DEFINE_COUNTER
+
+// counts of machines that no longer exist
+extern struct MachineStats g_machinestats;
+
 extern bool FLAG_statistics;
 
 void PrintStats(void);
+void AddMachineStats(struct MachineStats *, const struct MachineStats *);
 
 #endif /* BLINK_STATS_H_ */
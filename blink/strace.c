@@ -363,9 +363,10 @@ void Strace(struct Machine *m, const char *func, bool isentry, const char *fmt,
   va_list va;
   i64 ax, arg;
   bool isoutmem;
-  int c, i, bi, bn;
+  int c, i, bi, bn, err;
   char tmp[kStraceArgMax];
   char buf[7][kStraceArgMax];
+  err = errno;
   va_start(va, fmt);
   for (i = 0; i < 7; ++i) {
     buf[i][0] = 0;
@@ -776,4 +777,6 @@ void Strace(struct Machine *m, const char *func, bool isentry, const char *fmt,
   va_end(va);
   SYS_LOGF("%s(%s%s%s%s%s%s) -> %s", func, buf[1], buf[2], buf[3], buf[4],
            buf[5], buf[6], buf[0]);
+  // describing the arguments may clobber errno, which the guest needs
+  errno = err;
 }
@@ -174,6 +174,7 @@
 #define STRACE_IOCTL        CANCPT  I32    FD         WAT_IOCTL  UN        UN        UN       UN
 #define STRACE_PIPE         NORMAL  SSIZE_ O_PFDS     UN         UN        UN        UN       UN
 #define STRACE_PIPE2        NORMAL  SSIZE_ O_PFDS     OFLAGS     PAD       UN        UN       UN
+#define STRACE_MEMFD_CREATE NORMAL  I32    STR        HEX        UN        UN        UN       UN
 #define STRACE_SOCKETPAIR   NORMAL  RC0    FAMILY     SOCKTYPE   I32       O_PFDS    UN       UN
 #define STRACE_SELECT       TWOWAY  SSIZE_ I32        IO_FDSET   IO_FDSET  IO_FDSET  IO_TIMEV UN
 #define STRACE_PSELECT      TWOWAY  SSIZE_ I32        IO_FDSET   IO_FDSET  IO_FDSET  IO_TIME  WAT_PSELECT
@@ -70,8 +70,10 @@
 #include "blink/map.h"
 #include "blink/ndelay.h"
 #include "blink/overlays.h"
+#include "blink/perfmap.h"
 #include "blink/pml4t.h"
 #include "blink/preadv.h"
+#include "blink/profile.h"
 #include "blink/random.h"
 #include "blink/signal.h"
 #include "blink/stats.h"
@@ -79,6 +81,7 @@
 #include "blink/swap.h"
 #include "blink/thread.h"
 #include "blink/timespec.h"
+#include "blink/tmpfs.h"
 #include "blink/util.h"
 #include "blink/vfs.h"
 #include "blink/xlat.h"
@@ -222,7 +225,7 @@ const char *GetDirFildesPath(struct System *s, int fildes) {
 
 void SignalActor(struct Machine *m) {
   for (;;) {
-    STATISTIC(++interps);
+    MACHINE_STATISTIC(m, interps);
     JitlessDispatch(DISPATCH_NOTHING);
     if (atomic_load_explicit(&m->attention, memory_order_acquire)) {
       if (m->restored) break;
@@ -294,52 +297,12 @@ HandleSomeMoreInterrupts:
   return res;
 }
 
-static struct Futex *FindFutex(struct Machine *m, i64 addr) {
-  struct Dll *e;
-  for (e = dll_first(g_bus->futexes.active); e;
-       e = dll_next(g_bus->futexes.active, e)) {
-    if (FUTEX_CONTAINER(e)->addr == addr) {
-      return FUTEX_CONTAINER(e);
-    }
-  }
-  return 0;
-}
-
-static int SysFutexWake(struct Machine *m, i64 uaddr, u32 count) {
-  int rc;
-  struct Futex *f;
-  if (!count) return 0;
-  LOCK(&g_bus->futexes.lock);
-  if ((f = FindFutex(m, uaddr))) {
-    LOCK(&f->lock);
-  }
-  UNLOCK(&g_bus->futexes.lock);
-  if (f && f->waiters) {
-    THR_LOGF("pid=%d tid=%d is waking %d waiters at address %#" PRIx64,
-             m->system->pid, m->tid, f->waiters, uaddr);
-    if (count == 1) {
-      unassert(!pthread_cond_signal(&f->cond));
-      rc = 1;
-    } else {
-      unassert(!pthread_cond_broadcast(&f->cond));
-      rc = f->waiters;
-    }
-    UNLOCK(&f->lock);
-  } else {
-    if (f) UNLOCK(&f->lock);
-    THR_LOGF("pid=%d tid=%d is waking no one at address %#" PRIx64,
-             m->system->pid, m->tid, uaddr);
-    rc = 0;
-  }
-  return rc;
-}
-
 static void ClearChildTid(struct Machine *m) {
 #if defined(HAVE_FORK) || defined(HAVE_THREADS)
   _Atomic(int) *ctid;
   if (m->ctid) {
     THR_LOGF("ClearChildTid(%#" PRIx64 ")", m->ctid);
-    if ((ctid = (_Atomic(int) *)LookupAddress(m, m->ctid))) {
+    if ((ctid = (_Atomic(int) *)LookupWritableAddress(m, m->ctid))) {
       atomic_store_explicit(ctid, 0, memory_order_seq_cst);
     } else {
       THR_LOGF("invalid clear child tid address %#" PRIx64, m->ctid);
@@ -352,12 +315,14 @@ static void ClearChildTid(struct Machine *m) {
 _Noreturn void SysExitGroup(struct Machine *m, int rc) {
   THR_LOGF("pid=%d tid=%d SysExitGroup", m->system->pid, m->tid);
   ClearChildTid(m);
+#ifndef DISABLE_VFS
+  TmpfsExit();
+#endif
+  WriteProfile();
   if (m->system->isfork) {
-#ifndef NDEBUG
     if (FLAG_statistics) {
       PrintStats();
     }
-#endif
     THR_LOGF("calling _Exit(%d)", rc);
     _Exit(rc);
   } else {
@@ -375,15 +340,17 @@ _Noreturn void SysExitGroup(struct Machine *m, int rc) {
 #ifdef HAVE_JIT
     ShutdownJit();
 #endif
-#ifndef NDEBUG
     if (FLAG_statistics) {
       PrintStats();
     }
-#endif
     exit(rc);
   }
 }
 
+#ifdef HAVE_THREADS
+_Thread_local static sigjmp_buf g_respawn;
+#endif
+
 _Noreturn void SysExit(struct Machine *m, int rc) {
 #ifdef HAVE_THREADS
   THR_LOGF("pid=%d tid=%d SysExit", m->system->pid, m->tid);
@@ -391,7 +358,9 @@ _Noreturn void SysExit(struct Machine *m, int rc) {
     SysExitGroup(m, rc);
   } else {
     ClearChildTid(m);
-    FreeMachine(m);
+    if (RecycleMachine(m)) {
+      siglongjmp(g_respawn, 1);
+    }
     pthread_exit(EXIT_SUCCESS);
   }
 #else
@@ -408,17 +377,18 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
   // exec_lock must come before fds.lock (see dup3)
   // exec_lock must come before fds.lock (see execve)
   // mmap_lock must come before fds.lock (see GetOflags)
-  // mmap_lock must come before pagelocks_lock (see FreePage)
+  // mmap_lock must come before pins_lock (see FencePages)
+  // fds.lock must come before the fd pool lock (see dup2)
   if (m->threaded) {
     LOCK(&m->system->exec_lock);
     LOCK(&m->system->sig_lock);
     LOCK(&m->system->mmap_lock);
-    LOCK(&m->system->pagelocks_lock);
+    LOCK(&m->system->pins_lock);
     LOCK(&m->system->fds.lock);
+    LockFdPool();
     LOCK(&m->system->machines_lock);
-#ifndef HAVE_PTHREAD_PROCESS_SHARED
-    LOCK(&g_bus->futexes.lock);
-#endif
+    LOCK(&m->system->icache.lock);
+    LockFutexes();
 #ifdef HAVE_JIT
     LOCK(&m->system->jit.lock);
 #endif
@@ -433,12 +403,12 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
 #ifdef HAVE_JIT
     UNLOCK(&m->system->jit.lock);
 #endif
-#ifndef HAVE_PTHREAD_PROCESS_SHARED
-    UNLOCK(&g_bus->futexes.lock);
-#endif
+    UnlockFutexes();
+    UNLOCK(&m->system->icache.lock);
     UNLOCK(&m->system->machines_lock);
+    UnlockFdPool();
     UNLOCK(&m->system->fds.lock);
-    UNLOCK(&m->system->pagelocks_lock);
+    UNLOCK(&m->system->pins_lock);
     UNLOCK(&m->system->mmap_lock);
     UNLOCK(&m->system->sig_lock);
     UNLOCK(&m->system->exec_lock);
@@ -456,14 +426,21 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
     m->tid = m->system->pid = newpid;
     m->system->isfork = true;
     RemoveOtherThreads(m->system);
+    ResetFutexes();
+    ResetFds(&m->system->fds);
+    CloseWakeFds(m);
 #ifdef __CYGWIN__
     // Cygwin doesn't seem to properly set the PROT_EXEC
     // protection for JIT blocks after forking.
     FixJitProtection(&m->system->jit);
 #endif
+#ifdef HAVE_JIT
+    SetupPerfMap(m->system);
+#endif
+    SetupProfiler(m->system);
     if ((flags & (CLONE_CHILD_SETTID_LINUX | CLONE_CHILD_CLEARTID_LINUX)) &&
         !(ctid & (sizeof(i32) - 1)) &&
-        (ctid_ptr = (_Atomic(i32) *)LookupAddress(m, ctid))) {
+        (ctid_ptr = (_Atomic(i32) *)LookupWritableAddress(m, ctid))) {
       if (flags & CLONE_CHILD_SETTID_LINUX) {
         atomic_store_explicit(ctid_ptr, Little32(newpid), memory_order_release);
       }
@@ -487,8 +464,12 @@ static int SysVfork(struct Machine *m) {
 static void *OnSpawn(void *arg) {
   int rc;
   struct Machine *m = (struct Machine *)arg;
-  THR_LOGF("pid=%d tid=%d OnSpawn", m->system->pid, m->tid);
   m->thread = pthread_self();
+#ifdef HAVE_THREADS
+  // threads recycled by SysExit() come back here to run a new thread
+  sigsetjmp(g_respawn, 0);
+#endif
+  THR_LOGF("pid=%d tid=%d OnSpawn", m->system->pid, m->tid);
   if (!(rc = sigsetjmp(m->onhalt, 1))) {
     m->canhalt = true;
     unassert(!pthread_sigmask(SIG_SETMASK, &m->spawn_sigmask, 0));
@@ -504,6 +485,7 @@ static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
   int tid;
   int err;
   int ignored;
+  int oldtid = 0;
   pthread_t thread;
   unsigned supported;
   unsigned mandatory;
@@ -539,11 +521,11 @@ static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
   if (((flags & CLONE_PARENT_SETTID_LINUX) &&
        ((ptid & (sizeof(int) - 1)) ||
         !IsValidMemory(m, ptid, 4, PROT_READ | PROT_WRITE) ||
-        !(ptid_ptr = (_Atomic(int) *)LookupAddress(m, ptid)))) ||
+        !(ptid_ptr = (_Atomic(int) *)LookupWritableAddress(m, ptid)))) ||
       ((flags & CLONE_CHILD_SETTID_LINUX) &&
        ((ctid & (sizeof(int) - 1)) ||
         !IsValidMemory(m, ctid, 4, PROT_READ | PROT_WRITE) ||
-        !(ctid_ptr = (_Atomic(int) *)LookupAddress(m, ctid))))) {
+        !(ctid_ptr = (_Atomic(int) *)LookupWritableAddress(m, ctid))))) {
     LOGF("bad clone() ptid / ctid pointers: %#" PRIx64, flags);
     return efault();
   }
@@ -567,18 +549,29 @@ static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
   Put64(m2->ax, 0);
   Put64(m2->sp, stack);
   m2->spawn_sigmask = oldss;
+  // the parent tid must be stored before the child runs, since libc
+  // may pass the same address as ctid, which gets cleared on its exit
+  if (flags & CLONE_PARENT_SETTID_LINUX) {
+    oldtid = atomic_exchange_explicit(ptid_ptr, Little32(tid),
+                                      memory_order_release);
+  }
+  if (m2->parked) {
+    UnparkMachine(m2);
+    unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+    return tid;
+  }
   unassert(!pthread_attr_init(&attr));
   unassert(!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
   err = pthread_create(&thread, &attr, OnSpawn, m2);
   unassert(!pthread_attr_destroy(&attr));
   if (err) {
+    if (flags & CLONE_PARENT_SETTID_LINUX) {
+      atomic_store_explicit(ptid_ptr, oldtid, memory_order_release);
+    }
     FreeMachine(m2);
     unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
     return eagain();
   }
-  if (flags & CLONE_PARENT_SETTID_LINUX) {
-    atomic_store_explicit(ptid_ptr, Little32(tid), memory_order_release);
-  }
   unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
   return tid;
 }
@@ -609,25 +602,6 @@ static int SysClone(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
 #endif
 }
 
-static struct Futex *NewFutex(i64 addr) {
-  struct Dll *e;
-  struct Futex *f;
-  if (!(e = dll_first(g_bus->futexes.free))) {
-    LOG_ONCE(LOGF("ran out of futexes"));
-    enomem();
-    return 0;
-  }
-  dll_remove(&g_bus->futexes.free, e);
-  f = FUTEX_CONTAINER(e);
-  f->waiters = 1;
-  f->addr = addr;
-  return f;
-}
-
-static void FreeFutex(struct Futex *f) {
-  dll_make_first(&g_bus->futexes.free, &f->elem);
-}
-
 static int LoadTimespec(struct Machine *m, i64 addr, struct timespec *ts,
                         u64 mask, u64 need) {
   const struct timespec_linux *gt;
@@ -653,126 +627,6 @@ static int LoadTimespecRW(struct Machine *m, i64 addr, struct timespec *ts) {
   return LoadTimespec(m, addr, ts, PAGE_U | PAGE_RW, PAGE_U | PAGE_RW);
 }
 
-static int SysFutexWait(struct Machine *m,  //
-                        i64 uaddr,          //
-                        i32 op,             //
-                        u32 expect,         //
-                        i64 timeout_addr) {
-  int rc;
-  u8 *mem;
-  struct Futex *f;
-  const struct timespec_linux *gtimeout;
-  struct timespec now, tick, timeout, deadline;
-  now = tick = GetTime();
-  if (timeout_addr) {
-    if (!(gtimeout = (const struct timespec_linux *)SchlepR(
-              m, timeout_addr, sizeof(*gtimeout)))) {
-      return -1;
-    }
-    timeout.tv_sec = Read64(gtimeout->sec);
-    timeout.tv_nsec = Read64(gtimeout->nsec);
-    if (!(0 <= timeout.tv_nsec && timeout.tv_nsec < 1000000000)) {
-      return einval();
-    }
-    deadline = AddTime(now, timeout);
-  } else {
-    deadline = GetMaxTime();
-  }
-  if (!(mem = LookupAddress(m, uaddr))) return -1;
-  LOCK(&g_bus->futexes.lock);
-  if (Load32(mem) != expect) {
-    UNLOCK(&g_bus->futexes.lock);
-    return eagain();
-  }
-  if ((f = FindFutex(m, uaddr))) {
-    LOCK(&f->lock);
-    ++f->waiters;
-    UNLOCK(&f->lock);
-  }
-  if (!f) {
-    if ((f = NewFutex(uaddr))) {
-      dll_make_first(&g_bus->futexes.active, &f->elem);
-    } else {
-      UNLOCK(&g_bus->futexes.lock);
-      return -1;
-    }
-  }
-  UNLOCK(&g_bus->futexes.lock);
-  THR_LOGF("pid=%d tid=%d is waiting at address %#" PRIx64, m->system->pid,
-           m->tid, uaddr);
-  do {
-    if (m->killed) {
-      rc = EAGAIN;
-      break;
-    }
-    if (CheckInterrupt(m, true)) {
-      rc = EINTR;
-      break;
-    }
-    if (!(mem = LookupAddress(m, uaddr))) {
-      rc = errno;
-      break;
-    }
-    LOCK(&f->lock);
-    if (Load32(mem) != expect) {
-      rc = 0;
-    } else {
-      tick = AddTime(tick, FromMilliseconds(kPollingMs));
-      if (CompareTime(tick, deadline) > 0) tick = deadline;
-      rc = pthread_cond_timedwait(&f->cond, &f->lock, &tick);
-      if (rc == ETIMEDOUT) {
-        THR_LOGF("futex wait timed out");
-      } else {
-        THR_LOGF("futex wait returned %s", DescribeHostErrno(rc));
-      }
-    }
-    UNLOCK(&f->lock);
-  } while (rc == ETIMEDOUT && CompareTime(tick, deadline) < 0);
-  LOCK(&g_bus->futexes.lock);
-  LOCK(&f->lock);
-  if (!--f->waiters) {
-    dll_remove(&g_bus->futexes.active, &f->elem);
-    UNLOCK(&f->lock);
-    FreeFutex(f);
-    UNLOCK(&g_bus->futexes.lock);
-  } else {
-    UNLOCK(&f->lock);
-    UNLOCK(&g_bus->futexes.lock);
-  }
-  if (rc) {
-    errno = rc;
-    rc = -1;
-  }
-  return rc;
-}
-
-static int SysFutex(struct Machine *m,  //
-                    i64 uaddr,          //
-                    i32 op,             //
-                    u32 val,            //
-                    i64 timeout_addr,   //
-                    i64 uaddr2,         //
-                    u32 val3) {
-  if (uaddr & 3) return efault();
-  op &= ~FUTEX_PRIVATE_FLAG_LINUX;
-  switch (op) {
-    case FUTEX_WAIT_LINUX:
-      return SysFutexWait(m, uaddr, op, val, timeout_addr);
-    case FUTEX_WAKE_LINUX:
-      return SysFutexWake(m, uaddr, val);
-    case FUTEX_WAIT_BITSET_LINUX:
-    case FUTEX_WAIT_BITSET_LINUX | FUTEX_CLOCK_REALTIME_LINUX:
-      // will be supported soon
-      // avoid logging when cosmo feature checks this
-      if (!m->system->iscosmo) goto DefaultCase;
-      return einval();
-    default:
-    DefaultCase:
-      LOGF("unsupported %s op %#x", "futex", op);
-      return einval();
-  }
-}
-
 static void UnlockRobustFutex(struct Machine *m, u64 futex_addr,
                               bool ispending) {
   int owner;
@@ -782,7 +636,7 @@ static void UnlockRobustFutex(struct Machine *m, u64 futex_addr,
     LOGF("robust futex isn't aligned");
     return;
   }
-  if (!(futex = (_Atomic(u32) *)SchlepR(m, futex_addr, 4))) {
+  if (!(futex = (_Atomic(u32) *)SchlepRW(m, futex_addr, 4))) {
     LOGF("encountered efault in robust futex list");
     return;
   }
@@ -1150,13 +1004,12 @@ static int SysMunmap(struct Machine *m, i64 virt, u64 size) {
 int GetOflags(struct Machine *m, int fildes) {
   int oflags;
   struct Fd *fd;
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     oflags = -1;
   }
-  UNLOCK(&m->system->fds.lock);
   return oflags;
 }
 
@@ -1201,6 +1054,7 @@ static i64 SysMmapImpl(struct Machine *m, i64 virt, i64 size, int prot,
       errno = EACCES;
       return -1;
     }
+    if ((offset = GetIoUringMapOffset(m, fildes, offset)) == -1) return -1;
   }
   newautomap = -1;
   fixedmap = false;
@@ -1363,7 +1217,7 @@ static int SysDup2(struct Machine *m, i32 fildes, i32 newfildes) {
   } else if ((rc = Dup2(m, fildes, newfildes)) != -1) {
     LOCK(&m->system->fds.lock);
     if ((fd = GetFd(&m->system->fds, newfildes))) {
-      dll_remove(&m->system->fds.list, &fd->elem);
+      RemoveFd(&m->system->fds, fd);
       FreeFd(fd);
     }
     unassert(fd = GetFd(&m->system->fds, fildes));
@@ -1392,7 +1246,7 @@ static int SysDup3(struct Machine *m, i32 fildes, i32 newfildes, i32 flags) {
 #endif
     LOCK(&m->system->fds.lock);
     if ((fd = GetFd(&m->system->fds, newfildes))) {
-      dll_remove(&m->system->fds.list, &fd->elem);
+      RemoveFd(&m->system->fds, fd);
       FreeFd(fd);
     }
     unassert(fd = GetFd(&m->system->fds, fildes));
@@ -1627,17 +1481,16 @@ static int SysGetpeername(struct Machine *m, int fd, i64 aa, i64 asa) {
 
 static int GetNoRestart(struct Machine *m, int fildes, bool *norestart) {
   struct Fd *fd;
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     *norestart = fd->norestart;
+    ReleaseFd(fd);
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return ebadf();
   return 0;
 }
 
-static int SysAccept4(struct Machine *m, i32 fildes, i64 sockaddr_addr,
-                      i64 sockaddr_size_addr, i32 flags) {
+int SysAccept4(struct Machine *m, i32 fildes, i64 sockaddr_addr,
+               i64 sockaddr_size_addr, i32 flags) {
   struct Fd *fd;
   socklen_t addrlen;
   bool restartable = false;
@@ -1861,13 +1714,13 @@ static void EnsureSockAddrHasDestination(struct Machine *m, int fildes,
 #endif
 }
 
-static i64 SysSendto(struct Machine *m,  //
-                     i32 fildes,         //
-                     i64 bufaddr,        //
-                     u64 buflen,         //
-                     i32 flags,          //
-                     i64 sockaddr_addr,  //
-                     i32 sockaddr_size) {
+i64 SysSendto(struct Machine *m,  //
+              i32 fildes,         //
+              i64 bufaddr,        //
+              u64 buflen,         //
+              i32 flags,          //
+              i64 sockaddr_addr,  //
+              i32 sockaddr_size) {
   ssize_t rc;
   int socktype;
   struct Fd *fd;
@@ -1876,15 +1729,14 @@ static i64 SysSendto(struct Machine *m,  //
   struct msghdr msg;
   int len, hostflags;
   struct sockaddr_storage ss;
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     socktype = fd->socktype;
     norestart = fd->norestart;
+    ReleaseFd(fd);
   } else {
     socktype = 0;
     norestart = false;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return ebadf();
   if (sockaddr_size < 0) return einval();
   if ((hostflags = XlatSendFlags(flags, socktype)) == -1) return -1;
@@ -1911,13 +1763,13 @@ static i64 SysSendto(struct Machine *m,  //
   return HandleSigpipe(m, rc, flags);
 }
 
-static i64 SysRecvfrom(struct Machine *m,  //
-                       i32 fildes,         //
-                       i64 bufaddr,        //
-                       u64 buflen,         //
-                       i32 flags,          //
-                       i64 sockaddr_addr,  //
-                       i64 sockaddr_size_addr) {
+i64 SysRecvfrom(struct Machine *m,  //
+                i32 fildes,         //
+                i64 bufaddr,        //
+                u64 buflen,         //
+                i32 flags,          //
+                i64 sockaddr_addr,  //
+                i64 sockaddr_size_addr) {
   ssize_t rc;
   int hostflags;
   struct Iovs iv;
@@ -2337,23 +2189,22 @@ static int SysGetsockopt(struct Machine *m, i32 fildes, i32 level, i32 optname,
   return rc;
 }
 
-static i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
+i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
   i64 rc;
   int oflags;
   struct Fd *fd;
   struct Iovs iv;
   ssize_t (*readv_impl)(int, const struct iovec *, int);
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     unassert(fd->cb);
     unassert(readv_impl = fd->cb->readv);
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     readv_impl = 0;
     oflags = 0;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_WRONLY) return ebadf();
   if (size) {
@@ -2369,23 +2220,22 @@ static i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
   return rc;
 }
 
-static i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
+i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
   i64 rc;
   int oflags;
   struct Fd *fd;
   struct Iovs iv;
   ssize_t (*writev_impl)(int, const struct iovec *, int);
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     unassert(fd->cb);
     unassert(writev_impl = fd->cb->writev);
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     writev_impl = 0;
     oflags = 0;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_RDONLY) return ebadf();
   if (size) {
@@ -2403,17 +2253,16 @@ static i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
 
 // FreeBSD doesn't do access mode check on read/write to pipes.
 // Cygwin generally doesn't do access checks or is inconsistent.
-static long CheckFdAccess(struct Machine *m, i32 fildes, bool writable,
-                          int errno_if_check_fails) {
+long CheckFdAccess(struct Machine *m, i32 fildes, bool writable,
+                   int errno_if_check_fails) {
   int oflags;
   struct Fd *fd;
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     oflags = 0;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((writable && ((oflags & O_ACCMODE) == O_RDONLY)) ||
       (!writable && ((oflags & O_ACCMODE) == O_WRONLY))) {
@@ -2423,8 +2272,8 @@ static long CheckFdAccess(struct Machine *m, i32 fildes, bool writable,
   return 0;
 }
 
-static i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
-                    u64 offset) {
+i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
+             u64 offset) {
   ssize_t rc;
   struct Iovs iv;
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
@@ -2442,8 +2291,8 @@ static i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
   return rc;
 }
 
-static i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
-                     u64 offset) {
+i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
+              u64 offset) {
   ssize_t rc;
   struct Iovs iv;
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
@@ -2461,8 +2310,8 @@ static i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
   return rc;
 }
 
-static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
-                      i64 offset, i32 flags) {
+i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
+               i64 offset, i32 flags) {
   i64 rc;
   int oflags;
   struct Fd *fd;
@@ -2473,16 +2322,15 @@ static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
     return einval();
   }
   if (iovlen > IOV_MAX_LINUX) return einval();
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     unassert(fd->cb);
     unassert(readv_impl = fd->cb->readv);
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     readv_impl = 0;
     oflags = 0;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_WRONLY) return ebadf();
   if (iovlen) {
@@ -2509,8 +2357,8 @@ static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
   return rc;
 }
 
-static i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
-                       i64 offset, i32 flags) {
+i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
+                i64 offset, i32 flags) {
   i64 rc;
   int oflags;
   struct Fd *fd;
@@ -2521,16 +2369,15 @@ static i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
     return einval();
   }
   if (iovlen > IOV_MAX_LINUX) return einval();
-  LOCK(&m->system->fds.lock);
-  if ((fd = GetFd(&m->system->fds, fildes))) {
+  if ((fd = AcquireFd(&m->system->fds, fildes))) {
     unassert(fd->cb);
     unassert(writev_impl = fd->cb->writev);
     oflags = fd->oflags;
+    ReleaseFd(fd);
   } else {
     writev_impl = 0;
     oflags = 0;
   }
-  UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_RDONLY) return ebadf();
   if (iovlen) {
@@ -2578,50 +2425,6 @@ static i64 SysPwritev(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
   return SysPwritev2(m, fildes, iovaddr, iovlen, offset, 0);
 }
 
-static i64 SysSendfile(struct Machine *m, i32 out_fd, i32 in_fd, i64 offsetaddr,
-                       u64 count) {
-  u64 toto, offset;
-  ssize_t got, wrote;
-  u8 *buf, *offsetp = 0;
-  size_t chunk, maxchunk = 16384;
-  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
-  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
-  if (offsetaddr && !(offsetp = (u8 *)SchlepRW(m, offsetaddr, 8))) return -1;
-  if (!(buf = (u8 *)AddToFreeList(m, malloc(maxchunk)))) return -1;
-  if (offsetp) {
-    offset = Read64(offsetp);
-    if ((i64)offset < 0) return einval();
-    if (Read64(offsetp) + count < count ||
-        Read64(offsetp) + count > NUMERIC_MAX(off_t)) {
-      return eoverflow();
-    }
-  }
-  for (toto = 0; toto < count;) {
-    chunk = MIN(count - toto, maxchunk);
-    if (offsetp) {
-      got = VfsPread(in_fd, buf, chunk, offset + toto);
-    } else {
-      got = VfsRead(in_fd, buf, chunk);
-    }
-    if (got == -1) goto OnFailure;
-    if (offsetp) Write64(offsetp, offset + toto + got);
-    if (got == 0) break;
-    while (got > 0) {
-      if ((wrote = VfsWrite(out_fd, buf, got)) == -1) goto OnFailure;
-      toto += wrote;
-      got -= wrote;
-    }
-  }
-  return toto;
-OnFailure:
-  if (toto) {
-    LOGF("sendfile() partial failure: %s", DescribeHostErrno(errno));
-    return toto;
-  } else {
-    return -1;
-  }
-}
-
 static int UnXlatDt(int x) {
 #ifndef DT_UNKNOWN
   return DT_UNKNOWN_LINUX;
@@ -2937,9 +2740,10 @@ static int SysChroot(struct Machine *m, i64 path) {
 #ifndef DISABLE_VFS
 static int SysMount(struct Machine *m, i64 source, i64 target, i64 fstype,
                     i64 mountflags, i64 data) {
-  // No xlat, the VFS system will handle raw Linux options.
+  // No xlat, the VFS system will handle raw Linux options, which for the
+  // filesystems we implement are always strings, e.g. "size=64m".
   return VfsMount(LoadStr(m, source), LoadStr(m, target), LoadStr(m, fstype),
-                  mountflags, (void *)(uintptr_t)data);
+                  mountflags, data ? LoadStr(m, data) : 0);
 }
 #endif
 
@@ -2990,7 +2794,7 @@ static int CheckSyncable(int fildes) {
   return 0;
 }
 
-static int SysFsync(struct Machine *m, i32 fildes) {
+int SysFsync(struct Machine *m, i32 fildes) {
   if (CheckSyncable(fildes) == -1) return -1;
 #ifdef F_FULLSYNC
   int rc;
@@ -3014,7 +2818,7 @@ static int SysFsync(struct Machine *m, i32 fildes) {
 #endif
 }
 
-static int SysFdatasync(struct Machine *m, i32 fildes) {
+int SysFdatasync(struct Machine *m, i32 fildes) {
   if (CheckSyncable(fildes) == -1) return -1;
 #ifdef F_FULLSYNC
   int rc;
@@ -3273,6 +3077,8 @@ static int SysFcntl(struct Machine *m, i32 fildes, i32 cmd, i64 arg) {
     } else {
       rc = -1;
     }
+  } else if (cmd == F_ADD_SEALS_LINUX || cmd == F_GET_SEALS_LINUX) {
+    rc = SysFcntlSeals(fd, cmd, arg);
   } else if (cmd == F_SETLK_LINUX ||   //
              cmd == F_SETLKW_LINUX ||  //
              cmd == F_GETLK_LINUX) {
@@ -3541,7 +3347,7 @@ static void ExecveBlink(struct Machine *m, char *prog, char **argv,
       // point of no return
       // prog/argv/envp are copied onto the freelist
       m->sysdepth = 0;
-      CollectPageLocks(m);
+      CollectPagePins(m);
       // TODO(jart): Prevent possibility of stack overflow.
       SYS_LOGF("m->system->exec(%s)", prog);
       SysCloseExec(m->system);
@@ -3561,7 +3367,10 @@ static int SysExecve(struct Machine *m, i64 pa, i64 aa, i64 ea) {
   LOCK(&m->system->exec_lock);
   ExecveBlink(m, prog, argv, envp);
   SYS_LOGF("execve(%s)", prog);
+  // the profile timer would kill a host program that replaces us
+  WriteProfile();
   VfsExecve(prog, argv, envp);
+  SetupProfiler(m->system);
   UNLOCK(&m->system->exec_lock);
   return -1;
 }
@@ -3593,6 +3402,8 @@ static int SysWait4(struct Machine *m, int pid, i64 opt_out_wstatus_addr,
   RESTARTABLE(rc = waitpid(pid, &wstatus, options));
 #endif
   if (rc != -1 && rc != 0) {
+    // the child may have changed files that our path caches remember
+    VfsFlushDentries();
     if (opt_out_wstatus_addr) {
 #ifdef WIFCONTINUED
       if (WIFCONTINUED(wstatus)) {
@@ -3774,7 +3585,13 @@ static ssize_t SysGetrandom(struct Machine *m, i64 a, size_t n, int f) {
 
 void OnSignal(int sig, siginfo_t *si, void *uc) {
   SIG_LOGF("OnSignal(%s)", DescribeSignal(UnXlatSignal(sig)));
-  EnqueueSignal(g_machine, UnXlatSignal(sig));
+#ifdef SI_TKILL
+  if (si->si_code == SI_TKILL) {
+    EnqueueSignal(g_machine, UnXlatSignal(sig));
+    return;
+  }
+#endif
+  EnqueueProcessSignal(g_machine, UnXlatSignal(sig));
 }
 
 static int SysSigaction(struct Machine *m, int sig, i64 act, i64 old,
@@ -3839,6 +3656,7 @@ static int SysSigaction(struct Machine *m, int sig, i64 act, i64 old,
     m->system->hands[sig - 1] = hand;
     if (isignored) {
       m->signals &= ~((u64)1 << (sig - 1));
+      m->system->signals &= ~((u64)1 << (sig - 1));
     }
     if ((syssig = XlatSignal(sig)) != -1 && !IsBlinkSig(m->system, sig)) {
       sigfillset(&syshand.sa_mask);
@@ -4115,7 +3933,7 @@ static int SysSigaltstack(struct Machine *m, i64 newaddr, i64 oldaddr) {
   return 0;
 }
 
-static int SysClockGettime(struct Machine *m, int clock, i64 ts) {
+int SysClockGettime(struct Machine *m, int clock, i64 ts) {
   int rc;
   clock_t sysclock;
   struct timespec htimespec;
@@ -4165,7 +3983,7 @@ static int SysClockGetres(struct Machine *m, int clock, i64 ts) {
   return rc;
 }
 
-static int SysGettimeofday(struct Machine *m, i64 tv, i64 tz) {
+int SysGettimeofday(struct Machine *m, i64 tv, i64 tz) {
   int rc;
   void *htimezonep;
   struct timeval htimeval;
@@ -4201,7 +4019,7 @@ static int SysGettimeofday(struct Machine *m, i64 tv, i64 tz) {
   return rc;
 }
 
-static i64 SysTime(struct Machine *m, i64 addr) {
+i64 SysTime(struct Machine *m, i64 addr) {
   u8 buf[8];
   time_t secs;
   if ((secs = time(0)) == (time_t)-1) return -1;
@@ -4212,6 +4030,26 @@ static i64 SysTime(struct Machine *m, i64 addr) {
   return secs;
 }
 
+int SysGetcpu(struct Machine *m, i64 cpuaddr, i64 nodeaddr, i64 cache) {
+  u8 buf[4];
+  int cpu, node;
+#ifdef HAVE_SCHED_GETCPU
+  if ((cpu = sched_getcpu()) == -1) return -1;
+#else
+  cpu = 0;
+#endif
+  node = 0;
+  if (cpuaddr) {
+    Write32(buf, cpu);
+    if (CopyToUserWrite(m, cpuaddr, buf, sizeof(buf)) == -1) return -1;
+  }
+  if (nodeaddr) {
+    Write32(buf, node);
+    if (CopyToUserWrite(m, nodeaddr, buf, sizeof(buf)) == -1) return -1;
+  }
+  return 0;
+}
+
 static i64 SysTimes(struct Machine *m, i64 bufaddr) {
   // no conversion needed thanks to getauxval(AT_CLKTCK)
   clock_t res;
@@ -4412,6 +4250,57 @@ static int SaveFdSet(struct Machine *m, int nfds, const fd_set *fds, i64 addr) {
   return CopyToUserWrite(m, addr, p, FD_SETSIZE_LINUX / 8);
 }
 
+// Returns host descriptor that poll() may wait on for `fildes`, or -1
+// if it isn't backed by one, e.g. the blinkenlights pty or procfs.
+int GetPollableFd(const struct FdCb *cb, int fildes) {
+#ifndef __EMSCRIPTEN__
+  if (cb == &kFdCbHost || cb == &kFdCbSignalfd) return VfsHostFd(fildes);
+  if (cb == &kFdCbIoUring) return GetIoUringPollFd(fildes);
+#endif
+  return -1;
+}
+
+// Blocks until one of the `n` host descriptors in `hfds` becomes ready,
+// a signal is enqueued for this thread, or `deadline` elapses. The slot
+// at `hfds[n]` is reserved for the wake pipe. Wakeups may be spurious,
+// so callers need to poll their descriptors again afterwards. If some
+// descriptor had no host equivalent, then we sleep for kPollingMs. It
+// returns true if this thread is being killed and should stop waiting.
+bool WaitForFds(struct Machine *m, struct pollfd *hfds, int n,
+                bool pollable, struct timespec deadline) {
+  int ms;
+  struct timespec now, wait;
+  if (atomic_load_explicit(&m->killed, memory_order_acquire)) return true;
+  if (CompareTime((now = GetTime()), deadline) >= 0) return false;
+  wait = SubtractTime(deadline, now);
+  if (pollable && m->waitfd == -1 && GetWaitFd(m) != -1) {
+    // a signal enqueued before the wake pipe existed couldn't ring it,
+    // so the caller must check for interrupts again before we sleep
+    return false;
+  }
+  if (!pollable || (hfds[n].fd = GetWaitFd(m)) == -1) {
+    if (CompareTime(wait, FromMilliseconds(kPollingMs)) > 0) {
+      wait = FromMilliseconds(kPollingMs);
+    }
+    nanosleep(&wait, 0);
+    return false;
+  }
+  if (CompareTime(deadline, GetMaxTime()) >= 0) {
+    ms = -1;
+  } else {
+    // time is left, so poll() mustn't be told zero, which would spin
+    // until the deadline. ToMilliseconds() rounds the fraction upward
+    ms = MAX(1, ConvertTimeToInt(ToMilliseconds(wait)));
+  }
+  hfds[n].events = POLLIN;
+  hfds[n].revents = 0;
+  STATISTIC(++poll_waits);
+  if (poll(hfds, n + 1, ms) > 0 && hfds[n].revents) {
+    DrainWaitFd(m);
+  }
+  return false;
+}
+
 static i32 Select(struct Machine *m,          //
                   i32 nfds,                   //
                   i64 readfds_addr,           //
@@ -4419,14 +4308,16 @@ static i32 Select(struct Machine *m,          //
                   i64 exceptfds_addr,         //
                   struct timespec *timeoutp,  //
                   const u64 *sigmaskp_guest) {
-  int fildes, rc;
+  int fildes, rc, n;
   i32 setsize;
+  bool pollable;
   u64 oldmask_guest = 0;
   fd_set readfds, writefds, exceptfds, readyreadfds, readywritefds,
       readyexceptfds;
-  struct pollfd hfds[1];
-  struct timespec now, wait, remain, deadline = {0};
+  struct pollfd hfds[1], *wfds;
+  struct timespec now, deadline = {0};
   struct Fd *fd;
+  const struct FdCb *cb;
   int (*poll_impl)(struct pollfd *, nfds_t, int);
   if (timeoutp) {
     deadline = AddTime(GetTime(), *timeoutp);
@@ -4457,6 +4348,10 @@ static i32 Select(struct Machine *m,          //
   } else {
     FD_ZERO(&exceptfds);
   }
+  if (!(wfds = (struct pollfd *)AddToFreeList(
+            m, malloc((nfds + 1) * sizeof(*wfds))))) {
+    return -1;
+  }
   FD_ZERO(&readyreadfds);
   FD_ZERO(&readywritefds);
   FD_ZERO(&readyexceptfds);
@@ -4471,6 +4366,8 @@ static i32 Select(struct Machine *m,          //
       break;
     }
     rc = 0;
+    n = 0;
+    pollable = true;
     for (fildes = 0; fildes < nfds; ++fildes) {
       if (!FD_ISSET(fildes, &readfds) && !FD_ISSET(fildes, &writefds) &&
           !FD_ISSET(fildes, &exceptfds)) {
@@ -4483,7 +4380,7 @@ static i32 Select(struct Machine *m,          //
       }
       LOCK(&m->system->fds.lock);
       if ((fd = GetFd(&m->system->fds, fildes))) {
-        unassert(fd->cb);
+        unassert(cb = fd->cb);
         unassert(poll_impl = fd->cb->poll);
       } else {
         poll_impl = 0;
@@ -4496,6 +4393,10 @@ static i32 Select(struct Machine *m,          //
                           (FD_ISSET(fildes, &exceptfds) ? POLLPRI : 0));
         switch (poll_impl(hfds, 1, 0)) {
           case 0:
+            if ((wfds[n].fd = GetPollableFd(cb, fildes)) == -1) {
+              pollable = false;
+            }
+            wfds[n++].events = hfds[0].events;
             break;
           case 1:
             if (FD_ISSET(fildes, &readfds) && (hfds[0].revents & POLLIN)) {
@@ -4527,19 +4428,13 @@ static i32 Select(struct Machine *m,          //
       }
     }
   BreakLoop:
-    if (rc || (timeoutp && CompareTime(now = GetTime(), deadline) >= 0)) {
+    if (rc || (timeoutp && CompareTime(GetTime(), deadline) >= 0)) {
       break;
     }
-    if (timeoutp) {
-      wait = FromMilliseconds(kPollingMs);
-      remain = SubtractTime(deadline, now);
-      if (CompareTime(remain, wait) < 0) {
-        wait = remain;
-      }
-    } else {
-      wait = FromMilliseconds(kPollingMs);
+    if (WaitForFds(m, wfds, n, pollable, timeoutp ? deadline : GetMaxTime())) {
+      rc = eintr();
+      break;
     }
-    nanosleep(&wait, 0);
   }
   if (sigmaskp_guest) {
     m->sigmask = oldmask_guest;
@@ -4665,18 +4560,23 @@ static int Poll(struct Machine *m, i64 fdsaddr, u64 nfds,
                 struct timespec deadline) {
   long i;
   u64 gfdssize;
+  bool pollable;
   struct Fd *fd;
-  int fildes, rc, ev;
-  struct pollfd hfds[1];
+  int fildes, rc, ev, n;
+  const struct FdCb *cb;
+  struct pollfd hfds[1], *wfds;
   struct pollfd_linux *gfds;
-  struct timespec now, wait, remain;
   int (*poll_impl)(struct pollfd *, nfds_t, int);
   if (!ckd_mul(&gfdssize, nfds, sizeof(struct pollfd_linux)) &&
       gfdssize <= 0x7ffff000) {
-    if ((gfds = (struct pollfd_linux *)AddToFreeList(m, malloc(gfdssize)))) {
+    if ((gfds = (struct pollfd_linux *)AddToFreeList(m, malloc(gfdssize))) &&
+        (wfds = (struct pollfd *)AddToFreeList(
+             m, malloc((nfds + 1) * sizeof(*wfds))))) {
       rc = 0;
       CopyFromUserRead(m, gfds, fdsaddr, gfdssize);
       for (;;) {
+        n = 0;
+        pollable = true;
         for (i = 0; i < nfds; ++i) {
         TryAgain:
           if (CheckInterrupt(m, false)) {
@@ -4686,7 +4586,7 @@ static int Poll(struct Machine *m, i64 fdsaddr, u64 nfds,
           fildes = Read32(gfds[i].fd);
           LOCK(&m->system->fds.lock);
           if ((fd = GetFd(&m->system->fds, fildes))) {
-            unassert(fd->cb);
+            unassert(cb = fd->cb);
             unassert(poll_impl = fd->cb->poll);
           } else {
             poll_impl = 0;
@@ -4701,6 +4601,10 @@ static int Poll(struct Machine *m, i64 fdsaddr, u64 nfds,
             switch (poll_impl(hfds, 1, 0)) {
               case 0:
                 Write16(gfds[i].revents, 0);
+                if ((wfds[n].fd = GetPollableFd(cb, fildes)) == -1) {
+                  pollable = false;
+                }
+                wfds[n++].events = hfds[0].events;
                 break;
               case 1:
                 ++rc;
@@ -4728,15 +4632,13 @@ static int Poll(struct Machine *m, i64 fdsaddr, u64 nfds,
             Write16(gfds[i].revents, POLLNVAL_LINUX);
           }
         }
-        if (rc || CompareTime((now = GetTime()), deadline) >= 0) {
+        if (rc || CompareTime(GetTime(), deadline) >= 0) {
           break;
         }
-        wait = FromMilliseconds(kPollingMs);
-        remain = SubtractTime(deadline, now);
-        if (CompareTime(remain, wait) < 0) {
-          wait = remain;
+        if (WaitForFds(m, wfds, n, pollable, deadline)) {
+          rc = eintr();
+          break;
         }
-        nanosleep(&wait, 0);
       }
       if (rc != -1) {
         CopyToUserWrite(m, fdsaddr, gfds, nfds * sizeof(*gfds));
@@ -4861,7 +4763,7 @@ static int SysSigprocmask(struct Machine *m, int how, i64 setaddr,
 
 static int SysSigpending(struct Machine *m, i64 setaddr) {
   u8 word[8];
-  Write64(word, m->signals);
+  Write64(word, m->signals | m->system->signals);
   return CopyToUserWrite(m, setaddr, word, 8);
 }
 
@@ -4910,7 +4812,7 @@ static int SysTkill(struct Machine *m, int tid, int sig) {
       UNLOCK(&m->system->sig_lock);
       return rc;
     } else {
-      m->signals |= (u64)1 << (sig - 1);
+      EnqueueSignal(m, sig);
       return 0;
     }
   }
@@ -5186,8 +5088,22 @@ static int SysSchedYield(struct Machine *m) {
 #endif
 }
 
+int GetUmask(struct System *s) {
+  int mask;
+  LOCK(&s->umask_lock);
+  mask = s->umask;
+  UNLOCK(&s->umask_lock);
+  return mask;
+}
+
 static int SysUmask(struct Machine *m, int mask) {
-  return umask(mask);
+  int old;
+  LOCK(&m->system->umask_lock);
+  old = m->system->umask;
+  m->system->umask = mask & 0777;
+  umask(mask & 0777);
+  UNLOCK(&m->system->umask_lock);
+  return old;
 }
 
 static int SysSetuid(struct Machine *m, int uid) {
@@ -5291,9 +5207,10 @@ static i32 SysEpollCreate1(struct Machine *m, i32 flags) {
     return einval();
   }
   if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
-  if ((fildes = epoll_create1(sysflags)) != -1) {
+  if ((fildes = epoll_create1(sysflags)) != -1 &&
+      (fildes = VfsWrapFd(fildes)) != -1) {
     if (fildes >= lim) {
-      close(fildes);
+      VfsClose(fildes);
       fildes = emfile();
     } else {
       LOCK(&m->system->fds.lock);
@@ -5311,6 +5228,7 @@ static i32 SysEpollCreate(struct Machine *m, i32 size) {
 
 static i32 SysEpollCtl(struct Machine *m, i32 epfd, i32 op, i32 fd,
                        i64 eventaddr) {
+  int hostfd;
   struct epoll_event epe, *pepe;
   const struct epoll_event_linux *gepe;
   switch (op) {
@@ -5330,7 +5248,13 @@ static i32 SysEpollCtl(struct Machine *m, i32 epfd, i32 op, i32 fd,
     default:
       return einval();
   }
-  return epoll_ctl(epfd, op, fd, pepe);
+  if ((epfd = VfsHostFd(epfd)) == -1) return -1;
+  // rings are watched through the host epoll that tracks their waits
+  if ((hostfd = GetIoUringPollFd(fd)) == -1 &&
+      (hostfd = VfsHostFd(fd)) == -1) {
+    return -1;
+  }
+  return epoll_ctl(epfd, op, hostfd, pepe);
 }
 
 static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
@@ -5344,6 +5268,7 @@ static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
   struct epoll_event_linux *gevents;
   const struct sigset_linux *sigmaskp_guest = 0;
   if (maxevents <= 0) return einval();
+  if ((epfd = VfsHostFd(epfd)) == -1) return -1;
   if (sigmaskaddr) {
     if (sigsetsize != 8) return einval();
     if (!(sigmaskp_guest = (const struct sigset_linux *)SchlepR(
@@ -5369,6 +5294,7 @@ static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
   }
   if (!CheckInterrupt(m, false)) {
     do {
+      ProgressIoUrings(m);
       now = GetTime();
       if (CompareTime(now, deadline) < 0) {
         waitfor = SubtractTime(deadline, now);
@@ -5397,6 +5323,10 @@ static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
     SIG_LOGF("sigmask pop %" PRIx64, m->sigmask);
   }
   unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+  if (rc > 0) {
+    // so rings that woke us have completions for the guest to reap
+    ProgressIoUrings(m);
+  }
   if (rc != -1) {
     for (i = 0; i < rc; ++i) {
       Write32(gevents[i].events, events[i].events);
@@ -5456,7 +5386,7 @@ void OpSyscall(P) {
     Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
     return;
   }
-  STATISTIC(++syscalls);
+  MACHINE_STATISTIC(m, syscalls);
   // make sure blinkenlights display is up to date before performing any
   // potentially blocking operations which would otherwise freeze things
   if (m->system->redraw && m->tid == m->system->pid) {
@@ -5682,6 +5612,7 @@ void OpSyscall(P) {
     SYSCALL(5, 0x10F, "ppoll", SysPpoll, STRACE_5);
     SYSCALL(5, 0x13C, "renameat2", SysRenameat2, STRACE_RENAMEAT2);
     SYSCALL(3, 0x13E, "getrandom", SysGetrandom, STRACE_GETRANDOM);
+    SYSCALL(3, 0x135, "getcpu", SysGetcpu, STRACE_3);
     SYSCALL(5, 0x147, "preadv2", SysPreadv2, STRACE_PREADV2);
     SYSCALL(5, 0x148, "pwritev2", SysPwritev2, STRACE_PWRITEV2);
     SYSCALL(3, 0x1B4, "close_range", SysCloseRange, STRACE_3);
@@ -5693,6 +5624,24 @@ void OpSyscall(P) {
     SYSCALL(6, 0x119, "epoll_pwait", SysEpollPwait, STRACE_6);
     SYSCALL(6, 0x1B9, "epoll_pwait2", SysEpollPwait2, STRACE_6);
 #endif /* HAVE_EPOLL_PWAIT1 */
+#ifdef HAVE_EVENTFD
+    SYSCALL(1, 0x11C, "eventfd", SysEventfd, STRACE_1);
+    SYSCALL(2, 0x122, "eventfd2", SysEventfd2, STRACE_2);
+#endif /* HAVE_EVENTFD */
+#ifdef HAVE_TIMERFD
+    SYSCALL(2, 0x11B, "timerfd_create", SysTimerfdCreate, STRACE_2);
+    SYSCALL(4, 0x11E, "timerfd_settime", SysTimerfdSettime, STRACE_4);
+    SYSCALL(2, 0x11F, "timerfd_gettime", SysTimerfdGettime, STRACE_2);
+#endif /* HAVE_TIMERFD */
+    SYSCALL(2, 0x13F, "memfd_create", SysMemfdCreate, STRACE_MEMFD_CREATE);
+    SYSCALL(3, 0x11A, "signalfd", SysSignalfd, STRACE_3);
+    SYSCALL(4, 0x121, "signalfd4", SysSignalfd4, STRACE_4);
+    SYSCALL(2, 0x1A9, "io_uring_setup", SysIoUringSetup, STRACE_2);
+    SYSCALL(6, 0x1AA, "io_uring_enter", SysIoUringEnter, STRACE_6);
+    SYSCALL(4, 0x1AB, "io_uring_register", SysIoUringRegister, STRACE_4);
+    SYSCALL(6, 0x113, "splice", SysSplice, STRACE_6);
+    SYSCALL(4, 0x114, "tee", SysTee, STRACE_4);
+    SYSCALL(6, 0x146, "copy_file_range", SysCopyFileRange, STRACE_6);
 #endif /* DISABLE_NONPOSIX */
     case 0x3C:
       SYS_LOGF("%s(%#" PRIx64 ")", "exit", di);
@@ -5704,8 +5653,6 @@ void OpSyscall(P) {
       SigRestore(m);
       m->interrupted = true;  // preevnt ax clobber
       break;
-    case 0x146:
-      // avoid noisy copy_file_range() feature check in cosmo
     case 0x1BC:
       // avoid noisy landlock_create_ruleset() feature check in cosmo
     case 0x500:
@@ -5727,8 +5674,8 @@ void OpSyscall(P) {
     Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
   }
   unassert(--m->sysdepth >= 0);
-  CollectPageLocks(m);
-  unassert(!m->pagelocks.i || m->sysdepth);
+  CollectPagePins(m);
+  unassert(!m->pins.n || m->sysdepth);
   CollectGarbage(m, mark);
   m->insyscall = false;
 }
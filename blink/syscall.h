@@ -58,11 +58,48 @@ extern char *g_blink_path;
 void OpSyscall(P);
 
 void SysCloseExec(struct System *);
+int GetUmask(struct System *);
 int SysClose(struct Machine *, i32);
 int SysCloseRange(struct Machine *, u32, u32, u32);
 int SysDup(struct Machine *, i32, i32, i32, i32);
 int SysOpenat(struct Machine *, i32, i64, i32, i32);
 int SysPipe2(struct Machine *, i64, i32);
+int SysEventfd(struct Machine *, u32);
+int SysEventfd2(struct Machine *, u32, i32);
+int SysTimerfdCreate(struct Machine *, i32, i32);
+int SysTimerfdSettime(struct Machine *, i32, i32, i64, i64);
+int SysTimerfdGettime(struct Machine *, i32, i64);
+int SysSignalfd(struct Machine *, i32, i64, u64);
+int SysSignalfd4(struct Machine *, i32, i64, u64, i32);
+void WakeSignalfds(int);
+int SysMemfdCreate(struct Machine *, i64, u32);
+int CreateMemfd(const char *, bool, bool);
+int SysFcntlSeals(struct Fd *, i32, i64);
+int SysIoUringSetup(struct Machine *, u32, i64);
+int SysIoUringEnter(struct Machine *, i32, u32, u32, u32, i64, u64);
+int SysIoUringRegister(struct Machine *, i32, u32, i64, u32);
+i64 GetIoUringMapOffset(struct Machine *, i32, i64);
+int GetIoUringPollFd(i32);
+void ProgressIoUrings(struct Machine *);
+i64 SysSendfile(struct Machine *, i32, i32, i64, u64);
+i64 SysSplice(struct Machine *, i32, i64, i32, i64, u64, u32);
+i64 SysTee(struct Machine *, i32, i32, u64, u32);
+i64 SysCopyFileRange(struct Machine *, i32, i64, i32, i64, u64, u32);
+int SysAccept4(struct Machine *, i32, i64, i64, i32);
+i64 SysSendto(struct Machine *, i32, i64, u64, i32, i64, i32);
+i64 SysRecvfrom(struct Machine *, i32, i64, u64, i32, i64, i64);
+i64 SysRead(struct Machine *, i32, i64, u64);
+i64 SysWrite(struct Machine *, i32, i64, u64);
+i64 SysPread(struct Machine *, i32, i64, u64, u64);
+i64 SysPwrite(struct Machine *, i32, i64, u64, u64);
+i64 SysPreadv2(struct Machine *, i32, i64, u32, i64, i32);
+i64 SysPwritev2(struct Machine *, i32, i64, u32, i64, i32);
+int SysFsync(struct Machine *, i32);
+int SysClockGettime(struct Machine *, int, i64);
+int SysGettimeofday(struct Machine *, i64, i64);
+i64 SysTime(struct Machine *, i64);
+int SysGetcpu(struct Machine *, i64, i64, i64);
+int SysFdatasync(struct Machine *, i32);
 int SysIoctl(struct Machine *, int, u64, i64);
 _Noreturn void SysExitGroup(struct Machine *, int);
 _Noreturn void SysExit(struct Machine *, int);
@@ -72,8 +109,16 @@ void AddStdFd(struct Fds *, int);
 int GetOflags(struct Machine *, int);
 int GetFildes(struct Machine *, int);
 struct Fd *GetAndLockFd(struct Machine *, int);
+long CheckFdAccess(struct Machine *, i32, bool, int);
+int GetPollableFd(const struct FdCb *, int);
+bool WaitForFds(struct Machine *, struct pollfd *, int, bool, struct timespec);
 bool CheckInterrupt(struct Machine *, bool);
 int SysStatfs(struct Machine *, i64, i64);
+int SysFutex(struct Machine *, i64, i32, u32, i64, i64, u32);
+int SysFutexWake(struct Machine *, i64, u32);
+void LockFutexes(void);
+void UnlockFutexes(void);
+void ResetFutexes(void);
 int SysFstatfs(struct Machine *, i32, i64);
 int mkfifoat_(int, const char *, mode_t);
 int mkfifo_(const char *, mode_t);
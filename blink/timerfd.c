@@ -0,0 +1,148 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/ndelay.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+
+int SysTimerfdCreate(struct Machine *m, i32 clock, i32 flags) {
+  clock_t sysclock;
+  int lim, fildes, oflags, sysflags;
+  if (flags & ~(TFD_CLOEXEC_LINUX | TFD_NONBLOCK_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "timerfd_create", flags);
+    return einval();
+  }
+  switch (clock) {
+    case CLOCK_REALTIME_LINUX:
+    case CLOCK_MONOTONIC_LINUX:
+    case CLOCK_BOOTTIME_LINUX:
+      if (XlatClock(clock, &sysclock) == -1) return -1;
+      break;
+    default:
+      LOGF("unsupported %s clock: %d", "timerfd_create", clock);
+      return einval();
+  }
+  oflags = O_RDONLY;
+  sysflags = 0;
+  if (flags & TFD_CLOEXEC_LINUX) {
+    oflags |= O_CLOEXEC;
+    sysflags |= TFD_CLOEXEC;
+  }
+  if (flags & TFD_NONBLOCK_LINUX) {
+    oflags |= O_NDELAY;
+    sysflags |= TFD_NONBLOCK;
+  }
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  if ((fildes = timerfd_create(sysclock, sysflags)) != -1 &&
+      (fildes = VfsWrapFd(fildes)) != -1) {
+    if (fildes >= lim) {
+      VfsClose(fildes);
+      fildes = emfile();
+    } else {
+      LOCK(&m->system->fds.lock);
+      unassert(AddFd(&m->system->fds, fildes, oflags));
+      UNLOCK(&m->system->fds.lock);
+    }
+  }
+  return fildes;
+}
+
+static int GetTimerfd(struct Machine *m, i32 fildes) {
+  struct Fd *fd;
+  LOCK(&m->system->fds.lock);
+  fd = GetFd(&m->system->fds, fildes);
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return -1;
+  return VfsHostFd(fildes);
+}
+
+static void StoreItimerspec(struct itimerspec_linux *gits,
+                            const struct itimerspec *its) {
+  Write64(gits->interval.sec, its->it_interval.tv_sec);
+  Write64(gits->interval.nsec, its->it_interval.tv_nsec);
+  Write64(gits->value.sec, its->it_value.tv_sec);
+  Write64(gits->value.nsec, its->it_value.tv_nsec);
+}
+
+int SysTimerfdSettime(struct Machine *m, i32 fildes, i32 flags, i64 valueaddr,
+                      i64 oldvalueaddr) {
+  int hostfd, sysflags;
+  struct itimerspec its, old;
+  struct itimerspec_linux gold;
+  const struct itimerspec_linux *gits;
+  if (flags & ~(TFD_TIMER_ABSTIME_LINUX | TFD_TIMER_CANCEL_ON_SET_LINUX)) {
+    LOGF("unsupported %s flags: %#x", "timerfd_settime", flags);
+    return einval();
+  }
+  sysflags = 0;
+  if (flags & TFD_TIMER_ABSTIME_LINUX) {
+    sysflags |= TFD_TIMER_ABSTIME;
+  }
+  if (flags & TFD_TIMER_CANCEL_ON_SET_LINUX) {
+#ifdef TFD_TIMER_CANCEL_ON_SET
+    sysflags |= TFD_TIMER_CANCEL_ON_SET;
+#else
+    return einval();
+#endif
+  }
+  if (!(gits = (const struct itimerspec_linux *)SchlepR(m, valueaddr,
+                                                        sizeof(*gits)))) {
+    return -1;
+  }
+  its.it_interval.tv_sec = Read64(gits->interval.sec);
+  its.it_interval.tv_nsec = Read64(gits->interval.nsec);
+  its.it_value.tv_sec = Read64(gits->value.sec);
+  its.it_value.tv_nsec = Read64(gits->value.nsec);
+  if ((hostfd = GetTimerfd(m, fildes)) == -1) return -1;
+  if (timerfd_settime(hostfd, sysflags, &its, &old) == -1) return -1;
+  if (oldvalueaddr) {
+    StoreItimerspec(&gold, &old);
+    if (CopyToUserWrite(m, oldvalueaddr, &gold, sizeof(gold)) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int SysTimerfdGettime(struct Machine *m, i32 fildes, i64 valueaddr) {
+  int hostfd;
+  struct itimerspec its;
+  struct itimerspec_linux gits;
+  if ((hostfd = GetTimerfd(m, fildes)) == -1) return -1;
+  if (timerfd_gettime(hostfd, &its) == -1) return -1;
+  StoreItimerspec(&gits, &its);
+  return CopyToUserWrite(m, valueaddr, &gits, sizeof(gits));
+}
+
+#endif /* HAVE_TIMERFD */
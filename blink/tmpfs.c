@@ -0,0 +1,1907 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/tmpfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/dll.h"
+#include "blink/errno.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/vfs.h"
+
+#if defined(__APPLE__) || defined(__NetBSD__)
+#define st_atim st_atimespec
+#define st_ctim st_ctimespec
+#define st_mtim st_mtimespec
+#endif
+
+#ifndef DISABLE_VFS
+
+// tmpfs keeps files in memory rather than on the host filesystem. the
+// whole filesystem lives in one host memfd, which is mapped MAP_SHARED
+// so it survives fork() and execve() just like a real mount would. it
+// begins with a superblock, the inode table, and a bitmap of the pages
+// in use; the rest is divided into pages which hold file contents, the
+// entries of directories, and the indirect blocks of large files. the
+// mmap() of a file maps its pages of the memfd into the guest, so that
+// no data needs to be copied, and guest writes land right in the file.
+
+#define TMPFS_ROOT     1   // inode number of the root directory
+#define TMPFS_DIRECT   12  // pages referenced directly by each inode
+#define TMPFS_LOCKBITS 41  // each inode gets 2**41 bytes of host locks
+
+struct TmpfsSuper {
+  pthread_mutex_t_ lock;
+  u32 nodes;      // size of the inode table
+  u32 highnode;   // inodes past this one were never used
+  u32 freenode;   // first inode on the free list
+  u32 metapages;  // pages holding the superblock, inodes and bitmap
+  u32 datapages;  // pages that may be allocated to files
+  u32 freepages;  // how many of the data pages are available
+  u32 hint;       // where in the bitmap to look for a free page
+};
+
+struct TmpfsNode {
+  u32 mode;  // zero if the inode is free
+  u32 nlink;
+  u32 uid;
+  u32 gid;
+  u32 gen;              // bumped when freed, so stale lookups notice
+  _Atomic(u32) opens;   // open file descriptions across all processes
+  u32 parent;           // containing directory, for directories
+  u32 next;             // next inode on the free list
+  u32 slots;            // directory entry slots, in use or not
+  u32 blocks;           // pages allocated, including indirect ones
+  u32 mapped;           // nonzero if mmap()'d since it was last closed
+  u64 size;             // bytes, or number of entries for directories
+  u64 kept;             // end of pages kept past size, since mapped
+  struct timespec atim;
+  struct timespec mtim;
+  struct timespec ctim;
+  u32 direct[TMPFS_DIRECT];
+  u32 indirect;   // page of page numbers
+  u32 dindirect;  // page of pages of page numbers
+};
+
+struct TmpfsDirent {
+  u32 node;  // zero if the slot is free
+  u32 namelen;
+  char name[VFS_NAME_MAX];
+};
+
+struct TmpfsDevice {
+  struct TmpfsSuper *sb;
+  struct TmpfsNode *nodes;
+  u64 *bitmap;
+  u8 *base;
+  size_t size;
+  size_t pagesize;
+  u32 perpage;    // page numbers that fit in an indirect page
+  u32 perdirent;  // directory entries that fit in a page
+  int fd;
+  char *source;
+};
+
+// open file description, which dup() shares
+struct TmpfsFile {
+  struct Dll elem;
+  struct TmpfsDevice *fs;
+  pthread_mutex_t_ lock;
+  _Atomic(u32) refs;
+  u32 node;
+  int oflags;
+  off_t pos;
+};
+
+struct TmpfsInfo {
+  struct TmpfsDevice *fs;
+  struct TmpfsFile *file;  // null unless opened
+  u32 node;
+  u32 gen;
+};
+
+// open file descriptions belonging to this process, which is needed
+// to count them again in the child after fork(), and drop them when
+// we exit, so files that were unlinked while open can be reclaimed
+static struct TmpfsFiles {
+  pthread_once_t_ once;
+  pthread_mutex_t_ lock;
+  struct Dll *list GUARDED_BY(lock);
+} g_tmpfs_files = {
+    PTHREAD_ONCE_INIT_,
+    PTHREAD_MUTEX_INITIALIZER_,
+};
+
+#define TMPFS_FILE_CONTAINER(e) DLL_CONTAINER(struct TmpfsFile, elem, (e))
+
+static void TmpfsLockFiles(void) {
+  LOCK(&g_tmpfs_files.lock);
+}
+
+static void TmpfsUnlockFiles(void) {
+  UNLOCK(&g_tmpfs_files.lock);
+}
+
+static void TmpfsAfterForkChild(void) {
+  struct Dll *e;
+  struct TmpfsFile *f;
+  for (e = dll_first(g_tmpfs_files.list); e;
+       e = dll_next(g_tmpfs_files.list, e)) {
+    f = TMPFS_FILE_CONTAINER(e);
+    atomic_fetch_add(&f->fs->nodes[f->node].opens, 1);
+  }
+  TmpfsUnlockFiles();
+}
+
+static void TmpfsInitFiles(void) {
+  unassert(!pthread_atfork(TmpfsLockFiles,    //
+                           TmpfsUnlockFiles,  //
+                           TmpfsAfterForkChild));
+}
+
+static void TmpfsInitLock(pthread_mutex_t_ *lock) {
+#ifdef HAVE_PTHREAD_PROCESS_SHARED
+  pthread_mutexattr_t_ attr;
+  unassert(!pthread_mutexattr_init(&attr));
+  unassert(!pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED));
+  unassert(!pthread_mutex_init(lock, &attr));
+  unassert(!pthread_mutexattr_destroy(&attr));
+#else
+  unassert(!pthread_mutex_init(lock, 0));
+#endif
+}
+
+static mode_t TmpfsUmask(void) {
+  return g_machine ? GetUmask(g_machine->system) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static u8 *TmpfsPage(struct TmpfsDevice *fs, u32 page) {
+  return fs->base + (size_t)page * fs->pagesize;
+}
+
+static u32 TmpfsAllocPage(struct TmpfsDevice *fs, struct TmpfsNode *n) {
+  u64 w;
+  u32 i, j, words;
+  if (!fs->sb->freepages) {
+    enospc();
+    return 0;
+  }
+  words = ROUNDUP(fs->sb->datapages, 64) / 64;
+  for (j = 0, i = fs->sb->hint; j <= words; ++j, i = (i + 1) % words) {
+    if ((w = ~fs->bitmap[i])) {
+      i = i * 64 + __builtin_ctzll(w);
+      if (i >= fs->sb->datapages) continue;
+      fs->bitmap[i / 64] |= (u64)1 << (i % 64);
+      fs->sb->hint = i / 64;
+      --fs->sb->freepages;
+      ++n->blocks;
+      i += fs->sb->metapages;
+      memset(TmpfsPage(fs, i), 0, fs->pagesize);
+      return i;
+    }
+  }
+  enospc();
+  return 0;
+}
+
+static void TmpfsFreePage(struct TmpfsDevice *fs, struct TmpfsNode *n,
+                          u32 page) {
+  u32 i = page - fs->sb->metapages;
+  unassert(page >= fs->sb->metapages);
+  unassert(fs->bitmap[i / 64] & (u64)1 << (i % 64));
+  fs->bitmap[i / 64] &= ~((u64)1 << (i % 64));
+  ++fs->sb->freepages;
+  --n->blocks;
+#ifdef MADV_REMOVE
+  // give the memory back to the host
+  madvise(TmpfsPage(fs, page), fs->pagesize, MADV_REMOVE);
+#endif
+}
+
+// returns where the page number of block `b` of `n` is kept, creating
+// any indirect pages needed along the way when `alloc` is true. returns
+// null if the block doesn't exist, or if `alloc` and it couldn't be made
+static u32 *TmpfsBlockSlot(struct TmpfsDevice *fs, struct TmpfsNode *n, u64 b,
+                           bool alloc) {
+  u32 *p, r = fs->perpage;
+  if (b < TMPFS_DIRECT) return n->direct + b;
+  if ((b -= TMPFS_DIRECT) < r) {
+    if (!n->indirect && (!alloc || !(n->indirect = TmpfsAllocPage(fs, n)))) {
+      return 0;
+    }
+    return (u32 *)TmpfsPage(fs, n->indirect) + b;
+  }
+  if ((b -= r) < (u64)r * r) {
+    if (!n->dindirect && (!alloc || !(n->dindirect = TmpfsAllocPage(fs, n)))) {
+      return 0;
+    }
+    p = (u32 *)TmpfsPage(fs, n->dindirect) + b / r;
+    if (!*p && (!alloc || !(*p = TmpfsAllocPage(fs, n)))) {
+      return 0;
+    }
+    return (u32 *)TmpfsPage(fs, *p) + b % r;
+  }
+  if (alloc) efbig();
+  return 0;
+}
+
+// returns page holding block `b` of `n`, or zero if it's a hole. when
+// `alloc` is true, holes are filled, and zero means we're out of space
+static u32 TmpfsGetBlock(struct TmpfsDevice *fs, struct TmpfsNode *n, u64 b,
+                         bool alloc) {
+  u32 *p;
+  if (!(p = TmpfsBlockSlot(fs, n, b, alloc))) return 0;
+  if (!*p && alloc) *p = TmpfsAllocPage(fs, n);
+  return *p;
+}
+
+static u64 TmpfsMaxBlocks(struct TmpfsDevice *fs) {
+  return TMPFS_DIRECT + fs->perpage + (u64)fs->perpage * fs->perpage;
+}
+
+// frees every block of `n` from `keep` onwards
+static void TmpfsTruncateBlocks(struct TmpfsDevice *fs, struct TmpfsNode *n,
+                                u64 keep) {
+  u64 b, i, j, first;
+  u32 *p, *q, r = fs->perpage;
+  for (b = keep; b < TMPFS_DIRECT; ++b) {
+    if (n->direct[b]) {
+      TmpfsFreePage(fs, n, n->direct[b]);
+      n->direct[b] = 0;
+    }
+  }
+  if (n->indirect) {
+    p = (u32 *)TmpfsPage(fs, n->indirect);
+    for (i = keep > TMPFS_DIRECT ? keep - TMPFS_DIRECT : 0; i < r; ++i) {
+      if (p[i]) {
+        TmpfsFreePage(fs, n, p[i]);
+        p[i] = 0;
+      }
+    }
+    if (keep <= TMPFS_DIRECT) {
+      TmpfsFreePage(fs, n, n->indirect);
+      n->indirect = 0;
+    }
+  }
+  if (n->dindirect) {
+    p = (u32 *)TmpfsPage(fs, n->dindirect);
+    for (i = 0; i < r; ++i) {
+      first = TMPFS_DIRECT + r + i * r;
+      if (!p[i] || first + r <= keep) continue;
+      q = (u32 *)TmpfsPage(fs, p[i]);
+      for (j = keep > first ? keep - first : 0; j < r; ++j) {
+        if (q[j]) {
+          TmpfsFreePage(fs, n, q[j]);
+          q[j] = 0;
+        }
+      }
+      if (keep <= first) {
+        TmpfsFreePage(fs, n, p[i]);
+        p[i] = 0;
+      }
+    }
+    if (keep <= TMPFS_DIRECT + r) {
+      TmpfsFreePage(fs, n, n->dindirect);
+      n->dindirect = 0;
+    }
+  }
+}
+
+// zeroes bytes [lo,hi) of `n` where it has pages, punching holes in
+// the memfd for whole pages, so every mapping of them sees the zeroes
+static void TmpfsZeroRange(struct TmpfsDevice *fs, struct TmpfsNode *n, u64 lo,
+                           u64 hi) {
+  u32 page;
+  size_t skew, chunk;
+  for (; lo < hi; lo += chunk) {
+    skew = lo % fs->pagesize;
+    chunk = MIN(fs->pagesize - skew, hi - lo);
+    if (!(page = TmpfsGetBlock(fs, n, lo / fs->pagesize, false))) continue;
+#ifdef MADV_REMOVE
+    if (chunk == fs->pagesize &&
+        !madvise(TmpfsPage(fs, page), chunk, MADV_REMOVE)) {
+      continue;
+    }
+#endif
+    memset(TmpfsPage(fs, page) + skew, 0, chunk);
+  }
+}
+
+// gives back the pages of `n` past its end, which it kept while mapped
+static void TmpfsTrimBlocks(struct TmpfsDevice *fs, struct TmpfsNode *n) {
+  u64 end = ROUNDUP(n->size, fs->pagesize);
+  TmpfsZeroRange(fs, n, n->size, end);
+  TmpfsTruncateBlocks(fs, n, end / fs->pagesize);
+  n->mapped = 0;
+  n->kept = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static u32 TmpfsIndex(struct TmpfsDevice *fs, struct TmpfsNode *n) {
+  return n - fs->nodes;
+}
+
+// returns inode referenced by `info`, or null if it has been removed
+static struct TmpfsNode *TmpfsGetNode(struct VfsInfo *info) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsNode *n = ti->fs->nodes + ti->node;
+  if (!n->mode || n->gen != ti->gen) {
+    enoent();
+    return 0;
+  }
+  return n;
+}
+
+static u32 TmpfsAllocNode(struct TmpfsDevice *fs) {
+  u32 x;
+  if ((x = fs->sb->freenode)) {
+    fs->sb->freenode = fs->nodes[x].next;
+  } else if (fs->sb->highnode + 1 < fs->sb->nodes) {
+    x = ++fs->sb->highnode;
+  } else {
+    enospc();
+    return 0;
+  }
+  return x;
+}
+
+// frees inode once it's neither linked nor open. mappings hold their
+// file open, so once it's closed, pages it kept for them are recycled
+static void TmpfsMaybeFreeNode(struct TmpfsDevice *fs, struct TmpfsNode *n) {
+  if (atomic_load_explicit(&n->opens, memory_order_relaxed)) return;
+  if (n->nlink) {
+    if (n->mapped) TmpfsTrimBlocks(fs, n);
+    return;
+  }
+  TmpfsTruncateBlocks(fs, n, 0);
+  unassert(!n->blocks);
+  n->mode = 0;
+  n->mapped = 0;
+  n->size = 0;
+  n->kept = 0;
+  n->slots = 0;
+  ++n->gen;
+  n->next = fs->sb->freenode;
+  fs->sb->freenode = TmpfsIndex(fs, n);
+}
+
+static int TmpfsCheckAccess(struct TmpfsNode *n, int mode) {
+  return VfsCheckAccess(n->mode, n->uid, n->gid, mode);
+}
+
+static bool TmpfsIsOwner(struct TmpfsNode *n) {
+  uid_t uid = geteuid();
+  return !uid || uid == n->uid;
+}
+
+// checks if the entry for `n` in `dir` may be removed or replaced
+static int TmpfsCheckDelete(struct TmpfsNode *dir, struct TmpfsNode *n) {
+  uid_t uid;
+  if (TmpfsCheckAccess(dir, W_OK | X_OK) == -1) return -1;
+  if ((dir->mode & S_ISVTX) && (uid = geteuid()) && uid != n->uid &&
+      uid != dir->uid) {
+    return eperm();
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static ssize_t TmpfsReadNode(struct TmpfsDevice *fs, struct TmpfsNode *n,
+                             void *buf, size_t len, u64 off) {
+  u32 page;
+  size_t i, chunk, skew;
+  if (off >= n->size) return 0;
+  len = MIN(len, n->size - off);
+  for (i = 0; i < len; i += chunk) {
+    skew = (off + i) % fs->pagesize;
+    chunk = MIN(fs->pagesize - skew, len - i);
+    if ((page = TmpfsGetBlock(fs, n, (off + i) / fs->pagesize, false))) {
+      memcpy((u8 *)buf + i, TmpfsPage(fs, page) + skew, chunk);
+    } else {
+      memset((u8 *)buf + i, 0, chunk);
+    }
+  }
+  return len;
+}
+
+// prepares to grow `n` to `size`. when it's mapped, bytes past its end
+// may have been written through the mapping, or kept when it shrunk
+static void TmpfsExtend(struct TmpfsDevice *fs, struct TmpfsNode *n,
+                        u64 size) {
+  if (!n->mapped || size <= n->size) return;
+  TmpfsZeroRange(fs, n, n->size,
+                 MIN(size, MAX(n->kept, ROUNDUP(n->size, fs->pagesize))));
+  if (size >= n->kept) n->kept = 0;
+}
+
+static ssize_t TmpfsWriteNode(struct TmpfsDevice *fs, struct TmpfsNode *n,
+                              const void *buf, size_t len, u64 off) {
+  u32 page;
+  size_t i, chunk, skew;
+  if (off >= TmpfsMaxBlocks(fs) * fs->pagesize) return efbig();
+  len = MIN(len, TmpfsMaxBlocks(fs) * fs->pagesize - off);
+  TmpfsExtend(fs, n, off + len);
+  for (i = 0; i < len; i += chunk) {
+    skew = (off + i) % fs->pagesize;
+    chunk = MIN(fs->pagesize - skew, len - i);
+    if (!(page = TmpfsGetBlock(fs, n, (off + i) / fs->pagesize, true))) {
+      if (!i) return -1;
+      break;
+    }
+    memcpy(TmpfsPage(fs, page) + skew, (const u8 *)buf + i, chunk);
+  }
+  if (off + i > n->size) n->size = off + i;
+  if (i) n->mtim = n->ctim = GetTime();
+  return i;
+}
+
+static int TmpfsResize(struct TmpfsDevice *fs, struct TmpfsNode *n, u64 size) {
+  u64 end;
+  if (size > TmpfsMaxBlocks(fs) * fs->pagesize) return efbig();
+  if (size < n->size && n->mapped) {
+    // a mapping may still reach these pages, so they can't be given to
+    // another file until this one is closed. they're zeroed meanwhile
+    end = ROUNDUP(n->size, fs->pagesize);
+    TmpfsZeroRange(fs, n, size, end);
+    n->kept = MAX(n->kept, end);
+  } else if (size < n->size) {
+    // zero the tail of the last page, so extending again reads zeroes
+    end = ROUNDUP(size, fs->pagesize);
+    TmpfsZeroRange(fs, n, size, end);
+    TmpfsTruncateBlocks(fs, n, end / fs->pagesize);
+  } else {
+    TmpfsExtend(fs, n, size);
+  }
+  n->size = size;
+  n->mtim = n->ctim = GetTime();
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct TmpfsDirent *TmpfsGetDirent(struct TmpfsDevice *fs,
+                                          struct TmpfsNode *dir, u32 slot,
+                                          bool alloc) {
+  u32 page;
+  if (!(page = TmpfsGetBlock(fs, dir, slot / fs->perdirent, alloc))) return 0;
+  return (struct TmpfsDirent *)TmpfsPage(fs, page) + slot % fs->perdirent;
+}
+
+// returns inode of `name` in `dir`, or zero if it doesn't exist
+static u32 TmpfsLookup(struct TmpfsDevice *fs, struct TmpfsNode *dir,
+                       const char *name, u32 *out_slot) {
+  u32 slot;
+  size_t len;
+  struct TmpfsDirent *d;
+  len = strlen(name);
+  for (slot = 0; slot < dir->slots; ++slot) {
+    if ((d = TmpfsGetDirent(fs, dir, slot, false)) && d->node &&
+        d->namelen == len && !memcmp(d->name, name, len)) {
+      if (out_slot) *out_slot = slot;
+      return d->node;
+    }
+  }
+  return 0;
+}
+
+static int TmpfsAddEntry(struct TmpfsDevice *fs, struct TmpfsNode *dir,
+                         const char *name, u32 node) {
+  u32 slot;
+  size_t len;
+  struct TmpfsDirent *d = 0;
+  if ((len = strlen(name)) >= VFS_NAME_MAX) return enametoolong();
+  for (slot = 0; slot < dir->slots; ++slot) {
+    if (!(d = TmpfsGetDirent(fs, dir, slot, false)) || !d->node) break;
+  }
+  if (!d || d->node) {
+    if (!(d = TmpfsGetDirent(fs, dir, slot, true))) return -1;
+  }
+  if (slot == dir->slots) ++dir->slots;
+  d->node = node;
+  d->namelen = len;
+  memcpy(d->name, name, len + 1);
+  ++dir->size;
+  dir->mtim = dir->ctim = GetTime();
+  return 0;
+}
+
+static void TmpfsRemoveEntry(struct TmpfsDevice *fs, struct TmpfsNode *dir,
+                             u32 slot) {
+  struct TmpfsDirent *d;
+  unassert(d = TmpfsGetDirent(fs, dir, slot, false));
+  d->node = 0;
+  --dir->size;
+  while (dir->slots && (!(d = TmpfsGetDirent(fs, dir, dir->slots - 1, false)) ||
+                        !d->node)) {
+    --dir->slots;
+  }
+  TmpfsTruncateBlocks(
+      fs, dir, ROUNDUP(dir->slots, fs->perdirent) / fs->perdirent);
+  dir->mtim = dir->ctim = GetTime();
+}
+
+// creates inode named `name` in `dir`, returning zero w/ errno on error
+static u32 TmpfsCreate(struct TmpfsDevice *fs, struct TmpfsNode *dir,
+                       const char *name, u32 mode) {
+  u32 x;
+  struct TmpfsNode *n;
+  if (!dir->nlink) return enoent(), 0;
+  if (strlen(name) >= VFS_NAME_MAX) return enametoolong(), 0;
+  if (TmpfsCheckAccess(dir, W_OK | X_OK) == -1) return 0;
+  if (!(x = TmpfsAllocNode(fs))) return 0;
+  n = fs->nodes + x;
+  n->mode = mode;
+  n->nlink = S_ISDIR(mode) ? 2 : 1;
+  n->uid = geteuid();
+  n->gid = (dir->mode & S_ISGID) ? dir->gid : getegid();
+  if (S_ISDIR(mode) && (dir->mode & S_ISGID)) n->mode |= S_ISGID;
+  n->parent = TmpfsIndex(fs, dir);
+  n->slots = 0;
+  n->size = 0;
+  n->atim = n->mtim = n->ctim = GetTime();
+  if (TmpfsAddEntry(fs, dir, name, x) == -1) {
+    n->nlink = 0;
+    TmpfsMaybeFreeNode(fs, n);
+    return 0;
+  }
+  if (S_ISDIR(mode)) ++dir->nlink;
+  return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsParseSize(const char *s, u64 *out) {
+  char *end;
+  u64 x = strtoull(s, &end, 10);
+  switch (*end) {
+    case 'k':
+    case 'K':
+      x <<= 10, ++end;
+      break;
+    case 'm':
+    case 'M':
+      x <<= 20, ++end;
+      break;
+    case 'g':
+    case 'G':
+      x <<= 30, ++end;
+      break;
+    default:
+      break;
+  }
+  if (end == s || *end) return einval();
+  *out = x;
+  return 0;
+}
+
+// parses linux tmpfs mount options, e.g. "size=64m,nr_inodes=1k"
+static int TmpfsParseOptions(const char *data, u64 *size, u64 *nodes,
+                             u32 *mode, u32 *uid, u32 *gid) {
+  u64 x;
+  int rc = 0;
+  char *opts, *opt, *tok;
+  if (!data || !*data) return 0;
+  if (!(opts = strdup(data))) return enomem();
+  for (opt = strtok_r(opts, ",", &tok); opt && rc != -1;
+       opt = strtok_r(0, ",", &tok)) {
+    if (!strncmp(opt, "size=", 5)) {
+      rc = TmpfsParseSize(opt + 5, size);
+    } else if (!strncmp(opt, "nr_inodes=", 10)) {
+      rc = TmpfsParseSize(opt + 10, nodes);
+    } else if (!strncmp(opt, "mode=", 5)) {
+      *mode = strtoul(opt + 5, 0, 8) & 07777;
+    } else if (!strncmp(opt, "uid=", 4) && !TmpfsParseSize(opt + 4, &x)) {
+      *uid = x;
+    } else if (!strncmp(opt, "gid=", 4) && !TmpfsParseSize(opt + 4, &x)) {
+      *gid = x;
+    } else {
+      LOGF("ignoring tmpfs mount option: %s", opt);
+    }
+  }
+  free(opts);
+  if (rc == -1) LOGF("bad tmpfs mount options: %s", data);
+  return rc;
+}
+
+static int TmpfsCreateInfo(struct VfsDevice *device, struct VfsInfo *parent,
+                           const char *name, u32 node,
+                           struct VfsInfo **output) {
+  struct TmpfsInfo *ti;
+  struct TmpfsDevice *fs = (struct TmpfsDevice *)device->data;
+  *output = NULL;
+  if (!(ti = (struct TmpfsInfo *)malloc(sizeof(*ti)))) return enomem();
+  ti->fs = fs;
+  ti->file = NULL;
+  ti->node = node;
+  ti->gen = fs->nodes[node].gen;
+  if (VfsCreateInfo(output) == -1) {
+    free(ti);
+    return -1;
+  }
+  (*output)->data = ti;
+  (*output)->ino = node;
+  (*output)->mode = fs->nodes[node].mode;
+  unassert(!VfsAcquireDevice(device, &(*output)->device));
+  if (parent) {
+    (*output)->dev = parent->dev;
+    unassert(!VfsAcquireInfo(parent, &(*output)->parent));
+  }
+  if (name) {
+    if (!((*output)->name = strdup(name))) {
+      unassert(!VfsFreeInfo(*output));
+      *output = NULL;
+      return enomem();
+    }
+    (*output)->namelen = strlen(name);
+  }
+  return 0;
+}
+
+static int TmpfsInit(const char *source, u64 flags, const void *data,
+                     struct VfsDevice **device, struct VfsMount **mount) {
+  struct TmpfsDevice *fs;
+  struct TmpfsNode *root;
+  u64 size, nodes, datapages, metabytes, total;
+  u32 mode = 01777, uid = geteuid(), gid = getegid();
+  size = kTmpfsSize;
+  nodes = kTmpfsNodes;
+  *device = NULL;
+  *mount = NULL;
+  if (TmpfsParseOptions((const char *)data, &size, &nodes, &mode, &uid, &gid) ==
+      -1) {
+    return -1;
+  }
+  if (!(fs = (struct TmpfsDevice *)calloc(1, sizeof(*fs)))) {
+    return enomem();
+  }
+  fs->fd = -1;
+  fs->pagesize = sysconf(_SC_PAGESIZE);
+  fs->perpage = fs->pagesize / sizeof(u32);
+  fs->perdirent = fs->pagesize / sizeof(struct TmpfsDirent);
+  nodes = MAX(MIN(nodes, UINT32_MAX / 2), 2);
+  datapages = MIN(MAX(size / fs->pagesize, 1), UINT32_MAX / 2);
+  metabytes = ROUNDUP(sizeof(struct TmpfsSuper), 64) +
+              nodes * sizeof(struct TmpfsNode) + ROUNDUP(datapages, 64) / 8;
+  total = ROUNDUP(metabytes, fs->pagesize) + datapages * fs->pagesize;
+  if (total > SIZE_MAX / 2) {
+    einval();
+    goto cleananddie;
+  }
+  if (!(fs->source = strdup(source && *source ? source : "tmpfs"))) {
+    enomem();
+    goto cleananddie;
+  }
+  // the file is sparse, so memory is only used once pages are touched
+  if ((fs->fd = CreateMemfd("tmpfs", false, true)) == -1 ||
+      ftruncate(fs->fd, total) == -1) {
+    goto cleananddie;
+  }
+  if ((fs->base = (u8 *)mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             fs->fd, 0)) == MAP_FAILED) {
+    fs->base = 0;
+    goto cleananddie;
+  }
+  fs->size = total;
+  fs->sb = (struct TmpfsSuper *)fs->base;
+  fs->nodes = (struct TmpfsNode *)(fs->base +
+                                   ROUNDUP(sizeof(struct TmpfsSuper), 64));
+  fs->bitmap = (u64 *)(fs->nodes + nodes);
+  TmpfsInitLock(&fs->sb->lock);
+  fs->sb->nodes = nodes;
+  fs->sb->highnode = TMPFS_ROOT;
+  fs->sb->metapages = ROUNDUP(metabytes, fs->pagesize) / fs->pagesize;
+  fs->sb->datapages = datapages;
+  fs->sb->freepages = datapages;
+  root = fs->nodes + TMPFS_ROOT;
+  root->mode = S_IFDIR | mode;
+  root->nlink = 2;
+  root->uid = uid;
+  root->gid = gid;
+  root->parent = TMPFS_ROOT;
+  root->atim = root->mtim = root->ctim = GetTime();
+  unassert(!pthread_once_(&g_tmpfs_files.once, TmpfsInitFiles));
+  if (VfsCreateDevice(device) == -1) {
+    goto cleananddie;
+  }
+  (*device)->data = fs;
+  (*device)->ops = &g_tmpfs.ops;
+  if (!(*mount = (struct VfsMount *)malloc(sizeof(struct VfsMount)))) {
+    enomem();
+    goto cleananddie;
+  }
+  if (TmpfsCreateInfo(*device, NULL, NULL, TMPFS_ROOT, &(*mount)->root) ==
+      -1) {
+    goto cleananddie;
+  }
+  // Weak reference.
+  (*device)->root = (*mount)->root;
+  VFS_LOGF("Mounted a tmpfs device of %zu bytes", fs->size);
+  return 0;
+cleananddie:
+  free(*mount);
+  *mount = NULL;
+  if (*device) {
+    unassert(!VfsFreeDevice(*device));
+    *device = NULL;
+  } else {
+    if (fs->base) munmap(fs->base, fs->size);
+    if (fs->fd != -1) close(fs->fd);
+    free(fs->source);
+    free(fs);
+  }
+  return -1;
+}
+
+static int TmpfsFreeDevice(void *data) {
+  struct TmpfsDevice *fs = (struct TmpfsDevice *)data;
+  if (fs) {
+    if (fs->base) munmap(fs->base, fs->size);
+    if (fs->fd != -1) close(fs->fd);
+    free(fs->source);
+    free(fs);
+  }
+  return 0;
+}
+
+static void TmpfsReleaseFile(struct TmpfsFile *f) {
+  struct TmpfsDevice *fs = f->fs;
+  if (atomic_fetch_sub(&f->refs, 1) != 1) return;
+  LOCK(&g_tmpfs_files.lock);
+  dll_remove(&g_tmpfs_files.list, &f->elem);
+  UNLOCK(&g_tmpfs_files.lock);
+  LOCK(&fs->sb->lock);
+  atomic_fetch_sub(&fs->nodes[f->node].opens, 1);
+  TmpfsMaybeFreeNode(fs, fs->nodes + f->node);
+  UNLOCK(&fs->sb->lock);
+  unassert(!pthread_mutex_destroy(&f->lock));
+  free(f);
+}
+
+static int TmpfsFreeInfo(void *data) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)data;
+  if (ti) {
+    if (ti->file) TmpfsReleaseFile(ti->file);
+    free(ti);
+  }
+  return 0;
+}
+
+/**
+ * Drops the open files of this process, since it's about to exit.
+ */
+void TmpfsExit(void) {
+  struct Dll *e;
+  struct TmpfsFile *f;
+  LOCK(&g_tmpfs_files.lock);
+  while ((e = dll_first(g_tmpfs_files.list))) {
+    f = TMPFS_FILE_CONTAINER(e);
+    dll_remove(&g_tmpfs_files.list, e);
+    LOCK(&f->fs->sb->lock);
+    atomic_fetch_sub(&f->fs->nodes[f->node].opens, 1);
+    TmpfsMaybeFreeNode(f->fs, f->fs->nodes + f->node);
+    UNLOCK(&f->fs->sb->lock);
+  }
+  UNLOCK(&g_tmpfs_files.lock);
+}
+
+static int TmpfsReadmountentry(struct VfsDevice *device, char **spec,
+                               char **type, char **mntops) {
+  struct TmpfsDevice *fs = (struct TmpfsDevice *)device->data;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "size=%lluk,nr_inodes=%u",
+           (unsigned long long)fs->sb->datapages * fs->pagesize / 1024,
+           fs->sb->nodes);
+  *spec = strdup(fs->source);
+  *type = strdup("tmpfs");
+  *mntops = strdup(buf);
+  if (!*spec || !*type || !*mntops) {
+    free(*spec);
+    free(*type);
+    free(*mntops);
+    return enomem();
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// looks up `name` in `parent`, which must be locked
+static struct TmpfsNode *TmpfsFind(struct VfsInfo *parent, const char *name,
+                                   u32 *out_slot) {
+  u32 x;
+  bool slashed;
+  struct TmpfsNode *dir;
+  char leaf[VFS_NAME_MAX];
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  if (!(dir = TmpfsGetNode(parent))) return 0;
+  slashed = VfsTrimName(name, leaf);
+  if (!strcmp(leaf, ".") || !strcmp(leaf, "/")) return dir;
+  if (!S_ISDIR(dir->mode)) return enotdir(), (struct TmpfsNode *)0;
+  if (TmpfsCheckAccess(dir, X_OK) == -1) return 0;
+  if (!(x = TmpfsLookup(fs, dir, leaf, out_slot))) return enoent(), (void *)0;
+  if (slashed && !S_ISDIR(fs->nodes[x].mode)) return enotdir(), (void *)0;
+  return fs->nodes + x;
+}
+
+static int TmpfsFinddir(struct VfsInfo *parent, const char *name,
+                        struct VfsInfo **output) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  u32 x = 0;
+  VFS_LOGF("TmpfsFinddir(%p, \"%s\", %p)", parent, name, output);
+  if (!strcmp(name, ".")) {
+    unassert(!VfsAcquireInfo(parent, output));
+    return 0;
+  }
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) x = TmpfsIndex(fs, n);
+  UNLOCK(&fs->sb->lock);
+  if (!x) return -1;
+  return TmpfsCreateInfo(parent->device, parent, name, x, output);
+}
+
+static ssize_t TmpfsReadlink(struct VfsInfo *info, char **output) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  struct TmpfsNode *n;
+  ssize_t rc;
+  *output = NULL;
+  LOCK(&fs->sb->lock);
+  if (!(n = TmpfsGetNode(info))) {
+    rc = -1;
+  } else if (!S_ISLNK(n->mode)) {
+    rc = einval();
+  } else if (!(*output = (char *)malloc(n->size + 1))) {
+    rc = enomem();
+  } else {
+    rc = TmpfsReadNode(fs, n, *output, n->size, 0);
+    (*output)[rc] = 0;
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsMkdir(struct VfsInfo *parent, const char *name, mode_t mode) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *dir;
+  char leaf[VFS_NAME_MAX];
+  int rc = -1;
+  VFS_LOGF("TmpfsMkdir(%p, \"%s\", %o)", parent, name, mode);
+  VfsTrimName(name, leaf);
+  name = leaf;
+  mode = S_IFDIR | (mode & 07777 & ~TmpfsUmask());
+  LOCK(&fs->sb->lock);
+  if ((dir = TmpfsFind(parent, ".", 0))) {
+    if (!S_ISDIR(dir->mode)) {
+      enotdir();
+    } else if (!strcmp(name, ".") || TmpfsLookup(fs, dir, name, 0)) {
+      eexist();
+    } else if (TmpfsCreate(fs, dir, name, mode)) {
+      rc = 0;
+    }
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsOpen(struct VfsInfo *parent, const char *name, int flags,
+                     int mode, struct VfsInfo **output) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *dir, *n = 0;
+  struct TmpfsFile *f;
+  char leaf[VFS_NAME_MAX];
+  bool slashed, created = false;
+  int acc = flags & O_ACCMODE;
+  u32 x = 0;
+  VFS_LOGF("TmpfsOpen(%p, \"%s\", %d, %o)", parent, name, flags, mode);
+  *output = NULL;
+  slashed = VfsTrimName(name, leaf);
+  name = leaf;
+  if (!(f = (struct TmpfsFile *)calloc(1, sizeof(*f)))) return enomem();
+  if (flags & O_CREAT) mode = S_IFREG | (mode & 07777 & ~TmpfsUmask());
+  LOCK(&fs->sb->lock);
+  if (!(dir = TmpfsFind(parent, ".", 0))) {
+    // parent was removed
+  } else if (!strcmp(name, ".") || !strcmp(name, "/")) {
+    n = dir;
+    if (flags & O_CREAT) n = 0, eisdir();
+  } else if (!S_ISDIR(dir->mode)) {
+    enotdir();
+  } else if (TmpfsCheckAccess(dir, X_OK) == -1) {
+    // can't search parent
+  } else if ((x = TmpfsLookup(fs, dir, name, 0))) {
+    n = fs->nodes + x;
+    if ((flags & O_CREAT) && (flags & O_EXCL)) n = 0, eexist();
+  } else if (!(flags & O_CREAT)) {
+    enoent();
+  } else if (slashed) {
+    eisdir();
+  } else if ((x = TmpfsCreate(fs, dir, name, mode))) {
+    n = fs->nodes + x;
+    created = true;
+  }
+  if (n) {
+    if (slashed && !S_ISDIR(n->mode)) {
+      n = 0, enotdir();
+    } else if (S_ISLNK(n->mode)) {
+      n = 0, eloop();
+    } else if (S_ISDIR(n->mode) && (acc != O_RDONLY || (flags & O_CREAT))) {
+      n = 0, eisdir();
+    } else if ((flags & O_DIRECTORY) && !S_ISDIR(n->mode)) {
+      n = 0, enotdir();
+    } else if (!created &&
+               ((acc != O_WRONLY && TmpfsCheckAccess(n, R_OK) == -1) ||
+                (acc != O_RDONLY && TmpfsCheckAccess(n, W_OK) == -1))) {
+      n = 0;
+    } else if ((flags & O_TRUNC) && acc != O_RDONLY && S_ISREG(n->mode) &&
+               n->size) {
+      TmpfsResize(fs, n, 0);
+    }
+  }
+  if (n) {
+    x = TmpfsIndex(fs, n);
+    atomic_fetch_add(&n->opens, 1);
+  }
+  UNLOCK(&fs->sb->lock);
+  if (!n) {
+    free(f);
+    return -1;
+  }
+  f->fs = fs;
+  f->node = x;
+  f->refs = 1;
+  f->oflags = flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+  unassert(!pthread_mutex_init(&f->lock, 0));
+  dll_init(&f->elem);
+  LOCK(&g_tmpfs_files.lock);
+  dll_make_last(&g_tmpfs_files.list, &f->elem);
+  UNLOCK(&g_tmpfs_files.lock);
+  if (x == ((struct TmpfsInfo *)parent->data)->node) {
+    // opening the directory itself, e.g. the mount root
+    if (VfsCreateInfo(output) != -1) {
+      if (!((*output)->data = malloc(sizeof(struct TmpfsInfo)))) {
+        unassert(!VfsFreeInfo(*output));
+        *output = NULL;
+        enomem();
+      } else {
+        memcpy((*output)->data, parent->data, sizeof(struct TmpfsInfo));
+        (*output)->ino = parent->ino;
+        (*output)->dev = parent->dev;
+        (*output)->mode = parent->mode;
+        unassert(!VfsAcquireDevice(parent->device, &(*output)->device));
+        unassert(!VfsAcquireInfo(parent->parent, &(*output)->parent));
+        if (parent->name && !((*output)->name = strdup(parent->name))) {
+          unassert(!VfsFreeInfo(*output));
+          *output = NULL;
+          enomem();
+        } else {
+          (*output)->namelen = parent->namelen;
+        }
+      }
+    }
+  } else {
+    TmpfsCreateInfo(parent->device, parent, name, x, output);
+  }
+  if (!*output) {
+    TmpfsReleaseFile(f);
+    return -1;
+  }
+  ((struct TmpfsInfo *)(*output)->data)->file = f;
+  return 0;
+}
+
+static int TmpfsAccess(struct VfsInfo *parent, const char *name, mode_t mode,
+                       int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) {
+    rc = mode == F_OK ? 0 : TmpfsCheckAccess(n, mode);
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static void TmpfsStatNode(struct VfsInfo *info, struct TmpfsNode *n,
+                          struct stat *st) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  memset(st, 0, sizeof(*st));
+  st->st_dev = info->device->dev;
+  st->st_ino = TmpfsIndex(fs, n);
+  st->st_mode = n->mode;
+  st->st_nlink = n->nlink;
+  st->st_uid = n->uid;
+  st->st_gid = n->gid;
+  st->st_rdev = 0;
+  // linux reports 20 bytes per directory entry, counting . and ..
+  st->st_size = S_ISDIR(n->mode) ? (n->size + 2) * 20 : n->size;
+  st->st_blksize = fs->pagesize;
+  st->st_blocks = (u64)n->blocks * (fs->pagesize / 512);
+  st->st_atim = n->atim;
+  st->st_mtim = n->mtim;
+  st->st_ctim = n->ctim;
+}
+
+static int TmpfsStat(struct VfsInfo *parent, const char *name, struct stat *st,
+                     int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) TmpfsStatNode(parent, n, st);
+  UNLOCK(&fs->sb->lock);
+  return n ? 0 : -1;
+}
+
+static int TmpfsFstat(struct VfsInfo *info, struct stat *st) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  struct TmpfsNode *n;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) TmpfsStatNode(info, n, st);
+  UNLOCK(&fs->sb->lock);
+  return n ? 0 : -1;
+}
+
+static int TmpfsChmodNode(struct TmpfsNode *n, mode_t mode) {
+  if (!TmpfsIsOwner(n)) return eperm();
+  n->mode = (n->mode & S_IFMT) | (mode & 07777);
+  n->ctim = GetTime();
+  return 0;
+}
+
+static int TmpfsChmod(struct VfsInfo *parent, const char *name, mode_t mode,
+                      int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) rc = TmpfsChmodNode(n, mode);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsFchmod(struct VfsInfo *info, mode_t mode) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) rc = TmpfsChmodNode(n, mode);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsChownNode(struct TmpfsNode *n, uid_t uid, gid_t gid) {
+  if (geteuid() &&
+      (!TmpfsIsOwner(n) || (uid != (uid_t)-1 && uid != n->uid))) {
+    return eperm();
+  }
+  if (uid != (uid_t)-1) n->uid = uid;
+  if (gid != (gid_t)-1) n->gid = gid;
+  if (S_ISREG(n->mode)) n->mode &= ~(S_ISUID | S_ISGID);
+  n->ctim = GetTime();
+  return 0;
+}
+
+static int TmpfsChown(struct VfsInfo *parent, const char *name, uid_t uid,
+                      gid_t gid, int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) rc = TmpfsChownNode(n, uid, gid);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsFchown(struct VfsInfo *info, uid_t uid, gid_t gid) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) rc = TmpfsChownNode(n, uid, gid);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsFtruncate(struct VfsInfo *info, off_t length) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsNode *n;
+  int rc = -1;
+  if (!ti->file || (ti->file->oflags & O_ACCMODE) == O_RDONLY) {
+    return einval();
+  }
+  if (length < 0) return einval();
+  LOCK(&ti->fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) {
+    if (!S_ISREG(n->mode)) {
+      einval();
+    } else {
+      rc = TmpfsResize(ti->fs, n, length);
+    }
+  }
+  UNLOCK(&ti->fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsClose(struct VfsInfo *info) {
+  // the open file is released once the last reference goes away
+  return 0;
+}
+
+static int TmpfsLink(struct VfsInfo *olddir, const char *oldname,
+                     struct VfsInfo *newdir, const char *newname, int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)olddir->data)->fs;
+  struct TmpfsNode *n, *dir;
+  char leaf[VFS_NAME_MAX];
+  bool slashed;
+  int rc = -1;
+  slashed = VfsTrimName(newname, leaf);
+  newname = leaf;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(olddir, oldname, 0)) &&
+      (dir = TmpfsFind(newdir, ".", 0))) {
+    if (S_ISDIR(n->mode)) {
+      eperm();
+    } else if (!S_ISDIR(dir->mode)) {
+      enotdir();
+    } else if (!dir->nlink) {
+      enoent();
+    } else if (!strcmp(newname, ".") || TmpfsLookup(fs, dir, newname, 0)) {
+      eexist();
+    } else if (slashed) {
+      enotdir();
+    } else if (TmpfsCheckAccess(dir, W_OK | X_OK) != -1 &&
+               TmpfsAddEntry(fs, dir, newname, TmpfsIndex(fs, n)) != -1) {
+      ++n->nlink;
+      n->ctim = GetTime();
+      rc = 0;
+    }
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsUnlink(struct VfsInfo *parent, const char *name, int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n, *dir;
+  int rc = -1;
+  u32 slot;
+  VFS_LOGF("TmpfsUnlink(%p, \"%s\", %d)", parent, name, flags);
+  if (!strcmp(name, ".") || !strcmp(name, "/")) {
+    return (flags & AT_REMOVEDIR) ? einval() : eisdir();
+  }
+  LOCK(&fs->sb->lock);
+  if ((dir = TmpfsFind(parent, ".", 0)) && (n = TmpfsFind(parent, name, &slot))) {
+    if ((flags & AT_REMOVEDIR) && !S_ISDIR(n->mode)) {
+      enotdir();
+    } else if (!(flags & AT_REMOVEDIR) && S_ISDIR(n->mode)) {
+      eisdir();
+    } else if (S_ISDIR(n->mode) && n->size) {
+      enotempty();
+    } else if (TmpfsCheckDelete(dir, n) != -1) {
+      TmpfsRemoveEntry(fs, dir, slot);
+      if (S_ISDIR(n->mode)) {
+        n->nlink = 0;
+        --dir->nlink;
+      } else {
+        --n->nlink;
+      }
+      n->ctim = GetTime();
+      TmpfsMaybeFreeNode(fs, n);
+      rc = 0;
+    }
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsRename(struct VfsInfo *olddir, const char *oldname,
+                       struct VfsInfo *newdir, const char *newname) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)olddir->data)->fs;
+  struct TmpfsNode *od, *nd, *n, *m, *p;
+  u32 oslot, nslot, x;
+  struct TmpfsDirent *d;
+  char leaf[VFS_NAME_MAX];
+  bool slashed;
+  int rc = -1;
+  slashed = VfsTrimName(newname, leaf);
+  newname = leaf;
+  VFS_LOGF("TmpfsRename(%p, \"%s\", %p, \"%s\")", olddir, oldname, newdir,
+           newname);
+  if (olddir->device != newdir->device) return exdev();
+  if (!strcmp(oldname, ".") || !strcmp(newname, ".")) return einval();
+  LOCK(&fs->sb->lock);
+  if (!(od = TmpfsFind(olddir, ".", 0)) || !(nd = TmpfsFind(newdir, ".", 0)) ||
+      !(n = TmpfsFind(olddir, oldname, &oslot))) {
+    goto done;
+  }
+  if (!S_ISDIR(nd->mode)) {
+    enotdir();
+    goto done;
+  }
+  if (!nd->nlink) {
+    enoent();
+    goto done;
+  }
+  if (TmpfsCheckDelete(od, n) == -1 ||
+      TmpfsCheckAccess(nd, W_OK | X_OK) == -1) {
+    goto done;
+  }
+  if (slashed && !S_ISDIR(n->mode)) {
+    enotdir();
+    goto done;
+  }
+  x = TmpfsIndex(fs, n);
+  if ((m = fs->nodes + TmpfsLookup(fs, nd, newname, &nslot)) == fs->nodes) {
+    m = 0;
+  }
+  if (m == n) {
+    rc = 0;
+    goto done;
+  }
+  if (S_ISDIR(n->mode)) {
+    // a directory can't be moved beneath itself
+    for (p = nd;; p = fs->nodes + p->parent) {
+      if (p == n) {
+        einval();
+        goto done;
+      }
+      if (TmpfsIndex(fs, p) == TMPFS_ROOT) break;
+    }
+  }
+  if (m) {
+    if (S_ISDIR(n->mode) && !S_ISDIR(m->mode)) {
+      enotdir();
+      goto done;
+    }
+    if (!S_ISDIR(n->mode) && S_ISDIR(m->mode)) {
+      eisdir();
+      goto done;
+    }
+    if (S_ISDIR(m->mode) && m->size) {
+      enotempty();
+      goto done;
+    }
+    if (TmpfsCheckDelete(nd, m) == -1) {
+      goto done;
+    }
+    unassert(d = TmpfsGetDirent(fs, nd, nslot, false));
+    d->node = x;
+    nd->mtim = nd->ctim = GetTime();
+    if (S_ISDIR(m->mode)) {
+      m->nlink = 0;
+      --nd->nlink;
+    } else {
+      --m->nlink;
+    }
+    m->ctim = GetTime();
+  } else if (TmpfsAddEntry(fs, nd, newname, x) == -1) {
+    goto done;
+  }
+  TmpfsRemoveEntry(fs, od, oslot);
+  if (S_ISDIR(n->mode) && od != nd) {
+    --od->nlink;
+    ++nd->nlink;
+    n->parent = TmpfsIndex(fs, nd);
+  }
+  n->ctim = GetTime();
+  if (m) TmpfsMaybeFreeNode(fs, m);
+  rc = 0;
+done:
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsSymlink(const char *target, struct VfsInfo *parent,
+                        const char *name) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *dir, *n;
+  char leaf[VFS_NAME_MAX];
+  bool slashed;
+  size_t len;
+  int rc = -1;
+  u32 x, slot;
+  if ((len = strlen(target)) >= VFS_PATH_MAX) return enametoolong();
+  slashed = VfsTrimName(name, leaf);
+  name = leaf;
+  LOCK(&fs->sb->lock);
+  if ((dir = TmpfsFind(parent, ".", 0))) {
+    if (!S_ISDIR(dir->mode)) {
+      enotdir();
+    } else if (!strcmp(name, ".") || TmpfsLookup(fs, dir, name, 0)) {
+      eexist();
+    } else if (slashed) {
+      enoent();
+    } else if ((x = TmpfsCreate(fs, dir, name, S_IFLNK | 0777))) {
+      n = fs->nodes + x;
+      if (TmpfsWriteNode(fs, n, target, len, 0) == len) {
+        rc = 0;
+      } else {
+        unassert(TmpfsLookup(fs, dir, name, &slot) == x);
+        TmpfsRemoveEntry(fs, dir, slot);
+        n->nlink = 0;
+        TmpfsMaybeFreeNode(fs, n);
+      }
+    }
+  }
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// reads or writes the open file `info`, at its position if `off` is -1
+static ssize_t TmpfsTransfer(struct VfsInfo *info, const struct iovec *iov,
+                             int iovcnt, off_t off, bool write) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsFile *f = ti->file;
+  struct TmpfsNode *n;
+  ssize_t rc, total;
+  size_t len;
+  off_t pos;
+  int i;
+  if (!f) return ebadf();
+  if ((f->oflags & O_ACCMODE) == (write ? O_RDONLY : O_WRONLY)) return ebadf();
+  if (S_ISDIR(info->mode)) return eisdir();
+  for (len = i = 0; i < iovcnt; ++i) {
+    if ((len += iov[i].iov_len) > SSIZE_MAX) return einval();
+  }
+  if (off == -1) LOCK(&f->lock);
+  LOCK(&ti->fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) {
+    pos = off == -1 ? f->pos : off;
+    if (write && (f->oflags & O_APPEND)) pos = n->size;
+    for (total = i = 0; i < iovcnt; ++i) {
+      if (write) {
+        rc = TmpfsWriteNode(ti->fs, n, iov[i].iov_base, iov[i].iov_len, pos);
+      } else {
+        rc = TmpfsReadNode(ti->fs, n, iov[i].iov_base, iov[i].iov_len, pos);
+      }
+      if (rc == -1) {
+        if (!total) total = -1;
+        break;
+      }
+      total += rc;
+      pos += rc;
+      if (rc < iov[i].iov_len) break;
+    }
+    if (off == -1 && total != -1) f->pos = pos;
+  } else {
+    total = -1;
+  }
+  UNLOCK(&ti->fs->sb->lock);
+  if (off == -1) UNLOCK(&f->lock);
+  return total;
+}
+
+static ssize_t TmpfsRead(struct VfsInfo *info, void *buf, size_t len) {
+  struct iovec iov = {buf, len};
+  return TmpfsTransfer(info, &iov, 1, -1, false);
+}
+
+static ssize_t TmpfsWrite(struct VfsInfo *info, const void *buf, size_t len) {
+  struct iovec iov = {(void *)buf, len};
+  return TmpfsTransfer(info, &iov, 1, -1, true);
+}
+
+static ssize_t TmpfsPread(struct VfsInfo *info, void *buf, size_t len,
+                          off_t off) {
+  struct iovec iov = {buf, len};
+  if (off < 0) return einval();
+  return TmpfsTransfer(info, &iov, 1, off, false);
+}
+
+static ssize_t TmpfsPwrite(struct VfsInfo *info, const void *buf, size_t len,
+                           off_t off) {
+  struct iovec iov = {(void *)buf, len};
+  if (off < 0) return einval();
+  return TmpfsTransfer(info, &iov, 1, off, true);
+}
+
+static ssize_t TmpfsReadv(struct VfsInfo *info, const struct iovec *iov,
+                          int iovcnt) {
+  return TmpfsTransfer(info, iov, iovcnt, -1, false);
+}
+
+static ssize_t TmpfsWritev(struct VfsInfo *info, const struct iovec *iov,
+                           int iovcnt) {
+  return TmpfsTransfer(info, iov, iovcnt, -1, true);
+}
+
+static ssize_t TmpfsPreadv(struct VfsInfo *info, const struct iovec *iov,
+                           int iovcnt, off_t off) {
+  if (off < 0) return einval();
+  return TmpfsTransfer(info, iov, iovcnt, off, false);
+}
+
+static ssize_t TmpfsPwritev(struct VfsInfo *info, const struct iovec *iov,
+                            int iovcnt, off_t off) {
+  if (off < 0) return einval();
+  return TmpfsTransfer(info, iov, iovcnt, off, true);
+}
+
+static off_t TmpfsSeek(struct VfsInfo *info, off_t off, int whence) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsFile *f = ti->file;
+  struct TmpfsNode *n;
+  off_t pos = -1;
+  if (!f) return ebadf();
+  LOCK(&f->lock);
+  switch (whence) {
+    case SEEK_SET:
+      pos = off;
+      break;
+    case SEEK_CUR:
+      pos = f->pos + off;
+      break;
+    case SEEK_END:
+      LOCK(&ti->fs->sb->lock);
+      if ((n = TmpfsGetNode(info))) pos = S_ISDIR(n->mode) ? -1 : n->size + off;
+      UNLOCK(&ti->fs->sb->lock);
+      break;
+    default:
+      break;
+  }
+  if (pos < 0) {
+    pos = einval();
+  } else {
+    f->pos = pos;
+  }
+  UNLOCK(&f->lock);
+  return pos;
+}
+
+static int TmpfsFsync(struct VfsInfo *info) {
+  return 0;
+}
+
+// file locks are host locks on a range of the memfd set aside for each
+// inode, so the host kernel arbitrates them between blink processes.
+// flock() is emulated with a posix lock on a byte past that range, so
+// it's released on exit like flock() but owned by the process instead
+// of the open file description.
+static int TmpfsHostLock(struct VfsInfo *info, int cmd, struct flock *lk) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsNode *n;
+  off_t base, start, limit;
+  int rc;
+  base = (off_t)ti->node << TMPFS_LOCKBITS;
+  limit = (off_t)1 << (TMPFS_LOCKBITS - 1);
+  start = lk->l_start;
+  if (lk->l_whence == SEEK_CUR) {
+    start += ti->file ? ti->file->pos : 0;
+  } else if (lk->l_whence == SEEK_END) {
+    LOCK(&ti->fs->sb->lock);
+    if ((n = TmpfsGetNode(info))) start += n->size;
+    UNLOCK(&ti->fs->sb->lock);
+  }
+  if (start < 0 || start >= limit || lk->l_len < 0 ||
+      lk->l_len > limit - start) {
+    return einval();
+  }
+  lk->l_whence = SEEK_SET;
+  lk->l_start = base + start;
+  if (!lk->l_len) lk->l_len = limit - start;
+  if ((rc = fcntl(ti->fs->fd, cmd, lk)) != -1 && lk->l_type != F_UNLCK) {
+    lk->l_start -= base;
+    if (lk->l_start + lk->l_len >= limit) lk->l_len = 0;
+  }
+  return rc;
+}
+
+static int TmpfsFlock(struct VfsInfo *info, int op) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct flock lk;
+  memset(&lk, 0, sizeof(lk));
+  lk.l_whence = SEEK_SET;
+  lk.l_start = ((off_t)ti->node << TMPFS_LOCKBITS) +
+               ((off_t)1 << (TMPFS_LOCKBITS - 1));
+  lk.l_len = 1;
+  switch (op & ~LOCK_NB) {
+    case LOCK_SH:
+      lk.l_type = F_RDLCK;
+      break;
+    case LOCK_EX:
+      lk.l_type = F_WRLCK;
+      break;
+    case LOCK_UN:
+      lk.l_type = F_UNLCK;
+      break;
+    default:
+      return einval();
+  }
+  if (fcntl(ti->fs->fd, (op & LOCK_NB) ? F_SETLK : F_SETLKW, &lk) == -1) {
+    if (errno == EACCES) errno = EWOULDBLOCK;
+    return -1;
+  }
+  return 0;
+}
+
+static int TmpfsFcntl(struct VfsInfo *info, int cmd, va_list args) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsFile *f = ti->file;
+  int rc;
+  if (!f) return ebadf();
+  if (cmd == F_GETFD) {
+    rc = 0;
+  } else if (cmd == F_SETFD) {
+    rc = 0;
+  } else if (cmd == F_GETFL) {
+    rc = f->oflags;
+  } else if (cmd == F_SETFL) {
+    LOCK(&f->lock);
+    f->oflags = (f->oflags & ~(O_APPEND | O_NONBLOCK)) |
+                (va_arg(args, int) & (O_APPEND | O_NONBLOCK));
+    UNLOCK(&f->lock);
+    rc = 0;
+  } else if (cmd == F_SETLK || cmd == F_SETLKW || cmd == F_GETLK) {
+    rc = TmpfsHostLock(info, cmd, va_arg(args, struct flock *));
+  } else {
+    rc = einval();
+  }
+  return rc;
+}
+
+static int TmpfsDup(struct VfsInfo *info, struct VfsInfo **newinfo) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data, *nti;
+  *newinfo = NULL;
+  if (!(nti = (struct TmpfsInfo *)malloc(sizeof(*nti)))) return enomem();
+  if (VfsCreateInfo(newinfo) == -1) {
+    free(nti);
+    return -1;
+  }
+  *nti = *ti;
+  if (nti->file) atomic_fetch_add(&nti->file->refs, 1);
+  (*newinfo)->data = nti;
+  (*newinfo)->ino = info->ino;
+  (*newinfo)->dev = info->dev;
+  (*newinfo)->mode = info->mode;
+  unassert(!VfsAcquireDevice(info->device, &(*newinfo)->device));
+  unassert(!VfsAcquireInfo(info->parent, &(*newinfo)->parent));
+  if (info->name) {
+    if (!((*newinfo)->name = strdup(info->name))) {
+      unassert(!VfsFreeInfo(*newinfo));
+      *newinfo = NULL;
+      return enomem();
+    }
+    (*newinfo)->namelen = info->namelen;
+  }
+  return 0;
+}
+
+#ifdef HAVE_DUP3
+static int TmpfsDup3(struct VfsInfo *info, struct VfsInfo **newinfo, int flags) {
+  // O_CLOEXEC is already handled by the syscall layer.
+  return TmpfsDup(info, newinfo);
+}
+#endif
+
+static int TmpfsPoll(struct VfsInfo **infos, struct pollfd *fds, nfds_t nfds,
+                     int timeout) {
+  nfds_t i;
+  int rc = 0;
+  // regular files never block
+  for (i = 0; i < nfds; ++i) {
+    fds[i].revents = fds[i].events & (POLLIN | POLLOUT);
+    rc += !!fds[i].revents;
+  }
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsOpendir(struct VfsInfo *info, struct VfsInfo **output) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  if (!S_ISDIR(info->mode) || !ti->file) return enotdir();
+  unassert(!VfsAcquireInfo(info, output));
+  return 0;
+}
+
+#ifdef HAVE_SEEKDIR
+static void TmpfsSeekdir(struct VfsInfo *info, long offset) {
+  struct TmpfsFile *f = ((struct TmpfsInfo *)info->data)->file;
+  LOCK(&f->lock);
+  f->pos = offset;
+  UNLOCK(&f->lock);
+}
+
+static long TmpfsTelldir(struct VfsInfo *info) {
+  struct TmpfsFile *f = ((struct TmpfsInfo *)info->data)->file;
+  long pos;
+  LOCK(&f->lock);
+  pos = f->pos;
+  UNLOCK(&f->lock);
+  return pos;
+}
+#endif
+
+static struct dirent *TmpfsReaddir(struct VfsInfo *info) {
+  static _Thread_local char buf[sizeof(struct dirent) + VFS_NAME_MAX];
+  struct dirent *de = (struct dirent *)buf;
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsFile *f = ti->file;
+  struct TmpfsDirent *d;
+  struct TmpfsNode *dir, *n = 0;
+  u32 x = 0;
+  LOCK(&f->lock);
+  LOCK(&ti->fs->sb->lock);
+  if ((dir = TmpfsGetNode(info))) {
+    for (;; ++f->pos) {
+      if (f->pos == 0) {
+        x = ti->node;
+        strcpy(de->d_name, ".");
+      } else if (f->pos == 1) {
+        x = ti->node == TMPFS_ROOT && info->parent ? info->parent->ino
+                                                   : dir->parent;
+        strcpy(de->d_name, "..");
+      } else if (f->pos - 2 >= dir->slots) {
+        break;
+      } else if ((d = TmpfsGetDirent(ti->fs, dir, f->pos - 2, false)) &&
+                 d->node) {
+        x = d->node;
+        memcpy(de->d_name, d->name, d->namelen + 1);
+      } else {
+        continue;
+      }
+      n = f->pos < 2 ? dir : ti->fs->nodes + x;
+      ++f->pos;
+      break;
+    }
+  }
+  if (n) {
+    de->d_ino = x;
+#ifdef DT_UNKNOWN
+    if (S_ISDIR(n->mode)) {
+      de->d_type = DT_DIR;
+    } else if (S_ISREG(n->mode)) {
+      de->d_type = DT_REG;
+    } else if (S_ISLNK(n->mode)) {
+      de->d_type = DT_LNK;
+    } else {
+      de->d_type = DT_UNKNOWN;
+    }
+#endif
+  }
+  UNLOCK(&ti->fs->sb->lock);
+  UNLOCK(&f->lock);
+  return n ? de : NULL;
+}
+
+static void TmpfsRewinddir(struct VfsInfo *info) {
+  struct TmpfsFile *f = ((struct TmpfsInfo *)info->data)->file;
+  LOCK(&f->lock);
+  f->pos = 0;
+  UNLOCK(&f->lock);
+}
+
+static int TmpfsClosedir(struct VfsInfo *info) {
+  unassert(!VfsFreeInfo(info));
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void TmpfsSetTime(struct timespec *t, const struct timespec *ts,
+                         struct timespec now) {
+  if (!ts || ts->tv_nsec == UTIME_NOW) {
+    *t = now;
+  } else if (ts->tv_nsec != UTIME_OMIT) {
+    *t = *ts;
+  }
+}
+
+static int TmpfsUtimeNode(struct TmpfsNode *n, const struct timespec times[2]) {
+  struct timespec now = GetTime();
+  if (!TmpfsIsOwner(n)) {
+    // anyone who may write to the file can touch it
+    if ((times && (times[0].tv_nsec != UTIME_NOW ||
+                   times[1].tv_nsec != UTIME_NOW)) ||
+        TmpfsCheckAccess(n, W_OK) == -1) {
+      return eperm();
+    }
+  }
+  TmpfsSetTime(&n->atim, times ? times : 0, now);
+  TmpfsSetTime(&n->mtim, times ? times + 1 : 0, now);
+  n->ctim = now;
+  return 0;
+}
+
+static int TmpfsUtime(struct VfsInfo *parent, const char *name,
+                      const struct timespec times[2], int flags) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)parent->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsFind(parent, name, 0))) rc = TmpfsUtimeNode(n, times);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+static int TmpfsFutime(struct VfsInfo *info, const struct timespec times[2]) {
+  struct TmpfsDevice *fs = ((struct TmpfsInfo *)info->data)->fs;
+  struct TmpfsNode *n;
+  int rc = -1;
+  LOCK(&fs->sb->lock);
+  if ((n = TmpfsGetNode(info))) rc = TmpfsUtimeNode(n, times);
+  UNLOCK(&fs->sb->lock);
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// maps pages of the file straight from the memfd, coalescing the runs
+// of pages that are contiguous in it. holes are filled first, so later
+// writes to the file are seen through the mapping. if the file shrinks
+// while mapped, its pages past the end are zeroed but stay with it till
+// it's closed, so on linux touching them would raise SIGBUS, whereas
+// here they read zero, and what's written to them is lost
+static void *TmpfsMmap(struct VfsInfo *info, void *addr, size_t len, int prot,
+                       int flags, off_t offset) {
+  struct TmpfsInfo *ti = (struct TmpfsInfo *)info->data;
+  struct TmpfsDevice *fs = ti->fs;
+  struct TmpfsNode *n;
+  u64 i, j, b, pages, fileblocks;
+  u32 first, page;
+  int type, acc;
+  u8 *p;
+  VFS_LOGF("TmpfsMmap(%p, %p, %zu, %d, %d, %ld)", info, addr, len, prot,
+           flags, (long)offset);
+  if (!ti->file) return ebadf(), MAP_FAILED;
+  if (!S_ISREG(info->mode)) return enodev(), MAP_FAILED;
+  if (offset < 0 || offset % fs->pagesize) return einval(), MAP_FAILED;
+  acc = ti->file->oflags & O_ACCMODE;
+  type = (flags & MAP_SHARED) ? MAP_SHARED : MAP_PRIVATE;
+  if (acc == O_WRONLY ||
+      (type == MAP_SHARED && (prot & PROT_WRITE) && acc != O_RDWR)) {
+    return eacces(), MAP_FAILED;
+  }
+  if ((p = (u8 *)mmap(addr, len, prot,
+                      (flags & ~(MAP_SHARED | MAP_PRIVATE)) | MAP_PRIVATE |
+                          MAP_ANONYMOUS,
+                      -1, 0)) == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  pages = ROUNDUP(len, fs->pagesize) / fs->pagesize;
+  b = offset / fs->pagesize;
+  LOCK(&fs->sb->lock);
+  if (!(n = TmpfsGetNode(info))) goto cleananddie;
+  n->mapped = 1;
+  fileblocks = ROUNDUP(n->size, fs->pagesize) / fs->pagesize;
+  for (i = 0; i < pages && b + i < fileblocks; i = j) {
+    if (!(first = TmpfsGetBlock(fs, n, b + i, true))) goto cleananddie;
+    for (j = i + 1; j < pages && b + j < fileblocks; ++j) {
+      if (!(page = TmpfsGetBlock(fs, n, b + j, true)) ||
+          page != first + (j - i)) {
+        break;
+      }
+    }
+    if (mmap(p + i * fs->pagesize, (j - i) * fs->pagesize, prot,
+             type | MAP_FIXED, fs->fd,
+             (off_t)first * fs->pagesize) == MAP_FAILED) {
+      goto cleananddie;
+    }
+  }
+  UNLOCK(&fs->sb->lock);
+  return p;
+cleananddie:
+  UNLOCK(&fs->sb->lock);
+  munmap(p, len);
+  return MAP_FAILED;
+}
+
+static int TmpfsMunmap(struct VfsInfo *info, void *addr, size_t len) {
+  // Do nothing. The host should handle all the cleanup.
+  return 0;
+}
+
+static int TmpfsMprotect(struct VfsInfo *info, void *addr, size_t len,
+                         int prot) {
+  // Do nothing, as the host should handle the protection details.
+  return 0;
+}
+
+static int TmpfsMsync(struct VfsInfo *info, void *addr, size_t len,
+                      int flags) {
+  // Do nothing, the mapping is the file.
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct VfsSystem g_tmpfs = {.name = "tmpfs",
+                            .nodev = true,
+                            .dcache = true,
+                            .ops = {
+                                .Init = TmpfsInit,
+                                .Freeinfo = TmpfsFreeInfo,
+                                .Freedevice = TmpfsFreeDevice,
+                                .Readmountentry = TmpfsReadmountentry,
+                                .Finddir = TmpfsFinddir,
+                                .Readlink = TmpfsReadlink,
+                                .Mkdir = TmpfsMkdir,
+                                .Mkfifo = NULL,
+                                .Open = TmpfsOpen,
+                                .Access = TmpfsAccess,
+                                .Stat = TmpfsStat,
+                                .Fstat = TmpfsFstat,
+                                .Chmod = TmpfsChmod,
+                                .Fchmod = TmpfsFchmod,
+                                .Chown = TmpfsChown,
+                                .Fchown = TmpfsFchown,
+                                .Ftruncate = TmpfsFtruncate,
+                                .Close = TmpfsClose,
+                                .Link = TmpfsLink,
+                                .Unlink = TmpfsUnlink,
+                                .Read = TmpfsRead,
+                                .Write = TmpfsWrite,
+                                .Pread = TmpfsPread,
+                                .Pwrite = TmpfsPwrite,
+                                .Readv = TmpfsReadv,
+                                .Writev = TmpfsWritev,
+                                .Preadv = TmpfsPreadv,
+                                .Pwritev = TmpfsPwritev,
+                                .Seek = TmpfsSeek,
+                                .Fsync = TmpfsFsync,
+                                .Fdatasync = TmpfsFsync,
+                                .Flock = TmpfsFlock,
+                                .Fcntl = TmpfsFcntl,
+                                .Ioctl = NULL,
+                                .Dup = TmpfsDup,
+#ifdef HAVE_DUP3
+                                .Dup3 = TmpfsDup3,
+#endif
+                                .Poll = TmpfsPoll,
+                                .Opendir = TmpfsOpendir,
+#ifdef HAVE_SEEKDIR
+                                .Seekdir = TmpfsSeekdir,
+                                .Telldir = TmpfsTelldir,
+#endif
+                                .Readdir = TmpfsReaddir,
+                                .Rewinddir = TmpfsRewinddir,
+                                .Closedir = TmpfsClosedir,
+                                .Rename = TmpfsRename,
+                                .Utime = TmpfsUtime,
+                                .Futime = TmpfsFutime,
+                                .Symlink = TmpfsSymlink,
+                                .Mmap = TmpfsMmap,
+                                .Munmap = TmpfsMunmap,
+                                .Mprotect = TmpfsMprotect,
+                                .Msync = TmpfsMsync,
+                            }};
+
+#endif /* DISABLE_VFS */
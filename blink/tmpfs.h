@@ -0,0 +1,10 @@
+#ifndef BLINK_TMPFS_H_
+#define BLINK_TMPFS_H_
+
+#include "blink/vfs.h"
+
+extern struct VfsSystem g_tmpfs;
+
+void TmpfsExit(void);
+
+#endif  // BLINK_TMPFS_H_
@@ -38,15 +38,33 @@
 #define kPollingMs    50   // busy loop for futex(), poll(), etc.
 #define kBusCount     256  // # load balanced semaphores in virtual bus
 #define kBusRegion    128  // 16 is sufficient for 8-byte loads/stores
-#define kFutexMax     100
+#define kFutexBuckets 256  // # independently locked futex hash buckets
+#define kMaxSignalfds 16   // # signalfd() descriptors open at once
+#define kMinFdTable   64   // initial # slots in the fd lookup table
+#define kThreadPool   16   // default # idle host threads kept for clone()
+#define kDentryHash   1024 // # hash buckets in vfs path lookup cache
+#define kMaxDentries  8192 // vfs path lookup cache is flushed beyond this
+#define kDentryTtlMs  1000 // how long cached lookups trust the host fs
+#define kOverlayHash  1024 // # hash buckets in overlay layer cache
+#define kOverlayPaths 8192 // overlay layer cache is flushed beyond this
+#define kOverlayTtlMs 1000 // how long overlay cache trusts the host fs
+#define kTmpfsNodes   65536 // default nr_inodes of a tmpfs mount
+#define kTmpfsSize    (UINT64_C(1) * 1024 * 1024 * 1024)  // default tmpfs size
 #define kRedzoneSize  128
 #define kSmcQueueSize 32
+#define kMaxUringSize 4096
+#define kIoUringWorkers 4   // threads doing blocking io_uring file i/o
+#define kPagePinSlots 4    // guest intervals pinned per chunk of slots
+#define kICacheSize   256  // guest code pages in decoded instruction cache
+#define kICacheLines  4096 // 64-byte lines of code the icache may decode
 #define kMaxMapSize   (UINT64_C(8) * 1024 * 1024 * 1024)
 #define kMaxResident  (UINT64_C(8) * 1024 * 1024 * 1024)
 #define kMaxVirtual   (kMaxResident * 8)
 #define kMaxAncillary 1000
 #define kMaxShebang   512
 #define kMaxSigDepth  8
+#define kProfileHz    1000  // guest samples per second of host cpu time
+#define kProfileDepth 64    // guest stack frames kept in each sample
 
 #define kStraceArgMax 256
 #define kStraceBufMax 32
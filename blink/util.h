@@ -36,6 +36,7 @@ char *Commandv(const char *, char *, size_t);
 char *Demangle(char *, const char *, size_t);
 void *Deflate(const void *, unsigned, unsigned *);
 void Inflate(void *, unsigned, const void *, unsigned);
+bool TryInflate(void *, unsigned, const void *, unsigned);
 ssize_t UninterruptibleWrite(int, const void *, size_t);
 long IsProcessTainted(void);
 long Magikarp(u8 *, long);
@@ -0,0 +1,337 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/vdso.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "blink/assert.h"
+#include "blink/elf.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/tunables.h"
+#include "blink/xlat.h"
+
+// blink synthesizes a virtual dynamic shared object for each program,
+// so libc can find it via getauxval(AT_SYSINFO_EHDR) and avoid making
+// system calls for the time. each function in its text is an 0F 0E op
+// (femms on 3dnow chips, which we don't emulate) followed by ret. when
+// we decode this op inside the vdso, it calls the host function below
+// and the jit compiles it into a direct call, bypassing OpSyscall().
+
+#define kVdsoSize        4096
+#define kVdsoText        0x800  // offset of first function
+#define kVdsoTextSection 7      // index of .text in kVdsoSections
+#define kVdsoFuncSize    16     // bytes reserved for each function
+#define kVdsoDynamics    10     // entries in the dynamic section
+#define kVerdefSize      28     // sizeof(Elf64_Verdef) + sizeof(Elf64_Verdaux)
+#define kVdsoVersion     "LINUX_2.6"
+#define kVdsoSoname      "linux-vdso.so.1"
+
+static void VdsoClockGettime(struct Machine *);
+static void VdsoGettimeofday(struct Machine *);
+static void VdsoTime(struct Machine *);
+static void VdsoGetcpu(struct Machine *);
+
+static const struct VdsoFunc {
+  const char *name;
+  const char *alias;
+  void (*func)(struct Machine *);
+} kVdsoFuncs[] = {
+    {"__vdso_clock_gettime", "clock_gettime", VdsoClockGettime},
+    {"__vdso_gettimeofday", "gettimeofday", VdsoGettimeofday},
+    {"__vdso_time", "time", VdsoTime},
+    {"__vdso_getcpu", "getcpu", VdsoGetcpu},
+};
+
+static const char *const kVdsoSections[] = {
+    "",                //
+    ".hash",           //
+    ".dynsym",         //
+    ".dynstr",         //
+    ".gnu.version",    //
+    ".gnu.version_d",  //
+    ".dynamic",        //
+    ".text",           //
+    ".shstrtab",       //
+};
+
+static void PutVdsoResult(struct Machine *m, i64 rc) {
+  MACHINE_STATISTIC(m, vdso_calls);
+  Put64(m->ax, rc != -1 ? rc : -(XlatErrno(errno) & 0xfff));
+}
+
+static void VdsoClockGettime(struct Machine *m) {
+  PutVdsoResult(m, SysClockGettime(m, Get32(m->di), Get64(m->si)));
+}
+
+static void VdsoGettimeofday(struct Machine *m) {
+  PutVdsoResult(m, SysGettimeofday(m, Get64(m->di), Get64(m->si)));
+}
+
+static void VdsoTime(struct Machine *m) {
+  PutVdsoResult(m, SysTime(m, Get64(m->di)));
+}
+
+static void VdsoGetcpu(struct Machine *m) {
+  PutVdsoResult(m, SysGetcpu(m, Get64(m->di), Get64(m->si), Get64(m->dx)));
+}
+
+static u32 ElfHash(const char *s) {
+  u32 h, g;
+  for (h = 0; *s; ++s) {
+    h = (h << 4) + (u8)*s;
+    if ((g = h & 0xf0000000)) h ^= g >> 24;
+    h &= ~g;
+  }
+  return h;
+}
+
+static u32 AddString(u8 *p, u32 *n, const char *s) {
+  u32 i = *n;
+  size_t len = strlen(s) + 1;
+  memcpy(p + i, s, len);
+  *n += len;
+  return i;
+}
+
+static void PutSection(Elf64_Shdr_ *sh, u32 name, u32 type, u64 flags,
+                       u64 off, u64 size, u32 link, u32 info, u64 align,
+                       u64 entsize) {
+  Write32(sh->name, name);
+  Write32(sh->type, type);
+  Write64(sh->flags, flags);
+  Write64(sh->addr, flags ? off : 0);
+  Write64(sh->offset, off);
+  Write64(sh->size, size);
+  Write32(sh->link, link);
+  Write32(sh->info, info);
+  Write64(sh->addralign, align);
+  Write64(sh->entsize, entsize);
+}
+
+static void PutDynamic(Elf64_Dyn_ **d, i64 tag, u64 val) {
+  Write64((*d)->tag, tag);
+  Write64((*d)->val, val);
+  ++*d;
+}
+
+static void AddSymbol(u8 *p, u32 hash, u32 dynsym, u32 versym, u32 nsyms,
+                      u32 n, u32 name, const char *s, int bind, u64 value) {
+  u32 bucket;
+  Elf64_Sym_ *sym;
+  sym = (Elf64_Sym_ *)(p + dynsym) + n;
+  Write32(sym->name, name);
+  sym->info = ELF64_ST_INFO_(bind, STT_FUNC_);
+  sym->other = STV_DEFAULT_;
+  Write16(sym->shndx, kVdsoTextSection);
+  Write64(sym->value, value);
+  Write64(sym->size, 3);
+  Write16(p + versym + n * 2, 2);
+  // push symbol onto the front of its hash chain
+  bucket = hash + 8 + ElfHash(s) % nsyms * 4;
+  Write32(p + hash + 8 + nsyms * 4 + n * 4, Read32(p + bucket));
+  Write32(p + bucket, n);
+}
+
+static void AddVerdef(u8 *p, u32 off, int flags, int ndx, const char *s,
+                      u32 name, u32 next) {
+  Write16(p + off + 0, VER_DEF_CURRENT_);  // vd_version
+  Write16(p + off + 2, flags);             // vd_flags
+  Write16(p + off + 4, ndx);               // vd_ndx
+  Write16(p + off + 6, 1);                 // vd_cnt
+  Write32(p + off + 8, ElfHash(s));        // vd_hash
+  Write32(p + off + 12, 20);               // vd_aux
+  Write32(p + off + 16, next);             // vd_next
+  Write32(p + off + 20, name);             // vda_name
+  Write32(p + off + 24, 0);                // vda_next
+}
+
+// creates an elf shared object linked at address zero, which contains
+// symbols versioned as LINUX_2.6, with the same names that linux uses
+static void BuildVdso(u8 *p) {
+  Elf64_Dyn_ *dyn;
+  Elf64_Ehdr_ *eh;
+  Elf64_Phdr_ *ph;
+  Elf64_Shdr_ *sh;
+  const char *s;
+  u32 i, j, n, nsyms, strsz, shstrsz;
+  u32 hash, dynsym, dynstr, versym, verdef, dynamic, shstr, shoff;
+  u32 soname, version, names[ARRAYLEN(kVdsoSections)];
+  u32 symnames[ARRAYLEN(kVdsoFuncs)][2];
+  memset(p, 0, kVdsoSize);
+  nsyms = 1 + ARRAYLEN(kVdsoFuncs) * 2;
+  hash = sizeof(Elf64_Ehdr_) + sizeof(Elf64_Phdr_) * 2;
+  dynsym = ROUNDUP(hash + (2 + nsyms * 2) * 4, 8);
+  dynstr = dynsym + nsyms * sizeof(Elf64_Sym_);
+  strsz = 1;
+  soname = AddString(p + dynstr, &strsz, kVdsoSoname);
+  version = AddString(p + dynstr, &strsz, kVdsoVersion);
+  for (i = 0; i < ARRAYLEN(kVdsoFuncs); ++i) {
+    symnames[i][0] = AddString(p + dynstr, &strsz, kVdsoFuncs[i].name);
+    symnames[i][1] = AddString(p + dynstr, &strsz, kVdsoFuncs[i].alias);
+  }
+  versym = ROUNDUP(dynstr + strsz, 2);
+  verdef = ROUNDUP(versym + nsyms * 2, 4);
+  dynamic = ROUNDUP(verdef + kVerdefSize * 2, 8);
+  shstr = dynamic + kVdsoDynamics * sizeof(Elf64_Dyn_);
+  shstrsz = 0;
+  for (i = 0; i < ARRAYLEN(kVdsoSections); ++i) {
+    names[i] = AddString(p + shstr, &shstrsz, kVdsoSections[i]);
+  }
+  shoff = ROUNDUP(shstr + shstrsz, 8);
+  unassert(shoff + sizeof(Elf64_Shdr_) * ARRAYLEN(kVdsoSections) <= kVdsoText);
+  unassert(kVdsoText + kVdsoFuncSize * ARRAYLEN(kVdsoFuncs) <= kVdsoSize);
+
+  // elf header
+  eh = (Elf64_Ehdr_ *)p;
+  memcpy(eh->ident, ELFMAG_, SELFMAG_);
+  eh->ident[EI_CLASS_] = ELFCLASS64_;
+  eh->ident[EI_DATA_] = ELFDATA2LSB_;
+  eh->ident[EI_VERSION_] = EV_CURRENT_;
+  eh->ident[EI_OSABI_] = ELFOSABI_NONE_;
+  Write16(eh->type, ET_DYN_);
+  Write16(eh->machine, EM_NEXGEN32E_);
+  Write32(eh->version, EV_CURRENT_);
+  Write64(eh->phoff, sizeof(Elf64_Ehdr_));
+  Write64(eh->shoff, shoff);
+  Write16(eh->ehsize, sizeof(Elf64_Ehdr_));
+  Write16(eh->phentsize, sizeof(Elf64_Phdr_));
+  Write16(eh->phnum, 2);
+  Write16(eh->shentsize, sizeof(Elf64_Shdr_));
+  Write16(eh->shnum, ARRAYLEN(kVdsoSections));
+  Write16(eh->shstrndx, ARRAYLEN(kVdsoSections) - 1);
+
+  // program headers
+  ph = (Elf64_Phdr_ *)(p + sizeof(Elf64_Ehdr_));
+  Write32(ph[0].type, PT_LOAD_);
+  Write32(ph[0].flags, PF_R_ | PF_X_);
+  Write64(ph[0].filesz, kVdsoSize);
+  Write64(ph[0].memsz, kVdsoSize);
+  Write64(ph[0].align, 4096);
+  Write32(ph[1].type, PT_DYNAMIC_);
+  Write32(ph[1].flags, PF_R_);
+  Write64(ph[1].offset, dynamic);
+  Write64(ph[1].vaddr, dynamic);
+  Write64(ph[1].paddr, dynamic);
+  Write64(ph[1].filesz, kVdsoDynamics * sizeof(Elf64_Dyn_));
+  Write64(ph[1].memsz, kVdsoDynamics * sizeof(Elf64_Dyn_));
+  Write64(ph[1].align, 8);
+
+  // functions, symbols, and the symbol hash table
+  Write32(p + hash, nsyms);      // nbucket
+  Write32(p + hash + 4, nsyms);  // nchain
+  for (n = 1, i = 0; i < ARRAYLEN(kVdsoFuncs); ++i) {
+    p[kVdsoText + kVdsoFuncSize * i + 0] = 0x0F;  // vdso call
+    p[kVdsoText + kVdsoFuncSize * i + 1] = 0x0E;
+    p[kVdsoText + kVdsoFuncSize * i + 2] = 0xC3;  // ret
+    memset(p + kVdsoText + kVdsoFuncSize * i + 3, 0xCC, kVdsoFuncSize - 3);
+    for (j = 0; j < 2; ++j, ++n) {
+      s = j ? kVdsoFuncs[i].alias : kVdsoFuncs[i].name;
+      AddSymbol(p, hash, dynsym, versym, nsyms, n, symnames[i][j], s,
+                j ? STB_WEAK_ : STB_GLOBAL_, kVdsoText + kVdsoFuncSize * i);
+    }
+  }
+
+  // version definitions
+  AddVerdef(p, verdef, VER_FLG_BASE_, 1, kVdsoSoname, soname, kVerdefSize);
+  AddVerdef(p, verdef + kVerdefSize, 0, 2, kVdsoVersion, version, 0);
+
+  // dynamic section
+  dyn = (Elf64_Dyn_ *)(p + dynamic);
+  PutDynamic(&dyn, DT_HASH_, hash);
+  PutDynamic(&dyn, DT_SYMTAB_, dynsym);
+  PutDynamic(&dyn, DT_STRTAB_, dynstr);
+  PutDynamic(&dyn, DT_STRSZ_, strsz);
+  PutDynamic(&dyn, DT_SYMENT_, sizeof(Elf64_Sym_));
+  PutDynamic(&dyn, DT_SONAME_, soname);
+  PutDynamic(&dyn, DT_VERSYM_, versym);
+  PutDynamic(&dyn, DT_VERDEF_, verdef);
+  PutDynamic(&dyn, DT_VERDEFNUM_, 2);
+  PutDynamic(&dyn, DT_NULL_, 0);
+  unassert((u8 *)dyn == p + dynamic + kVdsoDynamics * sizeof(Elf64_Dyn_));
+
+  // section headers, so debuggers can make sense of it
+  sh = (Elf64_Shdr_ *)(p + shoff);
+  PutSection(sh + 1, names[1], SHT_HASH_, SHF_ALLOC_, hash,
+             (2 + nsyms * 2) * 4, 2, 0, 8, 4);
+  PutSection(sh + 2, names[2], SHT_DYNSYM_, SHF_ALLOC_, dynsym,
+             nsyms * sizeof(Elf64_Sym_), 3, 1, 8, sizeof(Elf64_Sym_));
+  PutSection(sh + 3, names[3], SHT_STRTAB_, SHF_ALLOC_, dynstr, strsz, 0, 0,
+             1, 0);
+  PutSection(sh + 4, names[4], SHT_GNU_versym_, SHF_ALLOC_, versym,
+             nsyms * 2, 2, 0, 2, 2);
+  PutSection(sh + 5, names[5], SHT_GNU_verdef_, SHF_ALLOC_, verdef,
+             kVerdefSize * 2, 3, 2, 4, 0);
+  PutSection(sh + 6, names[6], SHT_DYNAMIC_, SHF_ALLOC_, dynamic,
+             kVdsoDynamics * sizeof(Elf64_Dyn_), 3, 0, 8,
+             sizeof(Elf64_Dyn_));
+  PutSection(sh + kVdsoTextSection, names[kVdsoTextSection], SHT_PROGBITS_,
+             SHF_ALLOC_ | SHF_EXECINSTR_, kVdsoText,
+             kVdsoFuncSize * ARRAYLEN(kVdsoFuncs), 0, 0, 16, 0);
+  PutSection(sh + 8, names[8], SHT_STRTAB_, 0, shstr, shstrsz, 0, 0, 1, 0);
+}
+
+// maps the vdso into the guest address space, returning its address
+i64 LoadVdso(struct Machine *m) {
+  i64 virt, size;
+  u8 image[kVdsoSize];
+  BuildVdso(image);
+  size = ROUNDUP(kVdsoSize, MAX(4096, FLAG_pagesize));
+  // linux puts the vdso right above the stack
+  virt = HasLinearMapping() && FLAG_vabits <= 47 && !kSkew ? 0 : kStackTop;
+  // it's made executable after being written, since writing to a page
+  // that's executable could trip self-modifying code detection
+  if ((virt = ReserveVirtual(m->system, virt, size,
+                             PAGE_FILE | PAGE_U | PAGE_RW | PAGE_XD, -1, 0, 0,
+                             0)) == -1) {
+    LOGF("failed to reserve vdso memory");
+    return 0;
+  }
+  unassert(!CopyToUser(m, virt, image, kVdsoSize));
+  unassert(!ProtectVirtual(m->system, virt, size, PROT_READ | PROT_EXEC,
+                           false));
+  unassert(AddFileMap(m->system, virt, size, "[vdso]", -1));
+  return virt;
+}
+
+void OpVdso(P) {
+  i64 off, base;
+  const struct VdsoFunc *f;
+  // this op is only meaningful inside the vdso's text
+  base = m->system->elf.at_sysinfo_ehdr;
+  off = (i64)(m->ip - m->oplen) - base - kVdsoText;
+  if (!base || off < 0 || off % kVdsoFuncSize ||
+      off / kVdsoFuncSize >= ARRAYLEN(kVdsoFuncs)) {
+    OpUdImpl(m);
+  }
+  f = kVdsoFuncs + off / kVdsoFuncSize;
+  if (IsMakingPath(m)) {
+    Jitter(A,
+           "q"   // arg0 = machine
+           "c",  // call function
+           f->func);
+  }
+  f->func(m);
+}
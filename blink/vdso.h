@@ -0,0 +1,8 @@
+#ifndef BLINK_VDSO_H_
+#define BLINK_VDSO_H_
+#include "blink/machine.h"
+
+i64 LoadVdso(struct Machine *);
+void OpVdso(P);
+
+#endif /* BLINK_VDSO_H_ */
@@ -20,11 +20,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "blink/assert.h"
 #include "blink/atomic.h"
@@ -34,19 +37,36 @@
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/macros.h"
+#include "blink/packfs.h"
 #include "blink/procfs.h"
+#include "blink/stats.h"
 #include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tmpfs.h"
 #include "blink/tunables.h"
+#include "blink/util.h"
 
 #ifndef DISABLE_VFS
 
 #define VFS_UNREACHABLE        "(unreachable)"
 #define VFS_TRAVERSE_MAX_LINKS 40
 
+// A slot in the descriptor table. Slots are created the first time a
+// descriptor number is used and then live forever, so VfsGetFd() can
+// look at one without locks. It announces itself using `refs` so that
+// whoever replaces `data` knows when it's safe to drop the reference.
 struct VfsFd {
-  struct Dll elem;
-  struct VfsInfo *data;
-  int fd;
+  _Atomic(struct VfsInfo *) data;
+  _Atomic(int) refs;  // # VfsGetFd() calls in the middle of reading data
+};
+
+// Emulated descriptors are indexed by number. The table is modified
+// while holding Vfs::lock. When it grows, the old table is retired as
+// opposed to freed, since readers may still be looking at it.
+struct VfsFdTable {
+  int size;
+  struct VfsFdTable *retired;
+  _Atomic(struct VfsFd *) p[];
 };
 
 struct VfsMap {
@@ -59,7 +79,28 @@ struct VfsMap {
   int flags;
 };
 
-#define VFS_FD_CONTAINER(e)  DLL_CONTAINER(struct VfsFd, elem, (e))
+// Remembers what Finddir() said about a name in a directory, so that
+// repeated path resolution doesn't have to ask the host. A null info
+// means the name didn't exist, which is what most include path probes
+// discover. Entries hold a reference to their parent, and are keyed by
+// its identity; the hash uses (dev, ino, name) so invalidation doesn't
+// need the same VfsInfo object that was used for the lookup.
+struct VfsDentry {
+  struct VfsDentry *next;
+  struct VfsInfo *parent;
+  struct VfsInfo *info;
+  struct timespec expires;
+  u64 hash;
+  size_t namelen;
+  char name[];
+};
+
+struct VfsDentries {
+  pthread_mutex_t_ lock;
+  int count GUARDED_BY(lock);
+  struct VfsDentry *hash[kDentryHash] GUARDED_BY(lock);
+};
+
 #define VFS_MAP_CONTAINER(e) DLL_CONTAINER(struct VfsMap, elem, (e))
 
 static struct VfsDevice g_rootdevice = {
@@ -93,17 +134,55 @@ struct Vfs g_vfs = {
     .mapslock = PTHREAD_MUTEX_INITIALIZER_,
 };
 
+static struct VfsDentries g_dentries = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void VfsLockDentries(void) {
+  LOCK(&g_dentries.lock);
+}
+
+static void VfsUnlockDentries(void) {
+  UNLOCK(&g_dentries.lock);
+}
+
+static void VfsResetFds(void);
+static void VfsAfterForkChild(void) {
+  VfsUnlockDentries();
+  VfsResetFds();
+}
+
+// creates a directory on which a filesystem will be mounted, returning
+// 0 if it can't be, because the root is a read-only image lacking it
+static int VfsMakeMountpoint(const char *path) {
+  if (VfsMkdir(AT_FDCWD, path, 0755) != -1 || errno == EEXIST) return 1;
+  if (errno == EROFS) {
+    LOGF("Not mounting %s since it's missing from the read-only root", path);
+    return 0;
+  }
+  ERRF("Failed to create %s, %s", path, strerror(errno));
+  return -1;
+}
+
 int VfsInit(const char *prefix) {
   struct stat st;
+  bool image = false;
+  int rc, hostroot;
   char *cwd, hostcwd[PATH_MAX], *bprefix = NULL;
   struct VfsInfo *info;
   size_t hostcwdlen, prefixlen;
   int fd;
 
+  unassert(!pthread_atfork(VfsLockDentries,    //
+                           VfsUnlockDentries,  //
+                           VfsAfterForkChild));
+
   // Register built-in filesystems
   unassert(!VfsRegister(&g_hostfs));
   unassert(!VfsRegister(&g_devfs));
   unassert(!VfsRegister(&g_procfs));
+  unassert(!VfsRegister(&g_tmpfs));
+  unassert(!VfsRegister(&g_packfs));
 
   dll_init(&g_rootdevice.elem);
   dll_make_first(&g_vfs.devices, &g_rootdevice.elem);
@@ -119,13 +198,20 @@ int VfsInit(const char *prefix) {
       ERRF("Failed to stat BLINK_PREFIX %s, %s", bprefix, strerror(errno));
       free(bprefix);
       bprefix = NULL;
+    } else if (S_ISREG(st.st_mode)) {
+      image = true;
     } else if (!S_ISDIR(st.st_mode)) {
-      ERRF("BLINK_PREFIX %s is not a directory", bprefix);
+      ERRF("BLINK_PREFIX %s is not a directory or packfs image", bprefix);
       free(bprefix);
       bprefix = NULL;
     }
   }
-  if (bprefix) {
+  if (image) {
+    if (VfsMount(bprefix, "/", "packfs", 0, NULL) == -1) {
+      ERRF("Failed to mount BLINK_PREFIX %s, %s", bprefix, strerror(errno));
+      goto cleananddie;
+    }
+  } else if (bprefix) {
     unassert(!VfsMount(bprefix, "/", "hostfs", 0, NULL));
   } else {
     unassert(!VfsMount("/", "/", "hostfs", 0, NULL));
@@ -137,29 +223,31 @@ int VfsInit(const char *prefix) {
   unassert(!VfsChdir("/"));
 
   // Mount the host's root.
-  if (VfsMkdir(AT_FDCWD, VFS_SYSTEM_ROOT_MOUNT, 0755) == -1 &&
-      errno != EEXIST) {
-    ERRF("Failed to create system root mount directory, %s", strerror(errno));
+  if ((hostroot = VfsMakeMountpoint(VFS_SYSTEM_ROOT_MOUNT)) == -1) {
     goto cleananddie;
+  } else if (hostroot) {
+    unassert(VfsMount("/", VFS_SYSTEM_ROOT_MOUNT, "hostfs", 0, NULL) != -1);
   }
-  unassert(VfsMount("/", VFS_SYSTEM_ROOT_MOUNT, "hostfs", 0, NULL) != -1);
   unassert(!VfsTraverse("/", &g_actualrootinfo, false));
 
   // devfs, procfs
-  if (VfsMkdir(AT_FDCWD, "/dev", 0755) == -1 && errno != EEXIST) {
-    ERRF("Failed to create /dev, %s", strerror(errno));
+  if ((rc = VfsMakeMountpoint("/dev")) == -1) {
     goto cleananddie;
+  } else if (rc) {
+    unassert(!VfsMount("", "/dev", "devfs", 0, NULL));
   }
-  unassert(!VfsMount("", "/dev", "devfs", 0, NULL));
-  if (VfsMkdir(AT_FDCWD, "/proc", 0755) == -1 && errno != EEXIST) {
-    ERRF("Failed to create /proc, %s", strerror(errno));
+  if ((rc = VfsMakeMountpoint("/proc")) == -1) {
     goto cleananddie;
+  } else if (rc) {
+    unassert(!VfsMount("proc", "/proc", "proc", 0, NULL));
   }
-  unassert(!VfsMount("proc", "/proc", "proc", 0, NULL));
 
   // Initialize the current working directory
   unassert(getcwd(hostcwd, sizeof(hostcwd)));
-  if (bprefix && !strncmp(hostcwd, bprefix, (prefixlen = strlen(bprefix)))) {
+  if (!hostroot) {
+    cwd = strdup("/");
+  } else if (bprefix && !image &&
+             !strncmp(hostcwd, bprefix, (prefixlen = strlen(bprefix)))) {
     hostcwdlen = strlen(hostcwd);
     if (hostcwdlen == prefixlen) {
       cwd = strdup("/");
@@ -308,6 +396,7 @@ int VfsMount(const char *source, const char *target, const char *fstype,
     dll_splice_after(dll_prev(g_vfs.devices, e), &newdevice->elem);
   }
   newdevice->flags = flags;
+  newdevice->dcache = newsystem->dcache;
   newmount->baseino = targetinfo->ino;
   newmount->root->dev = nextdev;
   newmount->root->name = newname;
@@ -317,10 +406,43 @@ int VfsMount(const char *source, const char *target, const char *fstype,
   dll_make_last(&targetdevice->mounts, &newmount->elem);
   UNLOCK(&g_vfs.lock);
   unassert(!VfsFreeInfo(targetinfo));
+  VfsFlushDentries();
   VFS_LOGF("Mounted a new device at %s, dev=%ld", target, nextdev);
   return 0;
 }
 
+/**
+ * Mounts filesystems listed in fstab format.
+ *
+ * Each entry has the form "SOURCE TARGET TYPE [OPTIONS]", and entries
+ * are separated by newlines or semicolons, e.g.
+ *
+ *     tmpfs /tmp tmpfs size=64m,mode=1777; proc /proc proc
+ *
+ * Blank entries and those beginning with `#` are ignored.
+ */
+int VfsMountAll(const char *spec) {
+  int rc = 0;
+  char *s, *entry, *tok1, *tok2, *f[4];
+  int i;
+  if (!(s = strdup(spec))) return enomem();
+  for (entry = strtok_r(s, ";\n", &tok1); entry && rc != -1;
+       entry = strtok_r(0, ";\n", &tok1)) {
+    for (i = 0; i < 4; ++i) {
+      if (!(f[i] = strtok_r(i ? 0 : entry, " \t", &tok2))) break;
+    }
+    if (!i || *f[0] == '#') continue;
+    if (i < 3) {
+      LOGF("bad mount entry: %s", f[0]);
+      rc = einval();
+    } else if ((rc = VfsMount(f[0], f[1], f[2], 0, i > 3 ? f[3] : 0)) == -1) {
+      LOGF("failed to mount %s on %s: %s", f[2], f[1], DescribeHostErrno(errno));
+    }
+  }
+  free(s);
+  return rc;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int VfsCreateDevice(struct VfsDevice **output) {
@@ -337,6 +459,7 @@ int VfsCreateDevice(struct VfsDevice **output) {
   device->data = NULL;
   device->ops = NULL;
   device->mounts = NULL;
+  device->dcache = false;
   device->refcount = 1;
   unassert(!pthread_mutex_init(&device->lock, NULL));
   dll_init(&device->elem);
@@ -462,6 +585,140 @@ int VfsFreeInfo(struct VfsInfo *info) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static u64 VfsHashDentry(u32 dev, u64 ino, const char *name, size_t namelen) {
+  size_t i;
+  u64 h = 0xcbf29ce484222325 ^ ((u64)dev << 48) ^ ino;
+  for (i = 0; i < namelen; ++i) {
+    h = (h ^ (name[i] & 255)) * 0x100000001b3;
+  }
+  return h;
+}
+
+static void VfsFreeDentry(struct VfsDentry *d) {
+  unassert(!VfsFreeInfo(d->info));
+  unassert(!VfsFreeInfo(d->parent));
+  free(d);
+}
+
+static void VfsFlushDentriesLocked(void) {
+  int i;
+  struct VfsDentry *d, *next;
+  for (i = 0; i < kDentryHash; ++i) {
+    for (d = g_dentries.hash[i]; d; d = next) {
+      next = d->next;
+      VfsFreeDentry(d);
+    }
+    g_dentries.hash[i] = 0;
+  }
+  g_dentries.count = 0;
+}
+
+// Forgets everything the dentry cache knows. This is needed whenever
+// names may have moved around, e.g. rename() and mount(), and when a
+// child process might have changed the host file system underneath us.
+void VfsFlushDentries(void) {
+  LOCK(&g_dentries.lock);
+  if (g_dentries.count) {
+    STATISTIC(++dentry_flushes);
+    VfsFlushDentriesLocked();
+  }
+  UNLOCK(&g_dentries.lock);
+}
+
+// Forgets what the dentry cache knows about `name` in directory `dir`
+// which must be called after we create or remove a directory entry.
+static void VfsForgetDentry(struct VfsInfo *dir, const char *name) {
+  u64 hash;
+  size_t namelen;
+  struct VfsDentry *d, **dp;
+  namelen = strlen(name);
+  hash = VfsHashDentry(dir->dev, dir->ino, name, namelen);
+  LOCK(&g_dentries.lock);
+  for (dp = g_dentries.hash + hash % kDentryHash; (d = *dp);) {
+    if (d->hash == hash && d->parent->dev == dir->dev &&
+        d->parent->ino == dir->ino && d->namelen == namelen &&
+        !memcmp(d->name, name, namelen)) {
+      *dp = d->next;
+      --g_dentries.count;
+      VfsFreeDentry(d);
+    } else {
+      dp = &d->next;
+    }
+  }
+  UNLOCK(&g_dentries.lock);
+}
+
+static void VfsRememberDentry(struct VfsInfo *parent, const char *name,
+                              size_t namelen, u64 hash, struct VfsInfo *info) {
+  struct VfsDentry *d, **dp;
+  if (!(d = (struct VfsDentry *)malloc(sizeof(*d) + namelen + 1))) return;
+  unassert(!VfsAcquireInfo(parent, &d->parent));
+  unassert(!VfsAcquireInfo(info, &d->info));
+  d->expires = AddTime(GetMonotonic(), FromMilliseconds(kDentryTtlMs));
+  d->hash = hash;
+  d->namelen = namelen;
+  memcpy(d->name, name, namelen + 1);
+  LOCK(&g_dentries.lock);
+  if (g_dentries.count >= kMaxDentries) {
+    STATISTIC(++dentry_flushes);
+    VfsFlushDentriesLocked();
+  }
+  dp = g_dentries.hash + hash % kDentryHash;
+  d->next = *dp;
+  *dp = d;
+  ++g_dentries.count;
+  UNLOCK(&g_dentries.lock);
+}
+
+// Looks up `name` in directory `parent` like the Finddir() operation,
+// consulting the dentry cache first if the file system allows it.
+static int VfsFinddir(struct VfsInfo *parent, const char *name,
+                      struct VfsInfo **output) {
+  int rc, err;
+  u64 hash;
+  size_t namelen;
+  struct timespec now;
+  struct VfsDentry *d, **dp;
+  if (!parent->device->dcache) {
+    return parent->device->ops->Finddir(parent, name, output);
+  }
+  namelen = strlen(name);
+  hash = VfsHashDentry(parent->dev, parent->ino, name, namelen);
+  now = GetMonotonic();
+  LOCK(&g_dentries.lock);
+  for (dp = g_dentries.hash + hash % kDentryHash; (d = *dp); dp = &d->next) {
+    if (d->hash == hash && d->parent == parent && d->namelen == namelen &&
+        !memcmp(d->name, name, namelen)) {
+      if (CompareTime(now, d->expires) >= 0) {
+        *dp = d->next;
+        --g_dentries.count;
+        VfsFreeDentry(d);
+        break;
+      }
+      STATISTIC(++dentry_hits);
+      if (d->info) {
+        unassert(!VfsAcquireInfo(d->info, output));
+        rc = 0;
+      } else {
+        rc = enoent();
+      }
+      UNLOCK(&g_dentries.lock);
+      return rc;
+    }
+  }
+  UNLOCK(&g_dentries.lock);
+  STATISTIC(++dentry_misses);
+  if ((rc = parent->device->ops->Finddir(parent, name, output)) != -1) {
+    VfsRememberDentry(parent, name, namelen, hash, *output);
+  } else if ((err = errno) == ENOENT) {
+    VfsRememberDentry(parent, name, namelen, hash, NULL);
+    errno = err;
+  }
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 static int VfsTraverseMount(struct VfsInfo **info,
                             char childname[VFS_NAME_MAX]) {
   struct VfsMount *mount;
@@ -564,7 +821,7 @@ static int VfsTraverseStackBuild(struct VfsInfo **stack, const char *path,
         }
         continue;
       }
-      if ((*stack)->device->ops->Finddir(*stack, filename, &next) == -1) {
+      if (VfsFinddir(*stack, filename, &next) == -1) {
         goto cleananddie;
       }
       unassert(!VfsFreeInfo(*stack));
@@ -715,40 +972,123 @@ ssize_t VfsPathBuild(struct VfsInfo *info, struct VfsInfo *root, bool absolute,
   return len;
 }
 
+/**
+ * Copies `name` to `leaf` without trailing slashes, e.g. "dir/" which
+ * is passed along to filesystems as is. Returns true if it had some,
+ * which means the name may only refer to a directory.
+ */
+bool VfsTrimName(const char *name, char leaf[VFS_NAME_MAX]) {
+  size_t n = strlen(name);
+  bool slashed = false;
+  while (n > 1 && name[n - 1] == '/') --n, slashed = true;
+  memcpy(leaf, name, n);
+  leaf[n] = 0;
+  return slashed;
+}
+
+/**
+ * Checks if the effective user may access a file that has the given
+ * `mode` and owners, for filesystems that keep permissions themselves.
+ * @param amode is a mask of R_OK, W_OK and X_OK
+ * @return 0 on success, or -1 w/ errno set to EACCES
+ */
+int VfsCheckAccess(u32 mode, u32 uid, u32 gid, int amode) {
+  unsigned bits;
+  uid_t euid = geteuid();
+  if (!euid) {
+    if ((amode & X_OK) && !S_ISDIR(mode) && !(mode & 0111)) {
+      return eacces();
+    }
+    return 0;
+  }
+  if (euid == uid) {
+    bits = mode >> 6;
+  } else if (getegid() == gid) {
+    bits = mode >> 3;
+  } else {
+    bits = mode;
+  }
+  if (amode & (R_OK | W_OK | X_OK) & ~bits) {
+    return eacces();
+  }
+  return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-int VfsAddFdAtOrAfter(struct VfsInfo *data, int minfd) {
-  struct VfsFd *vfsfd;
-  struct Dll *e;
-  vfsfd = (struct VfsFd *)malloc(sizeof(*vfsfd));
-  if (vfsfd == NULL) {
-    return -1;
+static struct VfsFd *VfsGetFdSlot(int fd) {
+  struct VfsFdTable *t;
+  if (fd >= 0 && (t = atomic_load_explicit(&g_vfs.fds, memory_order_acquire)) &&
+      fd < t->size) {
+    return atomic_load_explicit(t->p + fd, memory_order_acquire);
+  }
+  return NULL;
+}
+
+// returns slot for fd, creating it if needed, which needs Vfs::lock
+static struct VfsFd *VfsCreateFdSlot(int fd) {
+  int i, n;
+  struct VfsFd *slot;
+  struct VfsFdTable *t, *t2;
+  t = atomic_load_explicit(&g_vfs.fds, memory_order_relaxed);
+  if (!t || fd >= t->size) {
+    n = t ? t->size : kMinFdTable;
+    while (n <= fd) {
+      if (n > INT_MAX / 2) return NULL;
+      n *= 2;
+    }
+    if (!(t2 = (struct VfsFdTable *)calloc(
+              1, sizeof(struct VfsFdTable) + n * sizeof(t2->p[0])))) {
+      return NULL;
+    }
+    t2->size = n;
+    if (t) {
+      for (i = 0; i < t->size; ++i) {
+        atomic_store_explicit(
+            t2->p + i, atomic_load_explicit(t->p + i, memory_order_relaxed),
+            memory_order_relaxed);
+      }
+      t2->retired = t;
+    }
+    atomic_store_explicit(&g_vfs.fds, t2, memory_order_release);
+    t = t2;
   }
-  vfsfd->data = data;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd < minfd) {
-      continue;
-    } else if (VFS_FD_CONTAINER(e)->fd == minfd) {
-      ++minfd;
-    } else {
-      break;
+  if (!(slot = atomic_load_explicit(t->p + fd, memory_order_relaxed))) {
+    if (!(slot = (struct VfsFd *)calloc(1, sizeof(*slot)))) {
+      return NULL;
     }
+    atomic_store_explicit(t->p + fd, slot, memory_order_release);
   }
-  vfsfd->fd = minfd;
-  dll_init(&vfsfd->elem);
-  if (e == NULL) {
-    dll_make_last(&g_vfs.fds, &vfsfd->elem);
-  } else {
-    e = dll_prev(g_vfs.fds, e);
-    if (e == NULL) {
-      dll_make_first(&g_vfs.fds, &vfsfd->elem);
-    } else {
-      dll_splice_after(e, &vfsfd->elem);
+  return slot;
+}
+
+// replaces what's in slot, which needs Vfs::lock, and returns the old
+// data once no VfsGetFd() call can still be about to acquire a copy
+static struct VfsInfo *VfsExchangeFd(struct VfsFd *slot,
+                                     struct VfsInfo *data) {
+  struct VfsInfo *old;
+  if ((old = atomic_exchange(&slot->data, data))) {
+    while (atomic_load(&slot->refs)) {
+      sched_yield();
     }
   }
+  return old;
+}
+
+int VfsAddFdAtOrAfter(struct VfsInfo *data, int minfd) {
+  struct VfsFd *slot;
+  LOCK(&g_vfs.lock);
+  while ((slot = VfsGetFdSlot(minfd)) &&
+         atomic_load_explicit(&slot->data, memory_order_relaxed)) {
+    ++minfd;
+  }
+  if (!(slot = VfsCreateFdSlot(minfd))) {
+    UNLOCK(&g_vfs.lock);
+    return enomem();
+  }
+  atomic_store_explicit(&slot->data, data, memory_order_release);
   UNLOCK(&g_vfs.lock);
-  return vfsfd->fd;
+  return minfd;
 }
 
 int VfsAddFd(struct VfsInfo *data) {
@@ -760,72 +1100,57 @@ int VfsAddFd(struct VfsInfo *data) {
  * it.
  */
 int VfsFreeFd(int fd, struct VfsInfo **data) {
-  struct Dll *e;
-  struct VfsFd *vfsfd;
+  struct VfsFd *slot;
   LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e;) {
-    vfsfd = VFS_FD_CONTAINER(e);
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      *data = vfsfd->data;
-      dll_remove(&g_vfs.fds, &vfsfd->elem);
-      free(vfsfd);
-      VFS_LOGF("VfsFreeFd(%d)", fd);
-      UNLOCK(&g_vfs.lock);
-      return 0;
-    }
-    e = dll_next(g_vfs.fds, e);
+  if (!(slot = VfsGetFdSlot(fd)) || !(*data = VfsExchangeFd(slot, NULL))) {
+    UNLOCK(&g_vfs.lock);
+    return ebadf();
   }
+  VFS_LOGF("VfsFreeFd(%d)", fd);
   UNLOCK(&g_vfs.lock);
-  return ebadf();
+  return 0;
 }
 
 int VfsGetFd(int fd, struct VfsInfo **output) {
-  struct Dll *e;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      UNLOCK(&g_vfs.lock);
-      unassert(!VfsAcquireInfo(VFS_FD_CONTAINER(e)->data, output));
-      return 0;
-    }
+  struct VfsFd *slot;
+  struct VfsInfo *data;
+  if (!(slot = VfsGetFdSlot(fd))) {
+    return ebadf();
   }
-  UNLOCK(&g_vfs.lock);
-  return ebadf();
+  atomic_fetch_add(&slot->refs, 1);
+  if ((data = atomic_load(&slot->data))) {
+    unassert(!VfsAcquireInfo(data, output));
+  }
+  atomic_fetch_sub_explicit(&slot->refs, 1, memory_order_release);
+  return data ? 0 : ebadf();
 }
 
 int VfsSetFd(int fd, struct VfsInfo *data) {
-  struct Dll *e;
-  struct VfsFd *vfsfd;
+  struct VfsFd *slot;
   LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      unassert(!VfsFreeInfo(VFS_FD_CONTAINER(e)->data));
-      VFS_FD_CONTAINER(e)->data = data;
-      UNLOCK(&g_vfs.lock);
-      return 0;
-    } else if (VFS_FD_CONTAINER(e)->fd > fd) {
-      break;
-    }
-  }
-  vfsfd = (struct VfsFd *)malloc(sizeof(*vfsfd));
-  if (vfsfd == NULL) {
+  if (!(slot = VfsCreateFdSlot(fd))) {
     UNLOCK(&g_vfs.lock);
     return enomem();
   }
-  vfsfd->data = data;
-  vfsfd->fd = fd;
-  dll_init(&vfsfd->elem);
-  if (e == NULL) {
-    dll_make_last(&g_vfs.fds, &vfsfd->elem);
-  } else if ((e = dll_prev(g_vfs.fds, e))) {
-    dll_splice_after(e, &vfsfd->elem);
-  } else {
-    dll_make_first(&g_vfs.fds, &vfsfd->elem);
-  }
+  unassert(!VfsFreeInfo(VfsExchangeFd(slot, data)));
   UNLOCK(&g_vfs.lock);
   return 0;
 }
 
+// forgets about readers that didn't survive fork()
+static void VfsResetFds(void) {
+  int i;
+  struct VfsFd *slot;
+  struct VfsFdTable *t;
+  if ((t = atomic_load_explicit(&g_vfs.fds, memory_order_relaxed))) {
+    for (i = 0; i < t->size; ++i) {
+      if ((slot = atomic_load_explicit(t->p + i, memory_order_relaxed))) {
+        atomic_store_explicit(&slot->refs, 0, memory_order_relaxed);
+      }
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int VfsChdir(const char *path) {
@@ -984,7 +1309,7 @@ static int VfsHandleDirfdSymlink(struct VfsInfo **dir,
     if (!(*dir)->device->ops->Finddir || !(*dir)->device->ops->Readlink) {
       return eperm();
     }
-    if ((*dir)->device->ops->Finddir(*dir, name, &tmp) == -1) {
+    if (VfsFinddir(*dir, name, &tmp) == -1) {
       if (errno != ENOENT) {
         return -1;
       } else {
@@ -1055,6 +1380,7 @@ int VfsUnlink(int dirfd, const char *name, int flags) {
   } else {
     ret = eperm();
   }
+  VfsForgetDentry(dir, newname);
   unassert(!VfsFreeInfo(dir));
   return ret;
 }
@@ -1079,6 +1405,7 @@ int VfsMkdir(int dirfd, const char *name, mode_t mode) {
   } else {
     ret = eperm();
   }
+  VfsForgetDentry(dir, newname);
   unassert(!VfsFreeInfo(dir));
   return ret;
 }
@@ -1103,6 +1430,7 @@ int VfsMkfifo(int dirfd, const char *name, mode_t mode) {
   } else {
     ret = eperm();
   }
+  VfsForgetDentry(dir, newname);
   unassert(!VfsFreeInfo(dir));
   return ret;
 }
@@ -1136,6 +1464,9 @@ int VfsOpen(int dirfd, const char *name, int flags, int mode) {
       ret = eperm();
     }
   }
+  if (flags & O_CREAT) {
+    VfsForgetDentry(dir, newname);
+  }
   unassert(!VfsFreeInfo(dir));
   return ret;
 }
@@ -1234,6 +1565,7 @@ int VfsSymlink(const char *target, int dirfd, const char *name) {
   } else {
     ret = eperm();
   }
+  VfsForgetDentry(dir, newname);
   unassert(!VfsFreeInfo(dir));
   return ret;
 }
@@ -1333,6 +1665,9 @@ int VfsRename(int olddirfd, const char *oldname, int newdirfd,
   } else {
     ret = eperm();
   }
+  // Cached lookups beneath a renamed directory would resolve to a host
+  // path that no longer exists, so it's simplest to start over.
+  VfsFlushDentries();
   unassert(!VfsFreeInfo(olddir));
   unassert(!VfsFreeInfo(newdir));
   return ret;
@@ -1357,7 +1692,7 @@ ssize_t VfsReadlink(int dirfd, const char *name, char *buf, size_t bufsiz) {
       return -1;
     }
     if (!dir->device->ops->Finddir ||
-        dir->device->ops->Finddir(dir, newname, &file) == -1) {
+        VfsFinddir(dir, newname, &file) == -1) {
       unassert(!VfsFreeInfo(dir));
       return -1;
     }
@@ -1414,6 +1749,7 @@ int VfsLink(int olddirfd, const char *oldname, int newdirfd,
   } else {
     ret = eperm();
   }
+  VfsForgetDentry(newdir, newnewname);
   unassert(!VfsFreeInfo(olddir));
   unassert(!VfsFreeInfo(newdir));
   return ret;
@@ -1868,6 +2204,44 @@ int VfsPoll(struct pollfd *fds, nfds_t nfds, int timeout) {
   return ret;
 }
 
+/**
+ * Returns the host file descriptor backing the emulated descriptor fd,
+ * so it may be waited on with the host's poll(), or -1 w/ errno if it
+ * isn't backed by one.
+ */
+int VfsHostFd(int fd) {
+  struct VfsInfo *info;
+  int ret;
+  if (VfsGetFd(fd, &info) == -1) {
+    return -1;
+  }
+  if (info->device->ops->Poll == HostfsPoll) {
+    ret = ((struct HostfsInfo *)info->data)->filefd;
+  } else {
+    ret = eperm();
+  }
+  unassert(!VfsFreeInfo(info));
+  return ret;
+}
+
+/**
+ * Adopts host file descriptor, e.g. from eventfd(), into the emulated
+ * descriptor table. Returns the emulated descriptor, or -1 w/ errno in
+ * which case the host descriptor will have been closed.
+ */
+int VfsWrapFd(int hostfd) {
+  struct VfsInfo *info;
+  int fd;
+  if (HostfsWrapFd(hostfd, false, &info) == -1) {
+    close(hostfd);
+    return -1;
+  }
+  if ((fd = VfsAddFd(info)) == -1) {
+    unassert(!VfsFreeInfo(info));
+  }
+  return fd;
+}
+
 int VfsSelect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
               struct timespec *timeout, sigset_t *sigmask) {
   VFS_LOGF("VfsSelect(%d, %p, %p, %p, %p, %p)", nfds, readfds, writefds,
@@ -1952,22 +2326,20 @@ void VfsRewinddir(DIR *dir) {
 
 int VfsClosedir(DIR *dir) {
   struct VfsInfo *info;
-  struct Dll *e;
-  struct VfsFd *vfsfd;
-  int ret;
+  struct VfsFdTable *t;
+  struct VfsFd *slot;
+  int i, ret;
   VFS_LOGF("VfsClosedir(%p)", dir);
   info = (struct VfsInfo *)dir;
   if (info->device->ops->Closedir) {
     ret = info->device->ops->Closedir(info);
     if (ret != -1) {
       LOCK(&g_vfs.lock);
-      for (e = dll_first(g_vfs.fds); e;) {
-        vfsfd = VFS_FD_CONTAINER(e);
-        e = dll_next(g_vfs.fds, e);
-        if (vfsfd->data == info) {
-          unassert(!VfsFreeInfo(vfsfd->data));
-          dll_remove(&g_vfs.fds, &vfsfd->elem);
-          free(vfsfd);
+      t = atomic_load_explicit(&g_vfs.fds, memory_order_relaxed);
+      for (i = 0; t && i < t->size; ++i) {
+        if ((slot = atomic_load_explicit(t->p + i, memory_order_relaxed)) &&
+            atomic_load_explicit(&slot->data, memory_order_relaxed) == info) {
+          unassert(!VfsFreeInfo(VfsExchangeFd(slot, NULL)));
           break;
         }
       }
@@ -2020,6 +2392,7 @@ int VfsBind(int fd, const struct sockaddr *addr, socklen_t addrlen) {
           unassert(!VfsFreeDevice(olddevice));
         }
       }
+      VfsForgetDentry(dir, newname);
       unassert(!VfsFreeInfo(dir));
     }
   }
@@ -30,12 +30,13 @@ struct VfsMount;
 struct VfsInfo;
 struct VfsSystem;
 struct VfsFd;
+struct VfsFdTable;
 struct VfsMap;
 
 struct Vfs {
   struct Dll *devices GUARDED_BY(lock);
   struct Dll *systems GUARDED_BY(lock);
-  struct Dll *fds GUARDED_BY(lock);
+  _Atomic(struct VfsFdTable *) fds;
   struct Dll *maps GUARDED_BY(mapslock);
   pthread_mutex_t_ lock;
   pthread_mutex_t_ mapslock;
@@ -146,6 +147,7 @@ struct VfsSystem {
   struct VfsOps ops;
   char name[VFS_SYSTEM_NAME_MAX];
   bool nodev;
+  bool dcache;  // lookups may be remembered by the dentry cache
 };
 
 struct VfsMount {
@@ -163,6 +165,7 @@ struct VfsDevice {
   struct Dll elem;
   u64 flags;
   u32 dev;
+  bool dcache;
   _Atomic(u32) refcount;
 };
 
@@ -192,6 +195,7 @@ int VfsChdir(const char *);
 char *VfsGetcwd(char *, size_t);
 int VfsChroot(const char *);
 int VfsMount(const char *, const char *, const char *, u64, const void *);
+int VfsMountAll(const char *);
 int VfsUnlink(int, const char *, int);
 int VfsMkdir(int, const char *, mode_t);
 int VfsMkfifo(int, const char *, mode_t);
@@ -232,6 +236,8 @@ int VfsDup2(int, int);
 int VfsDup3(int, int, int);
 #endif
 int VfsPoll(struct pollfd *, nfds_t, int);
+int VfsHostFd(int);
+int VfsWrapFd(int);
 int VfsSelect(int, fd_set *, fd_set *, fd_set *, struct timespec *, sigset_t *);
 DIR *VfsOpendir(int);
 #ifdef HAVE_SEEKDIR
@@ -285,12 +291,15 @@ int VfsCreateDevice(struct VfsDevice **output);
 int VfsAcquireDevice(struct VfsDevice *, struct VfsDevice **);
 int VfsFreeDevice(struct VfsDevice *);
 int VfsFreeInfo(struct VfsInfo *);
+void VfsFlushDentries(void);
 int VfsAddFd(struct VfsInfo *);
 int VfsFreeFd(int, struct VfsInfo **);
 int VfsSetFd(int, struct VfsInfo *);
 ssize_t VfsPathBuildFull(struct VfsInfo *, struct VfsInfo *, char **);
 ssize_t VfsPathBuild(struct VfsInfo *, struct VfsInfo *, bool,
                      char[VFS_PATH_MAX]);
+bool VfsTrimName(const char *, char[VFS_NAME_MAX]);
+int VfsCheckAccess(u32, u32, u32, int);
 #elif !defined(DISABLE_OVERLAYS)
 #define VfsChown       OverlaysChown
 #define VfsAccess      OverlaysAccess
@@ -331,6 +340,8 @@ ssize_t VfsPathBuild(struct VfsInfo *, struct VfsInfo *, bool,
 #define VfsDup2        dup2
 #define VfsDup3        dup3
 #define VfsPoll        poll
+#define VfsHostFd(fd)  (fd)
+#define VfsWrapFd(fd)  (fd)
 #define VfsSelect      pselect
 #define VfsOpendir     fdopendir
 #define VfsSeekdir     seekdir
@@ -369,6 +380,7 @@ ssize_t VfsPathBuild(struct VfsInfo *, struct VfsInfo *, bool,
 #define VfsMunmap      munmap
 #define VfsMprotect    mprotect
 #define VfsMsync       msync
+#define VfsFlushDentries OverlaysFlushCache
 #else
 #define VfsChown       fchownat
 #define VfsAccess      faccessat
@@ -409,6 +421,8 @@ ssize_t VfsPathBuild(struct VfsInfo *, struct VfsInfo *, bool,
 #define VfsDup2        dup2
 #define VfsDup3        dup3
 #define VfsPoll        poll
+#define VfsHostFd(fd)  (fd)
+#define VfsWrapFd(fd)  (fd)
 #define VfsSelect      pselect
 #define VfsOpendir     fdopendir
 #define VfsSeekdir     seekdir
@@ -447,6 +461,7 @@ ssize_t VfsPathBuild(struct VfsInfo *, struct VfsInfo *, bool,
 #define VfsMunmap      munmap
 #define VfsMprotect    mprotect
 #define VfsMsync       msync
+#define VfsFlushDentries() (void)0
 #endif
 
 #endif /* BLINK_VFS_H_ */
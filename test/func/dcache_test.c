@@ -0,0 +1,89 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// path lookups are cached, including names that don't exist, so each
+// way of changing a directory must be reflected by later lookups
+
+char dir[] = "/tmp/dcache_test.XXXXXX";
+char path[256];
+
+int Exists(const char *name) {
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return !stat(path, &st);
+}
+
+int Missing(const char *name) {
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  errno = 0;
+  return stat(path, &st) == -1 && errno == ENOENT;
+}
+
+int Create(const char *name) {
+  int fd;
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) == -1) return 0;
+  return !close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  int ws;
+  pid_t pid;
+  char a[256], b[256];
+  if (!mkdtemp(dir)) return 1;
+
+  // a missing directory becomes visible once it's created
+  if (!Missing("sub/x")) return 2;
+  if (!Missing("sub/x")) return 3;
+  snprintf(a, sizeof(a), "%s/sub", dir);
+  if (mkdir(a, 0755)) return 4;
+  if (!Missing("sub/x")) return 5;
+  if (!Create("sub/x")) return 6;
+  if (!Exists("sub/x")) return 7;
+
+  // renaming moves everything beneath the directory
+  snprintf(b, sizeof(b), "%s/sub2", dir);
+  if (rename(a, b)) return 8;
+  if (!Missing("sub/x")) return 9;
+  if (!Exists("sub2/x")) return 10;
+
+  // symbolic links are resolved through the cache too
+  snprintf(a, sizeof(a), "%s/link", dir);
+  if (symlink("sub2", a)) return 11;
+  if (!Exists("link/x")) return 12;
+  if (unlink(a)) return 13;
+  if (!Missing("link/x")) return 14;
+
+  // changes made by child processes are seen after waiting on them
+  if (!Missing("kid/y")) return 15;
+  if ((pid = fork()) == -1) return 16;
+  if (!pid) {
+    snprintf(a, sizeof(a), "%s/kid", dir);
+    if (mkdir(a, 0755)) _exit(1);
+    if (!Create("kid/y")) _exit(2);
+    _exit(0);
+  }
+  if (waitpid(pid, &ws, 0) != pid) return 17;
+  if (!WIFEXITED(ws) || WEXITSTATUS(ws)) return 18;
+  if (!Exists("kid/y")) return 19;
+
+  // removing a directory makes it go away
+  snprintf(a, sizeof(a), "%s/kid/y", dir);
+  if (unlink(a)) return 20;
+  snprintf(a, sizeof(a), "%s/kid", dir);
+  if (rmdir(a)) return 21;
+  if (!Missing("kid/y")) return 22;
+
+  // clean up
+  snprintf(a, sizeof(a), "%s/sub2/x", dir);
+  if (unlink(a)) return 23;
+  if (rmdir(b)) return 24;
+  if (rmdir(dir)) return 25;
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// event loops wake up through eventfd, timerfd and signalfd
+
+int efd;
+
+void *Poker(void *arg) {
+  uint64_t x = 3;
+  usleep(20000);
+  if (write(efd, &x, 8) != 8) _exit(20);
+  return 0;
+}
+
+void *Killer(void *arg) {
+  usleep(20000);
+  kill(getpid(), SIGUSR2);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int ep, tfd, sfd;
+  uint64_t x;
+  sigset_t ss;
+  pthread_t th;
+  struct pollfd pfd;
+  struct itimerspec its = {0};
+  struct epoll_event ev, evs[4];
+  struct signalfd_siginfo si;
+
+  // eventfd counters and semaphores
+  if ((efd = eventfd(5, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return 1;
+  if (read(efd, &x, 8) != 8 || x != 5) return 2;
+  if (read(efd, &x, 8) != -1 || errno != EAGAIN) return 3;
+  close(efd);
+  if ((efd = eventfd(2, EFD_SEMAPHORE)) == -1) return 4;
+  if (read(efd, &x, 8) != 8 || x != 1) return 5;
+  if (read(efd, &x, 8) != 8 || x != 1) return 6;
+
+  // another thread wakes us through epoll
+  if ((ep = epoll_create1(EPOLL_CLOEXEC)) == -1) return 7;
+  ev.events = EPOLLIN;
+  ev.data.u64 = 123;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev)) return 8;
+  if (pthread_create(&th, 0, Poker, 0)) return 9;
+  if (epoll_wait(ep, evs, 4, 5000) != 1) return 10;
+  if (evs[0].data.u64 != 123) return 11;
+  if (read(efd, &x, 8) != 8 || x != 1) return 12;
+  if (pthread_join(th, 0)) return 13;
+  if (epoll_ctl(ep, EPOLL_CTL_DEL, efd, 0)) return 35;
+
+  // timerfd fires and reports its expirations
+  if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1) return 14;
+  its.it_value.tv_nsec = 10000000;
+  its.it_interval.tv_nsec = 10000000;
+  if (timerfd_settime(tfd, 0, &its, 0)) return 15;
+  pfd.fd = tfd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 5000) != 1) return 16;
+  if (read(tfd, &x, 8) != 8 || x < 1) return 17;
+  if (timerfd_gettime(tfd, &its)) return 18;
+  if (its.it_interval.tv_nsec != 10000000) return 19;
+  its.it_value.tv_nsec = 0;
+  if (timerfd_settime(tfd, 0, &its, &its)) return 21;
+  close(tfd);
+
+  // blocked signals are read from a signalfd
+  sigemptyset(&ss);
+  sigaddset(&ss, SIGUSR1);
+  sigaddset(&ss, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &ss, 0)) return 22;
+  if ((sfd = signalfd(-1, &ss, SFD_NONBLOCK)) == -1) return 23;
+  if (read(sfd, &si, sizeof(si)) != -1 || errno != EAGAIN) return 24;
+  if (read(sfd, &si, 8) != -1 || errno != EINVAL) return 25;
+  ev.events = EPOLLIN;
+  ev.data.u64 = 456;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &ev)) return 26;
+  kill(getpid(), SIGUSR2);
+  if (epoll_wait(ep, evs, 4, 5000) != 1) return 27;
+  if (evs[0].data.u64 != 456) return 28;
+  if (read(sfd, &si, sizeof(si)) != sizeof(si)) return 29;
+  if (si.ssi_signo != SIGUSR2) return 30;
+  if (read(sfd, &si, sizeof(si)) != -1 || errno != EAGAIN) return 31;
+  raise(SIGUSR1);
+  pfd.fd = sfd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 5000) != 1) return 32;
+  if (read(sfd, &si, sizeof(si)) != sizeof(si)) return 33;
+  if (si.ssi_signo != SIGUSR1) return 34;
+  // once every signal has been read, the descriptor isn't readable
+  raise(SIGUSR1);
+  raise(SIGUSR2);
+  if (read(sfd, &si, sizeof(si)) != sizeof(si)) return 36;
+  if (read(sfd, &si, sizeof(si)) != sizeof(si)) return 37;
+  if (poll(&pfd, 1, 0) != 0) return 38;
+  close(sfd);
+
+  // a blocking signalfd wakes up when another thread sends a signal
+  if ((sfd = signalfd(-1, &ss, 0)) == -1) return 39;
+  if (pthread_create(&th, 0, Killer, 0)) return 40;
+  if (read(sfd, &si, sizeof(si)) != sizeof(si)) return 41;
+  if (si.ssi_signo != SIGUSR2) return 42;
+  if (pthread_join(th, 0)) return 43;
+  close(sfd);
+  close(ep);
+  return 0;
+}
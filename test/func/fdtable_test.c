@@ -0,0 +1,68 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// descriptors are looked up in a table indexed by number, which must
+// grow to accommodate high numbers and stay consistent while threads
+// are reading and writing, as other threads open and close descriptors
+
+#define FDS     300
+#define THREADS 4
+#define ITERS   2000
+
+int fds[2];
+int dups[FDS];
+
+void *Worker(void *arg) {
+  int i, fd;
+  char c = 'x';
+  for (i = 0; i < ITERS; ++i) {
+    if ((fd = dup(fds[1])) == -1) _exit(10);
+    if (write(fd, &c, 1) != 1) _exit(11);
+    if (close(fd)) _exit(12);
+    if (read(fds[0], &c, 1) != 1) _exit(13);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+  char c;
+  pthread_t th[THREADS];
+  if (pipe(fds)) return 1;
+
+  // grow the table well past its initial size
+  for (i = 0; i < FDS; ++i) {
+    if ((dups[i] = dup(fds[1])) == -1) return 2;
+  }
+  for (i = 0; i < FDS; ++i) {
+    if (write(dups[i], "a", 1) != 1) return 3;
+  }
+  for (i = 0; i < FDS; ++i) {
+    if (read(fds[0], &c, 1) != 1 || c != 'a') return 4;
+  }
+  for (i = 0; i < FDS; ++i) {
+    if (close(dups[i])) return 5;
+  }
+  errno = 0;
+  if (write(dups[FDS - 1], "a", 1) != -1 || errno != EBADF) return 6;
+
+  // dup2() to a sparse high number
+  if (dup2(fds[1], 1000) != 1000) return 7;
+  if (write(1000, "b", 1) != 1) return 8;
+  if (read(fds[0], &c, 1) != 1 || c != 'b') return 9;
+  if (fcntl(1000, F_GETFD) != 0) return 10;
+  if (close(1000)) return 11;
+  errno = 0;
+  if (write(1000, "b", 1) != -1 || errno != EBADF) return 12;
+
+  // threads race to create, use, and destroy descriptors
+  for (i = 0; i < THREADS; ++i) {
+    if (pthread_create(th + i, 0, Worker, 0)) return 13;
+  }
+  for (i = 0; i < THREADS; ++i) {
+    if (pthread_join(th[i], 0)) return 14;
+  }
+  return 0;
+}
@@ -36,6 +36,10 @@ o/$(MODE)/test/func/%.com.ok:						\
 	$<
 	@touch $@
 
+# these tests only do something if blink is asked to by the environment
+o/$(MODE)/test/func/perfmap_test.com.ok: private export BLINK_PERF = map,jitdump
+o/$(MODE)/test/func/profile_test.com.ok: private export BLINK_PROFILE = o/$(MODE)/test/func/profile_test.folded
+
 $(TEST_FUNC_OBJS): private CFLAGS = -O -g
 $(TEST_FUNC_OBJS): private CPPFLAGS = -isystem.
 
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// exercises the futex operations used by condition variables and
+// semaphores: bitsets, absolute timeouts, requeue, and wake_op
+
+#define THREADS 8
+
+atomic_int cond;
+atomic_int mutex;
+atomic_int woke;
+atomic_int ready;
+
+long futex(atomic_int *uaddr, int op, int val, void *ts, atomic_int *uaddr2,
+           int val3) {
+  return syscall(SYS_futex, uaddr, op, val, ts, uaddr2, val3);
+}
+
+void *Waiter(void *arg) {
+  ++ready;
+  futex(&cond, FUTEX_WAIT_BITSET_PRIVATE, 0, 0, 0, FUTEX_BITSET_MATCH_ANY);
+  ++woke;
+  return 0;
+}
+
+void *BitWaiter(void *arg) {
+  ++ready;
+  futex(&cond, FUTEX_WAIT_BITSET_PRIVATE, 0, 0, 0, (long)arg);
+  ++woke;
+  return 0;
+}
+
+int Park(void *(*func)(void *), long n, long arg) {
+  long i;
+  pthread_t th;
+  ready = 0;
+  for (i = 0; i < n; ++i) {
+    if (pthread_create(&th, 0, func, (void *)arg)) return -1;
+    pthread_detach(th);
+  }
+  while (ready < n) usleep(1000);
+  // there's no telling when they're asleep, so give them ample time,
+  // since starting threads under the emulator can be slow
+  usleep(250000);
+  return 0;
+}
+
+int Settle(int n) {
+  int i;
+  for (i = 0; i < 1000 && woke < n; ++i) usleep(1000);
+  usleep(20000);
+  return woke;
+}
+
+int main(int argc, char *argv[]) {
+  long rc;
+  struct timespec ts;
+  // zero bitset is invalid
+  if (futex(&cond, FUTEX_WAIT_BITSET, 0, 0, 0, 0) != -1 || errno != EINVAL)
+    return 1;
+  // absolute monotonic timeout in the past times out immediately
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (futex(&cond, FUTEX_WAIT_BITSET, 0, &ts, 0, -1) != -1 ||
+      errno != ETIMEDOUT)
+    return 2;
+  // absolute realtime timeout in the near future
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_nsec += 20000000;
+  if (ts.tv_nsec >= 1000000000) ts.tv_sec += 1, ts.tv_nsec -= 1000000000;
+  if (futex(&cond, FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, 0, &ts, 0, -1) !=
+          -1 ||
+      errno != ETIMEDOUT)
+    return 3;
+  // wake_bitset only wakes waiters with intersecting bits
+  if (Park(BitWaiter, 2, 1)) return 4;
+  if (Park(BitWaiter, 2, 2)) return 5;
+  if (futex(&cond, FUTEX_WAKE_BITSET_PRIVATE, 100, 0, 0, 2) != 2) return 6;
+  if (Settle(2) != 2) return 7;
+  if (futex(&cond, FUTEX_WAKE_BITSET_PRIVATE, 100, 0, 0, 1) != 2) return 8;
+  if (Settle(4) != 4) return 9;
+  // cmp_requeue with the wrong value fails
+  woke = 0;
+  if (futex(&cond, FUTEX_CMP_REQUEUE_PRIVATE, 1, (void *)100, &mutex, 1) !=
+          -1 ||
+      errno != EAGAIN)
+    return 10;
+  // cmp_requeue wakes one and moves the rest to the mutex
+  if (Park(Waiter, THREADS, 0)) return 11;
+  rc = futex(&cond, FUTEX_CMP_REQUEUE_PRIVATE, 1, (void *)100, &mutex, 0);
+  if (rc != THREADS) return 12;
+  if (Settle(1) < 1) return 13;
+  // waking the cond again finds nobody, since they're on the mutex now
+  if (futex(&cond, FUTEX_WAKE_PRIVATE, 100, 0, 0, 0) != 0) return 14;
+  // though blink wakes requeued waiters on host futexes early, if they
+  // are still waiting when they next stop to check for interrupts
+  rc = futex(&mutex, FUTEX_WAKE_PRIVATE, 100, 0, 0, 0);
+  if (rc < 0 || rc > THREADS - 1) return 15;
+  if (Settle(THREADS) != THREADS) return 16;
+  // wake_op stores to the second word and conditionally wakes it too
+  woke = 0;
+  mutex = 5;
+  if (Park(Waiter, 2, 0)) return 17;
+  rc = futex(&cond, FUTEX_WAKE_OP_PRIVATE, 1, (void *)1, &cond,
+             FUTEX_OP(FUTEX_OP_ADD, 0, FUTEX_OP_CMP_EQ, 0));
+  if (rc != 2) return 18;
+  if (Settle(2) != 2) return 19;
+  rc = futex(&cond, FUTEX_WAKE_OP_PRIVATE, 0, (void *)0, &mutex,
+             FUTEX_OP(FUTEX_OP_SET, 7, FUTEX_OP_CMP_EQ, 5));
+  if (rc != 0 || mutex != 7) return 20;
+  return 0;
+}
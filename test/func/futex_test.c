@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// hundreds of threads may be parked on futexes at once, spread across
+// many different addresses as well as piled up on the same address
+
+#define THREADS 200
+
+atomic_int ready;
+atomic_int words[THREADS];
+atomic_int shared;
+
+long futex(atomic_int *uaddr, int op, int val, struct timespec *ts) {
+  return syscall(SYS_futex, uaddr, op, val, ts, 0, 0);
+}
+
+void *Worker(void *arg) {
+  int i = (long)arg;
+  ++ready;
+  while (!words[i]) futex(words + i, FUTEX_WAIT_PRIVATE, 0, 0);
+  while (!shared) futex(&shared, FUTEX_WAIT, 0, 0);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  long i, n;
+  pthread_attr_t attr;
+  pthread_t th[THREADS];
+  struct timespec ts = {0, 10000000};
+  // waiting on a word whose value differs shouldn't block
+  if (futex(&shared, FUTEX_WAIT, 1, 0) != -1 || errno != EAGAIN) return 1;
+  // waiting with a timeout should time out
+  if (futex(&shared, FUTEX_WAIT, 0, &ts) != -1 || errno != ETIMEDOUT) return 2;
+  // waking nobody wakes nobody
+  if (futex(&shared, FUTEX_WAKE, 1, 0)) return 3;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 65536);
+  for (i = 0; i < THREADS; ++i) {
+    if (pthread_create(th + i, &attr, Worker, (void *)i)) return 4;
+  }
+  while (ready < THREADS) usleep(1000);
+  usleep(20000);
+  for (i = 0; i < THREADS; ++i) {
+    words[i] = 1;
+    futex(words + i, FUTEX_WAKE_PRIVATE, 1, 0);
+  }
+  usleep(20000);
+  shared = 1;
+  // stragglers that never slept will notice shared is set by themselves
+  if ((n = futex(&shared, FUTEX_WAKE, THREADS, 0)) < 0 || n > THREADS) return 5;
+  for (i = 0; i < THREADS; ++i) {
+    if (pthread_join(th[i], 0)) return 6;
+  }
+  return 0;
+}
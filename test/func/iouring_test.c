@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// io_uring rings are driven through raw system calls, since there's no
+// liburing. reads on an empty pipe must be queued rather than blocking,
+// and waiting on the ring with poll() or epoll must see them complete
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup    425
+#define __NR_io_uring_enter    426
+#define __NR_io_uring_register 427
+#endif
+
+int ring;
+unsigned char *rings;
+struct io_uring_sqe *sqes;
+struct io_uring_params p;
+
+int Enter(unsigned submit, unsigned complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring, submit, complete, flags, 0, 8);
+}
+
+unsigned *Word(unsigned off) {
+  return (unsigned *)(rings + off);
+}
+
+struct io_uring_sqe *Prep(int op, int fd, void *addr, unsigned len,
+                          uint64_t off, uint64_t user_data) {
+  unsigned tail, index;
+  struct io_uring_sqe *sqe;
+  tail = *Word(p.sq_off.tail);
+  index = tail & *Word(p.sq_off.ring_mask);
+  sqe = sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = user_data;
+  Word(p.sq_off.array)[index] = index;
+  __atomic_store_n(Word(p.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+int Reap(uint64_t *user_data) {
+  int res;
+  unsigned head;
+  struct io_uring_cqe *cqe;
+  head = *Word(p.cq_off.head);
+  if (head == __atomic_load_n(Word(p.cq_off.tail), __ATOMIC_ACQUIRE)) {
+    return -99999;
+  }
+  cqe = (struct io_uring_cqe *)(rings + p.cq_off.cqes) +
+        (head & *Word(p.cq_off.ring_mask));
+  *user_data = cqe->user_data;
+  res = cqe->res;
+  __atomic_store_n(Word(p.cq_off.head), head + 1, __ATOMIC_RELEASE);
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  int ep;
+  int fds[2];
+  int file;
+  char buf[8];
+  char out[16];
+  uint64_t ud;
+  size_t size;
+  struct pollfd pfd;
+  struct iovec iov[2];
+  struct epoll_event ev;
+  char path[] = "/tmp/iouring_test.XXXXXX";
+  struct __kernel_timespec ts;
+  unsigned char probe[sizeof(struct io_uring_probe) +
+                      IORING_OP_LAST * sizeof(struct io_uring_probe_op)];
+
+  // create a ring and map it into memory
+  memset(&p, 0, sizeof(p));
+  if ((ring = syscall(__NR_io_uring_setup, 3, &p)) == -1) return 1;
+  if (p.sq_entries != 4 || p.cq_entries != 8) return 2;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) return 3;
+  size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (size < p.sq_off.array + p.sq_entries * 4) {
+    size = p.sq_off.array + p.sq_entries * 4;
+  }
+  rings = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring, IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED) return 4;
+  sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+              IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return 5;
+
+  // no-op completes immediately
+  Prep(IORING_OP_NOP, -1, 0, 0, 0, 1);
+  if (Enter(1, 1, IORING_ENTER_GETEVENTS) != 1) return 6;
+  if (Reap(&ud) != 0 || ud != 1) return 7;
+
+  // reading an empty pipe is queued until data arrives
+  if (pipe(fds)) return 8;
+  memset(buf, 0, sizeof(buf));
+  Prep(IORING_OP_READ, fds[0], buf, sizeof(buf), -1, 2);
+  if (Enter(1, 0, 0) != 1) return 9;
+  if (Reap(&ud) != -99999) return 10;
+  if (write(fds[1], "hi", 2) != 2) return 11;
+  if (Enter(0, 1, IORING_ENTER_GETEVENTS) != 0) return 12;
+  if (Reap(&ud) != 2 || ud != 2) return 13;
+  if (memcmp(buf, "hi", 2)) return 14;
+
+  // poll for readability
+  Prep(IORING_OP_POLL_ADD, fds[0], 0, 0, 0, 3)->poll_events = POLLIN;
+  if (Enter(1, 0, 0) != 1) return 15;
+  if (Reap(&ud) != -99999) return 16;
+  if (write(fds[1], "x", 1) != 1) return 17;
+  if (Enter(0, 1, IORING_ENTER_GETEVENTS) != 0) return 18;
+  if (Reap(&ud) != POLLIN || ud != 3) return 19;
+
+  // timeouts expire with -ETIME
+  ts.tv_sec = 0;
+  ts.tv_nsec = 10000000;
+  Prep(IORING_OP_TIMEOUT, -1, &ts, 1, 0, 4);
+  if (Enter(1, 1, IORING_ENTER_GETEVENTS) != 1) return 20;
+  if (Reap(&ud) != -ETIME || ud != 4) return 21;
+
+  // failures cancel the rest of a linked chain
+  Prep(IORING_OP_WRITE, -1, buf, 1, -1, 5)->flags = IOSQE_IO_LINK;
+  Prep(IORING_OP_NOP, -1, 0, 0, 0, 6);
+  if (Enter(2, 2, IORING_ENTER_GETEVENTS) != 2) return 22;
+  if (Reap(&ud) != -EBADF || ud != 5) return 23;
+  if (Reap(&ud) != -ECANCELED || ud != 6) return 24;
+
+  // the probe reports supported operations
+  memset(probe, 0, sizeof(probe));
+  if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe,
+              IORING_OP_LAST)) {
+    return 25;
+  }
+  if (!(((struct io_uring_probe *)probe)->ops[IORING_OP_READ].flags &
+        IO_URING_OP_SUPPORTED)) {
+    return 26;
+  }
+
+  // polling the ring makes progress on what's queued
+  if (read(fds[0], buf, sizeof(buf)) != 1) return 28;
+  Prep(IORING_OP_READ, fds[0], buf, sizeof(buf), -1, 7);
+  if (Enter(1, 0, 0) != 1) return 29;
+  pfd.fd = ring;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 0) != 0) return 30;
+  if (write(fds[1], "yo", 2) != 2) return 31;
+  if (poll(&pfd, 1, 10000) != 1 || !(pfd.revents & POLLIN)) return 32;
+  if (Reap(&ud) != 2 || ud != 7) return 33;
+
+  // as does waiting on it with epoll
+  if ((ep = epoll_create1(0)) == -1) return 34;
+  ev.events = EPOLLIN;
+  ev.data.u64 = 123;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, ring, &ev)) return 35;
+  Prep(IORING_OP_READ, fds[0], buf, sizeof(buf), -1, 8);
+  if (Enter(1, 0, 0) != 1) return 36;
+  if (epoll_wait(ep, &ev, 1, 0) != 0) return 37;
+  if (write(fds[1], "ok", 2) != 2) return 38;
+  if (epoll_wait(ep, &ev, 1, 10000) != 1 || ev.data.u64 != 123) return 39;
+  if (Reap(&ud) != 2 || ud != 8) return 40;
+  if (close(ep)) return 41;
+
+  // regular files, which can't be polled, are still read and written
+  if ((file = mkstemp(path)) == -1) return 42;
+  if (unlink(path)) return 43;
+  iov[0].iov_base = "hello ";
+  iov[0].iov_len = 6;
+  iov[1].iov_base = "world";
+  iov[1].iov_len = 5;
+  Prep(IORING_OP_WRITEV, file, iov, 2, 0, 9)->flags = IOSQE_IO_LINK;
+  Prep(IORING_OP_FSYNC, file, 0, 0, 0, 10);
+  if (Enter(2, 2, IORING_ENTER_GETEVENTS) != 2) return 44;
+  if (Reap(&ud) != 11 || ud != 9) return 45;
+  if (Reap(&ud) != 0 || ud != 10) return 46;
+  memset(out, 0, sizeof(out));
+  Prep(IORING_OP_READ, file, out, sizeof(out), 6, 11);
+  if (Enter(1, 1, IORING_ENTER_GETEVENTS) != 1) return 47;
+  if (Reap(&ud) != 5 || ud != 11) return 48;
+  if (memcmp(out, "world", 5)) return 49;
+  if (close(file)) return 50;
+
+  if (close(ring)) return 27;
+  return 0;
+}
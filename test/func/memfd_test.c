@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// memfd_create() files and shared anonymous memory can be mapped with
+// MAP_SHARED and written by a forked child, which the parent observes.
+// files survive execve() unless they were created with MFD_CLOEXEC
+
+int main(int argc, char *argv[]) {
+  int fd, fd2, ws;
+  char *p, *q;
+  char buf[8];
+  char arg1[16];
+  char arg2[16];
+  pid_t pid;
+
+  // the program runs itself, to see what was inherited
+  if (argc == 3) {
+    if (pread(atoi(argv[1]), buf, 4, 0) != 4) return 30;
+    if (memcmp(buf, "kept", 4)) return 31;
+    errno = 0;
+    if (fcntl(atoi(argv[2]), F_GETFD) != -1 || errno != EBADF) return 32;
+    return 0;
+  }
+
+  // create a sealable memfd and size it
+  if ((fd = memfd_create("hello", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) {
+    return 1;
+  }
+  if (fcntl(fd, F_GETFD) != FD_CLOEXEC) return 2;
+  if (ftruncate(fd, 8192)) return 3;
+  if (write(fd, "abc", 3) != 3) return 4;
+
+  // mappings of the memfd are shared across fork()
+  p = mmap(0, 8192, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) return 5;
+  if (memcmp(p, "abc", 3)) return 6;
+  q = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (q == MAP_FAILED) return 7;
+  if ((pid = fork()) == -1) return 8;
+  if (!pid) {
+    strcpy(p + 4096, "from child");
+    strcpy(q, "anonymous");
+    _exit(0);
+  }
+  if (waitpid(pid, &ws, 0) != pid) return 9;
+  if (!WIFEXITED(ws) || WEXITSTATUS(ws)) return 10;
+  if (strcmp(p + 4096, "from child")) return 11;
+  if (strcmp(q, "anonymous")) return 12;
+
+  // seals restrict what can be done to the file
+  if (fcntl(fd, F_GET_SEALS) != 0) return 13;
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK)) return 14;
+  if (fcntl(fd, F_GET_SEALS) != F_SEAL_SHRINK) return 15;
+  errno = 0;
+  if (ftruncate(fd, 4096) != -1 || errno != EPERM) return 16;
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL)) return 17;
+  errno = 0;
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_GROW) != -1 || errno != EPERM) return 18;
+  if (munmap(p, 8192) || munmap(q, 4096) || close(fd)) return 19;
+
+  // files not created with MFD_ALLOW_SEALING are sealed from the start
+  if ((fd = memfd_create("x", 0)) == -1) return 20;
+  if (fcntl(fd, F_GETFD) != 0) return 21;
+  if (fcntl(fd, F_GET_SEALS) != F_SEAL_SEAL) return 22;
+  if (close(fd)) return 23;
+  errno = 0;
+  if (memfd_create("x", 0x100) != -1 || errno != EINVAL) return 24;
+
+  // only files without MFD_CLOEXEC are inherited by execve()
+  if ((fd = memfd_create("kept", 0)) == -1) return 25;
+  if ((fd2 = memfd_create("gone", MFD_CLOEXEC)) == -1) return 26;
+  if (write(fd, "kept", 4) != 4) return 27;
+  snprintf(arg1, sizeof(arg1), "%d", fd);
+  snprintf(arg2, sizeof(arg2), "%d", fd2);
+  if ((pid = fork()) == -1) return 28;
+  if (!pid) {
+    execl(argv[0], argv[0], arg1, arg2, (char *)0);
+    _exit(127);
+  }
+  if (waitpid(pid, &ws, 0) != pid) return 29;
+  if (!WIFEXITED(ws)) return 33;
+  if (WEXITSTATUS(ws)) return WEXITSTATUS(ws);
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// packfs mounts an image file holding a read-only tree of files. this
+// builds a small image by hand, with an aligned file that's mapped from
+// the image, and a compressed file made of one deflated chunk and one
+// that's stored as is, and checks the mount from a forked child, since
+// the mount goes away with the process that made it. natively there's
+// no packfs, so this passes trivially
+
+#define ALIGN 65536
+#define CHUNK 64
+#define BIG   70000
+
+char img[] = "/tmp/packfs_test.img.XXXXXX";
+char dir[] = "/tmp/packfs_test.XXXXXX";
+char path[256];
+unsigned char image[3 * ALIGN];
+
+// "0123456789" * 6 + "0123" as raw deflate
+const unsigned char kDeflated[] = {0x33, 0x30, 0x34, 0x32, 0x36,
+                                   0x31, 0x35, 0x33, 0xb7, 0xb0,
+                                   0x34, 0x20, 0x8b, 0x05, 0x00};
+const char kStored[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+void Put32(unsigned char *p, unsigned x) {
+  p[0] = x, p[1] = x >> 8, p[2] = x >> 16, p[3] = x >> 24;
+}
+
+void Put64(unsigned char *p, unsigned long x) {
+  Put32(p, x);
+  Put32(p + 4, x >> 32);
+}
+
+void Node(int i, unsigned mode, unsigned parent, unsigned flags,
+          unsigned long size, unsigned long offset) {
+  unsigned char *p = image + 64 + i * 64;
+  Put32(p, mode);
+  Put32(p + 12, S_ISDIR(mode) ? 2 + (i == 1) : 1);
+  Put32(p + 16, parent);
+  Put32(p + 20, flags);
+  Put64(p + 24, size);
+  Put64(p + 32, offset);
+  Put64(p + 40, size);
+}
+
+void Dirent(unsigned long off, unsigned node, const char *name,
+            unsigned long nameoff) {
+  Put32(image + off, node);
+  Put32(image + off + 4, strlen(name));
+  Put64(image + off + 8, nameoff);
+  memcpy(image + nameoff, name, strlen(name));
+}
+
+void MakeImage(int fd) {
+  int i;
+  memcpy(image, "BLINKPAK", 8);
+  Put32(image + 8, 1);       // version
+  Put32(image + 12, ALIGN);  // align
+  Put32(image + 16, CHUNK);  // chunksize
+  Put32(image + 20, 8);      // nodes
+  Put64(image + 24, 64);     // nodetab
+  Put64(image + 32, sizeof(image));
+  Node(1, S_IFDIR | 0755, 1, 0, 5, 576);
+  Node(2, S_IFDIR | 0755, 1, 0, 1, 656);
+  Node(3, S_IFREG | 0755, 1, 1, BIG, ALIGN);
+  Node(4, S_IFLNK | 0777, 1, 0, 4, 700);
+  Node(5, S_IFREG | 0644, 1, 0, 5, 720);
+  Node(6, S_IFREG | 0644, 1, 2, 100, 768);
+  Node(7, S_IFREG | 0644, 2, 0, 6, 730);
+  Dirent(576, 2, "a", 672);
+  Dirent(592, 3, "file", 673);
+  Dirent(608, 4, "link", 677);
+  Dirent(624, 5, "small", 681);
+  Dirent(640, 6, "zip", 686);
+  Dirent(656, 7, "b", 689);
+  memcpy(image + 700, "file", 4);
+  memcpy(image + 720, "hello", 5);
+  memcpy(image + 730, "nested", 6);
+  Put64(image + 768, 792);
+  Put64(image + 776, 792 + sizeof(kDeflated));
+  Put64(image + 784, 792 + sizeof(kDeflated) + 36);
+  memcpy(image + 792, kDeflated, sizeof(kDeflated));
+  memcpy(image + 792 + sizeof(kDeflated), kStored, 36);
+  for (i = 0; i < BIG; ++i) image[ALIGN + i] = i * 7;
+  write(fd, image, sizeof(image));
+}
+
+char *Path(const char *name) {
+  strcpy(path, dir);
+  strcat(path, "/");
+  strcat(path, name);
+  return path;
+}
+
+int Slurp(const char *name, char *buf, int len) {
+  int fd, rc;
+  if ((fd = open(Path(name), O_RDONLY)) == -1) return -1;
+  rc = read(fd, buf, len);
+  close(fd);
+  return rc;
+}
+
+int Check(void) {
+  int i, n, fd;
+  DIR *d;
+  char buf[128];
+  struct stat st;
+  unsigned char *p;
+  if (mount(img, dir, "packfs", 0, 0)) return 2;
+  if (stat(dir, &st) || st.st_mode != (S_IFDIR | 0755)) return 3;
+  if (!(d = opendir(dir))) return 4;
+  for (n = 0; readdir(d); ++n) {
+  }
+  if (closedir(d) || n != 7) return 5;
+
+  // files can be looked up and read
+  if (Slurp("small", buf, 128) != 5 || memcmp(buf, "hello", 5)) return 6;
+  if (Slurp("a/b", buf, 128) != 6 || memcmp(buf, "nested", 6)) return 7;
+  if (stat(Path("file"), &st) || st.st_size != BIG) return 8;
+  if (readlink(Path("link"), buf, 128) != 4 || memcmp(buf, "file", 4)) {
+    return 9;
+  }
+  if (Slurp("link", buf, 128) != 128 || buf[1] != 7) return 10;
+  errno = 0;
+  if (!stat(Path("missing"), &st) || errno != ENOENT) return 11;
+  errno = 0;
+  if (!stat(Path("small/"), &st) || errno != ENOTDIR) return 12;
+
+  // compressed files are inflated a chunk at a time
+  if ((fd = open(Path("zip"), O_RDONLY)) == -1) return 13;
+  if (pread(fd, buf, 10, 60) != 10 || memcmp(buf, "0123abcdef", 10)) {
+    return 14;
+  }
+  if (read(fd, buf, 128) != 100) return 15;
+  if (memcmp(buf, "0123456789", 10) || memcmp(buf + 64, kStored, 36)) {
+    return 16;
+  }
+
+  // compressed files may be mapped, which copies them
+  p = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) return 17;
+  if (memcmp(p + 64, kStored, 36) || p[100] || munmap(p, 4096)) return 18;
+  if (close(fd)) return 19;
+
+  // aligned files are mapped from the image, zero past their end
+  if ((fd = open(Path("file"), O_RDONLY)) == -1) return 20;
+  p = mmap(0, 3 * ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) return 21;
+  for (i = 0; i < BIG; ++i) {
+    if (p[i] != (unsigned char)(i * 7)) return 22;
+  }
+  if (p[BIG] || p[2 * ALIGN]) return 23;
+  p[0] = 1;  // private
+  if (pread(fd, buf, 1, 0) != 1 || buf[0]) return 24;
+  if (munmap(p, 3 * ALIGN)) return 25;
+  errno = 0;
+  p = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p != MAP_FAILED || errno != EACCES) return 26;
+  if (close(fd)) return 27;
+
+  // nothing can be changed
+  errno = 0;
+  if (open(Path("small"), O_RDWR) != -1 || errno != EROFS) return 28;
+  errno = 0;
+  if (open(Path("new"), O_CREAT | O_WRONLY, 0644) != -1 || errno != EROFS) {
+    return 29;
+  }
+  errno = 0;
+  if (mkdir(Path("a"), 0755) != -1 || errno != EEXIST) return 30;
+  errno = 0;
+  if (mkdir(Path("c"), 0755) != -1 || errno != EROFS) return 31;
+  errno = 0;
+  if (unlink(Path("small")) != -1 || errno != EROFS) return 32;
+  errno = 0;
+  if (rename(Path("small"), Path("x")) != -1 || errno != EROFS) return 33;
+  errno = 0;
+  if (chmod(Path("small"), 0600) != -1 || errno != EROFS) return 34;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int fd, ws, rc;
+  pid_t pid;
+  if (access("/proc/blink", F_OK)) return 0;  // not running under blink
+  if ((fd = mkstemp(img)) == -1) return 1;
+  MakeImage(fd);
+  if (close(fd) || !mkdtemp(dir)) {
+    unlink(img);
+    return 1;
+  }
+
+  // images that aren't packfs can't be mounted
+  if ((pid = fork()) == -1) {
+    rc = 1;
+  } else if (!pid) {
+    errno = 0;
+    _exit(mount(dir, dir, "packfs", 0, 0) != -1 || errno != EINVAL);
+  } else if (waitpid(pid, &ws, 0) != pid || !WIFEXITED(ws)) {
+    rc = 1;
+  } else if (WEXITSTATUS(ws)) {
+    rc = 35;
+  } else if ((pid = fork()) == -1) {
+    rc = 1;
+  } else if (!pid) {
+    _exit(Check());
+  } else if (waitpid(pid, &ws, 0) != pid || !WIFEXITED(ws)) {
+    rc = 1;
+  } else {
+    rc = WEXITSTATUS(ws);
+  }
+  if (unlink(img) | rmdir(dir)) return 36;
+  return rc;
+}
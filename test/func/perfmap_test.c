@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// when blink is run with $BLINK_PERF=map,jitdump then the code that it
+// generates is described to perf, using the names of guest functions.
+// func.mk sets that variable. this test passes trivially if it isn't
+// set, or if the jit is disabled, in which case blink won't make files
+
+char buf[1 << 20];
+volatile int sink;
+
+__attribute__((__noinline__)) int Hot(int x) {
+  return x * 3 + 1;
+}
+
+void Spin(void) {
+  int i;
+  for (i = 0; i < 100000; ++i) sink += Hot(i);
+}
+
+void Unlink(const char *fmt) {
+  char path[64];
+  snprintf(path, sizeof(path), fmt, getpid());
+  unlink(path);
+}
+
+int Slurp(const char *fmt) {
+  int fd, rc, n = 0;
+  char path[64];
+  snprintf(path, sizeof(path), fmt, getpid());
+  if ((fd = open(path, O_RDONLY)) == -1) return -1;
+  while ((rc = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0) n += rc;
+  close(fd);
+  buf[n] = 0;
+  return n;
+}
+
+// paths are named like "401123 Hot" or "401126 Hot+0x3"
+int HasHot(int n) {
+  char *p, *e = buf + n;
+  for (p = buf; (p = memmem(p, e - p, " Hot", 4)); p += 4) {
+    if (p + 4 < e && (!p[4] || p[4] == '\n' || p[4] == '+')) return 1;
+  }
+  return 0;
+}
+
+int Check(void) {
+  int n;
+  const char *perf = getenv("BLINK_PERF");
+  if (strstr(perf, "map")) {
+    if ((n = Slurp("/tmp/perf-%d.map")) <= 0) return 2;
+    if (!HasHot(n)) return 3;
+    if (buf[n - 1] != '\n') return 4;
+  }
+  if (strstr(perf, "jitdump")) {
+    if ((n = Slurp("/tmp/jit-%d.dump")) < 40) return 5;
+    if (memcmp(buf, "DTiJ", 4)) return 6;
+    if (!HasHot(n)) return 7;
+  }
+  Unlink("/tmp/perf-%d.map");
+  Unlink("/tmp/jit-%d.dump");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int rc, ws;
+  pid_t pid;
+  if (!getenv("BLINK_PERF")) return 0;
+  if (Slurp("/tmp/perf-%d.map") == -1 && Slurp("/tmp/jit-%d.dump") == -1) {
+    return 0;  // jit is disabled
+  }
+  Spin();
+  if ((rc = Check())) return rc;
+
+  // forked children get their own files, which start with the parent's
+  if ((pid = fork()) == -1) return 8;
+  if (!pid) _exit(Check());
+  if (waitpid(pid, &ws, 0) != pid || !WIFEXITED(ws)) return 9;
+  if ((rc = WEXITSTATUS(ws))) return rc;
+  return 0;
+}
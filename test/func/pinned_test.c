@@ -0,0 +1,74 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// system calls pin the guest memory they touch. while one thread is
+// blocked reading into a buffer, other threads must still be able to
+// munmap() memory on either side of it, without waiting for the read
+
+#define PAGES 64
+#define IOVS  8
+
+int fds[2];
+char *map;
+
+void *Reader(void *arg) {
+  ssize_t rc;
+  char *buf = map + 16 * 4096;
+  rc = read(fds[0], buf, 8 * 4096);
+  if (rc != 3) _exit(10);
+  if (memcmp(buf, "hi\n", 3)) _exit(11);
+  return 0;
+}
+
+// buffers that are spread out mustn't pin the memory between them
+void *ScatterReader(void *arg) {
+  int i;
+  struct iovec iov[IOVS];
+  for (i = 0; i < IOVS; ++i) {
+    iov[i].iov_base = map + i * 2 * 4096;
+    iov[i].iov_len = 1;
+  }
+  if (readv(fds[0], iov, IOVS) != 3) _exit(13);
+  if (map[0] != 'h' || map[2 * 4096] != 'i') _exit(14);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+  pthread_t th;
+  map = mmap(0, PAGES * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return 1;
+  for (i = 0; i < PAGES; ++i) map[i * 4096] = i;
+  if (pipe(fds)) return 2;
+  if (pthread_create(&th, 0, Reader, 0)) return 3;
+  usleep(50000);
+  // punch holes before, between, and after the pinned pages
+  if (munmap(map, 4096)) return 4;
+  if (munmap(map + 8 * 4096, 4 * 4096)) return 5;
+  if (munmap(map + 40 * 4096, 24 * 4096)) return 6;
+  if (write(fds[1], "hi\n", 3) != 3) return 7;
+  if (pthread_join(th, 0)) return 8;
+  // everything else should still be intact
+  for (i = 1; i < 8; ++i) {
+    if (map[i * 4096] != i) return 9;
+  }
+  if (munmap(map + 4096, 39 * 4096)) return 12;
+
+  map = mmap(0, IOVS * 2 * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return 15;
+  if (pthread_create(&th, 0, ScatterReader, 0)) return 16;
+  usleep(50000);
+  for (i = 1; i < IOVS * 2 - 1; i += 2) {
+    if (munmap(map + i * 4096, 4096)) return 17;
+  }
+  if (write(fds[1], "hi\n", 3) != 3) return 18;
+  if (pthread_join(th, 0)) return 19;
+  return 0;
+}
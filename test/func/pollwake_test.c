@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+// blocking poll() and select() should wake up as soon as a descriptor
+// becomes ready, or a signal arrives, rather than on a polling tick
+
+#define ROUNDS 40
+
+int ping[2];
+int pong[2];
+volatile int gotsig;
+
+long Millis(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void OnSig(int sig) {
+  gotsig = sig;
+}
+
+void *Ponger(void *arg) {
+  int i;
+  char b;
+  fd_set rfds;
+  for (i = 0; i < ROUNDS; ++i) {
+    FD_ZERO(&rfds);
+    FD_SET(ping[0], &rfds);
+    if (select(ping[0] + 1, &rfds, 0, 0, 0) != 1) _exit(10);
+    if (read(ping[0], &b, 1) != 1) _exit(11);
+    if (write(pong[1], &b, 1) != 1) _exit(12);
+  }
+  return 0;
+}
+
+void *Killer(void *arg) {
+  usleep(20000);
+  pthread_kill(*(pthread_t *)arg, SIGUSR1);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+  char b;
+  long t;
+  pthread_t th, me;
+  struct pollfd pfd;
+  struct sigaction sa = {.sa_handler = OnSig};
+  if (pipe(ping) || pipe(pong)) return 1;
+  // ping pong between two threads blocked in select() and poll()
+  t = Millis();
+  if (pthread_create(&th, 0, Ponger, 0)) return 2;
+  for (i = 0; i < ROUNDS; ++i) {
+    if (write(ping[1], "x", 1) != 1) return 3;
+    pfd.fd = pong[0];
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) != 1) return 4;
+    if (!(pfd.revents & POLLIN)) return 5;
+    if (read(pong[0], &b, 1) != 1) return 6;
+  }
+  if (pthread_join(th, 0)) return 7;
+  if (Millis() - t > ROUNDS * 25) return 8;
+  // a signal interrupts an indefinite poll() promptly
+  sigaction(SIGUSR1, &sa, 0);
+  me = pthread_self();
+  if (pthread_create(&th, 0, Killer, &me)) return 9;
+  t = Millis();
+  pfd.fd = pong[0];
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, -1) != -1 || errno != EINTR) return 10;
+  if (gotsig != SIGUSR1) return 11;
+  if (Millis() - t > 1000) return 12;
+  if (pthread_join(th, 0)) return 13;
+  // timeouts still work
+  t = Millis();
+  if (poll(&pfd, 1, 30) != 0) return 14;
+  if (Millis() - t < 30) return 15;
+  return 0;
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// /proc/blink has the emulator's statistics, which are rendered when
+// they're read, so the guest can sample them while it's running. this
+// passes trivially natively, or if blink was built without the vfs
+
+char buf[65536];
+pthread_barrier_t barrier;
+
+int Slurp(const char *name, int chunk) {
+  int fd, rc, n = 0;
+  if ((fd = open(name, O_RDONLY)) == -1) return -1;
+  while ((rc = read(fd, buf + n, chunk)) > 0) {
+    if ((n += rc) + chunk >= sizeof(buf)) return -1;
+  }
+  close(fd);
+  buf[n] = 0;
+  return rc ? -1 : n;
+}
+
+int CountLines(void) {
+  int n = 0;
+  char *p;
+  for (p = buf; (p = strchr(p, '\n')); ++p) ++n;
+  return n;
+}
+
+void *Caller(void *arg) {
+  int i;
+  for (i = 0; i < 100; ++i) getppid();
+  return 0;
+}
+
+void *Worker(void *arg) {
+  pthread_barrier_wait(&barrier);
+  pthread_barrier_wait(&barrier);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int n, tid;
+  long x, y;
+  DIR *d;
+  char *p;
+  pthread_t th;
+  struct dirent *e;
+
+  // the directory lists its files
+  if (access("/proc/blink", F_OK)) return 0;  // not running under blink
+  if (!(d = opendir("/proc/blink"))) return 2;
+  for (n = 0; (e = readdir(d));) {
+    n += !strcmp(e->d_name, "jit") ||    //
+         !strcmp(e->d_name, "stats") ||  //
+         !strcmp(e->d_name, "threads");
+  }
+  if (closedir(d) || n != 3) return 3;
+
+  // every counter has a line, whose value is current as of the read
+  if (Slurp("/proc/blink/stats", 4096) <= 0) return 4;
+  if (!(p = strstr(buf, "\nsyscalls "))) return 5;
+  if (sscanf(p, " syscalls %ld", &x) != 1) return 6;
+  n = CountLines();
+  getppid();
+  if (Slurp("/proc/blink/stats", 10) <= 0) return 7;
+  if (CountLines() != n) return 8;
+  if (!(p = strstr(buf, "\nsyscalls "))) return 9;
+  if (sscanf(p, " syscalls %ld", &y) != 1 || y < x) return 10;
+
+  // the jit reports whether it's running and how much it has made
+  if (Slurp("/proc/blink/jit", 4096) <= 0) return 11;
+  if (sscanf(buf, "enabled %ld", &x) != 1 || (x != 0 && x != 1)) return 12;
+  if (!strstr(buf, "\ncode_bytes ")) return 13;
+
+  // each thread has a line
+  if (Slurp("/proc/blink/threads", 4096) <= 0) return 14;
+  if (CountLines() != 2) return 15;
+  if (sscanf(strchr(buf, '\n'), "%d", &tid) != 1 || tid != gettid()) {
+    return 16;
+  }
+  pthread_barrier_init(&barrier, 0, 2);
+  if (pthread_create(&th, 0, Worker, 0)) return 17;
+  pthread_barrier_wait(&barrier);
+  if (Slurp("/proc/blink/threads", 4096) <= 0) return 18;
+  if (CountLines() != 3) return 19;
+  pthread_barrier_wait(&barrier);
+  if (pthread_join(th, 0)) return 20;
+
+  // threads count on their own, and what they counted outlives them.
+  // release builds only count if blink was run with the -Z flag
+  if (Slurp("/proc/blink/stats", 4096) <= 0) return 21;
+  if (sscanf(strstr(buf, "\nsyscalls "), " syscalls %ld", &x) != 1) return 22;
+  if (pthread_create(&th, 0, Caller, 0) || pthread_join(th, 0)) return 23;
+  if (Slurp("/proc/blink/stats", 4096) <= 0) return 24;
+  if (sscanf(strstr(buf, "\nsyscalls "), " syscalls %ld", &y) != 1) return 25;
+  if (x && y < x + 100) return 26;
+  return 0;
+}
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// /proc/self/maps and friends are generated from the page tables, and
+// must agree with what the program mapped, even when read in pieces
+
+char buf[65536];
+char buf2[65536];
+char path[] = "/tmp/procmaps_test.XXXXXX";
+
+int Slurp(const char *name, char *p, int chunk) {
+  int fd, rc, n = 0;
+  if ((fd = open(name, O_RDONLY)) == -1) return -1;
+  while ((rc = read(fd, p + n, chunk)) > 0) {
+    if ((n += rc) + chunk >= sizeof(buf)) return -1;
+  }
+  close(fd);
+  p[n] = 0;
+  return rc ? -1 : n;
+}
+
+char *FindMapping(char *maps, void *addr) {
+  char *line;
+  unsigned long a, b;
+  for (line = maps; *line; line = strchr(line, '\n') + 1) {
+    if (sscanf(line, "%lx-%lx", &a, &b) == 2 &&  //
+        a <= (unsigned long)addr && (unsigned long)addr < b) {
+      return line;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int fd, n;
+  char *p, *q, *line;
+  size_t stacksize;
+  pthread_attr_t attr;
+  unsigned long a, b, off, size, rss, vss;
+  int pid, threads;
+  char name[64];
+  void *stack;
+
+  // anonymous memory shows up with its protection, and may be merged
+  // with neighboring mappings, just like linux does
+  p = mmap(0, 3 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  if (p == MAP_FAILED) return 2;
+  p[0] = 1;
+  if (mprotect(p + 4096, 4096, PROT_READ)) return 3;
+  if (Slurp("/proc/self/maps", buf, sizeof(buf) / 2) <= 0) return 4;
+  if (!(line = FindMapping(buf, p))) return 5;
+  if (sscanf(line, "%lx-%lx", &a, &b) != 2) return 6;
+  if (a > (unsigned long)p || b != (unsigned long)p + 4096) return 7;
+  if (strncmp(strchr(line, ' '), " rw-p ", 6)) return 8;
+  if (!(line = FindMapping(buf, p + 4096))) return 9;
+  if (strncmp(strchr(line, ' '), " r--p ", 6)) return 10;
+
+  // reading a little at a time gives the same result
+  if (Slurp("/proc/self/maps", buf2, 7) <= 0) return 11;
+  if (strcmp(buf, buf2)) return 12;
+
+  // file mappings show their path and offset
+  if ((fd = mkstemp(path)) == -1) return 13;
+  if (ftruncate(fd, 3 * 4096)) return 14;
+  q = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 8192);
+  if (q == MAP_FAILED) return 15;
+  if (Slurp("/proc/self/maps", buf, 4096) <= 0) return 16;
+  if (!(line = FindMapping(buf, q))) return 17;
+  if (sscanf(line, "%lx-%lx %*s %lx", &a, &b, &off) != 3) return 18;
+  if (off != 8192) return 19;
+  if (!(line = strchr(line, '/')) || strncmp(line, path, strlen(path))) {
+    return 20;
+  }
+  if (munmap(q, 4096) || close(fd) || unlink(path)) return 21;
+
+  // the main thread's stack can be found, as glibc does for pthreads
+  if (!(line = FindMapping(buf, &fd))) return 22;
+  if (pthread_getattr_np(pthread_self(), &attr)) return 23;
+  if (pthread_attr_getstack(&attr, &stack, &stacksize)) return 24;
+  if ((char *)&fd < (char *)stack) return 25;
+  if ((char *)&fd >= (char *)stack + stacksize) return 26;
+
+  // smaps has the size and resident pages of each mapping
+  if (Slurp("/proc/self/smaps", buf, 1000) <= 0) return 27;
+  if (!(line = FindMapping(buf, p))) return 28;
+  if (sscanf(line, "%lx-%lx", &a, &b) != 2) return 29;
+  if (!(line = strstr(line, "Size:"))) return 29;
+  if (sscanf(line, "Size: %lu kB", &size) != 1) return 30;
+  if (size != (b - a) / 1024) return 30;
+  if (!(line = strstr(line, "Rss:"))) return 31;
+  if (sscanf(line, "Rss: %lu kB", &rss) != 1 || rss > size) return 32;
+
+  // process totals are reported in pages, and as a status report
+  if (Slurp("/proc/self/statm", buf, 4096) <= 0) return 33;
+  if (sscanf(buf, "%lu %lu", &vss, &rss) != 2) return 34;
+  if (!vss || !rss || rss > vss) return 35;
+  if ((n = Slurp("/proc/self/stat", buf, 4096)) <= 0) return 36;
+  if (buf[n - 1] != '\n') return 37;
+  if (sscanf(buf, "%d (%63[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                  "%*u %*u %*d %*d %*d %*d %d",
+             &pid, name, &threads) != 3) {
+    return 38;
+  }
+  if (pid != getpid() || threads != 1) return 39;
+  if (strncmp(name, "procmaps_test", 13)) return 40;
+  if (Slurp("/proc/self/status", buf, 4096) <= 0) return 41;
+  if (!(line = strstr(buf, "\nPid:")) || atoi(line + 5) != getpid()) {
+    return 42;
+  }
+  if (!strstr(buf, "\nThreads:\t1\n")) return 43;
+  return 0;
+}
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// when blink is run with $BLINK_PROFILE=path then guest stacks sampled
+// while burning cpu are written to that path at exit, in folded format,
+// with forked children writing to path.pid instead. func.mk sets that
+// variable. this test passes trivially if it isn't set, or natively
+
+char buf[1 << 20];
+volatile int sink;
+
+__attribute__((__noinline__)) int Hot(int x) {
+  int i;
+  for (i = 0; i < 1000; ++i) x = x * 3 + 1;
+  return x;
+}
+
+void Spin(void) {
+  int i;
+  for (i = 0; clock() < CLOCKS_PER_SEC / 5; ++i) sink += Hot(i);
+}
+
+void OnSigProf(int sig) {
+  _exit(2);
+}
+
+int Slurp(const char *path) {
+  int fd, rc, n = 0;
+  if ((fd = open(path, O_RDONLY)) == -1) return -1;
+  while ((rc = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0) n += rc;
+  close(fd);
+  buf[n] = 0;
+  return n;
+}
+
+// stacks are written like "main;Spin;Hot 123" with the leaf last
+int HasHot(void) {
+  char *p;
+  for (p = buf; (p = strstr(p, "Hot ")); p += 4) {
+    if ((p == buf || p[-1] == ';' || p[-1] == '\n') && p[4] >= '1' &&
+        p[4] <= '9') {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int n, ws;
+  pid_t pid;
+  char path[4096];
+  const char *profile;
+  if (!(profile = getenv("BLINK_PROFILE"))) return 0;
+  if (access("/proc/blink", F_OK)) return 0;  // not running under blink
+
+  // the guest can't take the signal away from the profiler
+  if ((pid = fork()) == -1) return 3;
+  if (!pid) {
+    signal(SIGPROF, OnSigProf);
+    Spin();
+    _exit(0);
+  }
+  if (waitpid(pid, &ws, 0) != pid || !WIFEXITED(ws)) return 4;
+  if (WEXITSTATUS(ws)) return WEXITSTATUS(ws);
+  snprintf(path, sizeof(path), "%s.%d", profile, pid);
+  if ((n = Slurp(path)) <= 0) return 5;
+  if (buf[n - 1] != '\n') return 6;
+  if (!HasHot()) return 7;
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,65 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// sendfile(), splice(), tee() and copy_file_range() move data between
+// descriptors, honoring offsets and file positions like linux does
+
+int main(int argc, char *argv[]) {
+  off_t off, off2;
+  char buf[32];
+  int a, b, p[2], q[2];
+  FILE *fa, *fb;
+  if (!(fa = tmpfile()) || !(fb = tmpfile())) return 1;
+  a = fileno(fa);
+  b = fileno(fb);
+  if (write(a, "hello world", 11) != 11) return 2;
+
+  // sendfile() with an offset leaves the file position alone
+  off = 6;
+  if (sendfile(b, a, &off, 100) != 5) return 3;
+  if (off != 11) return 4;
+  if (lseek(a, 0, SEEK_CUR) != 11) return 5;
+  if (pread(b, buf, sizeof(buf), 0) != 5) return 6;
+  if (memcmp(buf, "world", 5)) return 7;
+
+  // sendfile() without an offset advances the file position
+  if (lseek(a, 0, SEEK_SET)) return 8;
+  if (pipe(p)) return 9;
+  if (sendfile(p[1], a, 0, 5) != 5) return 10;
+  if (lseek(a, 0, SEEK_CUR) != 5) return 11;
+
+  // tee() duplicates pipe data without consuming it
+  if (pipe(q)) return 12;
+  if (tee(p[0], q[1], 5, 0) != 5) return 13;
+  if (read(q[0], buf, sizeof(buf)) != 5) return 14;
+  if (memcmp(buf, "hello", 5)) return 15;
+
+  // splice() moves the data from the pipe into a file
+  off = 100;
+  if (splice(p[0], 0, b, &off, 5, 0) != 5) return 16;
+  if (off != 105) return 17;
+  if (pread(b, buf, 5, 100) != 5) return 18;
+  if (memcmp(buf, "hello", 5)) return 19;
+  off = 0;
+  off2 = 0;
+  errno = 0;
+  if (splice(a, &off, b, &off2, 5, 0) != -1 || errno != EINVAL) return 20;
+
+  // copy_file_range() copies between two files at offsets
+  off = 0;
+  off2 = 200;
+  if (copy_file_range(a, &off, b, &off2, 11, 0) != 11) return 21;
+  if (off != 11 || off2 != 211) return 22;
+  if (pread(b, buf, 11, 200) != 11) return 23;
+  if (memcmp(buf, "hello world", 11)) return 24;
+  errno = 0;
+  if (copy_file_range(a, &off, b, &off2, 11, 1) != -1 || errno != EINVAL) {
+    return 25;
+  }
+  return 0;
+}
@@ -0,0 +1,74 @@
+// tests for self-modifying code granularity
+// writes to data that shares a page with code must work
+// and so must writing to more pages than fit in the queue
+#include <string.h>
+#include <sys/mman.h>
+
+#define PAGES 100
+
+const unsigned char kAdd[] = {
+    0x89, 0xf8,  // mov %edi,%eax
+    0x01, 0xf0,  // add %esi,%eax
+    0xc3,        // ret
+};
+
+const unsigned char kSub[] = {
+    0x89, 0xf8,  // mov %edi,%eax
+    0x29, 0xf0,  // sub %esi,%eax
+    0xc3,        // ret
+};
+
+typedef int math_f(int, int);
+
+// copies memory using a single instruction, so blink can't flush its
+// self-modifying code queue until every page has been written
+void RepMovsb(void *dest, const void *src, unsigned long size) {
+  asm volatile("rep movsb"
+               : "+D"(dest), "+S"(src), "+c"(size)
+               : /* no inputs */
+               : "memory");
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+  char *p, *q;
+  math_f *f;
+  volatile int *counter;
+  p = mmap(0, PAGES * 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (p == MAP_FAILED) return 1;
+  q = mmap(0, PAGES * 4096, PROT_READ | PROT_WRITE,
+           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (q == MAP_FAILED) return 2;
+  // data lives on the same page as the code, but a few lines away
+  f = (math_f *)p;
+  counter = (volatile int *)(p + 2048);
+  memcpy(p, kAdd, sizeof(kAdd));
+  for (i = 0; i < 1000; ++i) {
+    if (f(i, 3) != i + 3) return 3;
+    ++*counter;
+  }
+  if (*counter != 1000) return 4;
+  // code modifications must still be noticed afterwards
+  memcpy(p, kSub, sizeof(kSub));
+  for (i = 0; i < 1000; ++i) {
+    if (f(i, 3) != i - 3) return 5;
+    ++*counter;
+  }
+  if (*counter != 2000) return 6;
+  // put code on every page, then clobber all of them at once
+  for (i = 0; i < PAGES; ++i) {
+    memcpy(p + i * 4096, kAdd, sizeof(kAdd));
+    memcpy(q + i * 4096, kSub, sizeof(kSub));
+  }
+  for (i = 0; i < PAGES; ++i) {
+    if (((math_f *)(p + i * 4096))(20, 3) != 23) return 7;
+  }
+  RepMovsb(p, q, PAGES * 4096);
+  for (i = 0; i < PAGES; ++i) {
+    if (((math_f *)(p + i * 4096))(20, 3) != 17) return 8;
+  }
+  if (munmap(q, PAGES * 4096)) return 9;
+  if (munmap(p, PAGES * 4096)) return 10;
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// system call buffers and strings that cross page boundaries must be
+// marshalled correctly, whether or not those pages happen to be next
+// to each other in host memory
+
+#define PAGES 64
+
+char *map;
+char buf[PAGES * 4096];
+
+int main(int argc, char *argv[]) {
+  int i, fd, fds[2];
+  char *path;
+  map = mmap(0, PAGES * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return 1;
+  // touch pages in reverse, so they're less likely to be contiguous
+  for (i = PAGES; i--;) map[i * 4096] = i;
+  for (i = 0; i < PAGES * 4096; ++i) map[i] = i * 7;
+  if (pipe(fds)) return 2;
+  // bulk write out of guest memory then read it back into guest memory
+  for (i = 0; i < PAGES; i += 8) {
+    if (write(fds[1], map + i * 4096 + 100, 8 * 4096 - 200) != 8 * 4096 - 200)
+      return 3;
+    if (read(fds[0], buf, 8 * 4096 - 200) != 8 * 4096 - 200) return 4;
+    if (memcmp(buf, map + i * 4096 + 100, 8 * 4096 - 200)) return 5;
+  }
+  // path string straddling a page boundary
+  path = map + 4096 - 5;
+  strcpy(path, "/dev/null");
+  if ((fd = open(path, O_RDONLY)) == -1) return 6;
+  if (close(fd)) return 7;
+  if (munmap(map, PAGES * 4096)) return 8;
+  return 0;
+}
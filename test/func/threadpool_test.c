@@ -0,0 +1,62 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// threads that exit may have their host threads recycled by the next
+// clone(), which must still see a fresh thread with the caller's state
+
+#define ROUNDS  200
+#define THREADS 8
+
+__thread int tls = 42;
+atomic_int counter;
+pid_t tids[THREADS];
+
+void *Worker(void *arg) {
+  sigset_t ss;
+  if (tls != 42) return (void *)1;
+  tls = 7;
+  if (syscall(SYS_gettid) == getpid()) return (void *)2;
+  tids[(long)arg % THREADS] = syscall(SYS_gettid);
+  if (pthread_sigmask(SIG_SETMASK, 0, &ss)) return (void *)3;
+  if (sigismember(&ss, SIGUSR1) != ((long)arg >= ROUNDS)) return (void *)4;
+  ++counter;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  long i, j;
+  void *res;
+  sigset_t ss;
+  pthread_t th[THREADS];
+
+  // create and join threads one at a time
+  for (i = 0; i < ROUNDS; ++i) {
+    if (pthread_create(th, 0, Worker, (void *)i)) return 1;
+    if (pthread_join(th[0], &res)) return 2;
+    if (res) return 3;
+  }
+  if (counter != ROUNDS) return 4;
+
+  // create and join threads in batches, with a different signal mask
+  sigemptyset(&ss);
+  sigaddset(&ss, SIGUSR1);
+  if (pthread_sigmask(SIG_BLOCK, &ss, 0)) return 5;
+  for (i = 0; i < ROUNDS / THREADS; ++i) {
+    for (j = 0; j < THREADS; ++j) {
+      if (pthread_create(th + j, 0, Worker, (void *)(ROUNDS + j))) return 6;
+    }
+    for (j = 0; j < THREADS; ++j) {
+      if (pthread_join(th[j], &res)) return 7;
+      if (res) return 8;
+    }
+    for (j = 0; j < THREADS; ++j) {
+      if (!tids[j]) return 9;
+      if (j && tids[j] == tids[j - 1]) return 10;
+    }
+  }
+  if (counter != ROUNDS * 2) return 11;
+  return 0;
+}
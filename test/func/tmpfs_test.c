@@ -0,0 +1,176 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// tmpfs keeps files in memory, which must behave like any other files,
+// be shared with forked children, and be mappable without copying
+
+// the mount is private to the emulated process and goes away with it,
+// so it's made by a forked child, and this passes trivially natively
+char dir[] = "/tmp/tmpfs_test.XXXXXX";
+char paths[2][256];
+int which;
+
+char *Path(const char *name) {
+  char *path = paths[which++ & 1];
+  snprintf(path, 256, "%s/%s", dir, name);
+  return path;
+}
+
+int CountEntries(const char *name) {
+  int n = 0;
+  DIR *d;
+  if (!(d = opendir(Path(name)))) return -1;
+  while (readdir(d)) ++n;
+  closedir(d);
+  return n;
+}
+
+int Check(void) {
+  int i, fd, fd2, ws;
+  char buf[64], *p;
+  struct stat st;
+  pid_t pid;
+  if (mount("tmpfs", dir, "tmpfs", 0, "size=1m,mode=0755")) return 2;
+  if (stat(dir, &st) || st.st_mode != (S_IFDIR | 0755)) return 3;
+  if (CountEntries(".") != 2) return 4;
+
+  // files can be written, read back, and resized
+  if ((fd = open(Path("a"), O_CREAT | O_RDWR | O_EXCL, 0644)) == -1) return 5;
+  if (write(fd, "hello", 5) != 5) return 6;
+  if (lseek(fd, 0, SEEK_SET) || read(fd, buf, 64) != 5) return 7;
+  if (memcmp(buf, "hello", 5)) return 8;
+  if (pwrite(fd, "J", 1, 8192) != 1) return 9;
+  if (fstat(fd, &st) || st.st_size != 8193) return 10;
+  if (pread(fd, buf, 3, 4000) != 3 || memcmp(buf, "\0\0\0", 3)) return 11;
+  if (ftruncate(fd, 2) || fstat(fd, &st) || st.st_size != 2) return 12;
+  if (ftruncate(fd, 4) || pread(fd, buf, 64, 0) != 4) return 13;
+  if (memcmp(buf, "he\0\0", 4)) return 14;
+  if (close(fd)) return 15;
+  if ((fd = open(Path("a"), O_WRONLY | O_APPEND)) == -1) return 16;
+  if (write(fd, "!", 1) != 1 || close(fd)) return 17;
+  if (stat(Path("a"), &st) || st.st_size != 5) return 18;
+  errno = 0;
+  if (open(Path("a"), O_CREAT | O_EXCL | O_RDWR, 0644) != -1) return 19;
+  if (errno != EEXIST) return 20;
+
+  // directories can be listed, and only removed once empty
+  if (mkdir(Path("d"), 0755)) return 21;
+  if ((fd = creat(Path("d/x"), 0644)) == -1 || close(fd)) return 22;
+  if (CountEntries(".") != 4 || CountEntries("d") != 3) return 23;
+  errno = 0;
+  if (rmdir(Path("d")) != -1 || errno != ENOTEMPTY) return 24;
+  if (stat(dir, &st) || st.st_nlink != 3) return 25;
+
+  // files can be renamed, linked, and symlinked
+  if (rename(Path("a"), Path("d/b"))) return 26;
+  if (!stat(Path("a"), &st)) return 27;
+  if (link(Path("d/b"), Path("c")) || stat(Path("c"), &st)) return 28;
+  if (st.st_nlink != 2 || st.st_size != 5) return 29;
+  if (symlink("d/b", Path("s"))) return 30;
+  if (readlink(Path("s"), buf, 64) != 3 || memcmp(buf, "d/b", 3)) return 31;
+  if ((fd = open(Path("s"), O_RDONLY)) == -1) return 32;
+  if (read(fd, buf, 64) != 5 || memcmp(buf, "he\0\0!", 5) || close(fd)) {
+    return 33;
+  }
+  errno = 0;
+  if (rename(Path("d"), Path("d/e")) != -1 || errno != EINVAL) return 34;
+
+  // unlinked files live on while they're open
+  if ((fd = open(Path("c"), O_RDWR)) == -1) return 35;
+  if (unlink(Path("c")) || unlink(Path("d/b"))) return 36;
+  if (read(fd, buf, 64) != 5 || close(fd)) return 37;
+  if (!stat(Path("c"), &st)) return 38;
+
+  // shared mappings see writes and vice versa
+  if ((fd = open(Path("m"), O_CREAT | O_RDWR, 0644)) == -1) return 39;
+  if (ftruncate(fd, 8192)) return 40;
+  p = mmap(0, 8192, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) return 41;
+  if (pwrite(fd, "abc", 3, 4096) != 3 || memcmp(p + 4096, "abc", 3)) return 42;
+  strcpy(p, "mapped");
+  if (pread(fd, buf, 7, 0) != 7 || strcmp(buf, "mapped")) return 43;
+
+  // changes made by forked children are seen by the parent
+  if ((pid = fork()) == -1) return 44;
+  if (!pid) {
+    if ((fd2 = creat(Path("kid"), 0644)) == -1) _exit(1);
+    if (write(fd2, "child", 5) != 5) _exit(2);
+    strcpy(p + 100, "kid");
+    _exit(0);
+  }
+  if (waitpid(pid, &ws, 0) != pid) return 45;
+  if (!WIFEXITED(ws) || WEXITSTATUS(ws)) return 46;
+  if (strcmp(p + 100, "kid")) return 47;
+  if ((fd2 = open(Path("kid"), O_RDONLY)) == -1) return 48;
+  if (read(fd2, buf, 64) != 5 || memcmp(buf, "child", 5)) return 49;
+  if (close(fd2) || munmap(p, 8192) || close(fd)) return 50;
+
+  // pages a mapping still reaches aren't given to other files when the
+  // mapped file is truncated, and read as zero if it grows back again
+  if ((fd = open(Path("t"), O_CREAT | O_RDWR, 0644)) == -1) return 51;
+  if (ftruncate(fd, 8192)) return 52;
+  p = mmap(0, 8192, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) return 53;
+  memset(p, 't', 8192);
+  if (ftruncate(fd, 100)) return 54;
+  if ((fd2 = open(Path("u"), O_CREAT | O_RDWR, 0644)) == -1) return 55;
+  memset(buf, 'u', sizeof(buf));
+  for (i = 0; i < 8192; i += sizeof(buf)) {
+    if (pwrite(fd2, buf, sizeof(buf), i) != sizeof(buf)) return 56;
+  }
+  if (p[99] != 't' || p[100] || p[4096]) return 57;
+  memset(p, 'T', 8192);
+  for (i = 0; i < 8192; i += sizeof(buf)) {
+    if (pread(fd2, buf, sizeof(buf), i) != sizeof(buf)) return 58;
+    if (buf[0] != 'u' || buf[sizeof(buf) - 1] != 'u') return 59;
+  }
+  if (ftruncate(fd, 8192) || pread(fd, buf, sizeof(buf), 4096) != 64) {
+    return 60;
+  }
+  for (i = 0; i < sizeof(buf); ++i) {
+    if (buf[i]) return 61;
+  }
+  if (pread(fd, buf, 2, 99) != 2 || buf[0] != 'T' || buf[1]) return 62;
+  if (munmap(p, 8192) || close(fd) || close(fd2)) return 63;
+
+  // the filesystem is limited to its size
+  if ((fd = creat(Path("big"), 0644)) == -1) return 64;
+  if (ftruncate(fd, 4 << 20)) return 65;
+  errno = 0;
+  for (;;) {
+    if (write(fd, buf, sizeof(buf)) == -1) break;
+  }
+  if (errno != ENOSPC) return 66;
+  if (close(fd) || unlink(Path("big"))) return 67;
+
+  // new files and directories honor the umask
+  umask(027);
+  if (umask(077) != 027) return 69;
+  if ((fd = creat(Path("private"), 0666)) == -1 || close(fd)) return 70;
+  if (stat(Path("private"), &st) || (st.st_mode & 0777) != 0600) return 71;
+  if (mkdir(Path("privdir"), 0777)) return 72;
+  if (stat(Path("privdir"), &st) || (st.st_mode & 0777) != 0700) return 73;
+  if (unlink(Path("private")) || rmdir(Path("privdir"))) return 74;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int ws;
+  pid_t pid;
+  if (access("/proc/blink", F_OK)) return 0;  // not running under blink
+  if (!mkdtemp(dir)) return 1;
+  if ((pid = fork()) == -1) return 1;
+  if (!pid) _exit(Check());
+  if (waitpid(pid, &ws, 0) != pid || !WIFEXITED(ws)) return 1;
+  if (rmdir(dir)) return 68;
+  return WEXITSTATUS(ws);
+}
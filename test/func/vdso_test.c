@@ -0,0 +1,88 @@
+#include <elf.h>
+#include <link.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// the vdso is an elf shared object whose symbols can be looked up via
+// its dynamic section, and called directly, as libc does for the time
+
+void *FindVdsoSymbol(const char *name) {
+  int i, n;
+  Elf64_Dyn *dyn;
+  Elf64_Phdr *ph;
+  Elf64_Ehdr *eh;
+  Elf64_Sym *syms = 0;
+  Elf64_Word *hash = 0;
+  const char *strs = 0;
+  if (!(eh = (Elf64_Ehdr *)getauxval(AT_SYSINFO_EHDR))) return 0;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG)) return 0;
+  if (eh->e_type != ET_DYN) return 0;
+  ph = (Elf64_Phdr *)((char *)eh + eh->e_phoff);
+  for (dyn = 0, i = 0; i < eh->e_phnum; ++i) {
+    if (ph[i].p_type == PT_DYNAMIC) {
+      dyn = (Elf64_Dyn *)((char *)eh + ph[i].p_offset);
+    }
+  }
+  if (!dyn) return 0;
+  for (; dyn->d_tag != DT_NULL; ++dyn) {
+    if (dyn->d_tag == DT_SYMTAB) syms = (void *)((char *)eh + dyn->d_un.d_ptr);
+    if (dyn->d_tag == DT_STRTAB) strs = (void *)((char *)eh + dyn->d_un.d_ptr);
+    if (dyn->d_tag == DT_HASH) hash = (void *)((char *)eh + dyn->d_un.d_ptr);
+  }
+  if (!syms || !strs || !hash) return 0;
+  for (n = hash[1], i = 1; i < n; ++i) {
+    if (!strcmp(strs + syms[i].st_name, name)) {
+      return (char *)eh + syms[i].st_value;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  time_t t;
+  unsigned cpu;
+  struct timeval tv;
+  struct timespec ts1, ts2;
+  int (*vdso_clock_gettime)(clockid_t, struct timespec *);
+  int (*vdso_gettimeofday)(struct timeval *, void *);
+  time_t (*vdso_time)(time_t *);
+  int (*vdso_getcpu)(unsigned *, unsigned *, void *);
+  if (!(vdso_clock_gettime = FindVdsoSymbol("__vdso_clock_gettime"))) return 1;
+  if (!(vdso_gettimeofday = FindVdsoSymbol("__vdso_gettimeofday"))) return 2;
+  if (!(vdso_time = FindVdsoSymbol("__vdso_time"))) return 3;
+  if (!(vdso_getcpu = FindVdsoSymbol("__vdso_getcpu"))) return 4;
+
+  // the vdso should agree with the system call
+  if (syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts1)) return 5;
+  if (vdso_clock_gettime(CLOCK_MONOTONIC, &ts2)) return 6;
+  if (ts2.tv_sec < ts1.tv_sec) return 7;
+  if (ts2.tv_sec - ts1.tv_sec > 5) return 8;
+  if (vdso_clock_gettime(-1000, &ts2) != -22) return 9;  // -EINVAL
+  if (vdso_gettimeofday(&tv, 0)) return 10;
+  t = vdso_time(0);
+  // time() may use a coarse clock that lags by a tick
+  if (t < tv.tv_sec - 1 || t - tv.tv_sec > 5) return 11;
+
+  // getcpu() reports a cpu, via the vdso and as a system call
+  cpu = -1;
+  if (vdso_getcpu(&cpu, 0, 0) || cpu == -1) return 12;
+  cpu = -1;
+  if (syscall(SYS_getcpu, &cpu, 0, 0) || cpu == -1) return 13;
+
+  // run it enough times for the jit to kick in
+  for (int i = 0; i < 1000; ++i) {
+    if (vdso_clock_gettime(CLOCK_REALTIME, &ts1)) return 14;
+  }
+  if (clock_gettime(CLOCK_REALTIME, &ts2)) return 15;
+
+  // a fresh vdso is provided to programs loaded by execve()
+  if (argc < 2) {
+    execl(argv[0], argv[0], "again", (char *)0);
+    return 16;
+  }
+  return 0;
+}
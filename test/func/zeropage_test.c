@@ -0,0 +1,40 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// anonymous memory that's only been read is backed by a shared page of
+// zeroes, so it must still read as zero, and writing to it afterwards
+// must only change the page that was written to
+
+#define PAGES 512
+
+int main(int argc, char *argv[]) {
+  int i, fds[2];
+  char buf[16];
+  volatile char *map;
+  unsigned long sum = 0;
+  map = mmap(0, PAGES * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return 1;
+  for (i = 0; i < PAGES * 4096; i += 64) sum += map[i];
+  if (sum) return 2;
+  for (i = 0; i < PAGES; i += 7) map[i * 4096 + 100] = i + 1;
+  for (i = 0; i < PAGES; ++i) {
+    if (map[i * 4096 + 100] != (i % 7 ? 0 : (char)(i + 1))) return 3;
+    if (map[i * 4096 + 101]) return 4;
+  }
+  // system calls writing into untouched memory must commit it
+  if (pipe(fds)) return 5;
+  if (write(fds[1], "hello", 5) != 5) return 6;
+  if (read(fds[0], (char *)map + 3 * 4096, 5) != 5) return 7;
+  if (memcmp((char *)map + 3 * 4096, "hello", 5)) return 8;
+  if (map[2 * 4096] || map[4 * 4096]) return 9;
+  // and system calls reading from untouched memory must see zeroes
+  if (write(fds[1], (char *)map + 5 * 4096, 16) != 16) return 10;
+  if (read(fds[0], buf, 16) != 16) return 11;
+  for (i = 0; i < 16; ++i) {
+    if (buf[i]) return 12;
+  }
+  if (munmap((void *)map, PAGES * 4096)) return 13;
+  return 0;
+}
@@ -0,0 +1,9 @@
+// Checks for Linux 4.5+ copy_file_range() support.
+#include <sys/types.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  off_t off = 0;
+  copy_file_range(0, &off, 1, 0, 0, 0);
+  return 0;
+}
@@ -0,0 +1,7 @@
+// Checks for Linux 2.6.27+ eventfd() support.
+#include <sys/eventfd.h>
+
+int main(int argc, char *argv[]) {
+  eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+  return 0;
+}
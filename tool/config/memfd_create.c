@@ -0,0 +1,11 @@
+// checks for linux 3.17+ memfd_create() with file sealing
+#include <fcntl.h>
+#include <sys/mman.h>
+
+int main(int argc, char *argv[]) {
+  int fd;
+  if ((fd = memfd_create("x", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) return 1;
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK)) return 2;
+  if (fcntl(fd, F_GET_SEALS) != F_SEAL_SHRINK) return 3;
+  return 0;
+}
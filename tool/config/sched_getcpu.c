@@ -0,0 +1,7 @@
+// checks for sched_getcpu()
+#include <sched.h>
+
+int main(int argc, char *argv[]) {
+  if (sched_getcpu() < 0) return 1;
+  return 0;
+}
@@ -0,0 +1,8 @@
+// Checks for Linux 2.6.33+ sendfile() between arbitrary descriptors.
+#include <sys/sendfile.h>
+
+int main(int argc, char *argv[]) {
+  off_t off = 0;
+  sendfile(1, 0, &off, 0);
+  return 0;
+}
@@ -0,0 +1,10 @@
+// Checks for Linux 2.6.17+ splice() and tee() support.
+#include <fcntl.h>
+#include <sys/types.h>
+
+int main(int argc, char *argv[]) {
+  off_t off = 0;
+  splice(0, &off, 1, 0, 0, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  tee(0, 1, 0, SPLICE_F_NONBLOCK);
+  return 0;
+}
@@ -0,0 +1,375 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "blink/endian.h"
+#include "blink/macros.h"
+#include "blink/packfs.h"
+
+// creates a packfs image of a directory, for blink to mount
+//
+// executables and shared objects are stored page aligned so blink can
+// map them straight from the image, and everything else is compressed
+// unless that doesn't make it smaller. hard links become copies.
+
+#if defined(__APPLE__) || defined(__NetBSD__)
+#define st_mtim st_mtimespec
+#endif
+
+#define USAGE \
+  " [-0] [-p] [-a ALIGN] DIR IMAGE\n\
+\n\
+Options:\n\
+  -0         store files uncompressed\n\
+  -p         preserve owners rather than making root own everything\n\
+  -a ALIGN   alignment of executables and libraries [default 65536]\n"
+
+#define CHUNK 65536
+
+struct Node {
+  char *path;
+  char *target;  // of symbolic link
+  struct stat st;
+  u32 parent;
+  u32 first;  // first entry of directory
+  u32 count;  // number of entries of directory
+  u32 flags;
+  u64 offset;
+  u64 stored;
+};
+
+struct Entry {
+  u32 node;
+  char *name;
+};
+
+static int g_fd;
+static u32 g_align = 65536;
+static bool g_store;
+static bool g_owners;
+static const char *g_image;
+static struct Node *g_nodes;
+static u32 g_nodecount;
+static struct Entry *g_entries;
+static u32 g_entrycount;
+
+static void Die(const char *thing) {
+  fprintf(stderr, "mkpackfs: %s: %s\n", thing, strerror(errno));
+  exit(1);
+}
+
+static void *Realloc(void *p, size_t n) {
+  if (!(p = realloc(p, n))) Die("realloc");
+  return p;
+}
+
+static char *Join(const char *dir, const char *name) {
+  char *path = (char *)Realloc(0, strlen(dir) + 1 + strlen(name) + 1);
+  sprintf(path, "%s/%s", dir, name);
+  return path;
+}
+
+// compresses `size` bytes as raw deflate, returning the compressed size
+// or `size` if that wouldn't make it any smaller
+static unsigned Compress(u8 *out, const u8 *data, unsigned size) {
+  int rc;
+  z_stream zs = {0};
+  if (deflateInit2(&zs, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK) {
+    fprintf(stderr, "mkpackfs: deflateInit2 failed\n");
+    exit(1);
+  }
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = size;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = size;
+  rc = deflate(&zs, Z_FINISH);
+  deflateEnd(&zs);
+  return rc == Z_STREAM_END ? size - zs.avail_out : size;
+}
+
+static int CompareNames(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static u32 AddNode(char *path, u32 parent) {
+  struct Node *n;
+  ssize_t rc;
+  g_nodes = (struct Node *)Realloc(g_nodes,
+                                   (g_nodecount + 1) * sizeof(*g_nodes));
+  n = g_nodes + g_nodecount;
+  memset(n, 0, sizeof(*n));
+  n->path = path;
+  n->parent = parent;
+  if (lstat(path, &n->st)) Die(path);
+  if (S_ISLNK(n->st.st_mode)) {
+    n->target = (char *)Realloc(0, PATH_MAX);
+    if ((rc = readlink(path, n->target, PATH_MAX - 1)) == -1) Die(path);
+    n->target[rc] = 0;
+  } else if (!S_ISDIR(n->st.st_mode) && !S_ISREG(n->st.st_mode)) {
+    fprintf(stderr, "mkpackfs: %s: skipping special file\n", path);
+    return 0;
+  }
+  return g_nodecount++;
+}
+
+// adds the entries of directory `x` and then, recursively, those of
+// its subdirectories, so every directory's entries are contiguous
+static void AddDirectory(u32 x) {
+  DIR *d;
+  char **names = 0;
+  struct dirent *ent;
+  u32 i, j, y, count = 0, first, subdirs = 0;
+  if (!(d = opendir(g_nodes[x].path))) Die(g_nodes[x].path);
+  while ((ent = readdir(d))) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+    names = (char **)Realloc(names, (count + 1) * sizeof(*names));
+    if (!(names[count++] = strdup(ent->d_name))) Die("strdup");
+  }
+  closedir(d);
+  qsort(names, count, sizeof(*names), CompareNames);
+  first = g_entrycount;
+  g_entries = (struct Entry *)Realloc(
+      g_entries, (g_entrycount + count) * sizeof(*g_entries));
+  for (j = i = 0; i < count; ++i) {
+    if ((y = AddNode(Join(g_nodes[x].path, names[i]), x))) {
+      g_entries[first + j].node = y;
+      g_entries[first + j].name = names[i];
+      subdirs += S_ISDIR(g_nodes[y].st.st_mode);
+      ++j;
+    } else {
+      free(names[i]);
+    }
+  }
+  free(names);
+  g_entrycount += j;
+  g_nodes[x].first = first;
+  g_nodes[x].count = j;
+  g_nodes[x].st.st_nlink = 2 + subdirs;
+  for (i = 0; i < j; ++i) {
+    if (S_ISDIR(g_nodes[g_entries[first + i].node].st.st_mode)) {
+      AddDirectory(g_entries[first + i].node);
+    }
+  }
+}
+
+static void Write(const void *data, u64 size, u64 offset) {
+  ssize_t rc;
+  u64 done;
+  for (done = 0; done < size; done += rc) {
+    if ((rc = pwrite(g_fd, (const char *)data + done, size - done,
+                     offset + done)) == -1) {
+      Die(g_image);
+    }
+  }
+}
+
+static u8 *Slurp(struct Node *n) {
+  int fd;
+  u8 *data;
+  ssize_t rc;
+  u64 done, size = n->st.st_size;
+  data = (u8 *)Realloc(0, size + 1);
+  if ((fd = open(n->path, O_RDONLY)) == -1) Die(n->path);
+  for (done = 0; done < size; done += rc) {
+    if ((rc = read(fd, data + done, size - done)) == -1) Die(n->path);
+    if (!rc) break;
+  }
+  close(fd);
+  n->st.st_size = done;
+  return data;
+}
+
+// stores the contents of file `n` at `pos`, returning where they end
+static u64 AddContents(struct Node *n, u64 pos) {
+  u8 *data, *table, *chunks;
+  u64 i, nchunks, len, clen, total;
+  u64 size;
+  data = Slurp(n);
+  size = n->st.st_size;
+  if (size >= 4 && !memcmp(data, "\177ELF", 4)) {
+    n->flags = PACKFS_ALIGNED;
+    n->offset = ROUNDUP(pos, g_align);
+    n->stored = ROUNDUP(size, g_align);
+    Write(data, size, n->offset);
+    free(data);
+    return n->offset + n->stored;
+  }
+  if (!g_store && size) {
+    nchunks = ROUNDUP(size, CHUNK) / CHUNK;
+    table = (u8 *)Realloc(0, (nchunks + 1) * 8);
+    chunks = (u8 *)Realloc(0, size);
+    for (total = i = 0; i < nchunks; ++i) {
+      len = MIN(CHUNK, size - i * CHUNK);
+      // a chunk as long as its contents is stored as it is
+      if ((clen = Compress(chunks + total, data + i * CHUNK, len)) == len) {
+        memcpy(chunks + total, data + i * CHUNK, len);
+      }
+      Write64(table + i * 8, total);
+      total += clen;
+    }
+    Write64(table + nchunks * 8, total);
+    if (total + (nchunks + 1) * 8 < size) {
+      n->flags = PACKFS_COMPRESSED;
+      n->offset = ROUNDUP(pos, 8);
+      n->stored = (nchunks + 1) * 8 + total;
+      pos = n->offset + (nchunks + 1) * 8;
+      for (i = 0; i <= nchunks; ++i) {
+        Write64(table + i * 8, pos + Read64(table + i * 8));
+      }
+      Write(table, (nchunks + 1) * 8, n->offset);
+      Write(chunks, total, pos);
+      pos += total;
+    }
+    free(chunks);
+    free(table);
+    if (n->flags) {
+      free(data);
+      return pos;
+    }
+  }
+  n->offset = pos;
+  n->stored = size;
+  Write(data, size, pos);
+  free(data);
+  return pos + size;
+}
+
+static void PackImage(const char *dir) {
+  u8 *meta, *p;
+  u32 i;
+  u64 pos, metasize, names, targets;
+  struct Node *n;
+  struct PackfsHeader *h;
+  struct PackfsNode *pn;
+  struct PackfsDirent *pd;
+  // node zero is unused, so the root directory is node one
+  AddNode(strdup(dir), 0);
+  AddNode(strdup(dir), PACKFS_ROOT);
+  if (!S_ISDIR(g_nodes[PACKFS_ROOT].st.st_mode)) {
+    errno = ENOTDIR;
+    Die(dir);
+  }
+  AddDirectory(PACKFS_ROOT);
+  names = sizeof(struct PackfsHeader) +
+          (u64)g_nodecount * sizeof(struct PackfsNode) +
+          (u64)g_entrycount * sizeof(struct PackfsDirent);
+  for (targets = names, i = 0; i < g_entrycount; ++i) {
+    targets += strlen(g_entries[i].name);
+  }
+  for (metasize = targets, i = PACKFS_ROOT; i < g_nodecount; ++i) {
+    if (g_nodes[i].target) metasize += strlen(g_nodes[i].target);
+  }
+  if ((g_fd = open(g_image, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+    Die(g_image);
+  }
+  for (pos = metasize, i = PACKFS_ROOT; i < g_nodecount; ++i) {
+    if (S_ISREG(g_nodes[i].st.st_mode)) {
+      pos = AddContents(g_nodes + i, pos);
+    }
+  }
+  if (ftruncate(g_fd, pos)) Die(g_image);
+  meta = (u8 *)Realloc(0, metasize);
+  memset(meta, 0, metasize);
+  h = (struct PackfsHeader *)meta;
+  memcpy(h->magic, PACKFS_MAGIC, 8);
+  Write32(h->version, PACKFS_VERSION);
+  Write32(h->align, g_align);
+  Write32(h->chunksize, CHUNK);
+  Write32(h->nodes, g_nodecount);
+  Write64(h->nodetab, sizeof(struct PackfsHeader));
+  Write64(h->size, pos);
+  pd = (struct PackfsDirent *)(meta + sizeof(struct PackfsHeader) +
+                               g_nodecount * sizeof(struct PackfsNode));
+  for (p = meta + names, i = 0; i < g_entrycount; ++i) {
+    Write32(pd[i].node, g_entries[i].node);
+    Write32(pd[i].namelen, strlen(g_entries[i].name));
+    Write64(pd[i].name, p - meta);
+    p = (u8 *)stpcpy((char *)p, g_entries[i].name);
+  }
+  pn = (struct PackfsNode *)(meta + sizeof(struct PackfsHeader));
+  for (i = PACKFS_ROOT; i < g_nodecount; ++i) {
+    n = g_nodes + i;
+    if (S_ISDIR(n->st.st_mode)) {
+      n->offset = (u8 *)(pd + n->first) - meta;
+      n->st.st_size = n->count;
+      n->stored = n->count * sizeof(struct PackfsDirent);
+    } else if (S_ISLNK(n->st.st_mode)) {
+      n->offset = p - meta;
+      n->st.st_size = strlen(n->target);
+      n->stored = n->st.st_size;
+      memcpy(p, n->target, n->st.st_size);
+      p += n->st.st_size;
+    }
+    Write32(pn[i].mode, n->st.st_mode);
+    Write32(pn[i].uid, g_owners ? n->st.st_uid : 0);
+    Write32(pn[i].gid, g_owners ? n->st.st_gid : 0);
+    Write32(pn[i].nlink, S_ISDIR(n->st.st_mode) ? n->st.st_nlink : 1);
+    Write32(pn[i].parent, n->parent);
+    Write32(pn[i].flags, n->flags);
+    Write64(pn[i].size, n->st.st_size);
+    Write64(pn[i].offset, n->offset);
+    Write64(pn[i].stored, n->stored);
+    Write64(pn[i].mtime, n->st.st_mtim.tv_sec);
+    Write32(pn[i].mtimensec, n->st.st_mtim.tv_nsec);
+  }
+  Write(meta, metasize, 0);
+  if (close(g_fd)) Die(g_image);
+  free(meta);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "0pa:h")) != -1) {
+    switch (opt) {
+      case '0':
+        g_store = true;
+        break;
+      case 'p':
+        g_owners = true;
+        break;
+      case 'a':
+        g_align = strtoul(optarg, 0, 0);
+        if (!g_align || (g_align & (g_align - 1))) {
+          fprintf(stderr, "mkpackfs: alignment must be a power of two\n");
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s%s", argv[0], USAGE);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s%s", argv[0], USAGE);
+    return 1;
+  }
+  g_image = argv[optind + 1];
+  PackImage(argv[optind]);
+  return 0;
+}